@@ -0,0 +1,313 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/ble.h>
+#include "common.h"
+
+#define NUM_MESSAGES		20000
+#define MAX_SYSEX		300
+#define MAX_BYTES		(NUM_MESSAGES * 8 + 64 * MAX_SYSEX)
+#define MAX_PACKETS		(MAX_BYTES / 4)
+
+struct event {
+	struct midi_message msg;
+	uint32_t timestamp;
+};
+
+struct link {
+	uint8_t data[MAX_BYTES];
+	size_t offsets[MAX_PACKETS + 1];
+	size_t num_packets;
+};
+
+struct receiver {
+	struct midi_ble_decoder decoder;
+	const struct event *events;
+	size_t num_events;
+	size_t errors;
+};
+
+static struct event events[NUM_MESSAGES];
+static uint8_t sysex_data[NUM_MESSAGES / 100 + 1][MAX_SYSEX];
+static uint8_t sysex_buffer[MAX_SYSEX];
+static struct link link;
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static size_t link_write(struct midi_ostream *stream, const void *data,
+			 size_t size)
+{
+	struct link *l = stream->param;
+	size_t offset = l->offsets[l->num_packets];
+
+	memcpy(&l->data[offset], data, size);
+	l->offsets[++l->num_packets] = offset + size;
+	return size;
+}
+
+/* Compares messages by their byte stream representation */
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[MAX_SYSEX + 2];
+	uint8_t buffer_b[MAX_SYSEX + 2];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+static void check_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct receiver *r = sink->param;
+	const struct event *e = &r->events[r->num_events++];
+	uint16_t timestamp = (uint16_t)(e->timestamp %
+					MIDI_BLE_TIMESTAMP_PERIOD);
+
+	if (!equal(msg, &e->msg) || r->decoder.timestamp != timestamp) {
+		if (r->errors++ < 5) {
+			printf("Mismatch at message %zu (%u ms): ",
+			       r->num_events - 1, r->decoder.timestamp);
+			print_msg(msg);
+		}
+	}
+}
+
+static void generate(void)
+{
+	static const enum midi_type types[] = {
+		MIDI_TYPE_NOTE_ON, MIDI_TYPE_NOTE_ON, MIDI_TYPE_NOTE_ON,
+		MIDI_TYPE_NOTE_OFF, MIDI_TYPE_CONTROL_CHANGE,
+		MIDI_TYPE_CONTROL_CHANGE, MIDI_TYPE_PITCH_BEND,
+		MIDI_TYPE_PROGRAM_CHANGE, MIDI_TYPE_CHANNEL_PRESSURE,
+		MIDI_TYPE_TIMING_CLOCK, MIDI_TYPE_SONG_POSITION,
+	};
+	uint32_t timestamp = 8000;
+	size_t num_sysex = 0;
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		struct midi_message *msg = &events[i].msg;
+		uint32_t r = random_value(100);
+
+		/* Mostly dense bursts, sometimes long pauses: */
+		if (r < 70)
+			timestamp += 0;
+		else if (r < 97)
+			timestamp += random_value(10);
+		else
+			timestamp += 100 + random_value(100);
+		events[i].timestamp = timestamp;
+
+		memset(msg, 0, sizeof(*msg));
+		if (i % 100 == 50) {
+			uint8_t *data = sysex_data[num_sysex++];
+			size_t length = random_value(MAX_SYSEX + 1);
+			for (size_t j = 0; j < length; j++)
+				data[j] = (uint8_t)random_value(128);
+
+			msg->type = MIDI_TYPE_SYSEX;
+			msg->data.sysex.data = data;
+			msg->data.sysex.length = length;
+			continue;
+		}
+
+		msg->type = types[random_value(sizeof(types)/sizeof(*types))];
+		msg->channel = (uint8_t)(1 + random_value(2));
+		switch (msg->type) {
+		case MIDI_TYPE_NOTE_ON:
+		case MIDI_TYPE_NOTE_OFF:
+			msg->data.note_on.note = (uint8_t)random_value(128);
+			msg->data.note_on.velocity = (uint8_t)random_value(128);
+			break;
+		case MIDI_TYPE_CONTROL_CHANGE:
+			msg->data.control_change.controller = 7;
+			msg->data.control_change.value =
+				(uint8_t)random_value(128);
+			break;
+		case MIDI_TYPE_PITCH_BEND:
+			msg->data.pitch_bend.value =
+				(uint16_t)random_value(16384);
+			break;
+		case MIDI_TYPE_PROGRAM_CHANGE:
+			msg->data.program_change.program =
+				(uint8_t)random_value(128);
+			break;
+		case MIDI_TYPE_CHANNEL_PRESSURE:
+			msg->data.channel_pressure.pressure =
+				(uint8_t)random_value(128);
+			break;
+		case MIDI_TYPE_SONG_POSITION:
+			msg->channel = 0;
+			msg->data.song_position.position =
+				(uint16_t)random_value(16384);
+			break;
+		default:
+			msg->channel = 0;
+			break;
+		}
+	}
+}
+
+static size_t run(size_t packet_size, bool print)
+{
+	uint8_t packet[512];
+	struct midi_ble_encoder encoder;
+	midi_ble_encoder_init(&encoder, packet, packet_size);
+
+	link.num_packets = 0;
+	struct midi_ostream stream = {
+		.write_cb = &link_write,
+		.capacity = MIDI_STREAM_CAPACITY_UNLIMITED,
+		.param = &link,
+	};
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		/* Flush once per connection interval (7.5 ms): */
+		if (i > 0 && events[i].timestamp * 2 / 15 !=
+			     events[i-1].timestamp * 2 / 15)
+			midi_ble_flush(&encoder, &stream);
+
+		midi_ble_encode(&encoder, &stream, &events[i].msg,
+				events[i].timestamp);
+	}
+	midi_ble_flush(&encoder, &stream);
+
+	struct receiver receiver = { .events = events };
+	midi_ble_decoder_init(&receiver.decoder);
+	receiver.decoder.stream.sysex_buffer.data = sysex_buffer;
+	receiver.decoder.stream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	struct midi_sink sink = {
+		.message_cb = &check_message,
+		.param = &receiver,
+	};
+
+	for (size_t i = 0; i < link.num_packets; i++) {
+		size_t offset = link.offsets[i];
+		size_t size = link.offsets[i+1] - offset;
+
+		if (print) {
+			printf("Packet %zu: ", i);
+			print_bytes(&link.data[offset], size);
+		}
+
+		midi_ble_decode(&receiver.decoder, &link.data[offset], size,
+				&sink);
+	}
+
+	if (receiver.num_events != NUM_MESSAGES)
+		receiver.errors++;
+
+	printf("Packet size %3zu: %5zu packets, %6zu bytes, %zu messages, "
+	       "%s\n", packet_size, link.num_packets,
+	       link.offsets[link.num_packets], receiver.num_events,
+	       (receiver.errors == 0) ? "OK" : "FAILED");
+
+	return receiver.errors;
+}
+
+int main(void)
+{
+	size_t errors = 0;
+
+	generate();
+
+	/* Bytes needed without Running Status (timestamp and message): */
+	size_t plain = 0;
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		const struct midi_message *msg = &events[i].msg;
+		if (msg->type == MIDI_TYPE_SYSEX)
+			plain += msg->data.sysex.length + 4;
+		else if (msg->type >= MIDI_TYPE_TIMING_CLOCK)
+			plain += 2;
+		else if (msg->type == MIDI_TYPE_PROGRAM_CHANGE ||
+			 msg->type == MIDI_TYPE_CHANNEL_PRESSURE)
+			plain += 3;
+		else
+			plain += 4;
+	}
+	printf("%d messages, %zu bytes without Running Status and headers\n",
+	       NUM_MESSAGES, plain);
+
+	errors += run(MIDI_BLE_PACKET_SIZE_DEFAULT, false);
+	errors += run(64, false);
+	errors += run(244, false);
+	errors += run(5, false);
+
+	/* Notes at the same time, sharing status and timestamp: */
+	struct midi_message note = {
+		.type = MIDI_TYPE_NOTE_ON,
+		.channel = 1,
+		.data.note_on.velocity = 100,
+	};
+	uint8_t packet[MIDI_BLE_PACKET_SIZE_DEFAULT];
+	struct midi_ble_encoder encoder;
+	midi_ble_encoder_init(&encoder, packet, sizeof(packet));
+
+	link.num_packets = 0;
+	struct midi_ostream stream = {
+		.write_cb = &link_write,
+		.capacity = MIDI_STREAM_CAPACITY_UNLIMITED,
+		.param = &link,
+	};
+	for (uint8_t i = 0; i < 3; i++) {
+		note.data.note_on.note = (uint8_t)(60 + 4*i);
+		midi_ble_encode(&encoder, &stream, &note, 8190u + i / 2 * 3);
+	}
+	midi_ble_flush(&encoder, &stream);
+	printf("Chord across timestamp overflow: ");
+	print_bytes(link.data, link.offsets[link.num_packets]);
+
+	/* SysEx which does not fit the stream must not affect the note: */
+	struct midi_message sysex = {
+		.type = MIDI_TYPE_SYSEX,
+		.data.sysex.data = sysex_data[0],
+		.data.sysex.length = 3 * sizeof(packet),
+	};
+	link.num_packets = 0;
+	stream.capacity = 2 * sizeof(packet);
+	size_t n = midi_ble_encode(&encoder, &stream, &note, 100);
+	bool rejected = (n > 0 &&
+			 midi_ble_encode(&encoder, &stream, &sysex, 100) == 0);
+	midi_ble_flush(&encoder, &stream);
+
+	uint8_t expected[] = { 0x80, 0x80 | 100, 0x90, note.data.note_on.note,
+			       100 };
+	bool kept = (link.num_packets == 1 &&
+		     link.offsets[1] == sizeof(expected) &&
+		     memcmp(link.data, expected, sizeof(expected)) == 0);
+	printf("SysEx exceeding stream capacity: %s\n",
+	       (rejected && kept) ? "OK" : "FAILED");
+	if (!rejected || !kept)
+		errors++;
+
+	return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <nanomidi/block.h>
+
+#define SAMPLE_RATE		48000
+#define TICKS_PER_SECOND	1000000	/* Microseconds */
+#define BLOCK_FRAMES		32
+#define EVENTS_PER_SECOND	10000
+#define SECONDS			600
+#define MAX_EVENTS		64
+#define MAX_CARRY		64
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+/* Timestamp of n-th event, 100 us apart with up to 100 us jitter: */
+static uint32_t event_time(uint32_t n)
+{
+	uint32_t period = TICKS_PER_SECOND / EVENTS_PER_SECOND;
+	return n * period + random_value(period);
+}
+
+int main(void)
+{
+	static struct midi_block_event events[MAX_EVENTS];
+	static struct midi_block_event carry[MAX_CARRY];
+
+	struct midi_block block;
+	midi_block_init(&block, TICKS_PER_SECOND, SAMPLE_RATE, events,
+			MAX_EVENTS, carry, MAX_CARRY);
+
+	struct midi_message msg = {
+		.type = MIDI_TYPE_NOTE_ON,
+		.channel = 1,
+	};
+
+	uint32_t blocks = SECONDS * SAMPLE_RATE / BLOCK_FRAMES;
+	uint32_t n = 0;
+	uint32_t time = event_time(n);
+	size_t delivered = 0;
+	size_t errors = 0;
+
+	clock_t begin = clock();
+
+	for (uint32_t i = 0; i < blocks; i++) {
+		uint64_t frame = (uint64_t)i * BLOCK_FRAMES;
+		uint32_t start = (uint32_t)(frame * TICKS_PER_SECOND /
+					    SAMPLE_RATE);
+		uint32_t horizon = (uint32_t)((frame + 2 * BLOCK_FRAMES) *
+					      TICKS_PER_SECOND / SAMPLE_RATE);
+
+		midi_block_begin(&block, start, BLOCK_FRAMES);
+
+		/* Messages arrive up to one block ahead of time: */
+		while ((int32_t)(time - horizon) < 0) {
+			msg.data.note_on.note = (uint8_t)(n & 0x7f);
+			msg.data.note_on.velocity = 100;
+			midi_block_push(&block, &msg, time);
+			time = event_time(++n);
+		}
+
+		/* Check the order (an audio callback would render here): */
+		for (size_t j = 1; j < block.num_events; j++) {
+			if (block.events[j].time < block.events[j-1].time ||
+			    block.events[j].time >= BLOCK_FRAMES)
+				errors++;
+		}
+
+		delivered += block.num_events;
+	}
+
+	double elapsed = (double)(clock() - begin) / CLOCKS_PER_SEC;
+
+	printf("%u blocks of %d frames at %d Hz, %u events\n",
+	       (unsigned int)blocks, BLOCK_FRAMES, SAMPLE_RATE,
+	       (unsigned int)n);
+	printf("Delivered: %u, pending: %u, dropped: %u, order errors: %u\n",
+	       (unsigned int)delivered, (unsigned int)block.num_carry,
+	       (unsigned int)block.dropped, (unsigned int)errors);
+	printf("Time: %.1f ns per block, %.1f ns per event (%.0fx real time)\n",
+	       elapsed * 1e9 / blocks, elapsed * 1e9 / n,
+	       (elapsed > 0) ? SECONDS / elapsed : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <nanomidi/capture.h>
+#include <nanomidi/usb_scheduler.h>
+#include "common.h"
+
+#define NUM_EVENTS		200000
+#define NUM_SEEKS		10000
+#define MAX_SYSEX		300
+#define NUM_REPLAYED		1000
+
+struct event {
+	struct midi_message msg;
+	uint8_t port;
+	uint64_t time;
+};
+
+static struct event events[NUM_EVENTS];
+static uint8_t sysex_data[NUM_EVENTS / 500 + 1][MAX_SYSEX];
+static uint8_t sysex_buffer[MAX_SYSEX];
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static long file_size(const char *path)
+{
+	struct stat st;
+	return (stat(path, &st) == 0) ? (long)st.st_size : -1;
+}
+
+/* Compares messages by their byte stream representation */
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[MAX_SYSEX + 2];
+	uint8_t buffer_b[MAX_SYSEX + 2];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+static bool check(size_t n, const struct midi_message *msg,
+		  const struct midi_capture_reader *reader)
+{
+	const struct event *e = &events[n];
+
+	if (equal(msg, &e->msg) && reader->time == e->time &&
+	    reader->port == e->port)
+		return true;
+
+	printf("Mismatch at event %zu (time %" PRIu64 ", port %u): ", n,
+	       reader->time, reader->port);
+	print_msg(msg);
+	return false;
+}
+
+static void generate(void)
+{
+	uint64_t time = 1000000;
+	size_t num_sysex = 0;
+
+	for (size_t i = 0; i < NUM_EVENTS; i++) {
+		struct midi_message *msg = &events[i].msg;
+		uint32_t r = random_value(100);
+
+		/* Bursts of simultaneous messages, one gap of over an hour: */
+		if (i == NUM_EVENTS / 2)
+			time += 5000000000u;
+		else if (r < 40)
+			time += 0;
+		else
+			time += random_value(2000);
+		events[i].time = time;
+		events[i].port = (uint8_t)random_value(4);
+
+		memset(msg, 0, sizeof(*msg));
+		if (i % 500 == 250) {
+			uint8_t *data = sysex_data[num_sysex++];
+			size_t length = 1 + random_value(MAX_SYSEX);
+			for (size_t j = 0; j < length; j++)
+				data[j] = (uint8_t)random_value(128);
+
+			msg->type = MIDI_TYPE_SYSEX;
+			msg->data.sysex.data = data;
+			msg->data.sysex.length = length;
+		} else if (r % 10 == 0) {
+			msg->type = MIDI_TYPE_TIMING_CLOCK;
+		} else if (r % 10 < 4) {
+			msg->type = MIDI_TYPE_CONTROL_CHANGE;
+			msg->channel = (uint8_t)(1 + random_value(16));
+			msg->data.control_change.controller = 7;
+			msg->data.control_change.value =
+				(uint8_t)random_value(128);
+		} else {
+			msg->type = MIDI_TYPE_NOTE_ON;
+			msg->channel = (uint8_t)(1 + random_value(16));
+			msg->data.note_on.note = (uint8_t)random_value(128);
+			msg->data.note_on.velocity = (uint8_t)random_value(128);
+		}
+	}
+}
+
+/* The original text log as produced by print_msg() */
+static void write_text(const char *path)
+{
+	static char line[8 * MAX_SYSEX];
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		return;
+
+	double start = now_ms();
+	for (size_t i = 0; i < NUM_EVENTS; i++) {
+		sprint_msg(line, &events[i].msg);
+		fprintf(f, "%" PRIu64 " %u %s\n", events[i].time,
+			events[i].port, line);
+	}
+	fclose(f);
+	double elapsed = now_ms() - start;
+
+	printf("Text log:   %8ld bytes, %6.1f ms\n", file_size(path), elapsed);
+}
+
+static bool write_capture(const char *path)
+{
+	struct midi_capture_writer writer;
+	if (!midi_capture_writer_open(&writer, path,
+				      MIDI_CAPTURE_SEGMENT_SIZE_DEFAULT,
+				      MIDI_CAPTURE_INDEX_INTERVAL_DEFAULT)) {
+		perror("midi_capture_writer_open");
+		return false;
+	}
+
+	double start = now_ms();
+	for (size_t i = 0; i < NUM_EVENTS; i++) {
+		midi_capture_write(&writer, &events[i].msg, events[i].port,
+				   events[i].time);
+	}
+	uint32_t num_segments = writer.header->num_segments;
+	size_t dropped = writer.dropped;
+	midi_capture_writer_close(&writer);
+	double elapsed = now_ms() - start;
+
+	printf("Capture:    %8ld bytes, %6.1f ms, %" PRIu32 " segments, "
+	       "%zu dropped\n", file_size(path), elapsed, num_segments,
+	       dropped);
+	return (dropped == 0);
+}
+
+static bool replay(struct midi_capture_reader *reader)
+{
+	struct midi_message msg;
+	size_t n = 0;
+
+	midi_capture_seek(reader, 0);
+	double start = now_ms();
+	while (midi_capture_read(reader, &msg))
+		n++;
+	double elapsed = now_ms() - start;
+
+	midi_capture_seek(reader, 0);
+	for (size_t i = 0; i < n; i++) {
+		if (!midi_capture_read(reader, &msg) || !check(i, &msg, reader))
+			return false;
+	}
+
+	printf("Replay:     %8zu messages, %6.1f ms\n", n, elapsed);
+	return (n == NUM_EVENTS);
+}
+
+static bool replay_istream(struct midi_capture_reader *reader)
+{
+	struct midi_istream stream;
+	struct midi_message *msg;
+	size_t n = 0;
+
+	midi_capture_seek(reader, 0);
+	midi_capture_istream(reader, &stream);
+	stream.sysex_buffer.data = sysex_buffer;
+	stream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	double start = now_ms();
+	while (midi_decode(&stream) != NULL)
+		n++;
+	double elapsed = now_ms() - start;
+
+	midi_capture_seek(reader, 0);
+	midi_capture_istream(reader, &stream);
+	stream.sysex_buffer.data = sysex_buffer;
+	stream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	for (size_t i = 0; i < n; i++) {
+		msg = midi_decode(&stream);
+		if (msg == NULL || !check(i, msg, reader))
+			return false;
+	}
+
+	printf("Istream:    %8zu messages, %6.1f ms\n", n, elapsed);
+	return (n == NUM_EVENTS);
+}
+
+/* Finds the first event at or after the time */
+static size_t lower_bound(uint64_t time)
+{
+	size_t lo = 0;
+	size_t hi = NUM_EVENTS;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (events[mid].time < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static bool seek(struct midi_capture_reader *reader)
+{
+	uint64_t first = events[0].time;
+	uint64_t range = events[NUM_EVENTS - 1].time - first + 1;
+	uint64_t targets[NUM_SEEKS];
+	struct midi_message msg;
+
+	for (size_t i = 0; i < NUM_SEEKS; i++) {
+		uint64_t r = ((uint64_t)random_value(1u << 15) << 15) |
+			     random_value(1u << 15);
+		/* Half of the targets hit an existing event time exactly: */
+		if (i % 2 == 0)
+			targets[i] = events[r % NUM_EVENTS].time;
+		else
+			targets[i] = first + r % range;
+	}
+
+	double start = now_ms();
+	for (size_t i = 0; i < NUM_SEEKS; i++)
+		midi_capture_seek(reader, targets[i]);
+	double elapsed = now_ms() - start;
+
+	for (size_t i = 0; i < NUM_SEEKS; i++) {
+		size_t n = lower_bound(targets[i]);
+		bool found = midi_capture_seek(reader, targets[i]);
+
+		if (found != (n < NUM_EVENTS) ||
+		    (found && (!midi_capture_read(reader, &msg) ||
+			       !check(n, &msg, reader)))) {
+			printf("Seek to %" PRIu64 " failed\n", targets[i]);
+			return false;
+		}
+	}
+
+	printf("Seek:       %8d seeks,    %6.1f ms (%.2f us per seek)\n",
+	       NUM_SEEKS, elapsed, elapsed * 1e3 / NUM_SEEKS);
+	return true;
+}
+
+/* Replays a time window into the USB scheduler, times in milliseconds */
+static bool schedule(struct midi_capture_reader *reader)
+{
+	static struct midi_message messages[4][NUM_REPLAYED];
+	static uint32_t times[4][NUM_REPLAYED];
+	struct midi_usb_port ports[4];
+	struct midi_usb_scheduler scheduler;
+	uint8_t buffer[64];
+	struct midi_message msg;
+	size_t packets = 0;
+
+	midi_usb_scheduler_init(&scheduler);
+	for (uint8_t i = 0; i < 4; i++) {
+		midi_usb_port_init(&ports[i], messages[i], times[i],
+				   NUM_REPLAYED, 4);
+		midi_usb_scheduler_add_port(&scheduler, i, &ports[i]);
+	}
+
+	uint64_t start = events[NUM_EVENTS / 4].time;
+	if (!midi_capture_seek(reader, start))
+		return false;
+
+	for (size_t i = 0; i < NUM_REPLAYED; i++) {
+		if (!midi_capture_read(reader, &msg))
+			return false;
+
+		uint32_t now = (uint32_t)((reader->time - start) / 1000);
+		midi_usb_scheduler_push(&scheduler, reader->port, &msg, now);
+
+		struct midi_ostream stream;
+		midi_ostream_from_buffer(&stream, buffer, sizeof(buffer));
+		packets += midi_usb_scheduler_encode(&scheduler, &stream,
+						     now) / 4;
+	}
+
+	printf("Scheduler:  %8d messages, %zu USB packets\n", NUM_REPLAYED,
+	       packets);
+	return true;
+}
+
+int main(void)
+{
+	char text_path[64];
+	char capture_path[64];
+	struct midi_capture_reader reader;
+	bool ok = true;
+
+	snprintf(text_path, sizeof(text_path), "/tmp/nanomidi-%ld.txt",
+		 (long)getpid());
+	snprintf(capture_path, sizeof(capture_path), "/tmp/nanomidi-%ld.cap",
+		 (long)getpid());
+
+	generate();
+	printf("Logging %d events:\n", NUM_EVENTS);
+	write_text(text_path);
+	ok = write_capture(capture_path);
+
+	if (ok && midi_capture_reader_open(&reader, capture_path)) {
+		ok = replay(&reader) && replay_istream(&reader) &&
+		     seek(&reader) && schedule(&reader);
+		midi_capture_reader_close(&reader);
+	} else {
+		ok = false;
+	}
+
+	unlink(text_path);
+	unlink(capture_path);
+
+	printf("%s\n", ok ? "Capture OK" : "Capture FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <nanomidi/clock.h>
+
+#define TICKS_PER_SECOND	1000000	/* Microseconds */
+#define JITTER			2000	/* Maximum jitter is +-2 ms */
+#define SETTLE_CLOCKS		(4 * MIDI_CLOCK_PPQN)	/* Skip four beats */
+
+struct stats {
+	double sum;
+	double max;
+	unsigned int count;
+};
+
+static uint32_t random_state = 1;
+
+/* Returns a pseudo-random number in range <-JITTER, JITTER>: */
+static int32_t jitter(void)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	uint32_t value = (random_state >> 16) % (2 * JITTER + 1);
+	return (int32_t)value - JITTER;
+}
+
+static void stats_add(struct stats *stats, double value)
+{
+	stats->sum += value * value;
+	if (fabs(value) > stats->max)
+		stats->max = fabs(value);
+	stats->count++;
+}
+
+static void stats_print(const char *name, const struct stats *stats,
+			const char *unit)
+{
+	printf("%-28s rms %8.3f %s, max %8.3f %s\n", name,
+	       sqrt(stats->sum / stats->count), unit, stats->max, unit);
+}
+
+static void run(double bpm_from, double bpm_to, unsigned int clocks)
+{
+	struct midi_clock clock;
+	midi_clock_init(&clock, TICKS_PER_SECOND);
+
+	struct stats bpm_dll = { 0 };
+	struct stats bpm_naive = { 0 };
+	struct stats next_dll = { 0 };
+	struct stats next_naive = { 0 };
+
+	struct midi_message msg = { .type = MIDI_TYPE_START };
+	midi_clock_update(&clock, &msg, 0);
+	msg.type = MIDI_TYPE_TIMING_CLOCK;
+
+	double period = 60.0 * TICKS_PER_SECOND / (bpm_from * MIDI_CLOCK_PPQN);
+	double ideal = 1000.0;
+	uint32_t last = 0;
+
+	for (unsigned int i = 0; i < clocks; i++) {
+		/* Tempo changes in the middle: */
+		if (i == clocks / 2)
+			period = 60.0 * TICKS_PER_SECOND /
+				 (bpm_to * MIDI_CLOCK_PPQN);
+
+		uint32_t now = (uint32_t)lrint(ideal) + (uint32_t)jitter();
+		midi_clock_update(&clock, &msg, now);
+
+		double bpm = 60.0 * TICKS_PER_SECOND /
+			     (period * MIDI_CLOCK_PPQN);
+		double naive = 60.0 * TICKS_PER_SECOND /
+			       ((double)(now - last) * MIDI_CLOCK_PPQN);
+		double error_dll = (double)midi_clock_next(&clock, 0) -
+				   (ideal + period);
+		double error_naive = (double)(2 * now - last) -
+				     (ideal + period);
+		last = now;
+		ideal += period;
+
+		unsigned int since_change = (i >= clocks / 2) ?
+					    i - clocks / 2 : i;
+		if (since_change < SETTLE_CLOCKS)
+			continue;
+
+		stats_add(&bpm_dll, (double)midi_clock_bpm(&clock) / 1000.0 -
+			  bpm);
+		stats_add(&bpm_naive, naive - bpm);
+		stats_add(&next_dll, error_dll / 1000.0);
+		stats_add(&next_naive, error_naive / 1000.0);
+	}
+
+	printf("%.0f -> %.0f BPM, jitter +-%d us, position %.3f beats\n",
+	       bpm_from, bpm_to, JITTER,
+	       (double)(midi_clock_position(&clock, last) >> 16) /
+	       MIDI_CLOCK_PPQN);
+	stats_print("Tempo (DLL):", &bpm_dll, "BPM");
+	stats_print("Tempo (last interval):", &bpm_naive, "BPM");
+	stats_print("Next clock (DLL):", &next_dll, "ms");
+	stats_print("Next clock (last interval):", &next_naive, "ms");
+}
+
+int main(void)
+{
+	run(120.0, 140.0, 200 * MIDI_CLOCK_PPQN);
+	run(90.0, 60.0, 200 * MIDI_CLOCK_PPQN);
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <nanomidi/nanomidi.hpp>
+
+static constexpr size_t NUM_MESSAGES = 1000000;
+
+/* Encoded at compile time, no code runs at startup: */
+static constexpr auto init_sequence = NANOMIDI_ENCODE_RUNNING_STATUS(
+	nanomidi::control_change(1, 121, 0),
+	nanomidi::control_change(1, 7, 100),
+	nanomidi::program_change(1, 5),
+	nanomidi::sysex({ 0x7e, 0x7f, 0x09, 0x01 }),
+	nanomidi::note_on(1, 60, 100),
+	nanomidi::note_on(1, 64, 100));
+static_assert(init_sequence.size() == 3 + 2 + 2 + 6 + 3 + 2);
+
+static constexpr auto usb_packets = nanomidi::encode_usb(0,
+	nanomidi::sysex({ 0x7e, 0x7f, 0x09, 0x01 }),
+	nanomidi::note_on(1, 60, 100),
+	nanomidi::sysex(),
+	nanomidi::sysex({ 0x01 }));
+static_assert(usb_packets.size() == 4 * (2 + 1 + 1 + 1));
+
+/* Compile-time USB packets have to match midi_encode_usb() */
+static int check_usb_packets()
+{
+	static const uint8_t sysex[] = { 0x7e, 0x7f, 0x09, 0x01 };
+	static const uint8_t short_sysex[] = { 0x01 };
+	midi_message msgs[4];
+	msgs[0].type = MIDI_TYPE_SYSEX;
+	msgs[0].data.sysex.data = sysex;
+	msgs[0].data.sysex.length = sizeof(sysex);
+	msgs[1].type = MIDI_TYPE_NOTE_ON;
+	msgs[1].channel = 1;
+	msgs[1].data.note_on.note = 60;
+	msgs[1].data.note_on.velocity = 100;
+	msgs[2].type = MIDI_TYPE_SYSEX;
+	msgs[2].data.sysex.data = nullptr;
+	msgs[2].data.sysex.length = 0;
+	msgs[3].type = MIDI_TYPE_SYSEX;
+	msgs[3].data.sysex.data = short_sysex;
+	msgs[3].data.sysex.length = sizeof(short_sysex);
+
+	uint8_t buffer[sizeof(usb_packets)];
+	midi_ostream ostream;
+	midi_ostream_from_buffer(&ostream, buffer, sizeof(buffer));
+
+	size_t length = 0;
+	for (const midi_message &msg : msgs)
+		length += midi_encode_usb(&ostream, &msg, 0);
+
+	if (length != usb_packets.size() ||
+	    std::memcmp(buffer, usb_packets.data(), length) != 0) {
+		std::printf("USB packets do not match\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_sysex_capacity()
+{
+	static uint8_t sysex[200];
+	midi_message msg;
+	msg.type = MIDI_TYPE_SYSEX;
+	msg.data.sysex.data = sysex;
+	msg.data.sysex.length = sizeof(sysex);
+
+	/* One byte short: nothing may be written */
+	uint8_t buffer[sizeof(sysex) + 2] = { 0 };
+	nanomidi::encoder<nanomidi::span_sink> enc({buffer,
+						     sizeof(buffer) - 1});
+	if (enc.encode(msg) != 0 || buffer[0] != 0 ||
+	    enc.sink().size != sizeof(buffer) - 1) {
+		std::printf("Partial SysEx written\n");
+		return 1;
+	}
+
+	enc.sink() = {buffer, sizeof(buffer)};
+	if (enc.encode(msg) != sizeof(buffer) ||
+	    buffer[sizeof(buffer) - 1] != 0xf7) {
+		std::printf("SysEx not written\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_fd_sink()
+{
+	static uint8_t sysex[1000];
+	static constexpr size_t NUM_SYSEX = 200;
+	static constexpr size_t SYSEX_SIZE = sizeof(sysex) + 2;
+
+	for (size_t i = 0; i < sizeof(sysex); i++)
+		sysex[i] = static_cast<uint8_t>(i & 0x7f);
+
+	int fds[2];
+	if (pipe(fds) != 0)
+		return 1;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		/* Slow reader so that the writer runs into a full pipe: */
+		close(fds[1]);
+		size_t received = 0;
+		uint8_t c[512];
+		ssize_t n;
+		while ((n = read(fds[0], c, sizeof(c))) > 0) {
+			for (ssize_t i = 0; i < n; i++, received++) {
+				size_t pos = received % SYSEX_SIZE;
+				uint8_t expected = (pos == 0) ? 0xf0 :
+					(pos == SYSEX_SIZE - 1) ? 0xf7 :
+					sysex[pos - 1];
+				if (c[i] != expected)
+					_exit(1);
+			}
+			usleep(100);
+		}
+		_exit(received == NUM_SYSEX * SYSEX_SIZE ? 0 : 1);
+	}
+
+	close(fds[0]);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+	midi_message msg;
+	msg.type = MIDI_TYPE_SYSEX;
+	msg.data.sysex.data = sysex;
+	msg.data.sysex.length = sizeof(sysex);
+
+	nanomidi::encoder<nanomidi::fd_sink<>> enc{nanomidi::fd_sink<>{fds[1]}};
+	size_t written = 0;
+	size_t buffered = 0;
+
+	for (size_t i = 0; i < NUM_SYSEX; i++) {
+		written += enc.encode(msg);
+		if (enc.sink().length > buffered)
+			buffered = enc.sink().length;
+	}
+
+	while (!enc.sink().flush())
+		usleep(100);
+	close(fds[1]);
+
+	int status;
+	waitpid(pid, &status, 0);
+
+	if (written != NUM_SYSEX * SYSEX_SIZE || buffered == 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		std::printf("File descriptor sink lost data\n");
+		return 1;
+	}
+
+	std::printf("File descriptor sink: %zu bytes, up to %zu buffered\n",
+		    written, buffered);
+	return 0;
+}
+
+template <typename F>
+static double measure(F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	f();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main()
+{
+	std::vector<midi_message> messages(NUM_MESSAGES);
+	std::vector<uint8_t> buffer(3*NUM_MESSAGES);
+
+	std::printf("Init sequence (%zu bytes):", init_sequence.size());
+	for (uint8_t c : init_sequence)
+		std::printf(" %02x", c);
+	std::printf("\n");
+
+	if (check_usb_packets() != 0 || check_sysex_capacity() != 0 ||
+	    check_fd_sink() != 0)
+		return 1;
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		midi_message &msg = messages[i];
+		msg.type = (i % 3 == 0) ? MIDI_TYPE_CONTROL_CHANGE
+					: MIDI_TYPE_NOTE_ON;
+		msg.channel = static_cast<uint8_t>(1 + i % 16);
+		msg.data.note_on.note = static_cast<uint8_t>(i % 128);
+		msg.data.note_on.velocity = static_cast<uint8_t>(1 + i % 127);
+	}
+
+	size_t c_length = 0;
+	double t = measure([&] {
+		midi_ostream ostream;
+		midi_ostream_from_buffer(&ostream, buffer.data(),
+					 buffer.size());
+		for (const midi_message &msg : messages)
+			c_length += midi_encode(&ostream, &msg);
+	});
+	std::printf("C encoder:   %6.2f ns/message\n", 1e9 * t / NUM_MESSAGES);
+
+	size_t cpp_length = 0;
+	t = measure([&] {
+		nanomidi::encoder<nanomidi::span_sink> enc({buffer.data(),
+							     buffer.size()});
+		for (const midi_message &msg : messages)
+			cpp_length += enc.encode(msg);
+	});
+	std::printf("C++ encoder: %6.2f ns/message\n", 1e9 * t / NUM_MESSAGES);
+
+	size_t c_count = 0;
+	t = measure([&] {
+		midi_istream istream;
+		midi_istream_from_buffer(&istream, buffer.data(), c_length);
+		while (midi_decode(&istream) != NULL)
+			c_count++;
+	});
+	std::printf("C decoder:   %6.2f ns/message\n", 1e9 * t / NUM_MESSAGES);
+
+	size_t cpp_count = 0;
+	t = measure([&] {
+		nanomidi::decoder<nanomidi::span_source> dec({buffer.data(),
+							      cpp_length});
+		while (dec.decode() != nullptr)
+			cpp_count++;
+	});
+	std::printf("C++ decoder: %6.2f ns/message\n", 1e9 * t / NUM_MESSAGES);
+
+	if (c_length != cpp_length || c_count != cpp_count) {
+		std::printf("Results do not match\n");
+		return 1;
+	}
+
+	return 0;
+}
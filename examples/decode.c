@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <nanomidi/encoder.h>
 #include <nanomidi/decoder.h>
 #include "common.h"
@@ -36,6 +37,15 @@ static uint8_t buffer[] = {
 	0xf0, 0xfa, 0x42, 0xf7,	/* SysEx, realtime message (START) injected */
 };
 
+/* Data arrive in chunks, e.g. from DMA half/full transfer interrupts: */
+#define CHUNK_SIZE		5
+
+static void print_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	(void)sink;
+	print_msg(msg);
+}
+
 int main(void)
 {
 	struct midi_istream istream;
@@ -57,5 +67,24 @@ int main(void)
 		print_msg(message);
 	}
 
+	/* The same data decoded using push-style API: */
+	struct midi_istream state;
+	memset(&state, 0, sizeof(state));
+#if SYSEX_SUPPORTED
+	state.sysex_buffer.data = sysex_buffer;
+	state.sysex_buffer.size = sizeof(sysex_buffer);
+#endif
+
+	struct midi_sink sink = { .message_cb = &print_message };
+
+	printf("\nDecoded messages (%d-byte chunks):\n", CHUNK_SIZE);
+
+	for (size_t i = 0; i < sizeof(buffer); i += CHUNK_SIZE) {
+		size_t n = sizeof(buffer) - i;
+		if (n > CHUNK_SIZE)
+			n = CHUNK_SIZE;
+		midi_decoder_feed(&state, &buffer[i], n, &sink);
+	}
+
 	return 0;
 }
@@ -0,0 +1,151 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <nanomidi/decoder.h>
+
+#define CAPTURE_SIZE	(64*1024)
+#define BLOCK_SIZE	34
+#define ITERATIONS	50
+#define RUNS		9
+
+static uint8_t capture[CAPTURE_SIZE];
+
+static size_t create_capture(void)
+{
+	size_t pos = 0;
+	uint8_t note = 0;
+
+	/* Clock-heavy traffic: 24 ppqn clock with sparse notes and controller
+	   changes on two channels and periodic Active Sensing: */
+	while (pos + BLOCK_SIZE <= sizeof(capture)) {
+		for (int i = 0; i < 12; i++)
+			capture[pos++] = 0xf8;
+
+		capture[pos++] = 0x90;
+		capture[pos++] = note;
+		capture[pos++] = 100;
+		capture[pos++] = 0xb1;
+		capture[pos++] = 1;
+		capture[pos++] = note;
+		capture[pos++] = 0xfe;
+
+		for (int i = 0; i < 12; i++)
+			capture[pos++] = 0xf8;
+
+		capture[pos++] = 0x80;
+		capture[pos++] = note;
+		capture[pos++] = 0;
+		note = (uint8_t)((note + 1) & 0x7f);
+	}
+
+	return pos;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Returns the best time of several runs so the result is repeatable */
+static double decode_capture(const struct midi_filter *filter, size_t length,
+			     size_t *count)
+{
+	double best = 0;
+
+	for (int run = 0; run < RUNS; run++) {
+		double start = now_ns();
+
+		for (int i = 0; i < ITERATIONS; i++) {
+			struct midi_istream istream;
+			midi_istream_from_buffer(&istream, capture, length);
+			istream.filter = filter;
+
+			*count = 0;
+			while (midi_decode(&istream) != NULL)
+				(*count)++;
+		}
+
+		double ns = (now_ns() - start) / ((double)length * ITERATIONS);
+		if (run == 0 || ns < best)
+			best = ns;
+	}
+
+	return best;
+}
+
+static bool check(const char *name, double ns, size_t count, size_t expected)
+{
+	bool ok = (count == expected);
+
+	printf("%-19s %6.2f ns/byte, %zu messages: %s\n", name, ns, count,
+	       ok ? "OK" : "FAILED");
+	return ok;
+}
+
+int main(void)
+{
+	size_t length = create_capture();
+	size_t blocks = length / BLOCK_SIZE;
+	size_t count;
+	double ns;
+	bool ok;
+
+	ns = decode_capture(NULL, length, &count);
+	ok = check("No filter:", ns, count, 28 * blocks);
+
+	/* Only interested in notes on channel 1: */
+	static const enum midi_type types[] = {
+		MIDI_TYPE_NOTE_ON,
+		MIDI_TYPE_NOTE_OFF,
+	};
+
+	struct midi_filter filter;
+	midi_filter_compile(&filter, types, sizeof(types)/sizeof(*types),
+			    0x0001);
+
+	ns = decode_capture(&filter, length, &count);
+	ok = check("Notes on channel 1:", ns, count, 2 * blocks) && ok;
+
+	/* Everything but clock and Active Sensing: */
+	static const enum midi_type no_clock[] = {
+		MIDI_TYPE_NOTE_ON,
+		MIDI_TYPE_NOTE_OFF,
+		MIDI_TYPE_CONTROL_CHANGE,
+		MIDI_TYPE_START,
+		MIDI_TYPE_STOP,
+		MIDI_TYPE_CONTINUE,
+	};
+
+	midi_filter_compile(&filter, no_clock,
+			    sizeof(no_clock)/sizeof(*no_clock), 0xffff);
+
+	ns = decode_capture(&filter, length, &count);
+	ok = check("No clock:", ns, count, 3 * blocks) && ok;
+
+	printf("%s\n", ok ? "Filter OK" : "Filter FAILED");
+	return ok ? 0 : 1;
+}
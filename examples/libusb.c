@@ -24,8 +24,12 @@
 #include <libusb.h>
 #include <nanomidi/decoder.h>
 #include <nanomidi/encoder.h>
+#include <nanomidi/sysex.h>
+#include "usb_transport.h"
 #include "common.h"
 
+#define NUM_TRANSFERS	4
+
 enum endpoint_direction {
 	EP_IN,
 	EP_OUT,
@@ -35,6 +39,7 @@ struct endpoint_table {
 	struct endpoint {
 		uint8_t address;
 		enum endpoint_direction direction;
+		size_t max_packet_size;
 	} *endpoints;
 	size_t length;
 	size_t max_size;
@@ -100,8 +105,10 @@ static bool midi_init(libusb_device_handle *devh,
 
 				/* Save MIDI IN and OUT endpoints to table: */
 				uint8_t ep, eid;
+				size_t mps;
 				for (eid = 0; eid < id->bNumEndpoints; eid++) {
 					ep = id->endpoint[eid].bEndpointAddress;
+					mps = id->endpoint[eid].wMaxPacketSize;
 
 					size_t pos = ep_table->length;
 					if (pos > ep_table->max_size)
@@ -112,6 +119,7 @@ static bool midi_init(libusb_device_handle *devh,
 						(struct endpoint) {
 							.address = ep,
 							.direction = EP_IN,
+							.max_packet_size = mps,
 						};
 						ep_table->length++;
 					} else {
@@ -119,6 +127,7 @@ static bool midi_init(libusb_device_handle *devh,
 						(struct endpoint) {
 							.address = ep,
 							.direction = EP_OUT,
+							.max_packet_size = mps,
 						};
 						ep_table->length++;
 					}
@@ -132,13 +141,11 @@ static bool midi_init(libusb_device_handle *devh,
 	return true;
 }
 
-static void sysex_identity_request(libusb_device_handle *devh,
-				   struct endpoint_table *ep_table)
+static void sysex_identity_request(struct usb_transport *transport)
 {
-	uint8_t buffer[64];
-	int length;
-
-	uint8_t id_request[] = { 0x7e, 0x7f, 0x06, 0x01 };
+	uint8_t id_request[] = { 0x7e, MIDI_SYSEX_ALL_DEVICES,
+				 MIDI_SYSEX_GENERAL_INFO,
+				 MIDI_SYSEX_IDENTITY_REQUEST };
 
 	struct midi_message msg = {
 		.type = MIDI_TYPE_SYSEX,
@@ -146,64 +153,81 @@ static void sysex_identity_request(libusb_device_handle *devh,
 		.data.sysex.length = sizeof(id_request),
 	};
 
-	for (size_t i = 0; i < ep_table->length; i++) {
-		struct endpoint *ep = &ep_table->endpoints[i];
-		if (ep->direction != EP_OUT)
-			continue;
-
-		struct midi_ostream ostream = { 0 };
-		midi_ostream_from_buffer(&ostream, buffer, sizeof(buffer));
-		int enc_len = (int)midi_encode_usb(&ostream, &msg, 0);
+	for (int i = 0; i < transport->num_out; i++)
+		usb_transport_send(&transport->out[i], &msg, 0);
+}
 
-		if (enc_len > 0) {
-			libusb_bulk_transfer(devh, ep->address, buffer, enc_len,
-					     &length, 100);
-		}
+static void identity_reply(const struct midi_sysex_header *header,
+			   void *param)
+{
+	(void)param;
+	struct midi_sysex_identity id;
+	if (midi_sysex_decode_identity(&id, header)) {
+		printf("Identity: manufacturer %06x, family %04x, model %04x, "
+		       "version %d.%d.%d.%d\n", (unsigned int)id.manufacturer,
+		       id.family, id.model, id.version[0], id.version[1],
+		       id.version[2], id.version[3]);
 	}
 }
 
+static void print_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct midi_sysex_dispatcher *dispatcher = sink->param;
+
+	print_msg(msg);
+	midi_sysex_dispatch(dispatcher, msg);
+}
+
 static void midi_run(libusb_device_handle *devh,
 		     struct endpoint_table *ep_table)
 {
-	uint8_t buffer[64];
-	int ret;
-	int length;
-	uint8_t cable_number;
+	static const struct midi_sysex_route routes[] = {
+		{ MIDI_SYSEX_ID_NON_REALTIME, MIDI_SYSEX_GENERAL_INFO,
+		  MIDI_SYSEX_IDENTITY_REPLY, &identity_reply, NULL },
+	};
 
-	struct midi_istream istream;
-	midi_istream_from_buffer(&istream, buffer, sizeof(buffer));
+	struct midi_sysex_dispatcher dispatcher;
+	midi_sysex_dispatcher_init(&dispatcher, routes,
+				   sizeof(routes)/sizeof(*routes));
 
-	char sysex_buffer[64];
-	istream.sysex_buffer.data = sysex_buffer;
-	istream.sysex_buffer.size = sizeof(sysex_buffer);
+	struct midi_sink sink = {
+		.message_cb = &print_message,
+		.param = &dispatcher,
+	};
 
-	sysex_identity_request(devh, ep_table);
+	/* Keep several transfers queued on each endpoint: */
+	struct usb_transport transport;
+	usb_transport_init(&transport, NULL, devh, &sink);
 
-	while (!stop) {
-		/* Bulk read from all available IN endpoints: */
-		for (size_t i = 0; i < ep_table->length; i++) {
-			struct endpoint *ep = &ep_table->endpoints[i];
-			if (ep->direction != EP_IN)
-				continue;
-
-			ret = libusb_bulk_transfer(devh, ep->address,
-						   buffer, sizeof(buffer),
-						   &length, 100);
-			if (ret != 0)
-				continue;
-
-			/* Reset stream and encode MIDI message: */
-			istream.param = buffer;
-			istream.capacity = (size_t)length;
-
-			struct midi_message *msg;
-			do {
-				msg = midi_decode_usb(&istream, &cable_number);
-				if (msg != NULL)
-					print_msg(msg);
-			} while (msg != NULL);
+	for (size_t i = 0; i < ep_table->length; i++) {
+		struct endpoint *ep = &ep_table->endpoints[i];
+		struct usb_endpoint *uep;
+
+		if (ep->direction == EP_IN) {
+			uep = usb_transport_add_in(&transport, ep->address,
+						   NUM_TRANSFERS,
+						   ep->max_packet_size);
+		} else {
+			uep = usb_transport_add_out(&transport, ep->address,
+						    NUM_TRANSFERS,
+						    ep->max_packet_size);
 		}
+
+		if (uep == NULL) {
+			fprintf(stderr, "Cannot set up endpoint %02x\n",
+				ep->address);
+		}
+	}
+
+	sysex_identity_request(&transport);
+
+	while (!stop) {
+		if (usb_transport_poll(&transport, 100) < 0)
+			break;
 	}
+
+	usb_transport_print_stats(&transport);
+	usb_transport_close(&transport);
 }
 
 int main(int argc, char **argv)
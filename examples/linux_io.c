@@ -0,0 +1,269 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <nanomidi/linux_io.h>
+#include "common.h"
+
+#define NUM_MESSAGES		20000
+#define BUFFER_SIZE		4096
+#define SYSEX_LENGTH		32
+#define NUM_PORTS		6
+#define MAX_TIMEOUTS		20
+
+struct link {
+	const char *name;
+	struct midi_linux_port *tx;
+	struct midi_linux_port *rx;
+	bool use_decode; /* Use midi_decode() instead of midi_linux_receive() */
+	uint32_t sent;
+	uint32_t received;
+	uint32_t errors;
+	size_t bytes;
+};
+
+static uint8_t rx_buffers[NUM_PORTS][BUFFER_SIZE];
+static uint8_t tx_buffers[NUM_PORTS][BUFFER_SIZE];
+static uint8_t sysex_buffers[NUM_PORTS][SYSEX_LENGTH];
+static uint8_t sysex_data[SYSEX_LENGTH];
+
+/* Deterministic sequence of messages with SysEx and clock interleaved */
+static void make_message(struct midi_message *msg, uint32_t n)
+{
+	memset(msg, 0, sizeof(*msg));
+
+	if (n % 100 == 99) {
+		msg->type = MIDI_TYPE_SYSEX;
+		msg->data.sysex.data = sysex_data;
+		msg->data.sysex.length = SYSEX_LENGTH;
+	} else if (n % 24 == 0) {
+		msg->type = MIDI_TYPE_TIMING_CLOCK;
+	} else {
+		msg->type = MIDI_TYPE_NOTE_ON;
+		msg->channel = (uint8_t)(1 + n % 16);
+		msg->data.note_on.note = (uint8_t)(n % 128);
+		msg->data.note_on.velocity = (uint8_t)((n / 128) % 128);
+	}
+}
+
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[SYSEX_LENGTH + 2];
+	uint8_t buffer_b[SYSEX_LENGTH + 2];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+static void check_message(struct link *link, const struct midi_message *msg)
+{
+	struct midi_message expected;
+	make_message(&expected, link->received++);
+
+	if (!equal(msg, &expected) && link->errors++ < 3) {
+		printf("%s: unexpected message ", link->name);
+		print_msg(msg);
+	}
+}
+
+static void receive_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	check_message(sink->param, msg);
+}
+
+static void receive(struct link *link)
+{
+	struct midi_linux_port *port = link->rx;
+
+	if (link->use_decode) {
+		struct midi_message *msg;
+		while ((msg = midi_decode(&port->input)) != NULL)
+			check_message(link, msg);
+	} else {
+		struct midi_sink sink = {
+			.message_cb = &receive_message,
+			.param = link,
+		};
+		midi_linux_receive(port, &sink);
+	}
+}
+
+static void send(struct link *link)
+{
+	struct midi_linux_port *port = link->tx;
+
+	while (link->sent < NUM_MESSAGES) {
+		struct midi_message msg;
+		make_message(&msg, link->sent);
+
+		size_t n = midi_encode(&port->output, &msg);
+		if (n == 0)
+			break;
+
+		link->bytes += n;
+		link->sent++;
+	}
+
+	if (!midi_linux_flush(port))
+		perror(link->name);
+}
+
+static bool init_port(struct midi_linux_port *ports, int index, int fd,
+		      struct midi_linux_poller *poller)
+{
+	struct midi_linux_port *port = &ports[index];
+
+	if (fd < 0 || !midi_linux_port_init(port, fd, rx_buffers[index],
+					    BUFFER_SIZE, tx_buffers[index],
+					    BUFFER_SIZE))
+		return false;
+
+	port->input.sysex_buffer.data = sysex_buffers[index];
+	port->input.sysex_buffer.size = SYSEX_LENGTH;
+
+	return midi_linux_poller_add(poller, port);
+}
+
+int main(void)
+{
+	static struct midi_linux_port ports[NUM_PORTS];
+	struct midi_linux_poller poller;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (size_t i = 0; i < SYSEX_LENGTH; i++)
+		sysex_data[i] = (uint8_t)i;
+
+	if (!midi_linux_poller_init(&poller)) {
+		perror("epoll");
+		return 1;
+	}
+
+	/* Pseudoterminal pair, slave is configured as a serial port: */
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+		perror("pty");
+		return 1;
+	}
+	int slave = midi_linux_open(ptsname(master), 115200);
+
+	/* Pipe: */
+	int pipe_fds[2];
+	if (pipe(pipe_fds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	/* FIFO, opened twice: */
+	char fifo_path[64];
+	snprintf(fifo_path, sizeof(fifo_path), "/tmp/nanomidi-%d.fifo",
+		 (int)getpid());
+	if (mkfifo(fifo_path, 0600) < 0) {
+		perror("mkfifo");
+		return 1;
+	}
+	int fifo_rx = midi_linux_open(fifo_path, 0);
+	int fifo_tx = midi_linux_open(fifo_path, 0);
+	unlink(fifo_path);
+
+	if (!init_port(ports, 0, master, &poller) ||
+	    !init_port(ports, 1, slave, &poller) ||
+	    !init_port(ports, 2, pipe_fds[0], &poller) ||
+	    !init_port(ports, 3, pipe_fds[1], &poller) ||
+	    !init_port(ports, 4, fifo_rx, &poller) ||
+	    !init_port(ports, 5, fifo_tx, &poller)) {
+		perror("port");
+		return 1;
+	}
+
+	struct link links[] = {
+		{ .name = "pty master -> slave", .tx = &ports[0],
+		  .rx = &ports[1] },
+		{ .name = "pty slave -> master", .tx = &ports[1],
+		  .rx = &ports[0] },
+		{ .name = "pipe", .tx = &ports[3], .rx = &ports[2],
+		  .use_decode = true },
+		{ .name = "FIFO", .tx = &ports[5], .rx = &ports[4] },
+	};
+	const size_t num_links = sizeof(links) / sizeof(*links);
+
+	int timeouts = 0;
+	while (timeouts < MAX_TIMEOUTS) {
+		bool done = true;
+		for (size_t i = 0; i < num_links; i++) {
+			send(&links[i]);
+			if (links[i].received < NUM_MESSAGES)
+				done = false;
+		}
+
+		if (done)
+			break;
+
+		struct midi_linux_port *ready[NUM_PORTS];
+		int n = midi_linux_poll(&poller, ready, NUM_PORTS, 100);
+		if (n <= 0) {
+			timeouts++;
+			continue;
+		}
+
+		for (int i = 0; i < n; i++) {
+			for (size_t j = 0; j < num_links; j++) {
+				if (links[j].rx == ready[i])
+					receive(&links[j]);
+			}
+		}
+	}
+
+	int ret = 0;
+	for (size_t i = 0; i < num_links; i++) {
+		struct link *link = &links[i];
+		size_t reads = link->rx->num_reads;
+		size_t writes = link->tx->num_writes;
+		bool ok = (link->received == NUM_MESSAGES && link->errors == 0);
+
+		printf("%-20s %5u messages, %6zu bytes, %4zu reads, "
+		       "%4zu writes, %s\n", link->name, link->received,
+		       link->bytes, reads, writes, ok ? "OK" : "FAILED");
+		if (!ok)
+			ret = 1;
+	}
+
+	printf("Reading one byte per read() would take %zu calls per link\n",
+	       links[0].bytes);
+
+	for (int i = 0; i < NUM_PORTS; i++)
+		midi_linux_port_close(&ports[i]);
+	midi_linux_poller_close(&poller);
+
+	return ret;
+}
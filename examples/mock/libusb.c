@@ -0,0 +1,262 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libusb.h"
+
+#define MAX_PENDING	64
+#define FIFO_SIZE	65536
+
+struct pending {
+	struct libusb_transfer *transfer;
+	uint64_t due;
+	bool cancelled;
+};
+
+struct libusb_device_handle {
+	unsigned int bus_time;
+	uint64_t bus_free;
+	struct pending pending[MAX_PENDING];
+	size_t num_pending;
+	uint8_t fifo[FIFO_SIZE];
+	size_t fifo_length;
+};
+
+static libusb_device_handle device;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000u + (uint64_t)ts.tv_nsec/1000u;
+}
+
+static void sleep_us(uint64_t us)
+{
+	struct timespec ts = {
+		.tv_sec = (time_t)(us / 1000000u),
+		.tv_nsec = (long)(us % 1000000u) * 1000,
+	};
+	nanosleep(&ts, NULL);
+}
+
+static bool is_in(const struct libusb_transfer *transfer)
+{
+	return (transfer->endpoint & 0x80) != 0;
+}
+
+static int find_pending(const libusb_device_handle *devh,
+			const struct libusb_transfer *transfer)
+{
+	for (size_t i = 0; i < devh->num_pending; i++) {
+		if (devh->pending[i].transfer == transfer)
+			return (int)i;
+	}
+	return -1;
+}
+
+static void complete(libusb_device_handle *devh, size_t index,
+		     enum libusb_transfer_status status, int actual_length)
+{
+	struct libusb_transfer *transfer = devh->pending[index].transfer;
+
+	devh->num_pending--;
+	memmove(&devh->pending[index], &devh->pending[index+1],
+		(devh->num_pending - index)*sizeof(struct pending));
+
+	transfer->status = status;
+	transfer->actual_length = actual_length;
+	transfer->callback(transfer);
+}
+
+/* Completes a single transfer, returns false if there is none to complete */
+static bool process(libusb_device_handle *devh, uint64_t now)
+{
+	struct libusb_transfer *transfer;
+
+	for (size_t i = 0; i < devh->num_pending; i++) {
+		if (devh->pending[i].cancelled) {
+			complete(devh, i, LIBUSB_TRANSFER_CANCELLED, 0);
+			return true;
+		}
+	}
+
+	/* Loop data written to OUT endpoint back to the FIFO: */
+	for (size_t i = 0; i < devh->num_pending; i++) {
+		transfer = devh->pending[i].transfer;
+		if (is_in(transfer) || devh->pending[i].due > now)
+			continue;
+
+		size_t length = (size_t)transfer->length;
+		if (devh->fifo_length + length > FIFO_SIZE) {
+			complete(devh, i, LIBUSB_TRANSFER_STALL, 0);
+			return true;
+		}
+
+		memcpy(&devh->fifo[devh->fifo_length], transfer->buffer,
+		       length);
+		devh->fifo_length += length;
+		complete(devh, i, LIBUSB_TRANSFER_COMPLETED, transfer->length);
+		return true;
+	}
+
+	/* Fill the oldest IN transfer with whole packets from the FIFO: */
+	if (devh->fifo_length < 4)
+		return false;
+
+	for (size_t i = 0; i < devh->num_pending; i++) {
+		transfer = devh->pending[i].transfer;
+		if (!is_in(transfer))
+			continue;
+
+		size_t length = (size_t)transfer->length;
+		if (length > devh->fifo_length)
+			length = devh->fifo_length;
+		length &= ~(size_t)3;
+
+		memcpy(transfer->buffer, devh->fifo, length);
+		devh->fifo_length -= length;
+		memmove(devh->fifo, &devh->fifo[length], devh->fifo_length);
+		complete(devh, i, LIBUSB_TRANSFER_COMPLETED, (int)length);
+		return true;
+	}
+
+	return false;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+	(void)iso_packets;
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	if (transfer == NULL)
+		return;
+
+	if (transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER)
+		free(transfer->buffer);
+	free(transfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	libusb_device_handle *devh = transfer->dev_handle;
+
+	if (find_pending(devh, transfer) >= 0)
+		return LIBUSB_ERROR_BUSY;
+	if (devh->num_pending >= MAX_PENDING)
+		return LIBUSB_ERROR_NO_MEM;
+
+	struct pending *pending = &devh->pending[devh->num_pending++];
+	pending->transfer = transfer;
+	pending->cancelled = false;
+	pending->due = 0;
+
+	/* OUT transfers are serialized on the bus: */
+	if (!is_in(transfer)) {
+		uint64_t now = now_us();
+		if (devh->bus_free < now)
+			devh->bus_free = now;
+		devh->bus_free += devh->bus_time;
+		pending->due = devh->bus_free;
+	}
+
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	libusb_device_handle *devh = transfer->dev_handle;
+	int i = find_pending(devh, transfer);
+
+	if (i < 0)
+		return LIBUSB_ERROR_NOT_FOUND;
+
+	devh->pending[i].cancelled = true;
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx,
+					   struct timeval *tv, int *completed)
+{
+	(void)ctx;
+	libusb_device_handle *devh = &device;
+	uint64_t deadline = now_us() + (uint64_t)tv->tv_sec*1000000u +
+			    (uint64_t)tv->tv_usec;
+
+	for (;;) {
+		if (completed != NULL && *completed)
+			return LIBUSB_SUCCESS;
+
+		uint64_t now = now_us();
+		bool progress = false;
+		while (process(devh, now))
+			progress = true;
+
+		if (progress || now >= deadline)
+			return LIBUSB_SUCCESS;
+
+		/* Sleep until the next OUT transfer leaves the bus: */
+		uint64_t next = deadline;
+		for (size_t i = 0; i < devh->num_pending; i++) {
+			if (!is_in(devh->pending[i].transfer) &&
+			    devh->pending[i].due < next)
+				next = devh->pending[i].due;
+		}
+		sleep_us(next - now);
+	}
+}
+
+const char *libusb_error_name(int errcode)
+{
+	switch (errcode) {
+	case LIBUSB_SUCCESS:
+		return "LIBUSB_SUCCESS";
+	case LIBUSB_ERROR_INVALID_PARAM:
+		return "LIBUSB_ERROR_INVALID_PARAM";
+	case LIBUSB_ERROR_NOT_FOUND:
+		return "LIBUSB_ERROR_NOT_FOUND";
+	case LIBUSB_ERROR_BUSY:
+		return "LIBUSB_ERROR_BUSY";
+	case LIBUSB_ERROR_NO_MEM:
+		return "LIBUSB_ERROR_NO_MEM";
+	default:
+		return "**UNKNOWN**";
+	}
+}
+
+libusb_device_handle *mock_libusb_open(unsigned int bus_time_us)
+{
+	memset(&device, 0, sizeof(device));
+	device.bus_time = bus_time_us;
+	return &device;
+}
+
+void mock_libusb_close(libusb_device_handle *devh)
+{
+	devh->num_pending = 0;
+	devh->fifo_length = 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Minimal in-process replacement of the libusb-1.0 asynchronous transfer API
+ * used to exercise usb_transport.c without a USB device. The mock device
+ * loops data written to its OUT endpoint back to its IN endpoint. Each OUT
+ * transfer occupies the simulated bus for a configurable time.
+ */
+
+#ifndef MOCK_LIBUSB_H
+#define MOCK_LIBUSB_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#define LIBUSB_CALL
+
+#define MOCK_LIBUSB_EP_OUT	0x01
+#define MOCK_LIBUSB_EP_IN	0x81
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device_handle libusb_device_handle;
+
+enum libusb_error {
+	LIBUSB_SUCCESS = 0,
+	LIBUSB_ERROR_INVALID_PARAM = -2,
+	LIBUSB_ERROR_NOT_FOUND = -5,
+	LIBUSB_ERROR_BUSY = -6,
+	LIBUSB_ERROR_NO_MEM = -11,
+};
+
+enum libusb_transfer_type {
+	LIBUSB_TRANSFER_TYPE_BULK = 2,
+};
+
+enum libusb_transfer_status {
+	LIBUSB_TRANSFER_COMPLETED,
+	LIBUSB_TRANSFER_ERROR,
+	LIBUSB_TRANSFER_TIMED_OUT,
+	LIBUSB_TRANSFER_CANCELLED,
+	LIBUSB_TRANSFER_STALL,
+	LIBUSB_TRANSFER_NO_DEVICE,
+	LIBUSB_TRANSFER_OVERFLOW,
+};
+
+enum libusb_transfer_flags {
+	LIBUSB_TRANSFER_SHORT_NOT_OK = 1 << 0,
+	LIBUSB_TRANSFER_FREE_BUFFER = 1 << 1,
+	LIBUSB_TRANSFER_FREE_TRANSFER = 1 << 2,
+};
+
+struct libusb_transfer;
+
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(
+	struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+	libusb_device_handle *dev_handle;
+	uint8_t flags;
+	unsigned char endpoint;
+	unsigned char type;
+	unsigned int timeout;
+	enum libusb_transfer_status status;
+	int length;
+	int actual_length;
+	libusb_transfer_cb_fn callback;
+	void *user_data;
+	unsigned char *buffer;
+	int num_iso_packets;
+};
+
+static inline void libusb_fill_bulk_transfer(struct libusb_transfer *transfer,
+	libusb_device_handle *dev_handle, unsigned char endpoint,
+	unsigned char *buffer, int length, libusb_transfer_cb_fn callback,
+	void *user_data, unsigned int timeout)
+{
+	transfer->dev_handle = dev_handle;
+	transfer->endpoint = endpoint;
+	transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+	transfer->timeout = timeout;
+	transfer->buffer = buffer;
+	transfer->length = length;
+	transfer->user_data = user_data;
+	transfer->callback = callback;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer *transfer);
+int libusb_submit_transfer(struct libusb_transfer *transfer);
+int libusb_cancel_transfer(struct libusb_transfer *transfer);
+int libusb_handle_events_timeout_completed(libusb_context *ctx,
+					   struct timeval *tv, int *completed);
+const char *libusb_error_name(int errcode);
+
+/* Opens the loopback device, each OUT transfer takes bus_time_us */
+libusb_device_handle *mock_libusb_open(unsigned int bus_time_us);
+void mock_libusb_close(libusb_device_handle *devh);
+
+#endif /* MOCK_LIBUSB_H */
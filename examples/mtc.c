@@ -0,0 +1,110 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#include <nanomidi/mtc.h>
+
+#define TICKS_PER_SECOND	1000000	/* Microseconds */
+#define STEP			1000	/* Main loop runs every millisecond */
+#define TIMEOUT			200000	/* Time code stops after 200 ms */
+
+struct receiver {
+	struct midi_istream istream;
+	struct midi_mtc mtc;
+	uint32_t now;
+};
+
+static const char *state_name[] = { "STOPPED", "LOCKED", "FREEWHEEL" };
+
+static void message_received(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct receiver *rx = sink->param;
+	midi_mtc_update(&rx->mtc, msg, rx->now);
+}
+
+static void print_time(struct receiver *rx)
+{
+	struct midi_mtc_time t;
+	midi_mtc_get_time(&rx->mtc, rx->now, &t);
+
+	printf("%7.3f s: %02d:%02d:%02d:%02d.%02d %s\n",
+	       (double)rx->now / TICKS_PER_SECOND, t.hours, t.minutes,
+	       t.seconds, t.frames, t.subframes,
+	       state_name[rx->mtc.state]);
+}
+
+int main(void)
+{
+	struct midi_mtc_time start = {
+		.hours = 1, .minutes = 2, .seconds = 3, .frames = 4,
+		.rate = MIDI_MTC_RATE_25,
+	};
+
+	struct midi_mtc_generator gen;
+	midi_mtc_generator_init(&gen, &start, TICKS_PER_SECOND, 0);
+
+	struct receiver rx;
+	memset(&rx, 0, sizeof(rx));
+	midi_mtc_init(&rx.mtc, TICKS_PER_SECOND, TIMEOUT);
+
+	struct midi_sink sink = {
+		.message_cb = &message_received,
+		.param = &rx,
+	};
+
+	uint32_t start_position = MIDI_MTC_SUBFRAMES *
+				  midi_mtc_time_to_frames(&start);
+	uint32_t max_error = 0;
+
+	for (rx.now = 0; rx.now <= 2000000; rx.now += STEP) {
+		/* Time code is interrupted between 1.0 s and 1.5 s: */
+		bool running = (rx.now < 1000000 || rx.now >= 1500000);
+
+		uint8_t buffer[16];
+		struct midi_ostream ostream;
+		midi_ostream_from_buffer(&ostream, buffer, sizeof(buffer));
+
+		size_t n = midi_mtc_generate(&gen, &ostream, rx.now);
+		if (running)
+			midi_decoder_feed(&rx.istream, buffer, n, &sink);
+
+		if (rx.now % 250000 == 0)
+			print_time(&rx);
+
+		/* Compare with exact position while locked: */
+		if (running && rx.mtc.state == MIDI_MTC_LOCKED) {
+			uint32_t exact = start_position + (uint32_t)
+				((uint64_t)rx.now * 25 * MIDI_MTC_SUBFRAMES /
+				 TICKS_PER_SECOND);
+			uint32_t position = midi_mtc_position(&rx.mtc, rx.now);
+			uint32_t error = (position > exact) ? position - exact :
+							      exact - position;
+			if (error > max_error)
+				max_error = error;
+		}
+	}
+
+	printf("Maximum error while locked: %u subframes\n",
+	       (unsigned int)max_error);
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/notes.h>
+
+#define NUM_MESSAGES		100000
+#define CHANNELS		3
+#define PANIC_PERIOD		500
+
+/* Receiver which keeps released notes sounding while the pedal is down */
+struct synth {
+	bool key[16][128];
+	bool sounding[16][128];
+	bool sustain[16];
+};
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static void release_sustained(struct synth *synth, uint8_t ch)
+{
+	for (size_t i = 0; i < 128; i++) {
+		if (!synth->key[ch][i])
+			synth->sounding[ch][i] = false;
+	}
+}
+
+static void synth_update(struct synth *synth, const struct midi_message *msg)
+{
+	uint8_t ch = (uint8_t)(msg->channel - 1);
+	uint8_t note;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		note = msg->data.note_on.note;
+		synth->key[ch][note] = (msg->data.note_on.velocity > 0);
+		if (synth->key[ch][note])
+			synth->sounding[ch][note] = true;
+		else if (!synth->sustain[ch])
+			synth->sounding[ch][note] = false;
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		note = msg->data.note_off.note;
+		synth->key[ch][note] = false;
+		if (!synth->sustain[ch])
+			synth->sounding[ch][note] = false;
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		switch (msg->data.control_change.controller) {
+		case 64:
+			synth->sustain[ch] =
+				(msg->data.control_change.value >= 64);
+			if (!synth->sustain[ch])
+				release_sustained(synth, ch);
+			break;
+		case 121: /* Reset All Controllers */
+			synth->sustain[ch] = false;
+			release_sustained(synth, ch);
+			break;
+		case 123: /* All Notes Off, pedal still holds the notes */
+			memset(synth->key[ch], 0, sizeof(synth->key[ch]));
+			if (!synth->sustain[ch])
+				release_sustained(synth, ch);
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static size_t count_sounding(const struct synth *synth)
+{
+	size_t n = 0;
+
+	for (size_t ch = 0; ch < 16; ch++) {
+		for (size_t i = 0; i < 128; i++)
+			n += synth->sounding[ch][i];
+	}
+
+	return n;
+}
+
+static void random_message(struct midi_message *msg)
+{
+	uint32_t r = random_value(100);
+
+	memset(msg, 0, sizeof(*msg));
+	msg->channel = (uint8_t)(1 + random_value(CHANNELS));
+
+	if (r < 45) {
+		msg->type = MIDI_TYPE_NOTE_ON;
+		msg->data.note_on.note = (uint8_t)(48 + random_value(24));
+		msg->data.note_on.velocity = (uint8_t)random_value(128);
+	} else if (r < 85) {
+		msg->type = MIDI_TYPE_NOTE_OFF;
+		msg->data.note_off.note = (uint8_t)(48 + random_value(24));
+	} else {
+		static const uint8_t controllers[] = { 64, 64, 64, 121, 123 };
+		msg->type = MIDI_TYPE_CONTROL_CHANGE;
+		msg->data.control_change.controller =
+			controllers[random_value(sizeof(controllers))];
+		msg->data.control_change.value =
+			(uint8_t)(random_value(2) ? 127 : 0);
+	}
+}
+
+/* Releases all notes through the tracker and plays the output to the synth */
+static size_t panic(struct midi_note_tracker *tracker, struct synth *synth)
+{
+	uint8_t buffer[16 * (1 + 2*128 + 3)];
+	struct midi_ostream ostream;
+	struct midi_istream istream;
+	struct midi_message *msg;
+
+	midi_ostream_from_buffer(&ostream, buffer, sizeof(buffer));
+	size_t n = midi_notes_release(tracker, &ostream, 0);
+
+	midi_istream_from_buffer(&istream, buffer, n);
+	while ((msg = midi_decode(&istream)) != NULL)
+		synth_update(synth, msg);
+
+	return n;
+}
+
+int main(void)
+{
+	static struct synth synth;
+	struct midi_note_tracker tracker;
+	struct midi_message msg;
+	size_t num_panics = 0;
+	size_t num_bytes = 0;
+	bool ok = true;
+
+	midi_notes_init(&tracker, NULL);
+
+	/* Pedal held, notes released, controllers reset, pedal pressed: */
+	static const struct midi_message script[] = {
+		{ .type = MIDI_TYPE_CONTROL_CHANGE, .channel = 1,
+		  .data.control_change = { 64, 127 } },
+		{ .type = MIDI_TYPE_NOTE_ON, .channel = 1,
+		  .data.note_on = { 60, 100 } },
+		{ .type = MIDI_TYPE_NOTE_OFF, .channel = 1,
+		  .data.note_off = { 60, 0 } },
+		{ .type = MIDI_TYPE_CONTROL_CHANGE, .channel = 1,
+		  .data.control_change = { 121, 0 } },
+	};
+
+	for (size_t i = 0; i < sizeof(script) / sizeof(script[0]); i++) {
+		midi_notes_update(&tracker, &script[i]);
+		synth_update(&synth, &script[i]);
+	}
+
+	if (tracker.sustain != 0 || count_sounding(&synth) != 0) {
+		printf("Reset All Controllers: pedal still down\n");
+		ok = false;
+	}
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		random_message(&msg);
+		midi_notes_update(&tracker, &msg);
+		synth_update(&synth, &msg);
+
+		if (random_value(PANIC_PERIOD) != 0)
+			continue;
+
+		num_bytes += panic(&tracker, &synth);
+		num_panics++;
+
+		size_t n = count_sounding(&synth);
+		if (n > 0 || tracker.sustain != 0) {
+			printf("Panic %zu: %zu notes still sounding\n",
+			       num_panics, n);
+			ok = false;
+		}
+	}
+
+	printf("%zu panics, %.1f bytes per panic\n", num_panics,
+	       (double)num_bytes / (double)num_panics);
+	printf("%s\n", ok ? "Notes OK" : "Notes FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <nanomidi/pack7.h>
+
+#define DATA_SIZE	(1024 * 1024)
+#define ITERATIONS	20
+#define TEST_RUNS	1000
+
+static uint8_t data[DATA_SIZE];
+static uint8_t packed[2 * DATA_SIZE];
+static uint8_t reference[2 * DATA_SIZE];
+static uint8_t unpacked[DATA_SIZE];
+
+static const char *scheme_name[] = { "MSB group", "MSB group reversed",
+				     "Nibbles" };
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(void)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 8);
+}
+
+/* Straightforward byte-by-byte packing used for comparison: */
+static size_t reference_encode(enum midi_pack7_scheme scheme, uint8_t *out,
+			       const uint8_t *in, size_t length)
+{
+	size_t n = 0;
+
+	if (scheme == MIDI_PACK7_NIBBLES) {
+		for (size_t i = 0; i < length; i++) {
+			out[n++] = (uint8_t)(in[i] >> 4);
+			out[n++] = (uint8_t)(in[i] & 0x0f);
+		}
+		return n;
+	}
+
+	for (size_t i = 0; i < length; i += 7) {
+		size_t header = n++;
+		out[header] = 0;
+		for (size_t j = 0; j < 7 && i + j < length; j++) {
+			size_t bit = (scheme == MIDI_PACK7_MSB_GROUP) ? j : 6-j;
+			if (in[i+j] & 0x80)
+				out[header] |= (uint8_t)(1 << bit);
+			out[n++] = (uint8_t)(in[i+j] & 0x7f);
+		}
+	}
+
+	return n;
+}
+
+static bool test(enum midi_pack7_scheme scheme, size_t length)
+{
+	size_t expected = reference_encode(scheme, reference, data, length);
+	uint8_t sum = 0;
+	for (size_t i = 0; i < expected; i++)
+		sum = (uint8_t)(sum + reference[i]);
+
+	/* Encode and decode in random chunks: */
+	struct midi_pack7 enc;
+	midi_pack7_init(&enc, scheme);
+	size_t n = 0;
+	for (size_t i = 0; i < length; ) {
+		size_t chunk = 1 + random_value() % 40;
+		if (chunk > length - i)
+			chunk = length - i;
+		n += midi_pack7_encode(&enc, &packed[n], &data[i], chunk);
+		i += chunk;
+	}
+	n += midi_pack7_encode_finish(&enc, &packed[n]);
+
+	if (n != expected || n != midi_pack7_encoded_size(scheme, length) ||
+	    memcmp(packed, reference, n) != 0 ||
+	    midi_pack7_checksum(&enc, MIDI_CHECKSUM_SUM) != (sum & 0x7f))
+		return false;
+
+	struct midi_pack7 dec;
+	midi_pack7_init(&dec, scheme);
+	size_t m = 0;
+	for (size_t i = 0; i < n; ) {
+		size_t chunk = 1 + random_value() % 40;
+		if (chunk > n - i)
+			chunk = n - i;
+		m += midi_pack7_decode(&dec, &unpacked[m], &packed[i], chunk);
+		i += chunk;
+	}
+
+	return (m == length && m == midi_pack7_decoded_size(scheme, n) &&
+		memcmp(unpacked, data, length) == 0 &&
+		midi_pack7_checksum(&dec, MIDI_CHECKSUM_XOR) ==
+		midi_pack7_checksum(&enc, MIDI_CHECKSUM_XOR));
+}
+
+static double seconds(clock_t begin)
+{
+	return (double)(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+static void benchmark(enum midi_pack7_scheme scheme)
+{
+	const double megabytes = (double)DATA_SIZE * ITERATIONS / 1e6;
+	struct midi_pack7 state;
+	size_t n = 0;
+
+	clock_t begin = clock();
+	for (int i = 0; i < ITERATIONS; i++)
+		n = reference_encode(scheme, reference, data, DATA_SIZE);
+	double naive = seconds(begin);
+
+	begin = clock();
+	for (int i = 0; i < ITERATIONS; i++) {
+		midi_pack7_init(&state, scheme);
+		n = midi_pack7_encode(&state, packed, data, DATA_SIZE);
+		n += midi_pack7_encode_finish(&state, &packed[n]);
+	}
+	double encode = seconds(begin);
+
+	begin = clock();
+	for (int i = 0; i < ITERATIONS; i++) {
+		midi_pack7_init(&state, scheme);
+		midi_pack7_decode(&state, unpacked, packed, n);
+	}
+	double decode = seconds(begin);
+
+	printf("%-20s byte by byte %7.1f MB/s, encode %7.1f MB/s, "
+	       "decode %7.1f MB/s\n", scheme_name[scheme], megabytes / naive,
+	       megabytes / encode, megabytes / decode);
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < DATA_SIZE; i++)
+		data[i] = (uint8_t)random_value();
+
+	for (int s = 0; s < 3; s++) {
+		enum midi_pack7_scheme scheme = (enum midi_pack7_scheme)s;
+		unsigned int failed = 0;
+		for (int i = 0; i < TEST_RUNS; i++) {
+			if (!test(scheme, random_value() % 1000))
+				failed++;
+		}
+		printf("%-20s %d round trips, %u failed\n", scheme_name[s],
+		       TEST_RUNS, failed);
+	}
+
+	/* Roland DT1 checksum covers the address and data: */
+	static const uint8_t address[] = { 0x40, 0x00, 0x7f };
+	static const uint8_t value[] = { 0x00 };
+	struct midi_pack7 roland;
+	midi_pack7_init(&roland, MIDI_PACK7_NIBBLES);
+	midi_pack7_checksum_update(&roland, address, sizeof(address));
+	midi_pack7_checksum_update(&roland, value, sizeof(value));
+	printf("Roland checksum of 40 00 7F 00: %02X\n",
+	       midi_pack7_checksum(&roland, MIDI_CHECKSUM_ROLAND));
+
+	for (int s = 0; s < 3; s++)
+		benchmark((enum midi_pack7_scheme)s);
+
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#include <nanomidi/packed.h>
+#include "common.h"
+
+#define NUM_MESSAGES		10000
+#define MAX_SYSEX		32
+#define POOL_ENTRIES		64
+#define POOL_SIZE		1024
+#define SMALL_POOL_SIZE		16
+
+static struct midi_message messages[NUM_MESSAGES];
+static uint8_t sysex_data[NUM_MESSAGES][MAX_SYSEX];
+static uint8_t stream_data[NUM_MESSAGES * (MAX_SYSEX + 2)];
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static void random_message(struct midi_message *msg, uint8_t *sysex)
+{
+	static const uint8_t types[] = {
+		MIDI_TYPE_NOTE_OFF, MIDI_TYPE_NOTE_ON,
+		MIDI_TYPE_POLYPHONIC_PRESSURE, MIDI_TYPE_CONTROL_CHANGE,
+		MIDI_TYPE_PROGRAM_CHANGE, MIDI_TYPE_CHANNEL_PRESSURE,
+		MIDI_TYPE_PITCH_BEND, MIDI_TYPE_TIME_CODE_QUARTER_FRAME,
+		MIDI_TYPE_SONG_POSITION, MIDI_TYPE_SONG_SELECT,
+		MIDI_TYPE_TUNE_REQUEST, MIDI_TYPE_TIMING_CLOCK,
+		MIDI_TYPE_START, MIDI_TYPE_CONTINUE, MIDI_TYPE_STOP,
+		MIDI_TYPE_ACTIVE_SENSE, MIDI_TYPE_SYSTEM_RESET,
+		MIDI_TYPE_SYSEX,
+	};
+	uint8_t d1 = (uint8_t)random_value(128);
+	uint8_t d2 = (uint8_t)random_value(128);
+
+	memset(msg, 0, sizeof(*msg));
+	msg->type = (enum midi_type)types[random_value(sizeof(types))];
+	msg->channel = (uint8_t)(1 + random_value(16));
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		msg->data.note_on.note = d1;
+		msg->data.note_on.velocity = (uint8_t)(1 + d2 % 127);
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		msg->data.note_off.note = d1;
+		msg->data.note_off.velocity = d2;
+		break;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		msg->data.polyphonic_pressure.note = d1;
+		msg->data.polyphonic_pressure.pressure = d2;
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		msg->data.control_change.controller = d1;
+		msg->data.control_change.value = d2;
+		break;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		msg->data.program_change.program = d1;
+		break;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		msg->data.channel_pressure.pressure = d1;
+		break;
+	case MIDI_TYPE_PITCH_BEND:
+		msg->data.pitch_bend.value = (uint16_t)(d1 << 7 | d2);
+		break;
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+		msg->data.time_code_quarter_frame.value = d1;
+		break;
+	case MIDI_TYPE_SONG_POSITION:
+		msg->data.song_position.position = (uint16_t)(d1 << 7 | d2);
+		break;
+	case MIDI_TYPE_SONG_SELECT:
+		msg->data.song_select.song = d1;
+		break;
+	case MIDI_TYPE_SYSEX:
+		msg->data.sysex.length = random_value(MAX_SYSEX + 1);
+		for (size_t i = 0; i < msg->data.sysex.length; i++)
+			sysex[i] = (uint8_t)random_value(128);
+		msg->data.sysex.data = sysex;
+		break;
+	default:
+		break;
+	}
+
+	/* System messages have no channel: */
+	if (msg->type >= MIDI_TYPE_SYSEX)
+		msg->channel = 0;
+}
+
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[MAX_SYSEX + 2];
+	uint8_t buffer_b[MAX_SYSEX + 2];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+/* Packs and unpacks each message, both forms must encode the same bytes */
+static bool test_pack(void)
+{
+	static struct midi_packed_sysex entries[POOL_ENTRIES];
+	static uint8_t pool_data[POOL_SIZE];
+	struct midi_packed_pool pool;
+
+	midi_packed_pool_init(&pool, entries, POOL_ENTRIES, pool_data,
+			      sizeof(pool_data));
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		struct midi_packed packed;
+		struct midi_message msg;
+		uint8_t buffer_a[MAX_SYSEX + 2] = { 0 };
+		uint8_t buffer_b[MAX_SYSEX + 2] = { 0 };
+		struct midi_ostream stream_a;
+		struct midi_ostream stream_b;
+
+		midi_packed_pool_reset(&pool);
+
+		midi_ostream_from_buffer(&stream_a, buffer_a, sizeof(buffer_a));
+		midi_ostream_from_buffer(&stream_b, buffer_b, sizeof(buffer_b));
+		if (!midi_pack(&packed, &messages[i], &pool) ||
+		    !midi_unpack(&msg, &packed, &pool) ||
+		    !equal(&msg, &messages[i]) ||
+		    midi_encode_packed(&stream_a, &packed, &pool) !=
+		    midi_encode(&stream_b, &messages[i]) ||
+		    memcmp(buffer_a, buffer_b, MAX_SYSEX + 2) != 0) {
+			printf("Pack: mismatch at %zu\n", i);
+			print_msg(&messages[i]);
+			return false;
+		}
+	}
+
+	printf("Pack: %d messages, %zu bytes instead of %zu: OK\n",
+	       NUM_MESSAGES, sizeof(struct midi_packed),
+	       sizeof(struct midi_message));
+	return true;
+}
+
+/* Decodes the whole stream in a loop with a pool too small for some SysEx
+ * messages, messages following a dropped SysEx must not be lost */
+static bool test_decode(size_t length)
+{
+	static struct midi_packed_sysex entries[POOL_ENTRIES];
+	static uint8_t pool_data[SMALL_POOL_SIZE];
+	static uint8_t sysex_buffer[MAX_SYSEX];
+	struct midi_packed_pool pool;
+	struct midi_istream stream;
+	struct midi_packed packed;
+	size_t num_decoded = 0;
+	size_t num_dropped = 0;
+
+	midi_packed_pool_init(&pool, entries, POOL_ENTRIES, pool_data,
+			      sizeof(pool_data));
+	midi_istream_from_buffer(&stream, stream_data, length);
+	stream.sysex_buffer.data = sysex_buffer;
+	stream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	while (midi_decode_packed(&stream, &packed, &pool)) {
+		const struct midi_message *expected = &messages[num_decoded];
+		struct midi_message msg;
+
+		if (num_decoded++ >= NUM_MESSAGES) {
+			printf("Decode: too many messages\n");
+			return false;
+		}
+
+		bool fits = (expected->type != MIDI_TYPE_SYSEX ||
+			     expected->data.sysex.length <= SMALL_POOL_SIZE);
+		bool dropped = (packed.status == MIDI_TYPE_SYSEX &&
+				(packed.data1 | packed.data2 << 8) ==
+				MIDI_PACKED_NO_HANDLE);
+
+		if (dropped && !fits) {
+			num_dropped++;
+		} else if (dropped || !midi_unpack(&msg, &packed, &pool) ||
+			   !equal(&msg, expected)) {
+			printf("Decode: mismatch at %zu\n", num_decoded - 1);
+			print_msg(expected);
+			return false;
+		}
+
+		/* Keep each message in the pool only until it is checked: */
+		midi_packed_pool_reset(&pool);
+	}
+
+	bool ok = (num_decoded == NUM_MESSAGES && num_dropped > 0 &&
+		   num_dropped == pool.dropped);
+	printf("Decode: %zu messages, %zu SysEx dropped (pool reports %zu): "
+	       "%s\n", num_decoded, num_dropped, pool.dropped,
+	       ok ? "OK" : "FAILED");
+	return ok;
+}
+
+int main(void)
+{
+	struct midi_ostream stream;
+	size_t length = 0;
+
+	midi_ostream_from_buffer(&stream, stream_data, sizeof(stream_data));
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		random_message(&messages[i], sysex_data[i]);
+		length += midi_encode(&stream, &messages[i]);
+	}
+
+	bool ok = test_pack();
+	ok = test_decode(length) && ok;
+
+	printf("%s\n", ok ? "Packed OK" : "Packed FAILED");
+	return ok ? 0 : 1;
+}
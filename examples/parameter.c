@@ -0,0 +1,201 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/parameter.h>
+
+#define NUM_PARAMETERS		100000
+
+#define CC(ch, c, v)		{ (ch), (c), (v) }
+#define PARAM(t, ch, n, v)	{ MIDI_PARAMETER_##t, (ch), (n), (v) }
+
+struct cc {
+	uint8_t channel;
+	uint8_t controller;
+	uint8_t value;
+};
+
+struct step {
+	struct cc cc;
+	bool reported;
+	struct midi_parameter param;
+};
+
+/* Modulation (1) is always sent with LSB, Volume (7) is not: */
+static const struct step steps[] = {
+	{ CC(1, 1, 64), false, { 0 } },
+	{ CC(1, 33, 5), true, PARAM(CONTROLLER, 1, 1, 64 << 7 | 5) },
+	{ CC(1, 7, 100), true, PARAM(CONTROLLER, 1, 7, 100 << 7) },
+	{ CC(1, 39, 3), true, PARAM(CONTROLLER, 1, 7, 100 << 7 | 3) },
+	/* Pitch Bend Sensitivity (RPN 0) set to 12 semitones: */
+	{ CC(2, 101, 0), false, { 0 } },
+	{ CC(2, 100, 0), false, { 0 } },
+	{ CC(2, 6, 12), true, PARAM(RPN, 2, 0, 12 << 7) },
+	{ CC(2, 38, 0), true, PARAM(RPN, 2, 0, 12 << 7) },
+	/* NRPN on another channel does not affect channel 2: */
+	{ CC(3, 99, 1), false, { 0 } },
+	{ CC(3, 98, 8), false, { 0 } },
+	{ CC(3, 6, 64), true, PARAM(NRPN, 3, 1 << 7 | 8, 64 << 7) },
+	{ CC(2, 6, 2), true, PARAM(RPN, 2, 0, 2 << 7) },
+	/* RPN Null deselects the parameter: */
+	{ CC(2, 101, 127), false, { 0 } },
+	{ CC(2, 100, 127), false, { 0 } },
+	{ CC(2, 6, 10), true, PARAM(CONTROLLER, 2, 6, 10 << 7) },
+	/* Other controllers are ignored: */
+	{ CC(1, 64, 127), false, { 0 } },
+};
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static bool equal(const struct midi_parameter *a,
+		  const struct midi_parameter *b)
+{
+	return (a->type == b->type && a->channel == b->channel &&
+		a->number == b->number && a->value == b->value);
+}
+
+static bool test_decoder(void)
+{
+	struct midi_parameter_decoder decoder;
+	bool ok = true;
+
+	midi_parameter_decoder_init(&decoder, 1 << 1);
+
+	for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		const struct step *s = &steps[i];
+		struct midi_message msg = {
+			.type = MIDI_TYPE_CONTROL_CHANGE,
+			.channel = s->cc.channel,
+			.data.control_change.controller = s->cc.controller,
+			.data.control_change.value = s->cc.value,
+		};
+
+		struct midi_parameter *param;
+		param = midi_parameter_decode(&decoder, &msg);
+		if ((param != NULL) != s->reported ||
+		    (param != NULL && !equal(param, &s->param))) {
+			printf("Decoder: unexpected result at step %zu\n", i);
+			ok = false;
+		}
+	}
+
+	printf("Decoder: %s\n", ok ? "OK" : "FAILED");
+	return ok;
+}
+
+static void random_parameter(struct midi_parameter *param)
+{
+	uint32_t r = random_value(3);
+
+	/* Mostly changes of a few parameters, as sent by a fader: */
+	param->type = (enum midi_parameter_type)r;
+	param->channel = (uint8_t)(1 + random_value(2));
+	if (r == MIDI_PARAMETER_CONTROLLER)
+		param->number = (uint16_t)random_value(32);
+	else
+		param->number = (uint16_t)random_value(4) << 7;
+	param->value = (uint16_t)random_value(16384);
+}
+
+/* Encodes random parameters and decodes them back from the byte stream */
+static bool test_round_trip(void)
+{
+	struct midi_parameter_encoder encoder;
+	struct midi_parameter_decoder decoder;
+	struct midi_istream istream;
+	uint8_t buffer[16];
+	size_t num_bytes = 0;
+
+	midi_parameter_encoder_init(&encoder);
+	midi_parameter_decoder_init(&decoder, 0xffffffff);
+	memset(&istream, 0, sizeof(istream));
+
+	for (size_t i = 0; i < NUM_PARAMETERS; i++) {
+		struct midi_parameter param;
+		struct midi_parameter *decoded = NULL;
+		struct midi_ostream ostream;
+
+		random_parameter(&param);
+		midi_ostream_from_buffer(&ostream, buffer, sizeof(buffer));
+		size_t n = midi_parameter_encode(&encoder, &ostream, &param);
+
+		for (size_t j = 0; j < n; j++) {
+			struct midi_message *msg;
+			msg = midi_decode_byte(&istream, buffer[j]);
+			if (msg == NULL)
+				continue;
+
+			struct midi_parameter *p;
+			p = midi_parameter_decode(&decoder, msg);
+			if (p != NULL && decoded != NULL) {
+				printf("Round trip: two changes at %zu\n", i);
+				return false;
+			}
+			if (p != NULL)
+				decoded = p;
+		}
+
+		if (decoded == NULL || !equal(decoded, &param)) {
+			printf("Round trip: mismatch at %zu\n", i);
+			return false;
+		}
+
+		num_bytes += n;
+	}
+
+	printf("Round trip: %d parameters, %.2f bytes per parameter: OK\n",
+	       NUM_PARAMETERS, (double)num_bytes / NUM_PARAMETERS);
+	return true;
+}
+
+/* Controllers 32-127 have no LSB controller and must not be encoded */
+static bool test_controller_range(void)
+{
+	struct midi_parameter_encoder encoder;
+	struct midi_parameter param = PARAM(CONTROLLER, 1, 40, 1000);
+	struct midi_ostream ostream;
+	uint8_t buffer[16];
+
+	midi_parameter_encoder_init(&encoder);
+	midi_ostream_from_buffer(&ostream, buffer, sizeof(buffer));
+
+	size_t n = midi_parameter_encode(&encoder, &ostream, &param);
+	bool ok = (n == 0 && ostream.capacity == sizeof(buffer));
+
+	printf("Controller out of range: %s\n", ok ? "OK" : "FAILED");
+	return ok;
+}
+
+int main(void)
+{
+	bool ok = test_decoder();
+	ok = test_round_trip() && ok;
+	ok = test_controller_range() && ok;
+
+	printf("%s\n", ok ? "Parameter OK" : "Parameter FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <nanomidi/queue.h>
+#include "common.h"
+
+#define QUEUE_SIZE		8
+#define NUM_OPERATIONS		200000
+#define BENCHMARK_SIZE		256
+#define BENCHMARK_MESSAGES	10000000
+
+#define CC(ch, c, v)	{ .type = MIDI_TYPE_CONTROL_CHANGE, .channel = (ch), \
+			  .data.control_change = { (c), (v) } }
+#define NOTE_ON(ch, n)	{ .type = MIDI_TYPE_NOTE_ON, .channel = (ch), \
+			  .data.note_on = { (n), 100 } }
+#define BEND(ch, v)	{ .type = MIDI_TYPE_PITCH_BEND, .channel = (ch), \
+			  .data.pitch_bend.value = (v) }
+#define CLOCK		{ .type = MIDI_TYPE_TIMING_CLOCK }
+#define TYPE_POP	((enum midi_type)1)
+#define POP		{ .type = TYPE_POP }
+#define UNDEFINED	{ .type = (enum midi_type)0xf4 }
+
+struct test {
+	const char *name;
+	struct midi_message input[12];
+	struct midi_message output[12];
+};
+
+/* POP in input pops a message from the queue, the output lists popped
+ * messages followed by what is left in the queue */
+static const struct test tests[] = {
+	{ "Latest value", {
+		CC(1, 7, 1), CC(1, 7, 2), CC(1, 7, 3), BEND(1, 100),
+		BEND(1, 200),
+	}, {
+		CC(1, 7, 3), BEND(1, 200),
+	} },
+	{ "Sustain around Note On", {
+		CC(1, 64, 127), NOTE_ON(1, 60), CC(1, 64, 0),
+	}, {
+		CC(1, 64, 127), NOTE_ON(1, 60), CC(1, 64, 0),
+	} },
+	{ "Coalescing after barrier", {
+		CC(1, 7, 1), NOTE_ON(1, 60), CC(1, 7, 2), CC(1, 7, 3),
+	}, {
+		CC(1, 7, 1), NOTE_ON(1, 60), CC(1, 7, 3),
+	} },
+	{ "Real Time is no barrier", {
+		CC(1, 7, 1), CLOCK, CC(1, 7, 2),
+	}, {
+		CC(1, 7, 2), CLOCK,
+	} },
+	{ "Pending value popped", {
+		CC(1, 7, 1), NOTE_ON(1, 60), CC(1, 7, 2), POP, CC(1, 7, 3),
+	}, {
+		CC(1, 7, 1), NOTE_ON(1, 60), CC(1, 7, 3),
+	} },
+	{ "RPN and Data Entry", {
+		CC(1, 101, 0), CC(1, 100, 0), CC(1, 6, 2), CC(1, 38, 0),
+		CC(1, 101, 0), CC(1, 100, 1), CC(1, 6, 64), CC(1, 38, 0),
+	}, {
+		CC(1, 101, 0), CC(1, 100, 0), CC(1, 6, 2), CC(1, 38, 0),
+		CC(1, 101, 0), CC(1, 100, 1), CC(1, 6, 64), CC(1, 38, 0),
+	} },
+	{ "Bank Select and Channel Mode", {
+		CC(2, 0, 1), CC(2, 32, 5), CC(2, 7, 10), CC(2, 0, 2),
+		CC(2, 32, 6), CC(2, 7, 20), CC(2, 123, 0), CC(2, 123, 0),
+	}, {
+		CC(2, 0, 1), CC(2, 32, 5), CC(2, 7, 10), CC(2, 0, 2),
+		CC(2, 32, 6), CC(2, 7, 20), CC(2, 123, 0), CC(2, 123, 0),
+	} },
+};
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[3];
+	uint8_t buffer_b[3];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+static size_t length(const struct midi_message *messages, size_t size)
+{
+	size_t n = 0;
+	while (n < size && messages[n].type != 0)
+		n++;
+
+	return n;
+}
+
+static bool run_test(const struct test *t)
+{
+	struct midi_message messages[QUEUE_SIZE];
+	struct midi_message output[12];
+	struct midi_queue queue;
+	struct midi_message *m;
+	size_t n = 0;
+
+	midi_queue_init(&queue, messages, QUEUE_SIZE);
+
+	size_t num_input = length(t->input, 12);
+	for (size_t i = 0; i < num_input; i++) {
+		if (t->input[i].type != TYPE_POP) {
+			midi_queue_push(&queue, &t->input[i]);
+		} else if ((m = midi_queue_peek(&queue)) != NULL) {
+			output[n++] = *m;
+			midi_queue_pop(&queue);
+		}
+	}
+
+	while ((m = midi_queue_peek(&queue)) != NULL) {
+		output[n++] = *m;
+		midi_queue_pop(&queue);
+	}
+
+	bool ok = (n == length(t->output, 12));
+	for (size_t i = 0; ok && i < n; i++)
+		ok = equal(&output[i], &t->output[i]);
+
+	printf("%s: %s\n", t->name, ok ? "OK" : "FAILED");
+	if (!ok) {
+		for (size_t i = 0; i < n; i++)
+			print_msg(&output[i]);
+	}
+
+	return ok;
+}
+
+/* Straightforward queue used for comparison: */
+struct reference {
+	struct midi_message messages[QUEUE_SIZE];
+	size_t length;
+	size_t barrier;
+};
+
+static int reference_key(const struct midi_message *msg)
+{
+	uint8_t c = msg->data.control_change.controller;
+
+	switch (msg->type) {
+	case MIDI_TYPE_CONTROL_CHANGE:
+		if (c == 0 || c == 6 || c == 32 || c == 38 ||
+		    (c >= 96 && c <= 101) || c >= 120)
+			return -1;
+		return msg->channel << 7 | c;
+	case MIDI_TYPE_PITCH_BEND:
+		return 0x10000 | msg->channel;
+	default:
+		return -1;
+	}
+}
+
+static bool reference_push(struct reference *ref,
+			   const struct midi_message *msg)
+{
+	int key = reference_key(msg);
+
+	for (size_t i = ref->length; key >= 0 && i-- > ref->barrier; ) {
+		if (reference_key(&ref->messages[i]) == key) {
+			ref->messages[i] = *msg;
+			return true;
+		}
+	}
+
+	if (ref->length == QUEUE_SIZE)
+		return false;
+
+	ref->messages[ref->length++] = *msg;
+	if (key < 0 && msg->type < MIDI_TYPE_TIMING_CLOCK)
+		ref->barrier = ref->length;
+
+	return true;
+}
+
+static void reference_pop(struct reference *ref)
+{
+	memmove(&ref->messages[0], &ref->messages[1],
+		(ref->length - 1) * sizeof(struct midi_message));
+	ref->length--;
+	if (ref->barrier > 0)
+		ref->barrier--;
+}
+
+static void random_message(struct midi_message *msg)
+{
+	static const uint8_t controllers[] = { 1, 7, 64, 6, 101, 123 };
+	uint32_t r = random_value(100);
+
+	memset(msg, 0, sizeof(*msg));
+	msg->channel = (uint8_t)(1 + random_value(2));
+
+	if (r < 60) {
+		msg->type = MIDI_TYPE_CONTROL_CHANGE;
+		msg->data.control_change.controller =
+			controllers[random_value(sizeof(controllers))];
+		msg->data.control_change.value = (uint8_t)random_value(128);
+	} else if (r < 80) {
+		msg->type = MIDI_TYPE_PITCH_BEND;
+		msg->data.pitch_bend.value = (uint16_t)random_value(16384);
+	} else if (r < 95) {
+		msg->type = MIDI_TYPE_NOTE_ON;
+		msg->data.note_on.note = (uint8_t)random_value(128);
+		msg->data.note_on.velocity = 100;
+	} else {
+		msg->type = MIDI_TYPE_TIMING_CLOCK;
+	}
+}
+
+/* Compares the queue with the reference on random pushes and pops */
+static bool run_random(void)
+{
+	struct midi_message messages[QUEUE_SIZE];
+	struct midi_queue queue;
+	struct reference ref;
+	struct midi_message msg;
+
+	midi_queue_init(&queue, messages, QUEUE_SIZE);
+	memset(&ref, 0, sizeof(ref));
+
+	for (size_t i = 0; i < NUM_OPERATIONS; i++) {
+		if (random_value(100) < 45) {
+			struct midi_message *m = midi_queue_peek(&queue);
+			if ((m == NULL) != (ref.length == 0) ||
+			    (m != NULL && !equal(m, &ref.messages[0]))) {
+				printf("Random: mismatch at %zu\n", i);
+				return false;
+			}
+
+			if (m != NULL) {
+				midi_queue_pop(&queue);
+				reference_pop(&ref);
+			}
+		} else {
+			random_message(&msg);
+			if (midi_queue_push(&queue, &msg) !=
+			    reference_push(&ref, &msg)) {
+				printf("Random: push mismatch at %zu\n", i);
+				return false;
+			}
+		}
+	}
+
+	printf("Random: %d operations, %zu coalesced: OK\n", NUM_OPERATIONS,
+	       queue.coalesced);
+	return true;
+}
+
+/* Messages which cannot be encoded must not block the queue */
+static bool run_encode(void)
+{
+	static const struct midi_message input[] = {
+		NOTE_ON(1, 60), UNDEFINED, NOTE_ON(1, 62), NOTE_ON(1, 64),
+	};
+	struct midi_message messages[QUEUE_SIZE];
+	struct midi_queue queue;
+	uint8_t buffer[16];
+	struct midi_ostream stream;
+
+	midi_queue_init(&queue, messages, QUEUE_SIZE);
+	for (size_t i = 0; i < sizeof(input) / sizeof(input[0]); i++)
+		midi_queue_push(&queue, &input[i]);
+
+	/* Room for two notes, the third one stays queued: */
+	midi_ostream_from_buffer(&stream, buffer, 8);
+	size_t n = midi_queue_encode(&queue, &stream);
+	bool ok = (n == 6 && queue.dropped == 1 &&
+		   queue.tail - queue.head == 1);
+
+	midi_ostream_from_buffer(&stream, buffer, sizeof(buffer));
+	n = midi_queue_encode(&queue, &stream);
+	ok = ok && (n == 3 && midi_queue_peek(&queue) == NULL);
+
+	printf("Unencodable message: %s\n", ok ? "OK" : "FAILED");
+	return ok;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* Keeps the queue full of distinct keys to measure lookup of pending values */
+static void benchmark(void)
+{
+	static struct midi_message messages[BENCHMARK_SIZE];
+	static struct midi_queue queue;
+	struct midi_message msg = CC(1, 1, 0);
+
+	midi_queue_init(&queue, messages, BENCHMARK_SIZE);
+
+	double begin = now_ms();
+	for (uint32_t i = 0; i < BENCHMARK_MESSAGES; i++) {
+		uint32_t k = random_value(BENCHMARK_SIZE + 16);
+		msg.channel = (uint8_t)(1 + k / 100);
+		msg.data.control_change.controller = (uint8_t)(1 + k % 100);
+		msg.data.control_change.value = (uint8_t)(i & 0x7f);
+
+		if (!midi_queue_push(&queue, &msg)) {
+			midi_queue_pop(&queue);
+			midi_queue_push(&queue, &msg);
+		}
+	}
+	double ms = now_ms() - begin;
+
+	printf("Benchmark: %.1f Mmsg/s (%zu-message queue, %zu coalesced)\n",
+	       BENCHMARK_MESSAGES / ms / 1e3, (size_t)BENCHMARK_SIZE,
+	       queue.coalesced);
+}
+
+int main(void)
+{
+	bool ok = true;
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		ok = run_test(&tests[i]) && ok;
+
+	ok = run_random() && ok;
+	ok = run_encode() && ok;
+	benchmark();
+
+	printf("%s\n", ok ? "Queue OK" : "Queue FAILED");
+	return ok ? 0 : 1;
+}
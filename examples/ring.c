@@ -0,0 +1,106 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/ring.h>
+#include "common.h"
+
+/* Small buffer to make messages wrap around its end: */
+#define DMA_BUFFER_SIZE		16
+
+static uint8_t dma_buffer[DMA_BUFFER_SIZE];
+static size_t dma_position;
+
+static const uint8_t input[] = {
+	0x91, 48, 64,		/* NOTE_ON: ch=2, note=48, velocity=64 */
+	49, 64,			/* Running status: note=49, velocity=64 */
+	0xfe,			/* Realtime message (Active Sensing) injected */
+	50, 64,			/* Running status: note=50, velocity=64 */
+	0x80, 48, 0,		/* NOTE_OFF: ch=1, note=48, velocity=0 */
+	0xf0, 0x19, 0x17, 0xf7,	/* SysEx: { 0x19, 0x17 } */
+	0xb0, 7, 100,		/* CONTROL_CHANGE: ch=1, controller=7 */
+	0xe0, 0x00, 0x40,	/* PITCH_BEND: ch=1, value=8192 */
+	0x81, 48, 0xf8, 64,	/* NOTE_OFF, realtime message (CLOCK) injected */
+};
+
+/* Simulates DMA transfer in circular mode followed by an interrupt: */
+static void dma_receive(struct midi_ring *ring, const uint8_t *data,
+			size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		dma_buffer[dma_position++] = data[i];
+		if (dma_position == DMA_BUFFER_SIZE)
+			dma_position = 0;
+	}
+
+	midi_ring_set_write(ring, dma_position);
+}
+
+static void print_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct midi_ring *ring = sink->param;
+
+	printf("[read=%2zu] ", ring->read);
+	print_msg(msg);
+}
+
+int main(void)
+{
+	struct midi_ring ring;
+	midi_ring_init(&ring, dma_buffer, sizeof(dma_buffer));
+
+	struct midi_istream istream;
+	memset(&istream, 0, sizeof(istream));
+
+	char sysex_buffer[32];
+	istream.sysex_buffer.data = sysex_buffer;
+	istream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	struct midi_sink sink = {
+		.message_cb = &print_message,
+		.param = &ring,
+	};
+
+	printf("Decoded messages (%d-byte circular buffer):\n",
+	       DMA_BUFFER_SIZE);
+
+	/* Receive data in chunks of different sizes: */
+	size_t pos = 0;
+	size_t chunk = 1;
+	while (pos < sizeof(input)) {
+		size_t n = sizeof(input) - pos;
+		if (n > chunk)
+			n = chunk;
+
+		dma_receive(&ring, &input[pos], n);
+		midi_decoder_feed_ring(&istream, &ring, &sink);
+
+		pos += n;
+		chunk = (chunk % 7) + 1;
+	}
+
+	if (midi_ring_available(&ring) != 0) {
+		printf("Data left in the buffer\n");
+		return 1;
+	}
+
+	return 0;
+}
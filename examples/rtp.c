@@ -0,0 +1,447 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <nanomidi/rtp.h>
+#include "common.h"
+
+#define NUM_PACKETS		5000
+#define MAX_COMMANDS		12
+#define LOSS_PERIOD		7	/* Every 7th packet is dropped */
+#define FEEDBACK_PERIOD		16	/* Receiver report every 16 packets */
+#define DATAGRAM_SIZE		1472
+#define LIST_SIZE		512
+#define BENCHMARK_MESSAGES	2000000
+#define CHANNELS		4
+
+/* Channel state as seen by the recovery journal */
+struct state {
+	uint8_t program[CHANNELS];
+	uint16_t pitch_bend[CHANNELS];
+	uint8_t pressure[CHANNELS];
+	uint8_t controllers[CHANNELS][128];
+	uint8_t velocities[CHANNELS][128]; /* Zero for notes off */
+};
+
+struct receiver {
+	struct midi_rtp_decoder decoder;
+	struct state state;
+	struct midi_message expected[NUM_PACKETS][MAX_COMMANDS];
+	size_t num_expected[NUM_PACKETS];
+	size_t num_received;
+	uint32_t lost;
+	size_t recovered;
+	size_t errors;
+};
+
+static struct receiver receiver;
+static struct state sender_state;
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static void apply(struct state *state, const struct midi_message *msg)
+{
+	int ch = msg->channel - 1;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		state->velocities[ch][msg->data.note_on.note] =
+			msg->data.note_on.velocity;
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		state->velocities[ch][msg->data.note_off.note] = 0;
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		state->controllers[ch][msg->data.control_change.controller] =
+			msg->data.control_change.value;
+		break;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		state->program[ch] = msg->data.program_change.program;
+		break;
+	case MIDI_TYPE_PITCH_BEND:
+		state->pitch_bend[ch] = msg->data.pitch_bend.value;
+		break;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		state->pressure[ch] = msg->data.channel_pressure.pressure;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Applies chapters P, C, W, N and T of the recovery journal */
+static void recover(struct state *state, const uint8_t *journal, size_t size)
+{
+	if (size < 3 || !(journal[0] & 0x20))
+		return;
+
+	const uint8_t *p = journal + 3;
+	const uint8_t *end = journal + size;
+	int num_channels = (journal[0] & 0x0f) + 1;
+
+	for (int i = 0; i < num_channels && p + 3 <= end; i++) {
+		int ch = (p[0] >> 3) & 0x0f;
+		size_t length = (size_t)(((p[0] & 0x03) << 8) | p[1]);
+		uint8_t chapters = p[2];
+		const uint8_t *next = p + length;
+		p += 3;
+
+		if (ch >= CHANNELS || next > end)
+			return;
+
+		if (chapters & MIDI_RTP_CHAPTER_P) {
+			state->program[ch] = p[0] & 0x7f;
+			p += 3;
+		}
+		if (chapters & MIDI_RTP_CHAPTER_C) {
+			int n = (p[0] & 0x7f) + 1;
+			for (p++; n > 0; n--, p += 2)
+				state->controllers[ch][p[0] & 0x7f] = p[1];
+		}
+		if (chapters & MIDI_RTP_CHAPTER_W) {
+			state->pitch_bend[ch] = (uint16_t)((p[0] & 0x7f) |
+							   (p[1] << 7));
+			p += 2;
+		}
+		if (chapters & MIDI_RTP_CHAPTER_N) {
+			int n = p[0] & 0x7f;
+			int low = p[1] >> 4;
+			int high = p[1] & 0x0f;
+			if (n == 127 && low == 15 && high == 0)
+				n = 128;
+			for (p += 2; n > 0; n--, p += 2) {
+				int note = p[0] & 0x7f;
+				state->velocities[ch][note] = p[1] & 0x7f;
+			}
+			for (int octet = low; octet <= high; octet++, p++) {
+				for (int bit = 0; bit < 8; bit++) {
+					if (p[0] & (0x80 >> bit))
+						state->velocities[ch][8*octet +
+								      bit] = 0;
+				}
+			}
+		}
+		if (chapters & MIDI_RTP_CHAPTER_T)
+			state->pressure[ch] = p[0] & 0x7f;
+
+		p = next;
+	}
+}
+
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[64];
+	uint8_t buffer_b[64];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+static void check_loss(struct receiver *r)
+{
+	if (r->decoder.lost == r->lost)
+		return;
+
+	r->lost = r->decoder.lost;
+	recover(&r->state, r->decoder.journal, r->decoder.journal_size);
+	r->recovered++;
+}
+
+static void receive_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct receiver *r = sink->param;
+	uint16_t seqnum = r->decoder.seqnum;
+
+	/* Journal codes the state before the first command of the packet: */
+	if (r->num_received == 0)
+		check_loss(r);
+
+	if (r->num_received >= r->num_expected[seqnum] ||
+	    !equal(msg, &r->expected[seqnum][r->num_received])) {
+		if (r->errors++ < 5) {
+			printf("Packet %u: unexpected message ", seqnum);
+			print_msg(msg);
+		}
+	}
+
+	r->num_received++;
+	apply(&r->state, msg);
+}
+
+static void random_message(struct midi_message *msg)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->channel = (uint8_t)(1 + random_value(CHANNELS));
+
+	uint32_t r = random_value(100);
+	if (r < 35) {
+		msg->type = MIDI_TYPE_NOTE_ON;
+		msg->data.note_on.note = (uint8_t)(36 + random_value(48));
+		msg->data.note_on.velocity = (uint8_t)random_value(128);
+	} else if (r < 55) {
+		msg->type = MIDI_TYPE_NOTE_OFF;
+		msg->data.note_off.note = (uint8_t)(36 + random_value(48));
+		msg->data.note_off.velocity = 64;
+	} else if (r < 80) {
+		msg->type = MIDI_TYPE_CONTROL_CHANGE;
+		msg->data.control_change.controller =
+			(uint8_t)random_value(120);
+		msg->data.control_change.value = (uint8_t)random_value(128);
+	} else if (r < 88) {
+		msg->type = MIDI_TYPE_PITCH_BEND;
+		msg->data.pitch_bend.value = (uint16_t)random_value(16384);
+	} else if (r < 92) {
+		msg->type = MIDI_TYPE_PROGRAM_CHANGE;
+		msg->data.program_change.program = (uint8_t)random_value(128);
+	} else if (r < 96) {
+		msg->type = MIDI_TYPE_CHANNEL_PRESSURE;
+		msg->data.channel_pressure.pressure =
+			(uint8_t)random_value(128);
+	} else {
+		msg->type = MIDI_TYPE_TIMING_CLOCK;
+		msg->channel = 0;
+	}
+}
+
+static size_t socket_write(struct midi_ostream *stream, const void *data,
+			   size_t size)
+{
+	uint8_t **p = stream->param;
+	memcpy(*p, data, size);
+	*p += size;
+	return size;
+}
+
+static size_t null_write(struct midi_ostream *stream, const void *data,
+			 size_t size)
+{
+	(void)stream;
+	(void)data;
+	return size;
+}
+
+static int open_socket(struct sockaddr_in *addr)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	socklen_t length = sizeof(*addr);
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *)addr, length) < 0 ||
+	    getsockname(fd, (struct sockaddr *)addr, &length) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Size of the journal following the MIDI command section */
+static size_t rtp_journal_size(const uint8_t *packet, size_t size)
+{
+	const uint8_t *header = &packet[MIDI_RTP_HEADER_SIZE];
+	size_t length = (header[0] & 0x0f);
+
+	if (header[0] & 0x80)
+		length = (length << 8 | header[1]) + 2;
+	else
+		length += 1;
+
+	return size - MIDI_RTP_HEADER_SIZE - length;
+}
+
+static bool states_equal(const struct state *a, const struct state *b)
+{
+	return memcmp(a, b, sizeof(struct state)) == 0;
+}
+
+static int loopback(void)
+{
+	struct sockaddr_in tx_addr, rx_addr;
+	int tx = open_socket(&tx_addr);
+	int rx = open_socket(&rx_addr);
+	if (tx < 0 || rx < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	static struct midi_rtp_journal journal;
+	static uint8_t list[LIST_SIZE];
+	struct midi_rtp_encoder encoder;
+	midi_rtp_journal_init(&journal);
+	midi_rtp_encoder_init(&encoder, list, sizeof(list), 0x12345678,
+			      &journal);
+
+	midi_rtp_decoder_init(&receiver.decoder);
+	struct midi_sink sink = {
+		.message_cb = &receive_message,
+		.param = &receiver,
+	};
+
+	uint32_t timestamp = 0;
+	size_t total_bytes = 0;
+	size_t journal_bytes = 0;
+	size_t max_journal = 0;
+
+	for (uint16_t seqnum = 0; seqnum < NUM_PACKETS; seqnum++) {
+		size_t n = 1 + random_value(MAX_COMMANDS);
+
+		for (size_t i = 0; i < n; i++) {
+			struct midi_message *msg;
+			msg = &receiver.expected[seqnum][i];
+			random_message(msg);
+
+			/* 44.1 kHz RTP clock, up to 50 ms between commands: */
+			timestamp += random_value(2205);
+			if (midi_rtp_encode(&encoder, msg, timestamp) == 0)
+				break;
+
+			apply(&sender_state, msg);
+			receiver.num_expected[seqnum]++;
+		}
+
+		uint8_t datagram[DATAGRAM_SIZE];
+		uint8_t *p = datagram;
+		struct midi_ostream stream = {
+			.write_cb = &socket_write,
+			.capacity = sizeof(datagram),
+			.param = &p,
+		};
+		size_t size = midi_rtp_flush(&encoder, &stream);
+		size_t journal_size = rtp_journal_size(datagram, size);
+
+		total_bytes += size;
+		journal_bytes += journal_size;
+		if (journal_size > max_journal)
+			max_journal = journal_size;
+
+		/* Drop some packets, but never the last one: */
+		if (seqnum % LOSS_PERIOD == 3 && seqnum != NUM_PACKETS - 1)
+			continue;
+
+		sendto(tx, datagram, size, 0, (struct sockaddr *)&rx_addr,
+		       sizeof(rx_addr));
+
+		ssize_t received = recv(rx, datagram, sizeof(datagram), 0);
+		if (received <= 0)
+			continue;
+
+		receiver.num_received = 0;
+		midi_rtp_decode(&receiver.decoder, datagram, (size_t)received,
+				&sink);
+		check_loss(&receiver);
+
+		if (receiver.num_received != receiver.num_expected[seqnum])
+			receiver.errors++;
+
+		/* Receiver report confirms the last packet received: */
+		if (seqnum % FEEDBACK_PERIOD == 0)
+			midi_rtp_journal_checkpoint(&journal,
+						    receiver.decoder.seqnum);
+	}
+
+	close(tx);
+	close(rx);
+
+	bool recovered = states_equal(&sender_state, &receiver.state);
+
+	printf("%u packets, %u lost, %zu recoveries, %zu bytes "
+	       "(journal %zu bytes, max %zu per packet)\n",
+	       receiver.decoder.received + receiver.decoder.lost,
+	       receiver.decoder.lost, receiver.recovered, total_bytes,
+	       journal_bytes, max_journal);
+	printf("Messages: %s, channel state after recovery: %s\n",
+	       (receiver.errors == 0) ? "OK" : "FAILED",
+	       recovered ? "OK" : "FAILED");
+
+	return (receiver.errors == 0 && recovered) ? 0 : 1;
+}
+
+static void benchmark(bool use_journal)
+{
+	static struct midi_rtp_journal journal;
+	static uint8_t list[LIST_SIZE];
+	static struct midi_message messages[1024];
+	struct midi_rtp_encoder encoder;
+
+	midi_rtp_journal_init(&journal);
+	midi_rtp_encoder_init(&encoder, list, sizeof(list), 1,
+			      use_journal ? &journal : NULL);
+
+	for (size_t i = 0; i < 1024; i++)
+		random_message(&messages[i]);
+
+	struct midi_ostream stream = {
+		.write_cb = &null_write,
+		.capacity = MIDI_STREAM_CAPACITY_UNLIMITED,
+	};
+
+	size_t num_packets = 0;
+	clock_t start = clock();
+
+	for (uint32_t i = 0; i < BENCHMARK_MESSAGES; i++) {
+		midi_rtp_encode(&encoder, &messages[i % 1024], i * 10);
+
+		/* Packet every 8 messages, checkpoint every 64 packets: */
+		if (i % 8 == 7) {
+			midi_rtp_flush(&encoder, &stream);
+			if (++num_packets % 64 == 0)
+				midi_rtp_journal_checkpoint(&journal,
+					(uint16_t)(encoder.seqnum - 1));
+		}
+	}
+
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("Encoding %s journal: %.2f M messages/s\n",
+	       use_journal ? "with" : "without",
+	       BENCHMARK_MESSAGES / seconds / 1e6);
+}
+
+int main(void)
+{
+	int ret = loopback();
+
+	benchmark(false);
+	benchmark(true);
+
+	return ret;
+}
@@ -0,0 +1,284 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/usb_scheduler.h>
+
+#define TICKS_PER_SECOND	1000000	/* Microseconds */
+#define FRAME_PERIOD		1000	/* Bulk frame every 1 ms */
+#define FRAME_SIZE		64	/* Full-speed bulk endpoint */
+#define DURATION		200	/* Frames */
+#define DUMP_SIZE		4096
+#define CLOCK_PERIOD		20833	/* 24 PPQN at 120 BPM */
+#define QUEUE_SIZE		256
+#define NAIVE_SIZE		2048	/* Packets */
+#define CABLES			4
+
+struct naive_packet {
+	uint8_t cable;
+	uint32_t time; /* Push time if the packet ends a message, else 0 */
+	bool last;
+};
+
+struct naive {
+	struct naive_packet packets[NAIVE_SIZE];
+	size_t head;
+	size_t tail;
+	uint32_t max_latency[CABLES];
+	uint64_t total_latency[CABLES];
+	uint32_t messages[CABLES];
+};
+
+static uint8_t sysex_data[DUMP_SIZE];
+
+static size_t frame_write(struct midi_ostream *stream, const void *data,
+			  size_t size)
+{
+	(void)stream;
+	(void)data;
+	return size;
+}
+
+static size_t count_write(struct midi_ostream *stream, const void *data,
+			  size_t size)
+{
+	(void)data;
+	size_t *num_packets = (size_t *)stream->param;
+	*num_packets += size / 4;
+	return size;
+}
+
+/* Whole-message FIFO: each message is fully encoded before the next one. */
+static void naive_push(struct naive *naive, uint8_t cable,
+		       const struct midi_message *msg, uint32_t now)
+{
+	size_t num_packets = 0;
+	struct midi_ostream stream = {
+		.write_cb = &count_write,
+		.capacity = MIDI_STREAM_CAPACITY_UNLIMITED,
+		.param = &num_packets,
+	};
+	midi_encode_usb(&stream, msg, cable);
+
+	for (size_t i = 0; i < num_packets; i++) {
+		struct naive_packet *p;
+		p = &naive->packets[naive->tail++ % NAIVE_SIZE];
+		p->cable = cable;
+		p->time = now;
+		p->last = (i == num_packets - 1);
+	}
+}
+
+static void naive_send(struct naive *naive, uint32_t now)
+{
+	for (int i = 0; i < FRAME_SIZE / 4 && naive->head != naive->tail; i++) {
+		struct naive_packet *p = &naive->packets[naive->head++ %
+							 NAIVE_SIZE];
+		if (!p->last)
+			continue;
+
+		uint32_t latency = now - p->time;
+		naive->messages[p->cable]++;
+		naive->total_latency[p->cable] += latency;
+		if (latency > naive->max_latency[p->cable])
+			naive->max_latency[p->cable] = latency;
+	}
+}
+
+static void push(struct midi_usb_scheduler *scheduler, struct naive *naive,
+		 uint8_t cable, const struct midi_message *msg, uint32_t now)
+{
+	midi_usb_scheduler_push(scheduler, cable, msg, now);
+	naive_push(naive, cable, msg, now);
+}
+
+struct capture {
+	uint8_t data[32];
+	size_t length;
+};
+
+static size_t capture_write(struct midi_ostream *stream, const void *data,
+			    size_t size)
+{
+	struct capture *capture = stream->param;
+
+	memcpy(&capture->data[capture->length], data, size);
+	capture->length += size;
+	return size;
+}
+
+/* Sustain pedal must stay around the note, with or without coalescing */
+static bool check_order(bool coalescing)
+{
+	static const uint8_t coalesced[] = {
+		0x0b, 0xb0, 64, 127,
+		0x09, 0x90, 60, 100,
+		0x0b, 0xb0, 64, 0,
+		0x0b, 0xb0, 7, 2,
+	};
+	static const uint8_t all[] = {
+		0x0b, 0xb0, 64, 127,
+		0x09, 0x90, 60, 100,
+		0x0b, 0xb0, 64, 0,
+		0x0b, 0xb0, 7, 1,
+		0x0b, 0xb0, 7, 2,
+	};
+	static const uint8_t values[][2] = {
+		{ 64, 127 }, { 0, 0 }, { 64, 0 }, { 7, 1 }, { 7, 2 },
+	};
+	struct midi_message messages[8];
+	uint32_t times[8];
+	struct midi_usb_port port;
+	struct midi_usb_scheduler scheduler;
+	struct midi_message msg = {
+		.type = MIDI_TYPE_CONTROL_CHANGE,
+		.channel = 1,
+	};
+	struct midi_message note = {
+		.type = MIDI_TYPE_NOTE_ON,
+		.channel = 1,
+		.data.note_on.note = 60,
+		.data.note_on.velocity = 100,
+	};
+
+	midi_usb_scheduler_init(&scheduler);
+	midi_usb_port_init(&port, messages, times, 8, 1);
+	port.queue.coalescing = coalescing;
+	midi_usb_scheduler_add_port(&scheduler, 0, &port);
+
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		msg.data.control_change.controller = values[i][0];
+		msg.data.control_change.value = values[i][1];
+		midi_usb_scheduler_push(&scheduler, 0,
+					(i == 1) ? &note : &msg, 0);
+	}
+
+	struct capture capture = { .length = 0 };
+	struct midi_ostream stream = {
+		.write_cb = &capture_write,
+		.capacity = sizeof(capture.data),
+		.param = &capture,
+	};
+	midi_usb_scheduler_encode(&scheduler, &stream, 0);
+
+	const uint8_t *expected = coalescing ? coalesced : all;
+	size_t length = coalescing ? sizeof(coalesced) : sizeof(all);
+	bool ok = (capture.length == length &&
+		   memcmp(capture.data, expected, length) == 0);
+
+	printf("Order with coalescing %s: %s\n", coalescing ? "on" : "off",
+	       ok ? "OK" : "FAILED");
+	return ok;
+}
+
+static void print_latency(const char *name, uint8_t cable, uint32_t messages,
+			  uint64_t total, uint32_t max)
+{
+	printf("%-9s cable %u: %5u messages, avg %6.2f ms, max %6.2f ms\n",
+	       name, cable, messages,
+	       (messages > 0) ? (double)total / messages / 1000.0 : 0.0,
+	       (double)max / 1000.0);
+}
+
+int main(void)
+{
+	static struct midi_message messages[CABLES][QUEUE_SIZE];
+	static uint32_t times[CABLES][QUEUE_SIZE];
+	static struct midi_usb_port ports[CABLES];
+	static struct naive naive;
+
+	struct midi_usb_scheduler scheduler;
+	midi_usb_scheduler_init(&scheduler);
+
+	for (uint8_t i = 0; i < CABLES; i++) {
+		midi_usb_port_init(&ports[i], messages[i], times[i],
+				   QUEUE_SIZE, 1);
+		midi_usb_scheduler_add_port(&scheduler, i, &ports[i]);
+	}
+
+	for (size_t i = 0; i < DUMP_SIZE; i++)
+		sysex_data[i] = (uint8_t)(i & 0x7f);
+
+	struct midi_message dump = {
+		.type = MIDI_TYPE_SYSEX,
+		.data.sysex.data = sysex_data,
+		.data.sysex.length = DUMP_SIZE,
+	};
+	struct midi_message clock = {
+		.type = MIDI_TYPE_TIMING_CLOCK,
+	};
+	struct midi_message note = {
+		.type = MIDI_TYPE_NOTE_ON,
+		.channel = 1,
+		.data.note_on.note = 60,
+		.data.note_on.velocity = 100,
+	};
+
+	struct midi_ostream stream = {
+		.write_cb = &frame_write,
+	};
+
+	uint32_t next_clock = 0;
+
+	for (uint32_t frame = 0; frame < DURATION; frame++) {
+		uint32_t t = frame * FRAME_PERIOD;
+
+		/* Input arriving during the millisecond: */
+		if (frame == 0)
+			push(&scheduler, &naive, 0, &dump, t);
+
+		if (t >= next_clock) {
+			push(&scheduler, &naive, 0, &clock, t);
+			next_clock += CLOCK_PERIOD;
+		}
+
+		for (uint8_t cable = 1; cable < CABLES; cable++) {
+			note.data.note_on.note = (uint8_t)(60 + frame % 12);
+			push(&scheduler, &naive, cable, &note,
+			     t + 250u * cable);
+		}
+
+		/* Bulk frame sent at the end of the millisecond: */
+		uint32_t now = t + FRAME_PERIOD;
+		stream.capacity = FRAME_SIZE;
+		midi_usb_scheduler_encode(&scheduler, &stream, now);
+		naive_send(&naive, now);
+	}
+
+	printf("%u ms, %d-byte frames every %u us, %u-byte SysEx on cable 0\n",
+	       DURATION, FRAME_SIZE, FRAME_PERIOD, DUMP_SIZE);
+
+	for (uint8_t cable = 0; cable < CABLES; cable++) {
+		print_latency("FIFO", cable, naive.messages[cable],
+			      naive.total_latency[cable],
+			      naive.max_latency[cable]);
+	}
+
+	for (uint8_t cable = 0; cable < CABLES; cable++) {
+		struct midi_usb_port *port = &ports[cable];
+		print_latency("Scheduler", cable, port->messages,
+			      port->total_latency, port->max_latency);
+	}
+
+	bool ok = check_order(true);
+	ok = check_order(false) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/sds.h>
+
+#define TICKS_PER_SECOND	1000000	/* Microseconds */
+#define STEP			100	/* Simulation step */
+#define LINK_SIZE		512	/* Bytes buffered or in transit */
+#define NUM_SAMPLES		12000
+
+/* Simulated unidirectional link with constant byte rate and latency: */
+struct link {
+	uint8_t data[LINK_SIZE];
+	uint32_t time[LINK_SIZE];
+	size_t head;
+	size_t tail;
+	uint64_t busy; /* Nanoseconds */
+	uint32_t byte_time; /* Nanoseconds */
+	uint32_t latency; /* Ticks */
+	uint32_t now;
+	size_t corrupt; /* Index of a byte to be corrupted (zero for none) */
+	size_t total;
+};
+
+struct endpoint {
+	struct midi_istream istream;
+	uint8_t sysex[256];
+	struct midi_sds_sender *sender;
+	struct midi_sds_receiver *receiver;
+	struct midi_ostream *reply;
+	uint32_t now;
+};
+
+struct scenario {
+	const char *name;
+	uint32_t byte_time;
+	uint32_t latency;
+	uint8_t window;
+	bool open_loop;
+	size_t corrupt;
+};
+
+static int16_t samples[NUM_SAMPLES];
+static int16_t received[NUM_SAMPLES];
+
+static size_t link_write(struct midi_ostream *stream, const void *data,
+			 size_t size)
+{
+	struct link *link = stream->param;
+	const uint8_t *bytes = data;
+
+	for (size_t i = 0; i < size; i++) {
+		uint64_t now = (uint64_t)link->now * 1000;
+		if (link->busy < now)
+			link->busy = now;
+		link->busy += link->byte_time;
+
+		size_t pos = link->tail % LINK_SIZE;
+		link->data[pos] = bytes[i];
+		link->time[pos] = (uint32_t)(link->busy / 1000) + link->latency;
+		if (++link->total == link->corrupt)
+			link->data[pos] ^= 0x01;
+		link->tail++;
+	}
+
+	return size;
+}
+
+static void link_stream(struct midi_ostream *stream, struct link *link)
+{
+	stream->write_cb = &link_write;
+	stream->capacity = LINK_SIZE - (link->tail - link->head);
+	stream->param = link;
+}
+
+static void message_received(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct endpoint *ep = sink->param;
+
+	if (ep->sender)
+		midi_sds_sender_receive(ep->sender, msg, ep->now);
+	if (ep->receiver)
+		midi_sds_receive(ep->receiver, msg, ep->reply);
+}
+
+static void link_deliver(struct link *link, struct endpoint *ep)
+{
+	struct midi_sink sink = {
+		.message_cb = &message_received,
+		.param = ep,
+	};
+
+	while (link->head != link->tail &&
+	       (int32_t)(link->time[link->head % LINK_SIZE] - link->now) <= 0) {
+		uint8_t c = link->data[link->head % LINK_SIZE];
+		link->head++;
+		midi_decoder_feed(&ep->istream, &c, 1, &sink);
+	}
+}
+
+static void endpoint_init(struct endpoint *ep)
+{
+	memset(ep, 0, sizeof(*ep));
+	ep->istream.sysex_buffer.data = ep->sysex;
+	ep->istream.sysex_buffer.size = sizeof(ep->sysex);
+}
+
+static void run(const struct scenario *s)
+{
+	static struct link down;
+	static struct link up;
+	memset(&down, 0, sizeof(down));
+	memset(&up, 0, sizeof(up));
+	down.byte_time = up.byte_time = s->byte_time;
+	down.latency = up.latency = s->latency;
+	down.corrupt = s->corrupt;
+
+	struct midi_sds_header header = {
+		.sample_number = 1,
+		.bits = 16,
+		.period = 1000000000 / 44100,
+		.length = NUM_SAMPLES,
+		.loop_type = MIDI_SDS_LOOP_OFF,
+	};
+
+	struct midi_sds_sender sender;
+	midi_sds_sender_init(&sender, 0, &header, samples, TICKS_PER_SECOND);
+	sender.window = s->window;
+	/* Timeout runs from encoding, add transmission time of a packet: */
+	sender.timeout += (uint32_t)((uint64_t)127 * s->byte_time / 1000);
+	sender.open_loop = s->open_loop;
+
+	struct midi_sds_receiver receiver;
+	memset(received, 0, sizeof(received));
+	midi_sds_receiver_init(&receiver, 0, received, NUM_SAMPLES);
+
+	struct midi_ostream down_stream;
+	struct midi_ostream up_stream;
+
+	struct endpoint tx, rx;
+	endpoint_init(&tx);
+	endpoint_init(&rx);
+	tx.sender = &sender;
+	rx.receiver = &receiver;
+	rx.reply = &up_stream;
+
+	uint32_t now;
+	for (now = 0; now < 600 * TICKS_PER_SECOND; now += STEP) {
+		down.now = up.now = tx.now = rx.now = now;
+
+		link_stream(&up_stream, &up);
+		link_deliver(&down, &rx);
+		link_deliver(&up, &tx);
+
+		link_stream(&down_stream, &down);
+		midi_sds_send(&sender, &down_stream, now);
+
+		if (receiver.state == MIDI_SDS_DONE ||
+		    receiver.state == MIDI_SDS_CANCELLED)
+			break;
+	}
+
+	double seconds = (double)now / TICKS_PER_SECOND;
+	bool ok = (receiver.state == MIDI_SDS_DONE &&
+		   memcmp(samples, received, sizeof(samples)) == 0);
+
+	printf("%-28s %6.2f s, %6.0f sample bytes/s, %u bytes sent, "
+	       "%u resent, %u errors, %s\n", s->name, seconds,
+	       (double)sizeof(samples) / seconds, (unsigned int)down.total,
+	       (unsigned int)sender.resent, (unsigned int)receiver.errors,
+	       ok ? "OK" : "FAILED");
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < NUM_SAMPLES; i++)
+		samples[i] = (int16_t)((i * 7919) % 65536 - 32768);
+
+	/* DIN: 10 bits per byte at 31250 baud, USB full speed: one 64-byte
+	 * bulk packet (16 USB-MIDI events, 48 SysEx bytes) per 1 ms frame: */
+	const struct scenario scenarios[] = {
+		{ "DIN, stop-and-wait", 320000, 0, 1, false, 0 },
+		{ "DIN, window 4", 320000, 0, 4, false, 0 },
+		{ "DIN, open loop", 320000, 0, 1, true, 0 },
+		{ "DIN, window 4, bit error", 320000, 0, 4, false, 20000 },
+		{ "USB, stop-and-wait", 20833, 1000, 1, false, 0 },
+		{ "USB, window 4", 20833, 1000, 4, false, 0 },
+		{ "USB, open loop", 20833, 1000, 1, true, 0 },
+		{ "USB, window 4, bit error", 20833, 1000, 4, false, 20000 },
+	};
+
+	for (size_t i = 0; i < sizeof(scenarios)/sizeof(*scenarios); i++)
+		run(&scenarios[i]);
+
+	return 0;
+}
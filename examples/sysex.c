@@ -0,0 +1,119 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <nanomidi/sysex.h>
+
+#define ITERATIONS	1000000
+
+#define SYSEX(bytes)	{ .type = MIDI_TYPE_SYSEX, \
+			  .data.sysex.data = bytes, \
+			  .data.sysex.length = sizeof(bytes) }
+
+static unsigned int counts[4];
+
+static void identity_reply(const struct midi_sysex_header *header,
+			   void *param)
+{
+	(void)param;
+	struct midi_sysex_identity id;
+	if (midi_sysex_decode_identity(&id, header)) {
+		printf("Identity Reply: manufacturer %06x, family %04x, "
+		       "model %04x, version %d.%d.%d.%d\n",
+		       (unsigned int)id.manufacturer, id.family, id.model,
+		       id.version[0], id.version[1], id.version[2],
+		       id.version[3]);
+	}
+}
+
+static void count_message(const struct midi_sysex_header *header,
+			  void *param)
+{
+	(void)header;
+	unsigned int *count = param;
+	(*count)++;
+}
+
+int main(void)
+{
+	/* Sorted by manufacturer ID: */
+	static const struct midi_sysex_route routes[] = {
+		{ MIDI_SYSEX_ID_EXTENDED(0x20, 0x29), MIDI_SYSEX_ANY,
+		  MIDI_SYSEX_ANY, &count_message, &counts[0] },
+		{ MIDI_SYSEX_ID(0x41), MIDI_SYSEX_ANY, MIDI_SYSEX_ANY,
+		  &count_message, &counts[1] },
+		{ MIDI_SYSEX_ID_NON_REALTIME, MIDI_SYSEX_GENERAL_INFO,
+		  MIDI_SYSEX_IDENTITY_REPLY, &identity_reply, NULL },
+		{ MIDI_SYSEX_ID_REALTIME, 0x01, MIDI_SYSEX_ANY,
+		  &count_message, &counts[2] },
+		{ MIDI_SYSEX_ID_REALTIME, MIDI_SYSEX_ANY, MIDI_SYSEX_ANY,
+		  &count_message, &counts[3] },
+	};
+
+	struct midi_sysex_dispatcher dispatcher;
+	midi_sysex_dispatcher_init(&dispatcher, routes,
+				   sizeof(routes)/sizeof(*routes));
+	dispatcher.device = 0x10;
+
+	/* Identity Reply from Roland (41) family 0x0123, model 0x0045: */
+	static const uint8_t reply[] = { 0x7e, 0x10, 0x06, 0x02, 0x41,
+					 0x23, 0x02, 0x45, 0x00,
+					 0x01, 0x00, 0x02, 0x00 };
+	/* Roland DT1 (data set): */
+	static const uint8_t roland[] = { 0x41, 0x10, 0x42, 0x12, 0x40, 0x00,
+					  0x7f, 0x00, 0x41 };
+	/* Novation (00 20 29): */
+	static const uint8_t novation[] = { 0x00, 0x20, 0x29, 0x02, 0x0c };
+	/* MTC full frame to all devices: */
+	static const uint8_t mtc[] = { 0x7f, 0x7f, 0x01, 0x01, 0x21, 0x02,
+				       0x03, 0x04 };
+	/* Master volume addressed to another device: */
+	static const uint8_t volume[] = { 0x7f, 0x20, 0x04, 0x01, 0x00, 0x7f };
+
+	struct midi_message msgs[] = {
+		SYSEX(reply), SYSEX(roland), SYSEX(novation), SYSEX(mtc),
+		SYSEX(volume),
+	};
+	size_t num_msgs = sizeof(msgs)/sizeof(*msgs);
+
+	for (size_t i = 0; i < num_msgs; i++) {
+		struct midi_sysex_header header;
+		midi_sysex_parse(&header, msgs[i].data.sysex.data,
+				 msgs[i].data.sysex.length);
+		printf("ID %06x, device %02x, sub-IDs %02x %02x, "
+		       "%u payload bytes: %s\n", (unsigned int)header.id,
+		       header.device, header.sub_id1, header.sub_id2,
+		       (unsigned int)header.length,
+		       midi_sysex_dispatch(&dispatcher, &msgs[i]) ?
+		       "handled" : "ignored");
+	}
+
+	/* Classification throughput (without the Identity Reply): */
+	clock_t begin = clock();
+	for (unsigned int i = 0; i < ITERATIONS; i++)
+		midi_sysex_dispatch(&dispatcher, &msgs[1 + i % (num_msgs-1)]);
+	double elapsed = (double)(clock() - begin) / CLOCKS_PER_SEC;
+
+	printf("Counts: Novation %u, Roland %u, MTC %u, other realtime %u\n",
+	       counts[0], counts[1], counts[2], counts[3]);
+	printf("%.1f ns per message\n", elapsed * 1e9 / ITERATIONS);
+
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/sysex_pool.h>
+
+#define NUM_MESSAGES		100000
+#define MAX_LENGTH		40
+#define QUEUE_SIZE		8
+#define NUM_BLOCKS		32
+#define BLOCK_SIZE		16
+
+struct pool_storage {
+	uint8_t data[NUM_BLOCKS * BLOCK_SIZE];
+	uint16_t next[NUM_BLOCKS];
+	uint32_t free_map[MIDI_SYSEX_POOL_MAP_SIZE(NUM_BLOCKS)];
+};
+
+/* Single-producer single-consumer queue of decoded messages */
+struct handoff {
+	struct midi_message messages[QUEUE_SIZE];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t done;
+};
+
+static struct pool_storage storage;
+static struct midi_sysex_pool pool;
+static struct handoff handoff;
+
+/* Decodes a SysEx message into the pool, returns NULL if it was dropped */
+static struct midi_message *decode(struct midi_istream *stream,
+				   const uint8_t *data, size_t length)
+{
+	struct midi_message *msg = midi_decode_byte(stream, 0xf0);
+	for (size_t i = 0; i < length; i++)
+		msg = midi_decode_byte(stream, data[i]);
+	msg = midi_decode_byte(stream, 0xf7);
+
+	return (msg != NULL && msg->data.sysex.data != NULL) ? msg : NULL;
+}
+
+static bool check(const struct midi_message *msg, const uint8_t *data,
+		  size_t length)
+{
+	return (msg->data.sysex.length == length &&
+		memcmp(msg->data.sysex.data, data, length) == 0);
+}
+
+static void init(struct midi_istream *stream, uint16_t num_blocks,
+		 size_t block_size)
+{
+	midi_sysex_pool_init(&pool, storage.data, block_size, num_blocks,
+			     storage.next, storage.free_map);
+	memset(stream, 0, sizeof(*stream));
+	stream->sysex_pool = &pool;
+}
+
+/* A long message never spans blocks of other live messages */
+static bool test_fragmented(void)
+{
+	static const uint8_t a[4] = { 1, 1, 1, 1 };
+	static const uint8_t b[4] = { 2, 2, 2, 2 };
+	static const uint8_t c[4] = { 3, 3, 3, 3 };
+	static const uint8_t d[4] = { 9, 9, 9, 9 };
+	static const uint8_t e[8] = { 0x10, 0x11, 0x12, 0x13,
+				      0x14, 0x15, 0x16, 0x17 };
+	struct midi_istream stream;
+	struct midi_message *msg;
+	const void *pa, *pb, *pc, *pd;
+
+	init(&stream, 4, 4);
+	pa = decode(&stream, a, sizeof(a))->data.sysex.data;
+	pb = decode(&stream, b, sizeof(b))->data.sysex.data;
+	pc = decode(&stream, c, sizeof(c))->data.sysex.data;
+	pd = decode(&stream, d, sizeof(d))->data.sysex.data;
+
+	/* Free blocks 0 and 2, there is no run of two free blocks: */
+	midi_sysex_pool_release(&pool, pa);
+	midi_sysex_pool_release(&pool, pc);
+	if (decode(&stream, e, sizeof(e)) != NULL || pool.exhausted != 1 ||
+	    pool.num_free != 2) {
+		printf("Fragmented pool: message not dropped\n");
+		return false;
+	}
+
+	/* Free block 1 as well, blocks 0 and 1 form a run: */
+	midi_sysex_pool_release(&pool, pb);
+	msg = decode(&stream, e, sizeof(e));
+	if (msg == NULL || !check(msg, e, sizeof(e)) ||
+	    memcmp(pd, d, sizeof(d)) != 0) {
+		printf("Fragmented pool: corrupted message\n");
+		return false;
+	}
+
+	midi_sysex_pool_release(&pool, msg->data.sysex.data);
+	midi_sysex_pool_release(&pool, pd);
+	printf("Fragmented pool: exhausted %u, free %u\n",
+	       (unsigned int)pool.exhausted, pool.num_free);
+	return (pool.num_free == 4);
+}
+
+/* A message growing into a used block is moved to a longer run */
+static bool test_relocation(void)
+{
+	static const uint8_t x[4] = { 1, 2, 3, 4 };
+	static const uint8_t y[4] = { 5, 6, 7, 8 };
+	uint8_t z[13];
+	struct midi_istream stream;
+	struct midi_message *msg;
+
+	for (size_t i = 0; i < sizeof(z); i++)
+		z[i] = (uint8_t)(0x20 + i);
+
+	init(&stream, 8, 4);
+	const void *px = decode(&stream, x, sizeof(x))->data.sysex.data;
+	const void *py = decode(&stream, y, sizeof(y))->data.sysex.data;
+	midi_sysex_pool_release(&pool, px);
+
+	/* Starts in block 0, block 1 is used so it moves to blocks 2-5: */
+	msg = decode(&stream, z, sizeof(z));
+	if (msg == NULL || !check(msg, z, sizeof(z)) ||
+	    memcmp(py, y, sizeof(y)) != 0 ||
+	    msg->data.sysex.data != &storage.data[2 * 4]) {
+		printf("Relocation: corrupted message\n");
+		return false;
+	}
+
+	/* The chain covers all blocks of the message: */
+	size_t num_blocks = 0;
+	const void *block = msg->data.sysex.data;
+	for (; block != NULL; block = midi_sysex_pool_next(&pool, block))
+		num_blocks++;
+
+	midi_sysex_pool_release(&pool, msg->data.sysex.data);
+	midi_sysex_pool_release(&pool, py);
+	printf("Relocation: %zu blocks, free %u\n", num_blocks, pool.num_free);
+	return (num_blocks == 4 && pool.num_free == 8);
+}
+
+/* The first two bytes carry the sequence number, the rest is derived */
+static size_t message_data(uint8_t *data, uint32_t id)
+{
+	size_t length = 2 + (id * 2654435761u >> 16) % (MAX_LENGTH - 1);
+
+	data[0] = (uint8_t)(id >> 7);
+	data[1] = (uint8_t)(id & 0x7f);
+	for (size_t i = 2; i < length; i++)
+		data[i] = (uint8_t)((id * 7 + i) & 0x7f);
+
+	return length;
+}
+
+/* Checks and releases messages decoded by the other thread */
+static void *consumer(void *param)
+{
+	size_t *errors = param;
+	uint8_t data[MAX_LENGTH + 1];
+
+	for (;;) {
+		uint32_t tail = handoff.tail;
+		bool done = __atomic_load_n(&handoff.done, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&handoff.head, __ATOMIC_ACQUIRE) == tail) {
+			if (done)
+				break;
+			sched_yield();
+			continue;
+		}
+
+		struct midi_message *msg = &handoff.messages[tail % QUEUE_SIZE];
+		const uint8_t *sysex = msg->data.sysex.data;
+		uint32_t id = (uint32_t)(sysex[0] << 7 | sysex[1]);
+		size_t length = message_data(data, id);
+		if (!check(msg, data, length))
+			(*errors)++;
+
+		midi_sysex_pool_release(&pool, sysex);
+		__atomic_store_n(&handoff.tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/* Decodes messages in this thread and releases them in another one */
+static bool test_threads(void)
+{
+	struct midi_istream stream;
+	uint8_t data[MAX_LENGTH + 1];
+	size_t errors = 0;
+	size_t delivered = 0;
+	pthread_t thread;
+
+	init(&stream, NUM_BLOCKS, BLOCK_SIZE);
+	pthread_create(&thread, NULL, &consumer, &errors);
+
+	for (uint32_t n = 0; n < NUM_MESSAGES; n++) {
+		size_t length = message_data(data, n & 0x3fff);
+		struct midi_message *msg = decode(&stream, data, length);
+		if (msg == NULL)
+			continue;
+
+		/* Wait for space in the queue: */
+		uint32_t head = handoff.head;
+		while (head - __atomic_load_n(&handoff.tail,
+					      __ATOMIC_ACQUIRE) >= QUEUE_SIZE)
+			sched_yield();
+
+		handoff.messages[head % QUEUE_SIZE] = *msg;
+		__atomic_store_n(&handoff.head, head + 1, __ATOMIC_RELEASE);
+		delivered++;
+	}
+
+	__atomic_store_n(&handoff.done, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+
+	printf("Threads: %zu delivered, %u exhausted, min free %u, "
+	       "%zu errors, free %u\n", delivered,
+	       (unsigned int)pool.exhausted, pool.min_free, errors,
+	       pool.num_free);
+	return (errors == 0 && pool.num_free == NUM_BLOCKS &&
+		delivered + pool.exhausted == NUM_MESSAGES);
+}
+
+int main(void)
+{
+	bool ok = test_fragmented();
+	ok = test_relocation() && ok;
+	ok = test_threads() && ok;
+
+	printf("%s\n", ok ? "SysEx pool OK" : "SysEx pool FAILED");
+	return ok ? 0 : 1;
+}
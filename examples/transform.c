@@ -0,0 +1,183 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <nanomidi/encoder.h>
+#include <nanomidi/transform.h>
+#include "common.h"
+
+#define BENCHMARK_SIZE		1024
+#define BENCHMARK_ROUNDS	10000
+
+#define NOTE_ON(ch, n, v)	{ .type = MIDI_TYPE_NOTE_ON, .channel = (ch), \
+				  .data.note_on = { (n), (v) } }
+#define NOTE_OFF(ch, n)		{ .type = MIDI_TYPE_NOTE_OFF, \
+				  .channel = (ch), .data.note_off = { (n), 0 } }
+#define CC(ch, c, v)		{ .type = MIDI_TYPE_CONTROL_CHANGE, \
+				  .channel = (ch), \
+				  .data.control_change = { (c), (v) } }
+#define CLOCK			{ .type = MIDI_TYPE_TIMING_CLOCK }
+
+/* Channel 1 is split at C4, channel 3 is muted, channel 4 goes to 5 and its
+ * top notes are transposed without choosing a channel: */
+static const struct midi_transform_split splits[] = {
+	{ .channel = 1, .low = 0, .high = 59, .out_channel = 2,
+	  .transpose = -12 },
+	{ .channel = 1, .low = 60, .high = 127, .out_channel = 1,
+	  .transpose = 24 },
+	{ .channel = 4, .low = 100, .high = 127, .transpose = -12 },
+};
+
+static uint8_t half_curve[128];
+static uint8_t inverted_curve[128];
+
+static struct midi_message input[] = {
+	NOTE_ON(1, 48, 100),	/* Lower part: ch=2, note=36 */
+	NOTE_ON(1, 72, 100),	/* Upper part: ch=1, note=96 */
+	NOTE_ON(1, 110, 100),	/* Transposed out of range: dropped */
+	NOTE_ON(3, 60, 100),	/* Muted: dropped */
+	CLOCK,			/* System messages are kept */
+	NOTE_ON(2, 60, 1),	/* Half curve: velocity 0 clamped to 1 */
+	NOTE_ON(2, 60, 0),	/* Note Off as Note On stays Note Off */
+	NOTE_ON(4, 60, 0),	/* Inverted curve: still Note Off */
+	NOTE_ON(4, 60, 127),	/* Inverted curve: velocity 0 clamped to 1 */
+	CC(4, 7, 100),		/* Remapped: ch=5 */
+	NOTE_ON(4, 100, 27),	/* Split without channel: ch=5, note=88 */
+	NOTE_OFF(1, 48),	/* Follows the Note On: ch=2, note=36 */
+};
+
+static const struct midi_message output[] = {
+	NOTE_ON(2, 36, 100),
+	NOTE_ON(1, 96, 100),
+	CLOCK,
+	NOTE_ON(2, 60, 1),
+	NOTE_ON(2, 60, 0),
+	NOTE_ON(5, 60, 0),
+	NOTE_ON(5, 60, 1),
+	CC(5, 7, 100),
+	NOTE_ON(5, 88, 100),
+	NOTE_OFF(2, 36),
+};
+
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[3];
+	uint8_t buffer_b[3];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+/* No curve may turn Note On into Note Off or the other way around */
+static bool check_velocity(const struct midi_transform_table *table)
+{
+	for (size_t ch = 0; ch < 16; ch++) {
+		if (table->velocity[ch][0] != 0)
+			return false;
+
+		for (size_t i = 1; i < 128; i++) {
+			if (table->velocity[ch][i] == 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void benchmark(const struct midi_transform *transform)
+{
+	static struct midi_message messages[BENCHMARK_SIZE];
+	static struct midi_message source[BENCHMARK_SIZE];
+	size_t kept = 0;
+
+	for (size_t i = 0; i < BENCHMARK_SIZE; i++)
+		source[i] = input[i % (sizeof(input) / sizeof(input[0]))];
+
+	double begin = now_ms();
+	for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+		memcpy(messages, source, sizeof(messages));
+		kept += midi_transform_apply_all(transform, messages,
+						 BENCHMARK_SIZE);
+	}
+	double ms = now_ms() - begin;
+
+	printf("Benchmark: %.1f Mmsg/s (%zu kept)\n",
+	       (double)BENCHMARK_SIZE * BENCHMARK_ROUNDS / ms / 1e3, kept);
+}
+
+int main(void)
+{
+	static struct midi_transform_table table;
+	struct midi_transform_rules rules;
+	struct midi_transform transform;
+
+	for (size_t i = 0; i < 128; i++) {
+		half_curve[i] = (uint8_t)(i / 2);
+		inverted_curve[i] = (uint8_t)(127 - i);
+	}
+
+	memset(&rules, 0, sizeof(rules));
+	rules.channels[3] = 5;
+	rules.mute = 1 << 2;
+	rules.splits = splits;
+	rules.num_splits = sizeof(splits) / sizeof(splits[0]);
+	rules.velocity[1] = half_curve;
+	rules.velocity[3] = inverted_curve;
+
+	midi_transform_compile(&table, &rules);
+	midi_transform_init(&transform, &table);
+
+	bool ok = check_velocity(&table);
+	printf("Velocity tables: %s\n", ok ? "OK" : "FAILED");
+
+	size_t n = midi_transform_apply_all(&transform, input,
+					    sizeof(input) / sizeof(input[0]));
+	bool ok_output = (n == sizeof(output) / sizeof(output[0]));
+	for (size_t i = 0; i < n; i++) {
+		print_msg(&input[i]);
+		if (ok_output && !equal(&input[i], &output[i]))
+			ok_output = false;
+	}
+
+	printf("Transformed messages: %s\n", ok_output ? "OK" : "FAILED");
+	ok = ok && ok_output;
+
+	benchmark(&transform);
+
+	printf("%s\n", ok ? "Transform OK" : "Transform FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/ump.h>
+#include "common.h"
+
+#define NUM_MESSAGES		100000
+#define MAX_SYSEX		40
+#define STREAM_SIZE		(NUM_MESSAGES * 8)
+#define GROUP			5
+#define ROUNDS			10
+
+static uint8_t input[STREAM_SIZE];
+static uint8_t ump[2 * STREAM_SIZE];
+static uint8_t ump_small[2 * STREAM_SIZE];
+static uint8_t output[STREAM_SIZE];
+
+/* Injected Timing Clock messages come on top of NUM_MESSAGES: */
+static struct midi_message messages[2 * NUM_MESSAGES];
+static uint8_t sysex_data[NUM_MESSAGES * MAX_SYSEX];
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* Occasionally injects a System Real Time message (Timing Clock) */
+static size_t put(uint8_t *stream, size_t n, uint8_t c)
+{
+	if (random_value(50) == 0)
+		stream[n++] = MIDI_TYPE_TIMING_CLOCK;
+
+	stream[n++] = c;
+	return n;
+}
+
+/* Generates a byte stream using running status where possible */
+static size_t generate(void)
+{
+	static const uint8_t statuses[] = {
+		0x80, 0x90, 0x90, 0x90, 0xa0, 0xb0, 0xb0, 0xc0, 0xd0, 0xe0,
+	};
+	uint8_t running_status = 0;
+	size_t n = 0;
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		uint32_t r = random_value(100);
+
+		if (r < 5) {
+			size_t length = random_value(MAX_SYSEX + 1);
+			n = put(input, n, MIDI_TYPE_SYSEX);
+			for (size_t j = 0; j < length; j++)
+				n = put(input, n, (uint8_t)random_value(128));
+			n = put(input, n, 0xf7);
+			running_status = 0;
+		} else if (r < 7) {
+			n = put(input, n, 0xf2); /* Song Position Pointer */
+			n = put(input, n, (uint8_t)random_value(128));
+			n = put(input, n, (uint8_t)random_value(128));
+			running_status = 0;
+		} else {
+			/* Mostly notes on a few channels: */
+			uint8_t status = statuses[random_value(
+						sizeof(statuses))];
+			status = (uint8_t)(status | random_value(3));
+			size_t length = (status < 0xc0 || status >= 0xe0) ? 2 :
+									 1;
+
+			if (status != running_status)
+				n = put(input, n, status);
+			for (size_t j = 0; j < length; j++)
+				n = put(input, n, (uint8_t)random_value(128));
+			running_status = status;
+		}
+	}
+
+	return n;
+}
+
+/* Decodes all messages in the stream, copying SysEx data aside */
+static size_t decode_all(const uint8_t *stream, size_t length,
+			 struct midi_message *msgs)
+{
+	struct midi_istream istream;
+	uint8_t sysex_buffer[MAX_SYSEX];
+	uint8_t *sysex = sysex_data;
+	size_t n = 0;
+
+	memset(&istream, 0, sizeof(istream));
+	istream.sysex_buffer.data = sysex_buffer;
+	istream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	for (size_t i = 0; i < length; i++) {
+		struct midi_message *msg;
+		msg = midi_decode_byte(&istream, stream[i]);
+		if (msg == NULL)
+			continue;
+
+		if (msgs == NULL) {
+			n++;
+			continue;
+		}
+
+		msgs[n] = *msg;
+		if (msg->type == MIDI_TYPE_SYSEX) {
+			memcpy(sysex, msg->data.sysex.data,
+			       msg->data.sysex.length);
+			msgs[n].data.sysex.data = sysex;
+			sysex += msg->data.sysex.length;
+		}
+		n++;
+	}
+
+	return n;
+}
+
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[MAX_SYSEX + 2];
+	uint8_t buffer_b[MAX_SYSEX + 2];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+/* Translates the input in chunks of random size as if read from a port */
+static size_t to_ump(size_t length)
+{
+	struct midi_ump_port port;
+	struct midi_ostream ostream;
+	size_t n = 0;
+
+	midi_ump_port_init(&port, GROUP);
+	midi_ostream_from_buffer(&ostream, ump, sizeof(ump));
+
+	for (size_t pos = 0; pos < length; ) {
+		size_t chunk = 1 + random_value(64);
+		if (chunk > length - pos)
+			chunk = length - pos;
+
+		struct midi_istream istream;
+		midi_istream_from_buffer(&istream, &input[pos], chunk);
+		n += midi_bytes_to_ump(&port, &istream, &ostream);
+		pos += chunk;
+	}
+
+	return n;
+}
+
+/* Translates the input through a small output buffer drained after each call */
+static bool to_small_ump(size_t length, size_t ump_length)
+{
+	struct midi_ump_port port;
+	struct midi_istream istream;
+	size_t n = 0;
+
+	midi_ump_port_init(&port, GROUP);
+	midi_istream_from_buffer(&istream, input, length);
+
+	while (istream.capacity > 0) {
+		uint8_t buffer[64];
+		size_t size = 12 + random_value(sizeof(buffer) - 11);
+		struct midi_ostream ostream;
+		size_t capacity = istream.capacity;
+
+		midi_ostream_from_buffer(&ostream, buffer, size);
+		size_t written = midi_bytes_to_ump(&port, &istream, &ostream);
+		if (istream.capacity == capacity)
+			return false;
+
+		memcpy(&ump_small[n], buffer, written);
+		n += written;
+	}
+
+	return (n == ump_length && memcmp(ump, ump_small, n) == 0);
+}
+
+static size_t to_bytes(size_t length)
+{
+	struct midi_ostream ostream;
+	struct midi_ostream *ports[MIDI_UMP_GROUPS] = { NULL };
+	struct midi_istream istream;
+
+	midi_ostream_from_buffer(&ostream, output, sizeof(output));
+	ports[GROUP] = &ostream;
+	midi_istream_from_buffer(&istream, ump, length);
+
+	return midi_ump_to_bytes(&istream, ports);
+}
+
+int main(void)
+{
+	size_t input_length = generate();
+	size_t num_input = decode_all(input, input_length, messages);
+
+	size_t ump_length = to_ump(input_length);
+	size_t output_length = to_bytes(ump_length);
+
+	/* Compare messages decoded from the output with the input ones: */
+	struct midi_istream istream;
+	uint8_t sysex_buffer[MAX_SYSEX];
+	size_t num_output = 0;
+	bool ok = true;
+
+	memset(&istream, 0, sizeof(istream));
+	istream.sysex_buffer.data = sysex_buffer;
+	istream.sysex_buffer.size = sizeof(sysex_buffer);
+
+	for (size_t i = 0; ok && i < output_length; i++) {
+		struct midi_message *msg;
+		msg = midi_decode_byte(&istream, output[i]);
+		if (msg == NULL)
+			continue;
+
+		if (num_output >= num_input ||
+		    !equal(msg, &messages[num_output])) {
+			printf("Mismatch at message %zu:\n", num_output);
+			print_msg(msg);
+			ok = false;
+		}
+		num_output++;
+	}
+
+	ok = ok && (num_output == num_input);
+	printf("%zu bytes -> %zu UMP bytes -> %zu bytes, %zu messages\n",
+	       input_length, ump_length, output_length, num_output);
+
+	bool small_ok = to_small_ump(input_length, ump_length);
+	printf("Small UMP output buffer: %s\n", small_ok ? "OK" : "FAILED");
+	ok = ok && small_ok;
+
+	/* Translator throughput compared with the raw decoder: */
+	double begin = now_ms();
+	for (int i = 0; i < ROUNDS; i++)
+		decode_all(input, input_length, NULL);
+	double decode_ms = now_ms() - begin;
+
+	begin = now_ms();
+	for (int i = 0; i < ROUNDS; i++)
+		to_ump(input_length);
+	double to_ump_ms = now_ms() - begin;
+
+	begin = now_ms();
+	for (int i = 0; i < ROUNDS; i++)
+		to_bytes(ump_length);
+	double to_bytes_ms = now_ms() - begin;
+
+	double megabytes = (double)input_length * ROUNDS / 1e6;
+	printf("Raw decoder:   %7.1f MB/s\n", megabytes / decode_ms * 1e3);
+	printf("Bytes to UMP:  %7.1f MB/s\n", megabytes / to_ump_ms * 1e3);
+	printf("UMP to bytes:  %7.1f MB/s (of MIDI 1.0 input)\n",
+	       megabytes / to_bytes_ms * 1e3);
+
+	printf("%s\n", ok ? "UMP OK" : "UMP FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "usb_transport.h"
+#include "common.h"
+
+#define NUM_MESSAGES		20000
+#define MAX_SYSEX		40
+#define BUS_TIME_US		125
+
+struct event {
+	struct midi_message msg;
+	uint8_t cable;
+};
+
+struct receiver {
+	struct usb_transport transport;
+	size_t num_events;
+	size_t errors;
+};
+
+struct config {
+	int num_transfers;
+	size_t frame_size;
+};
+
+static struct event events[NUM_MESSAGES];
+static uint8_t sysex_data[NUM_MESSAGES / 100 + 1][MAX_SYSEX];
+
+static uint32_t random_state = 1;
+
+static uint32_t random_value(uint32_t range)
+{
+	random_state = random_state * 1103515245u + 12345u;
+	return (random_state >> 16) % range;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* Compares messages by their byte stream representation */
+static bool equal(const struct midi_message *a, const struct midi_message *b)
+{
+	uint8_t buffer_a[MAX_SYSEX + 2];
+	uint8_t buffer_b[MAX_SYSEX + 2];
+	struct midi_ostream stream;
+
+	midi_ostream_from_buffer(&stream, buffer_a, sizeof(buffer_a));
+	size_t length_a = midi_encode(&stream, a);
+	midi_ostream_from_buffer(&stream, buffer_b, sizeof(buffer_b));
+	size_t length_b = midi_encode(&stream, b);
+
+	return (length_a == length_b &&
+		memcmp(buffer_a, buffer_b, length_a) == 0);
+}
+
+static void check_message(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct receiver *r = sink->param;
+	const struct event *e = &events[r->num_events++];
+
+	if (!equal(msg, &e->msg) || r->transport.cable != e->cable) {
+		if (r->errors++ < 5) {
+			printf("Mismatch at message %zu (cable %u): ",
+			       r->num_events - 1, r->transport.cable);
+			print_msg(msg);
+		}
+	}
+}
+
+static void generate(void)
+{
+	size_t num_sysex = 0;
+
+	for (size_t i = 0; i < NUM_MESSAGES; i++) {
+		struct midi_message *msg = &events[i].msg;
+		events[i].cable = (uint8_t)random_value(4);
+
+		memset(msg, 0, sizeof(*msg));
+		if (i % 100 == 50) {
+			uint8_t *data = sysex_data[num_sysex++];
+			size_t length = 1 + random_value(MAX_SYSEX);
+			for (size_t j = 0; j < length; j++)
+				data[j] = (uint8_t)random_value(128);
+
+			msg->type = MIDI_TYPE_SYSEX;
+			msg->data.sysex.data = data;
+			msg->data.sysex.length = length;
+		} else if (random_value(4) == 0) {
+			msg->type = MIDI_TYPE_CONTROL_CHANGE;
+			msg->channel = (uint8_t)(1 + random_value(16));
+			msg->data.control_change.controller = 7;
+			msg->data.control_change.value =
+				(uint8_t)random_value(128);
+		} else {
+			msg->type = MIDI_TYPE_NOTE_ON;
+			msg->channel = (uint8_t)(1 + random_value(16));
+			msg->data.note_on.note = (uint8_t)random_value(128);
+			msg->data.note_on.velocity =
+				(uint8_t)(1 + random_value(127));
+		}
+	}
+}
+
+static bool run(const struct config *config)
+{
+	struct receiver r = { .num_events = 0 };
+	struct midi_sink sink = {
+		.message_cb = &check_message,
+		.param = &r,
+	};
+
+	libusb_device_handle *devh = mock_libusb_open(BUS_TIME_US);
+	usb_transport_init(&r.transport, NULL, devh, &sink);
+
+	struct usb_endpoint *in, *out;
+	in = usb_transport_add_in(&r.transport, MOCK_LIBUSB_EP_IN,
+				  config->num_transfers, config->frame_size);
+	out = usb_transport_add_out(&r.transport, MOCK_LIBUSB_EP_OUT,
+				    config->num_transfers, config->frame_size);
+	if (in == NULL || out == NULL) {
+		printf("Failed to add endpoints\n");
+		return false;
+	}
+
+	/* Send as fast as idle transfers allow: */
+	size_t sent = 0;
+	double start = now_ms();
+	while (r.num_events < NUM_MESSAGES) {
+		while (sent < NUM_MESSAGES &&
+		       usb_transport_send(out, &events[sent].msg,
+					  events[sent].cable)) {
+			sent++;
+		}
+
+		if (usb_transport_poll(&r.transport, 10) < 0)
+			break;
+	}
+	double elapsed = now_ms() - start;
+
+	printf("%d x %3zu B transfers: %6.0f ms, %7.0f msg/s\n",
+	       config->num_transfers, config->frame_size, elapsed,
+	       (double)NUM_MESSAGES * 1e3 / elapsed);
+	usb_transport_print_stats(&r.transport);
+
+	usb_transport_close(&r.transport);
+	mock_libusb_close(devh);
+
+	if (r.errors > 0)
+		printf("%zu mismatched messages\n", r.errors);
+	return (r.errors == 0 && r.num_events == NUM_MESSAGES);
+}
+
+int main(void)
+{
+	static const struct config configs[] = {
+		{ 1, 64 },
+		{ 4, 64 },
+		{ 8, 512 },
+	};
+	bool ok = true;
+
+	generate();
+
+	printf("Loopback of %d messages, %d us per transfer:\n",
+	       NUM_MESSAGES, BUS_TIME_US);
+	for (size_t i = 0; i < sizeof(configs)/sizeof(*configs); i++)
+		ok = run(&configs[i]) && ok;
+
+	printf("%s\n", ok ? "Loopback OK" : "Loopback FAILED");
+	return ok ? 0 : 1;
+}
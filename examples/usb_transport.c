@@ -0,0 +1,408 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "usb_transport.h"
+
+#define OUT_TIMEOUT_MS	1000
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000u + (uint64_t)ts.tv_nsec/1000u;
+}
+
+static void record(struct usb_transport_stats *stats, size_t bytes,
+		   uint64_t latency)
+{
+	stats->transfers++;
+	stats->bytes += bytes;
+	stats->total_latency += latency;
+	if (latency > stats->max_latency)
+		stats->max_latency = (uint32_t)latency;
+}
+
+static int transfer_index(const struct usb_endpoint *ep,
+			  const struct libusb_transfer *transfer)
+{
+	for (int i = 0; i < ep->num_transfers; i++) {
+		if (ep->transfers[i] == transfer)
+			return i;
+	}
+	return -1;
+}
+
+static void LIBUSB_CALL in_complete(struct libusb_transfer *transfer)
+{
+	struct usb_endpoint *ep = transfer->user_data;
+	struct usb_transport *transport = ep->transport;
+	struct midi_message *msg;
+	uint64_t start = now_us();
+
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		/* Feed all packets of the transfer to the USB decoder: */
+		ep->decoder.param = transfer->buffer;
+		ep->decoder.capacity = (size_t)transfer->actual_length;
+
+		while ((msg = midi_decode_usb(&ep->decoder,
+					      &transport->cable)) != NULL) {
+			ep->stats.messages++;
+			transport->sink->message_cb(transport->sink, msg);
+		}
+		break;
+	case LIBUSB_TRANSFER_CANCELLED:
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		ep->in_flight--;
+		return;
+	default:
+		ep->stats.errors++;
+		break;
+	}
+
+	/* Put the transfer back to the queue straight away: */
+	if (libusb_submit_transfer(transfer) < 0) {
+		ep->stats.errors++;
+		ep->in_flight--;
+		return;
+	}
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		record(&ep->stats, (size_t)transfer->actual_length,
+		       now_us() - start);
+	}
+}
+
+static bool next_frame(struct usb_endpoint *ep)
+{
+	if (ep->num_idle == 0)
+		return false;
+
+	ep->fill = ep->idle[--ep->num_idle];
+	ep->fill_length = 0;
+	ep->queued[ep->fill] = now_us();
+	ep->frame_messages[ep->fill] = 0;
+	return true;
+}
+
+static bool submit_frame(struct usb_endpoint *ep)
+{
+	int i = ep->fill;
+	struct libusb_transfer *transfer = ep->transfers[i];
+
+	transfer->length = (int)ep->fill_length;
+	ep->fill = -1;
+	ep->fill_length = 0;
+
+	if (libusb_submit_transfer(transfer) < 0) {
+		ep->stats.errors++;
+		ep->idle[ep->num_idle++] = i;
+		return false;
+	}
+
+	ep->in_flight++;
+	return true;
+}
+
+static void LIBUSB_CALL out_complete(struct libusb_transfer *transfer)
+{
+	struct usb_endpoint *ep = transfer->user_data;
+	int i = transfer_index(ep, transfer);
+
+	ep->in_flight--;
+	ep->idle[ep->num_idle++] = i;
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		ep->stats.messages += ep->frame_messages[i];
+		record(&ep->stats, (size_t)transfer->actual_length,
+		       now_us() - ep->queued[i]);
+	} else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+		ep->stats.errors++;
+	}
+
+	/* Send messages aggregated while the transfer was pending: */
+	if (ep->fill >= 0 && ep->fill_length > 0)
+		submit_frame(ep);
+}
+
+static size_t write_frame(struct midi_ostream *stream, const void *data,
+			  size_t size)
+{
+	struct usb_endpoint *ep = stream->param;
+
+	if (ep->fill >= 0 && ep->fill_length + size > ep->frame_size)
+		submit_frame(ep);
+	if (ep->fill < 0 && !next_frame(ep))
+		return 0;
+
+	uint8_t *dst = ep->transfers[ep->fill]->buffer;
+	memcpy(&dst[ep->fill_length], data, size);
+	ep->fill_length += size;
+	return size;
+}
+
+static void release_endpoint(struct usb_endpoint *ep)
+{
+	for (int i = 0; i < ep->num_transfers; i++)
+		libusb_free_transfer(ep->transfers[i]);
+
+	ep->num_transfers = 0;
+	ep->num_idle = 0;
+	ep->fill = -1;
+}
+
+static bool add_endpoint(struct usb_transport *transport,
+			 struct usb_endpoint *ep, uint8_t address,
+			 int num_transfers, size_t frame_size,
+			 libusb_transfer_cb_fn callback, unsigned int timeout)
+{
+	memset(ep, 0, sizeof(struct usb_endpoint));
+	ep->transport = transport;
+	ep->address = address;
+	ep->frame_size = frame_size;
+	ep->fill = -1;
+
+	for (int i = 0; i < num_transfers; i++) {
+		struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+		unsigned char *buffer = malloc(frame_size);
+		if (transfer == NULL || buffer == NULL) {
+			libusb_free_transfer(transfer);
+			free(buffer);
+			release_endpoint(ep);
+			return false;
+		}
+
+		libusb_fill_bulk_transfer(transfer, transport->devh, address,
+					  buffer, (int)frame_size, callback,
+					  ep, timeout);
+		transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+
+		ep->transfers[ep->num_transfers++] = transfer;
+		ep->idle[ep->num_idle++] = i;
+	}
+
+	return true;
+}
+
+static int pending_transfers(const struct usb_transport *transport)
+{
+	int pending = 0;
+
+	for (int i = 0; i < transport->num_in; i++)
+		pending += transport->in[i].in_flight;
+	for (int i = 0; i < transport->num_out; i++)
+		pending += transport->out[i].in_flight;
+
+	return pending;
+}
+
+/*
+ * Initializes an empty transport. Messages received on all IN endpoints are
+ * passed to sink, transport->cable holds the cable number of each message.
+ */
+void usb_transport_init(struct usb_transport *transport, libusb_context *ctx,
+			libusb_device_handle *devh, struct midi_sink *sink)
+{
+	memset(transport, 0, sizeof(struct usb_transport));
+	transport->ctx = ctx;
+	transport->devh = devh;
+	transport->sink = sink;
+}
+
+/*
+ * Adds a bulk IN endpoint and keeps num_transfers transfers of frame_size
+ * bytes queued on it so the device never waits for the host to resubmit.
+ */
+struct usb_endpoint *usb_transport_add_in(struct usb_transport *transport,
+					  uint8_t address, int num_transfers,
+					  size_t frame_size)
+{
+	if (transport->num_in >= USB_TRANSPORT_MAX_ENDPOINTS ||
+	    num_transfers < 1 || num_transfers > USB_TRANSPORT_MAX_TRANSFERS)
+		return NULL;
+
+	struct usb_endpoint *ep = &transport->in[transport->num_in];
+	if (!add_endpoint(transport, ep, address, num_transfers, frame_size,
+			  &in_complete, 0))
+		return NULL;
+
+	midi_istream_from_buffer(&ep->decoder, ep->transfers[0]->buffer, 0);
+	ep->decoder.sysex_buffer.data = ep->sysex;
+	ep->decoder.sysex_buffer.size = sizeof(ep->sysex);
+
+	for (int i = 0; i < ep->num_transfers; i++) {
+		if (libusb_submit_transfer(ep->transfers[i]) < 0)
+			break;
+		ep->in_flight++;
+	}
+	ep->num_idle = 0;
+
+	if (ep->in_flight == 0) {
+		release_endpoint(ep);
+		return NULL;
+	}
+
+	transport->num_in++;
+	return ep;
+}
+
+/*
+ * Adds a bulk OUT endpoint with num_transfers transfers of frame_size bytes.
+ * Frame size has to be a multiple of the 4-byte USB MIDI packet size.
+ */
+struct usb_endpoint *usb_transport_add_out(struct usb_transport *transport,
+					   uint8_t address, int num_transfers,
+					   size_t frame_size)
+{
+	if (transport->num_out >= USB_TRANSPORT_MAX_ENDPOINTS ||
+	    num_transfers < 1 || num_transfers > USB_TRANSPORT_MAX_TRANSFERS ||
+	    frame_size < 4 || frame_size % 4 != 0)
+		return NULL;
+
+	struct usb_endpoint *ep = &transport->out[transport->num_out];
+	if (!add_endpoint(transport, ep, address, num_transfers, frame_size,
+			  &out_complete, OUT_TIMEOUT_MS))
+		return NULL;
+
+	transport->num_out++;
+	return ep;
+}
+
+/*
+ * Queues a message for sending. The message is sent right away if the
+ * endpoint is idle. Otherwise it is aggregated with other messages into a
+ * frame which is sent once full or once a pending transfer completes.
+ * Returns false if there is not enough space in idle transfers.
+ */
+bool usb_transport_send(struct usb_endpoint *ep,
+			const struct midi_message *msg, uint8_t cable_number)
+{
+	size_t packets = 1;
+	if (msg->type == MIDI_TYPE_SYSEX)
+		packets = (msg->data.sysex.length + 4) / 3;
+
+	size_t space = ep->frame_size * (size_t)ep->num_idle;
+	if (ep->fill >= 0)
+		space += ep->frame_size - ep->fill_length;
+	if (4*packets > space)
+		return false;
+
+	struct midi_ostream stream = {
+		.write_cb = &write_frame,
+		.capacity = MIDI_STREAM_CAPACITY_UNLIMITED,
+		.param = ep,
+	};
+
+	if (midi_encode_usb(&stream, msg, cable_number) == 0)
+		return false;
+
+	ep->frame_messages[ep->fill]++;
+	if (ep->in_flight == 0 || ep->fill_length == ep->frame_size)
+		submit_frame(ep);
+
+	return true;
+}
+
+/*
+ * Sends the partially filled frame without waiting for pending transfers.
+ */
+bool usb_transport_flush(struct usb_endpoint *ep)
+{
+	if (ep->fill < 0 || ep->fill_length == 0)
+		return true;
+
+	return submit_frame(ep);
+}
+
+/*
+ * Handles transfer completions for up to timeout_ms milliseconds. Returns
+ * a negative libusb error code on failure.
+ */
+int usb_transport_poll(struct usb_transport *transport, int timeout_ms)
+{
+	struct timeval tv = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000,
+	};
+
+	return libusb_handle_events_timeout_completed(transport->ctx, &tv,
+						      NULL);
+}
+
+/*
+ * Cancels all pending transfers, drops unsent frames and frees the transfers.
+ */
+void usb_transport_close(struct usb_transport *transport)
+{
+	struct usb_endpoint *ep;
+
+	for (int i = 0; i < transport->num_in + transport->num_out; i++) {
+		if (i < transport->num_in)
+			ep = &transport->in[i];
+		else
+			ep = &transport->out[i - transport->num_in];
+
+		ep->fill = -1;
+		for (int j = 0; j < ep->num_transfers; j++)
+			libusb_cancel_transfer(ep->transfers[j]);
+	}
+
+	while (pending_transfers(transport) > 0) {
+		if (usb_transport_poll(transport, 100) < 0)
+			break;
+	}
+
+	for (int i = 0; i < transport->num_in; i++)
+		release_endpoint(&transport->in[i]);
+	for (int i = 0; i < transport->num_out; i++)
+		release_endpoint(&transport->out[i]);
+
+	transport->num_in = 0;
+	transport->num_out = 0;
+}
+
+static void print_stats(const char *direction, const struct usb_endpoint *ep)
+{
+	const struct usb_transport_stats *stats = &ep->stats;
+	uint64_t avg = 0;
+	if (stats->transfers > 0)
+		avg = stats->total_latency / stats->transfers;
+
+	printf("%s %02x: %" PRIu32 " transfers, %" PRIu64 " bytes, "
+	       "%" PRIu32 " messages, %" PRIu32 " errors, "
+	       "latency avg %" PRIu64 " us, max %" PRIu32 " us\n",
+	       direction, ep->address, stats->transfers, stats->bytes,
+	       stats->messages, stats->errors, avg, stats->max_latency);
+}
+
+void usb_transport_print_stats(const struct usb_transport *transport)
+{
+	for (int i = 0; i < transport->num_in; i++)
+		print_stats("IN ", &transport->in[i]);
+	for (int i = 0; i < transport->num_out; i++)
+		print_stats("OUT", &transport->out[i]);
+}
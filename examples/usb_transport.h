@@ -0,0 +1,95 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef USB_TRANSPORT_H
+#define USB_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libusb.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+
+#define USB_TRANSPORT_MAX_ENDPOINTS	4
+#define USB_TRANSPORT_MAX_TRANSFERS	8
+#define USB_TRANSPORT_SYSEX_SIZE	256
+
+/* Transfer statistics of a single endpoint, times in microseconds */
+struct usb_transport_stats {
+	uint32_t transfers;
+	uint64_t bytes;
+	uint32_t messages;
+	uint32_t errors;
+	/* OUT: from queueing the first message of a frame to completion,
+	 * IN: from completion to resubmission (processing time) */
+	uint64_t total_latency;
+	uint32_t max_latency;
+};
+
+struct usb_transport;
+
+struct usb_endpoint {
+	struct usb_transport *transport;
+	uint8_t address;
+	size_t frame_size;
+	int num_transfers;
+	int in_flight;
+	struct libusb_transfer *transfers[USB_TRANSPORT_MAX_TRANSFERS];
+	/* OUT frame aggregation: */
+	int idle[USB_TRANSPORT_MAX_TRANSFERS];
+	int num_idle;
+	int fill;
+	size_t fill_length;
+	uint64_t queued[USB_TRANSPORT_MAX_TRANSFERS];
+	uint32_t frame_messages[USB_TRANSPORT_MAX_TRANSFERS];
+	/* IN decoder: */
+	struct midi_istream decoder;
+	uint8_t sysex[USB_TRANSPORT_SYSEX_SIZE];
+	struct usb_transport_stats stats;
+};
+
+struct usb_transport {
+	libusb_context *ctx;
+	libusb_device_handle *devh;
+	/* Receives messages from all IN endpoints */
+	struct midi_sink *sink;
+	/* Cable number of the message passed to sink */
+	uint8_t cable;
+	struct usb_endpoint in[USB_TRANSPORT_MAX_ENDPOINTS];
+	int num_in;
+	struct usb_endpoint out[USB_TRANSPORT_MAX_ENDPOINTS];
+	int num_out;
+};
+
+void usb_transport_init(struct usb_transport *transport, libusb_context *ctx,
+			libusb_device_handle *devh, struct midi_sink *sink);
+struct usb_endpoint *usb_transport_add_in(struct usb_transport *transport,
+					  uint8_t address, int num_transfers,
+					  size_t frame_size);
+struct usb_endpoint *usb_transport_add_out(struct usb_transport *transport,
+					   uint8_t address, int num_transfers,
+					   size_t frame_size);
+bool usb_transport_send(struct usb_endpoint *ep,
+			const struct midi_message *msg, uint8_t cable_number);
+bool usb_transport_flush(struct usb_endpoint *ep);
+int usb_transport_poll(struct usb_transport *transport, int timeout_ms);
+void usb_transport_close(struct usb_transport *transport);
+void usb_transport_print_stats(const struct usb_transport *transport);
+
+#endif /* USB_TRANSPORT_H */
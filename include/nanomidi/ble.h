@@ -0,0 +1,100 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_BLE_H
+#define NANOMIDI_BLE_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup ble
+ @{ */
+
+/** Packet size for the default ATT MTU of 23 bytes */
+#define MIDI_BLE_PACKET_SIZE_DEFAULT	20
+/** Timestamp period in milliseconds (timestamps are 13-bit) */
+#define MIDI_BLE_TIMESTAMP_PERIOD	8192
+
+/**
+ * BLE MIDI packet encoder
+ *
+ * The structure should be initialized with midi_ble_encoder_init().
+ */
+struct midi_ble_encoder {
+	/** Packet buffer allocated by the user */
+	uint8_t *packet;
+	/** Maximum packet size (ATT MTU minus 3), at least 5 bytes */
+	size_t size;
+	/** Number of bytes in #packet (handled internally) */
+	size_t length;
+	/** Timestamp of the last message in #packet (handled internally) */
+	uint16_t timestamp;
+	/** Status byte which can be omitted, 0 if none (handled internally) */
+	uint8_t running_status;
+};
+
+/**
+ * BLE MIDI packet decoder
+ *
+ * The structure should be initialized with midi_ble_decoder_init().
+ */
+struct midi_ble_decoder {
+	/**
+	 * Byte stream decoder state. Fields midi_istream.sysex_buffer,
+	 * midi_istream.sysex_pool and midi_istream.filter can be set by the
+	 * user, other fields are handled internally.
+	 */
+	struct midi_istream stream;
+	/** Timestamp (0-8191 ms) of the message passed to the sink */
+	uint16_t timestamp;
+};
+
+void midi_ble_encoder_init(struct midi_ble_encoder *encoder, void *packet,
+			   size_t size);
+size_t midi_ble_encode(struct midi_ble_encoder *encoder,
+		       struct midi_ostream *stream,
+		       const struct midi_message *msg, uint32_t timestamp);
+size_t midi_ble_flush(struct midi_ble_encoder *encoder,
+		      struct midi_ostream *stream);
+void midi_ble_decoder_init(struct midi_ble_decoder *decoder);
+size_t midi_ble_decode(struct midi_ble_decoder *decoder, const void *packet,
+		       size_t size, struct midi_sink *sink);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_BLE_H */
@@ -0,0 +1,97 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_BLOCK_H
+#define NANOMIDI_BLOCK_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/packed.h>
+#else
+#include <nanomidi/packed.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup block
+ @{ */
+
+/** Message scheduled within an audio block */
+struct midi_block_event {
+	/** Frame offset from the start of the block (timestamp in ticks while
+	the event waits in the carry-over queue) */
+	uint32_t time;
+	/** Packed message */
+	struct midi_packed msg;
+};
+
+/**
+ * Audio block event scheduler
+ *
+ * The structure should be initialized with midi_block_init().
+ */
+struct midi_block {
+	/** Number of timestamp ticks per second */
+	uint32_t ticks_per_second;
+	/** Audio sample rate in frames per second */
+	uint32_t sample_rate;
+	/** Events of the current block sorted by #midi_block_event.time,
+	allocated by the user */
+	struct midi_block_event *events;
+	/** Number of elements in #events */
+	size_t max_events;
+	/** Number of events in the current block */
+	size_t num_events;
+	/** Carry-over queue for events of later blocks, allocated by the
+	user (handled internally) */
+	struct midi_block_event *carry;
+	/** Number of elements in #carry */
+	size_t max_carry;
+	/** Number of events in the carry-over queue */
+	size_t num_carry;
+	/** Optional pool for SysEx data, `NULL` drops SysEx messages. The
+	user resets the pool once no event refers to it. */
+	struct midi_packed_pool *pool;
+	/** Start time of the current block in ticks (handled internally) */
+	uint32_t start;
+	/** Length of the current block in frames (handled internally) */
+	uint32_t frames;
+	/** Number of events which did not fit the carry-over queue */
+	size_t dropped;
+};
+
+void midi_block_init(struct midi_block *block, uint32_t ticks_per_second,
+		     uint32_t sample_rate, struct midi_block_event *events,
+		     size_t max_events, struct midi_block_event *carry,
+		     size_t max_carry);
+size_t midi_block_begin(struct midi_block *block, uint32_t start,
+			uint32_t frames);
+bool midi_block_push(struct midi_block *block, const struct midi_message *msg,
+		     uint32_t time);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_BLOCK_H */
@@ -0,0 +1,187 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_CAPTURE_H
+#define NANOMIDI_CAPTURE_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/packed.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/packed.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup capture
+ @{ */
+
+/** Magic number of a capture file ("NMCP") */
+#define MIDI_CAPTURE_MAGIC			0x50434d4e
+/** Magic number of a segment ("NMCS") */
+#define MIDI_CAPTURE_SEGMENT_MAGIC		0x53434d4e
+/** Version of the capture file format */
+#define MIDI_CAPTURE_VERSION			1
+/** Default segment size in bytes */
+#define MIDI_CAPTURE_SEGMENT_SIZE_DEFAULT	65536
+/** Default number of records per index entry */
+#define MIDI_CAPTURE_INDEX_INTERVAL_DEFAULT	64
+/** Number of segments preallocated at once */
+#define MIDI_CAPTURE_PREALLOCATE		16
+/** Maximum length of a captured SysEx message */
+#define MIDI_CAPTURE_MAX_SYSEX			0xffff
+
+/**
+ * File header
+ *
+ * All structures are stored in native byte order. The header is followed
+ * by segments of equal size starting at #data_offset.
+ */
+struct midi_capture_header {
+	uint32_t magic; /*!< #MIDI_CAPTURE_MAGIC */
+	uint16_t version; /*!< #MIDI_CAPTURE_VERSION */
+	uint16_t header_size; /*!< Size of this structure */
+	uint32_t segment_size; /*!< Segment size in bytes */
+	uint32_t index_interval; /*!< Number of records per index entry */
+	uint32_t index_entries; /*!< Size of the index of each segment */
+	uint32_t num_segments; /*!< Number of segments written */
+	uint64_t data_offset; /*!< Offset of the first segment */
+};
+
+/**
+ * Segment header
+ *
+ * The header is followed by an index of midi_capture_header.index_entries
+ * #midi_capture_index entries and by records.
+ */
+struct midi_capture_segment {
+	uint32_t magic; /*!< #MIDI_CAPTURE_SEGMENT_MAGIC */
+	uint32_t length; /*!< Number of bytes of records written */
+	uint64_t base_time; /*!< Time of the first record */
+	uint32_t num_records; /*!< Number of records written */
+	uint32_t num_index; /*!< Number of index entries used */
+};
+
+/** Sparse time index entry, one per midi_capture_header.index_interval
+ records */
+struct midi_capture_index {
+	uint32_t time; /*!< Record time relative to the segment base time */
+	uint32_t offset; /*!< Offset of the record in the segment records */
+};
+
+/**
+ * Fixed record header
+ *
+ * Messages are stored as #midi_packed with the port number in
+ * midi_packed.flags. SysEx messages store the data length in
+ * midi_packed.data1 (LSB) and midi_packed.data2 (MSB) and the data follows
+ * the header, padded to a multiple of four bytes.
+ */
+struct midi_capture_record {
+	uint32_t time; /*!< Time relative to the segment base time */
+	struct midi_packed msg; /*!< Packed message */
+};
+
+/**
+ * Capture file writer
+ *
+ * The structure should be initialized with midi_capture_writer_open().
+ */
+struct midi_capture_writer {
+	/** File descriptor (handled internally) */
+	int fd;
+	/** Mapped file header (handled internally) */
+	struct midi_capture_header *header;
+	/** Mapped segment being written or `NULL` (handled internally) */
+	struct midi_capture_segment *segment;
+	/** Number of segments allocated in the file (handled internally) */
+	uint32_t allocated;
+	/** Time of the last record (handled internally) */
+	uint64_t time;
+	/** Number of messages which could not be written */
+	size_t dropped;
+};
+
+/**
+ * Capture file reader
+ *
+ * The structure should be initialized with midi_capture_reader_open().
+ */
+struct midi_capture_reader {
+	/** Mapped file (handled internally) */
+	const uint8_t *data;
+	/** Size of the mapped file (handled internally) */
+	size_t size;
+	/** Number of complete segments in the file (handled internally) */
+	uint32_t num_segments;
+	/** Segment being read (handled internally) */
+	uint32_t segment;
+	/** Offset of the next record in the segment (handled internally) */
+	uint32_t offset;
+	/** Time of the last message read */
+	uint64_t time;
+	/** Port number of the last message read */
+	uint8_t port;
+	/** Bytes not yet read by the input stream (handled internally) */
+	const uint8_t *pending;
+	/** Number of bytes in #pending (handled internally) */
+	size_t pending_length;
+	/** SysEx data not yet read by the input stream (handled internally) */
+	const uint8_t *sysex;
+	/** Number of bytes in #sysex (handled internally) */
+	size_t sysex_length;
+	/** EOX not yet read by the input stream (handled internally) */
+	bool eox;
+	/** Encoded message for the input stream (handled internally) */
+	uint8_t bytes[3];
+};
+
+bool midi_capture_writer_open(struct midi_capture_writer *writer,
+			      const char *path, size_t segment_size,
+			      uint32_t index_interval);
+bool midi_capture_write(struct midi_capture_writer *writer,
+			const struct midi_message *msg, uint8_t port,
+			uint64_t time);
+bool midi_capture_writer_sync(struct midi_capture_writer *writer);
+bool midi_capture_writer_close(struct midi_capture_writer *writer);
+bool midi_capture_reader_open(struct midi_capture_reader *reader,
+			      const char *path);
+bool midi_capture_seek(struct midi_capture_reader *reader, uint64_t time);
+bool midi_capture_read(struct midi_capture_reader *reader,
+		       struct midi_message *msg);
+void midi_capture_istream(struct midi_capture_reader *reader,
+			  struct midi_istream *stream);
+void midi_capture_reader_close(struct midi_capture_reader *reader);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_CAPTURE_H */
@@ -0,0 +1,97 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_CLOCK_H
+#define NANOMIDI_CLOCK_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/messages.h>
+#else
+#include <nanomidi/messages.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup clock
+ @{ */
+
+/** Number of Timing Clock messages per quarter note */
+#define MIDI_CLOCK_PPQN			24
+
+/** Default loop coefficient midi_clock.coef_b (0.0707 in Q16) */
+#define MIDI_CLOCK_COEF_B_DEFAULT	4634
+/** Default loop coefficient midi_clock.coef_c (0.0025 in Q16) */
+#define MIDI_CLOCK_COEF_C_DEFAULT	164
+
+/**
+ * Timing Clock follower
+ *
+ * The structure should be initialized with midi_clock_init(). Time is
+ * measured in user-defined ticks (e.g. microseconds or audio samples).
+ */
+struct midi_clock {
+	/** Number of ticks per second */
+	uint32_t ticks_per_second;
+	/** Phase correction coefficient of the loop filter (Q16) */
+	uint32_t coef_b;
+	/** Period correction coefficient of the loop filter (Q16) */
+	uint32_t coef_c;
+	/** Song position (in clocks) of the next Timing Clock message */
+	uint32_t position;
+	/** Transport is running (Start or Continue received) */
+	bool running;
+	/** Waiting for the first Timing Clock after Start, Continue or Stop
+	(handled internally) */
+	bool pending;
+	/** Number of Timing Clock messages since the loop was reset */
+	uint32_t count;
+	/** Last phase error in Q16 ticks (positive if the clock was late) */
+	int32_t error;
+	/** Filtered clock period in Q16 ticks (handled internally) */
+	uint64_t period;
+	/** Filtered time of the last Timing Clock (handled internally) */
+	uint32_t time;
+	/** Fractional part of #time in Q16 (handled internally) */
+	uint16_t time_frac;
+	/** Predicted time of the next Timing Clock (handled internally) */
+	uint32_t next;
+	/** Fractional part of #next in Q16 (handled internally) */
+	uint16_t next_frac;
+	/** Unfiltered time of the last Timing Clock (handled internally) */
+	uint32_t raw;
+};
+
+void midi_clock_init(struct midi_clock *clock, uint32_t ticks_per_second);
+bool midi_clock_update(struct midi_clock *clock,
+		       const struct midi_message *msg, uint32_t now);
+uint32_t midi_clock_bpm(const struct midi_clock *clock);
+uint32_t midi_clock_next(const struct midi_clock *clock, uint32_t n);
+uint64_t midi_clock_position(const struct midi_clock *clock, uint32_t now);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_CLOCK_H */
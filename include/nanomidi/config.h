@@ -0,0 +1,76 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_CONFIG_H
+#define NANOMIDI_CONFIG_H
+
+/**
+ * Compile-time feature configuration
+ * @defgroup config Configuration
+ *
+ * Features which are not needed can be disabled to reduce code size and the
+ * size of #midi_istream and #midi_message. Options can be set to `0` using
+ * compiler flags (e.g. `-DNANOMIDI_CONFIG_SYSEX=0`) or in a custom header
+ * file whose name is passed in `NANOMIDI_CONFIG_FILE`
+ * (e.g. `-DNANOMIDI_CONFIG_FILE=\"my_config.h\"`).
+ *
+ * All options have to be set identically for the library and for the code
+ * using it. Run `make size` in the examples directory to see code size of
+ * each configuration.
+ */
+
+/**@{*/
+
+#ifdef NANOMIDI_CONFIG_FILE
+#include NANOMIDI_CONFIG_FILE
+#endif
+
+#ifndef NANOMIDI_CONFIG_SYSEX
+/**
+ * Enables System Exclusive messages.
+ *
+ * If disabled, SysEx messages are skipped by the decoder and ignored by the
+ * encoder. Member midi_message.data.sysex and midi_istream.sysex_buffer are
+ * not available.
+ */
+#define NANOMIDI_CONFIG_SYSEX			1
+#endif
+
+#ifndef NANOMIDI_CONFIG_SYSTEM_COMMON
+/**
+ * Enables System Common messages (MIDI Time Code Quarter Frame, Song Position
+ * Pointer, Song Select and Tune Request).
+ *
+ * If disabled, System Common messages are skipped by the decoder and ignored
+ * by the encoder.
+ */
+#define NANOMIDI_CONFIG_SYSTEM_COMMON		1
+#endif
+
+#ifndef NANOMIDI_CONFIG_USB
+/**
+ * Enables USB-MIDI packet format, i.e. midi_decode_usb() and
+ * midi_encode_usb().
+ */
+#define NANOMIDI_CONFIG_USB			1
+#endif
+
+/**@}*/
+
+#endif /* NANOMIDI_CONFIG_H */
@@ -20,6 +20,8 @@
 #ifndef NANOMIDI_DECODER_H
 #define NANOMIDI_DECODER_H
 
+#include <stdbool.h>
+
 #ifdef ARDUINO
 #include <../include/nanomidi/common.h>
 #include <../include/nanomidi/messages.h>
@@ -35,6 +37,8 @@ extern "C" {
 /** @addtogroup decoder
  @{ */
 
+struct midi_sysex_pool;
+
 /** Buffer for SysEx messages decoding */
 struct midi_sysex_buffer {
 	/**
@@ -49,6 +53,17 @@ struct midi_sysex_buffer {
 	size_t size;
 };
 
+/**
+ * Message filter for midi_decode()
+ *
+ * The filter should be created using midi_filter_compile().
+ */
+struct midi_filter {
+	/** Bit mask of accepted status bytes (bit `n % 32` in `status[n / 32]`
+	for status byte `n`) */
+	uint32_t status[8];
+};
+
 /**
  * Input stream for midi_decode()
  *
@@ -86,8 +101,26 @@ struct midi_istream {
 	 * pointer to midi_istream.rtmsg.
 	 */
 	struct midi_message rtmsg;
+#if NANOMIDI_CONFIG_SYSEX
 	/** Buffer for SysEx messages decoding */
 	struct midi_sysex_buffer sysex_buffer;
+	/**
+	 * Pointer to an optional SysEx pool. If set, SysEx messages are
+	 * decoded into blocks acquired from the pool instead of
+	 * #sysex_buffer.
+	 */
+	struct midi_sysex_pool *sysex_pool;
+#endif
+	/**
+	 * Pointer to an optional message filter. Messages rejected by the
+	 * filter are skipped without being decoded.
+	 *
+	 * Can be set to `NULL` to decode all messages.
+	 */
+	const struct midi_filter *filter;
+	/** Data bytes of the current message are skipped (handled
+	internally) */
+	bool skip;
 	/** Number of bytes remaining to complete the current message
 	(handled internally). */
 	int bytes_left;
@@ -95,11 +128,38 @@ struct midi_istream {
 	void *param;
 };
 
+/**
+ * Message sink for midi_decoder_feed()
+ *
+ * Callback message_cb() must be provided by the user.
+ */
+struct midi_sink {
+	/**
+	 * Pointer to a user-implemented callback called for each decoded
+	 * message. The message has to be processed (e.g. copied) immediately
+	 * as it will become invalid once the callback returns.
+	 *
+	 * @param sink          Pointer to associated #midi_sink
+	 * @param[in] msg       Decoded message
+	 */
+	void (*message_cb)(struct midi_sink *sink, struct midi_message *msg);
+	/** Optional parameter to be used by message_cb() */
+	void *param;
+};
+
 void midi_istream_from_buffer(struct midi_istream *stream, const void *buffer,
 			      size_t size);
 struct midi_message *midi_decode(struct midi_istream *stream);
+struct midi_message *midi_decode_byte(struct midi_istream *stream, uint8_t c);
+size_t midi_decoder_feed(struct midi_istream *stream, const void *data,
+			 size_t size, struct midi_sink *sink);
+#if NANOMIDI_CONFIG_USB
 struct midi_message *midi_decode_usb(struct midi_istream *stream,
 				     uint8_t *cable_number);
+#endif
+void midi_filter_compile(struct midi_filter *filter,
+			 const enum midi_type *types, size_t count,
+			 uint16_t channels);
 
 /**@}*/
 
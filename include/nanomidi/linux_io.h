@@ -0,0 +1,122 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_LINUX_IO_H
+#define NANOMIDI_LINUX_IO_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup linux_io
+ @{ */
+
+/** Maximum number of events handled by a single midi_linux_poll() call */
+#define MIDI_LINUX_MAX_EVENTS		32
+
+/**
+ * Buffered non-blocking port (raw MIDI device, serial port, pipe or FIFO)
+ *
+ * The structure should be initialized with midi_linux_port_init().
+ */
+struct midi_linux_port {
+	/** File descriptor */
+	int fd;
+	/**
+	 * Input stream for midi_decode(), reads from #rx_buffer. Fields
+	 * midi_istream.sysex_buffer, midi_istream.sysex_pool and
+	 * midi_istream.filter can be set by the user.
+	 */
+	struct midi_istream input;
+	/**
+	 * Output stream for midi_encode(), writes to #tx_buffer. Its capacity
+	 * is the free space in #tx_buffer (handled internally).
+	 */
+	struct midi_ostream output;
+	/** Input buffer allocated by the user */
+	uint8_t *rx_buffer;
+	/** Size of #rx_buffer */
+	size_t rx_size;
+	/** Read position in #rx_buffer (handled internally) */
+	size_t rx_pos;
+	/** Number of bytes in #rx_buffer (handled internally) */
+	size_t rx_length;
+	/** Output ring buffer allocated by the user */
+	uint8_t *tx_buffer;
+	/** Size of #tx_buffer */
+	size_t tx_size;
+	/** Read position in #tx_buffer (handled internally) */
+	size_t tx_head;
+	/** Write position in #tx_buffer (handled internally) */
+	size_t tx_tail;
+	/** Poller file descriptor or -1 (handled internally) */
+	int poll_fd;
+	/** Input data may be available (handled internally) */
+	bool readable;
+	/** Waiting for the output to become writable (handled internally) */
+	bool waiting;
+	/** The other end has been closed */
+	bool hangup;
+	/** Number of read() calls */
+	size_t num_reads;
+	/** Number of writev() calls */
+	size_t num_writes;
+};
+
+/** Readiness notification for multiple ports */
+struct midi_linux_poller {
+	/** File descriptor of the epoll instance */
+	int fd;
+};
+
+int midi_linux_open(const char *path, int baud);
+bool midi_linux_port_init(struct midi_linux_port *port, int fd,
+			  void *rx_buffer, size_t rx_size,
+			  void *tx_buffer, size_t tx_size);
+void midi_linux_port_close(struct midi_linux_port *port);
+size_t midi_linux_receive(struct midi_linux_port *port,
+			  struct midi_sink *sink);
+bool midi_linux_flush(struct midi_linux_port *port);
+bool midi_linux_poller_init(struct midi_linux_poller *poller);
+bool midi_linux_poller_add(struct midi_linux_poller *poller,
+			   struct midi_linux_port *port);
+int midi_linux_poll(struct midi_linux_poller *poller,
+		    struct midi_linux_port **ports, int max_ports,
+		    int timeout_ms);
+void midi_linux_poller_close(struct midi_linux_poller *poller);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_LINUX_IO_H */
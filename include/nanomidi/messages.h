@@ -23,6 +23,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef ARDUINO
+#include <../include/nanomidi/config.h>
+#else
+#include <nanomidi/config.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -143,6 +149,7 @@ struct midi_message {
 			uint8_t song; /*!< Song number (0-127) */
 		} song_select;
 
+#if NANOMIDI_CONFIG_SYSEX
 		/**
 		 * Representation of #MIDI_TYPE_SYSEX. Both #data and #length
 		 * do not contain "SOX" and "EOX" bytes. */
@@ -150,6 +157,7 @@ struct midi_message {
 			const void *data; /*!< Pointer to SysEx data */
 			size_t length; /*!< Length of data in bytes */
 		} sysex;
+#endif
 	} data; /*!< MIDI message data representation */
 };
 
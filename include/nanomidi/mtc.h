@@ -0,0 +1,166 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_MTC_H
+#define NANOMIDI_MTC_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup mtc
+ @{ */
+
+/** Number of subframes in a frame */
+#define MIDI_MTC_SUBFRAMES		100
+
+/** MIDI Time Code frame rates */
+enum midi_mtc_rate {
+	/** 24 frames per second */
+	MIDI_MTC_RATE_24 = 0,
+	/** 25 frames per second */
+	MIDI_MTC_RATE_25 = 1,
+	/** 29.97 frames per second, drop-frame */
+	MIDI_MTC_RATE_30_DROP = 2,
+	/** 30 frames per second */
+	MIDI_MTC_RATE_30 = 3,
+};
+
+/** MIDI Time Code assembler state */
+enum midi_mtc_state {
+	/** No time code received or time code has stopped */
+	MIDI_MTC_STOPPED = 0,
+	/** Quarter frames are being received */
+	MIDI_MTC_LOCKED,
+	/** Quarter frames are late, position is extrapolated */
+	MIDI_MTC_FREEWHEEL,
+};
+
+/** Time code position */
+struct midi_mtc_time {
+	uint8_t hours; /*!< Hours (0-23) */
+	uint8_t minutes; /*!< Minutes (0-59) */
+	uint8_t seconds; /*!< Seconds (0-59) */
+	uint8_t frames; /*!< Frames (0-29) */
+	uint8_t subframes; /*!< Hundredths of a frame (0-99) */
+	enum midi_mtc_rate rate; /*!< Frame rate */
+};
+
+/**
+ * MIDI Time Code assembler
+ *
+ * The structure should be initialized with midi_mtc_init(). Time is measured
+ * in user-defined ticks (e.g. microseconds) provided to midi_mtc_update() and
+ * midi_mtc_position().
+ */
+struct midi_mtc {
+	/** Number of ticks per second */
+	uint32_t ticks_per_second;
+	/** Number of ticks without a quarter frame after which the state
+	changes from #MIDI_MTC_FREEWHEEL to #MIDI_MTC_STOPPED */
+	uint32_t timeout;
+	/** Current state */
+	enum midi_mtc_state state;
+	/** Current frame rate */
+	enum midi_mtc_rate rate;
+	/** Direction of the time code (1 forward, -1 reverse) */
+	int8_t direction;
+	/** Quarter frame data received so far (handled internally) */
+	uint8_t nibbles[8];
+	/** Bit mask of pieces received in sequence (handled internally) */
+	uint8_t received;
+	/** Piece of the last quarter frame (handled internally) */
+	uint8_t piece;
+	/** Position follows quarter frames (handled internally) */
+	bool tracking;
+	/** Position of the last quarter frame in quarter frames (handled
+	internally) */
+	uint32_t position;
+	/** Time of the last quarter frame in ticks (handled internally) */
+	uint32_t timestamp;
+	/** Measured quarter frame period in ticks (handled internally) */
+	uint32_t period;
+	/** Last position returned by midi_mtc_position() (handled
+	internally) */
+	uint32_t last;
+};
+
+/**
+ * MIDI Time Code generator
+ *
+ * The structure should be initialized with midi_mtc_generator_init().
+ */
+struct midi_mtc_generator {
+	/** Number of ticks per second */
+	uint32_t ticks_per_second;
+	/** Frame rate */
+	enum midi_mtc_rate rate;
+	/** Frame of the current quarter frame sequence (handled internally) */
+	uint32_t frame;
+	/** Position of the next quarter frame in quarter frames (handled
+	internally) */
+	uint32_t position;
+	/** Piece of the next quarter frame (handled internally) */
+	uint8_t piece;
+	/** Time of the next quarter frame in ticks (handled internally) */
+	uint32_t next;
+	/** Fractional part of #next (handled internally) */
+	uint32_t remainder;
+};
+
+uint32_t midi_mtc_time_to_frames(const struct midi_mtc_time *time);
+void midi_mtc_frames_to_time(struct midi_mtc_time *time, uint32_t frames,
+			     enum midi_mtc_rate rate);
+bool midi_mtc_decode_full_frame(struct midi_mtc_time *time, const void *data,
+				size_t length);
+size_t midi_encode_mtc_full_frame(struct midi_ostream *stream,
+				  const struct midi_mtc_time *time,
+				  uint8_t device_id);
+
+void midi_mtc_init(struct midi_mtc *mtc, uint32_t ticks_per_second,
+		   uint32_t timeout);
+bool midi_mtc_update(struct midi_mtc *mtc, const struct midi_message *msg,
+		     uint32_t now);
+uint32_t midi_mtc_position(struct midi_mtc *mtc, uint32_t now);
+void midi_mtc_get_time(struct midi_mtc *mtc, uint32_t now,
+		       struct midi_mtc_time *time);
+
+void midi_mtc_generator_init(struct midi_mtc_generator *gen,
+			     const struct midi_mtc_time *start,
+			     uint32_t ticks_per_second, uint32_t now);
+size_t midi_mtc_generate(struct midi_mtc_generator *gen,
+			 struct midi_ostream *stream, uint32_t now);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_MTC_H */
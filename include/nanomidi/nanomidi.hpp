@@ -0,0 +1,721 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_HPP
+#define NANOMIDI_HPP
+
+/*
+ * Header-only C++17 layer on top of nanomidi.
+ *
+ * Templates nanomidi::decoder<Source> and nanomidi::encoder<Sink> replace
+ * midi_istream.read_cb() and midi_ostream.write_cb() function pointers with
+ * compile-time policies so the byte I/O can be inlined. The decoder keeps its
+ * state in a regular #midi_istream structure which can be passed to the C API.
+ *
+ * A Source has to provide `bool read(uint8_t &c)` which returns `false` when
+ * no data is available. A Sink has to provide
+ * `size_t write(const uint8_t *data, size_t size)` which writes either all
+ * bytes or none and returns the number of bytes written. A Sink with limited
+ * space should also provide `size_t capacity() const` returning how many bytes
+ * the next writes are guaranteed to accept; SysEx messages are written in
+ * chunks and are checked against it up front so they are written whole or
+ * not at all. A Sink without capacity() is treated as unlimited.
+ *
+ * Constant message tables (init sequences, SysEx dumps, etc.) can be encoded
+ * at compile time using constexpr functions nanomidi::encode(),
+ * nanomidi::encode_usb() and #NANOMIDI_ENCODE_RUNNING_STATUS:
+ *
+ *     constexpr auto init = nanomidi::encode(
+ *             nanomidi::control_change(1, 7, 100),
+ *             nanomidi::program_change(1, 5),
+ *             nanomidi::sysex({ 0x7e, 0x7f, 0x06, 0x01 }));
+ *
+ * The result is a std::array<uint8_t, N> which can be placed in flash and
+ * sent out with a single memcpy() or DMA transfer.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+
+#if __has_include(<unistd.h>) && __has_include(<poll.h>)
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#define NANOMIDI_HAVE_UNISTD	1
+#endif
+
+namespace nanomidi {
+
+namespace detail {
+
+constexpr uint8_t data_byte(unsigned int value)
+{
+	return static_cast<uint8_t>(value & 0x7f);
+}
+
+inline uint8_t status_byte(const midi_message &msg)
+{
+	if (msg.type >= MIDI_TYPE_SYSEX)
+		return static_cast<uint8_t>(msg.type);
+
+	/* Channel goes from 1 to 16 but accept zero too: */
+	unsigned int c = (msg.channel > 0) ? msg.channel - 1u : 0u;
+	return static_cast<uint8_t>((msg.type & 0xf0) | (c & 0x0f));
+}
+
+/* Encodes a message other than SysEx, returns its length (0 if unknown) */
+inline size_t encode_short(const midi_message &msg, uint8_t (&buffer)[3])
+{
+	buffer[0] = status_byte(msg);
+
+	switch (msg.type) {
+	case MIDI_TYPE_NOTE_ON:
+		buffer[1] = data_byte(msg.data.note_on.note);
+		buffer[2] = data_byte(msg.data.note_on.velocity);
+		return 3;
+	case MIDI_TYPE_NOTE_OFF:
+		buffer[1] = data_byte(msg.data.note_off.note);
+		buffer[2] = data_byte(msg.data.note_off.velocity);
+		return 3;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		buffer[1] = data_byte(msg.data.polyphonic_pressure.note);
+		buffer[2] = data_byte(msg.data.polyphonic_pressure.pressure);
+		return 3;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		buffer[1] = data_byte(msg.data.control_change.controller);
+		buffer[2] = data_byte(msg.data.control_change.value);
+		return 3;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		buffer[1] = data_byte(msg.data.program_change.program);
+		return 2;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		buffer[1] = data_byte(msg.data.channel_pressure.pressure);
+		return 2;
+	case MIDI_TYPE_PITCH_BEND:
+		buffer[1] = data_byte(msg.data.pitch_bend.value);
+		buffer[2] = data_byte(msg.data.pitch_bend.value >> 7);
+		return 3;
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+		buffer[1] = data_byte(msg.data.time_code_quarter_frame.value);
+		return 2;
+	case MIDI_TYPE_SONG_POSITION:
+		buffer[1] = data_byte(msg.data.song_position.position);
+		buffer[2] = data_byte(msg.data.song_position.position >> 7);
+		return 3;
+	case MIDI_TYPE_SONG_SELECT:
+		buffer[1] = data_byte(msg.data.song_select.song);
+		return 2;
+	case MIDI_TYPE_TUNE_REQUEST:
+	case MIDI_TYPE_TIMING_CLOCK:
+	case MIDI_TYPE_START:
+	case MIDI_TYPE_CONTINUE:
+	case MIDI_TYPE_STOP:
+	case MIDI_TYPE_ACTIVE_SENSE:
+	case MIDI_TYPE_SYSTEM_RESET:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+template <typename Sink, typename = void>
+struct has_capacity : std::false_type {};
+
+template <typename Sink>
+struct has_capacity<Sink,
+	std::void_t<decltype(std::declval<const Sink &>().capacity())>>
+	: std::true_type {};
+
+/* Not constexpr: calling it during constant evaluation fails to compile */
+void encoded_size_mismatch();
+
+constexpr uint8_t channel_status(uint8_t type, uint8_t channel)
+{
+	/* Channel goes from 1 to 16 but accept zero too: */
+	unsigned int c = (channel > 0) ? channel - 1u : 0u;
+	return static_cast<uint8_t>(type | (c & 0x0f));
+}
+
+constexpr uint8_t usb_cin(uint8_t status, size_t remaining)
+{
+	if (status < MIDI_TYPE_SYSEX)
+		return static_cast<uint8_t>(status >> 4);
+
+	switch (status) {
+	case MIDI_TYPE_SYSEX:
+		if (remaining > 3)
+			return 0x04;
+		return static_cast<uint8_t>(0x04 + remaining);
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+	case MIDI_TYPE_SONG_SELECT:
+		return 0x02;
+	case MIDI_TYPE_SONG_POSITION:
+		return 0x03;
+	case MIDI_TYPE_TUNE_REQUEST:
+		return 0x05;
+	default:
+		return 0x0f;
+	}
+}
+
+} /* namespace detail */
+
+/** Encoded message of `N` bytes for compile-time encoding */
+template <size_t N>
+struct message {
+	uint8_t bytes[N];
+};
+
+constexpr message<3> note_on(uint8_t channel, uint8_t note, uint8_t velocity)
+{
+	return {{ detail::channel_status(MIDI_TYPE_NOTE_ON, channel),
+		  detail::data_byte(note), detail::data_byte(velocity) }};
+}
+
+constexpr message<3> note_off(uint8_t channel, uint8_t note,
+			      uint8_t velocity = 0)
+{
+	return {{ detail::channel_status(MIDI_TYPE_NOTE_OFF, channel),
+		  detail::data_byte(note), detail::data_byte(velocity) }};
+}
+
+constexpr message<3> polyphonic_pressure(uint8_t channel, uint8_t note,
+					 uint8_t pressure)
+{
+	return {{ detail::channel_status(MIDI_TYPE_POLYPHONIC_PRESSURE,
+					 channel),
+		  detail::data_byte(note), detail::data_byte(pressure) }};
+}
+
+constexpr message<3> control_change(uint8_t channel, uint8_t controller,
+				    uint8_t value)
+{
+	return {{ detail::channel_status(MIDI_TYPE_CONTROL_CHANGE, channel),
+		  detail::data_byte(controller), detail::data_byte(value) }};
+}
+
+constexpr message<2> program_change(uint8_t channel, uint8_t program)
+{
+	return {{ detail::channel_status(MIDI_TYPE_PROGRAM_CHANGE, channel),
+		  detail::data_byte(program) }};
+}
+
+constexpr message<2> channel_pressure(uint8_t channel, uint8_t pressure)
+{
+	return {{ detail::channel_status(MIDI_TYPE_CHANNEL_PRESSURE, channel),
+		  detail::data_byte(pressure) }};
+}
+
+constexpr message<3> pitch_bend(uint8_t channel, uint16_t value)
+{
+	return {{ detail::channel_status(MIDI_TYPE_PITCH_BEND, channel),
+		  detail::data_byte(value), detail::data_byte(value >> 7) }};
+}
+
+constexpr message<2> time_code_quarter_frame(uint8_t value)
+{
+	return {{ MIDI_TYPE_TIME_CODE_QUARTER_FRAME, detail::data_byte(value) }};
+}
+
+constexpr message<3> song_position(uint16_t position)
+{
+	return {{ MIDI_TYPE_SONG_POSITION, detail::data_byte(position),
+		  detail::data_byte(position >> 7) }};
+}
+
+constexpr message<2> song_select(uint8_t song)
+{
+	return {{ MIDI_TYPE_SONG_SELECT, detail::data_byte(song) }};
+}
+
+/** Single-byte message: Tune Request or any System Real Time message */
+constexpr message<1> single_byte(midi_type type)
+{
+	return {{ static_cast<uint8_t>(type) }};
+}
+
+/** SysEx message, `data` does not contain "SOX" and "EOX" bytes */
+template <size_t N>
+constexpr message<N+2> sysex(const uint8_t (&data)[N])
+{
+	message<N+2> msg{};
+	msg.bytes[0] = MIDI_TYPE_SYSEX;
+	for (size_t i = 0; i < N; i++)
+		msg.bytes[i+1] = detail::data_byte(data[i]);
+	msg.bytes[N+1] = 0xf7;
+	return msg;
+}
+
+/** Empty SysEx message, only "SOX" and "EOX" bytes */
+constexpr message<2> sysex()
+{
+	return {{ MIDI_TYPE_SYSEX, 0xf7 }};
+}
+
+/** Encodes messages at compile time, see midi_encode() */
+template <size_t... N>
+constexpr std::array<uint8_t, (N + ... + 0)> encode(const message<N> &... msgs)
+{
+	std::array<uint8_t, (N + ... + 0)> out{};
+	size_t pos = 0;
+
+	auto append = [&](const auto &msg) {
+		for (uint8_t c : msg.bytes)
+			out[pos++] = c;
+	};
+	(append(msgs), ...);
+
+	return out;
+}
+
+/** Returns the size of messages encoded with Running Status */
+template <size_t... N>
+constexpr size_t running_status_size(const message<N> &... msgs)
+{
+	size_t size = 0;
+	uint8_t status = 0;
+
+	auto append = [&](const auto &msg) {
+		uint8_t s = msg.bytes[0];
+		size += sizeof(msg.bytes);
+		if (s >= MIDI_TYPE_TIMING_CLOCK)
+			return; /* Real Time messages keep Running Status */
+		if (s == status)
+			size--;
+		status = (s < MIDI_TYPE_SYSEX) ? s : 0;
+	};
+	(append(msgs), ...);
+
+	return size;
+}
+
+/**
+ * Encodes messages with Running Status at compile time.
+ *
+ * Size `Size` has to be obtained from running_status_size(), macro
+ * #NANOMIDI_ENCODE_RUNNING_STATUS does that automatically.
+ */
+template <size_t Size, size_t... N>
+constexpr std::array<uint8_t, Size> encode_running_status(
+	const message<N> &... msgs)
+{
+	std::array<uint8_t, Size> out{};
+	size_t pos = 0;
+	uint8_t status = 0;
+
+	auto append = [&](const auto &msg) {
+		uint8_t s = msg.bytes[0];
+		size_t skip = (s < MIDI_TYPE_SYSEX && s == status) ? 1 : 0;
+
+		if (pos + sizeof(msg.bytes) - skip > Size)
+			detail::encoded_size_mismatch();
+
+		for (size_t i = skip; i < sizeof(msg.bytes); i++)
+			out[pos++] = msg.bytes[i];
+
+		if (s < MIDI_TYPE_TIMING_CLOCK)
+			status = (s < MIDI_TYPE_SYSEX) ? s : 0;
+	};
+	(append(msgs), ...);
+
+	if (pos != Size)
+		detail::encoded_size_mismatch();
+
+	return out;
+}
+
+/** Encodes messages with Running Status into std::array of the right size */
+#define NANOMIDI_ENCODE_RUNNING_STATUS(...) \
+	(::nanomidi::encode_running_status< \
+		::nanomidi::running_status_size(__VA_ARGS__)>(__VA_ARGS__))
+
+/** Encodes messages into USB packets at compile time, see midi_encode_usb() */
+template <size_t... N>
+constexpr std::array<uint8_t, 4*(((N+2)/3) + ... + 0)> encode_usb(
+	uint8_t cable_number, const message<N> &... msgs)
+{
+	std::array<uint8_t, 4*(((N+2)/3) + ... + 0)> out{};
+	size_t pos = 0;
+	uint8_t cable = static_cast<uint8_t>((cable_number & 0x0f) << 4);
+
+	auto append = [&](const auto &msg) {
+		size_t length = sizeof(msg.bytes);
+
+		for (size_t i = 0; i < length; i += 3) {
+			size_t remaining = length - i;
+			out[pos] = static_cast<uint8_t>(cable |
+				detail::usb_cin(msg.bytes[0], remaining));
+
+			for (size_t j = 0; j < 3 && i+j < length; j++)
+				out[pos+1+j] = msg.bytes[i+j];
+
+			pos += 4;
+		}
+	};
+	(append(msgs), ...);
+
+	return out;
+}
+
+/** Source reading from a memory buffer */
+struct span_source {
+	const uint8_t *data;
+	size_t size;
+
+	bool read(uint8_t &c)
+	{
+		if (size == 0)
+			return false;
+
+		c = *data++;
+		size--;
+		return true;
+	}
+};
+
+/** Sink writing to a memory buffer */
+struct span_sink {
+	uint8_t *data;
+	size_t size;
+
+	size_t write(const uint8_t *src, size_t n)
+	{
+		if (n > size)
+			return 0;
+
+		for (size_t i = 0; i < n; i++)
+			data[i] = src[i];
+
+		data += n;
+		size -= n;
+		return n;
+	}
+
+	size_t capacity() const
+	{
+		return size;
+	}
+};
+
+/** Single-producer single-consumer ring buffer usable as Source and Sink */
+template <size_t N>
+struct ring_buffer {
+	static_assert(N > 0 && (N & (N-1)) == 0, "N must be a power of two");
+
+	uint8_t data[N];
+	size_t head = 0; /* Read position */
+	size_t tail = 0; /* Write position */
+
+	bool read(uint8_t &c)
+	{
+		if (head == tail)
+			return false;
+
+		c = data[head++ % N];
+		return true;
+	}
+
+	size_t write(const uint8_t *src, size_t n)
+	{
+		if (n > N - (tail - head))
+			return 0;
+
+		for (size_t i = 0; i < n; i++)
+			data[tail++ % N] = src[i];
+
+		return n;
+	}
+
+	size_t capacity() const
+	{
+		return N - (tail - head);
+	}
+};
+
+#ifdef NANOMIDI_HAVE_UNISTD
+/** Source reading from a file descriptor in chunks */
+template <size_t N = 256>
+struct fd_source {
+	int fd;
+	uint8_t buffer[N];
+	size_t pos = 0;
+	size_t length = 0;
+
+	explicit fd_source(int fd) : fd(fd) {}
+
+	bool read(uint8_t &c)
+	{
+		if (pos == length) {
+			ssize_t n = ::read(fd, buffer, N);
+			if (n <= 0)
+				return false;
+
+			pos = 0;
+			length = static_cast<size_t>(n);
+		}
+
+		c = buffer[pos++];
+		return true;
+	}
+};
+
+/**
+ * Sink writing to a file descriptor.
+ *
+ * Short writes are retried. If a non-blocking descriptor is full (EAGAIN),
+ * up to `N` remaining bytes are kept in an internal buffer and sent before
+ * the next write or by flush(); the sink only waits for the descriptor when
+ * the buffer cannot take the rest. This way every write is accepted whole
+ * unless the descriptor fails (e.g. the other end of a pipe is closed).
+ */
+template <size_t N = 256>
+struct fd_sink {
+	int fd;
+	uint8_t buffer[N];
+	size_t length = 0;
+
+	explicit fd_sink(int fd) : fd(fd) {}
+
+	/** Sends buffered bytes, returns `false` if some are still pending */
+	bool flush()
+	{
+		size_t n = send(buffer, length);
+
+		for (size_t i = n; i < length; i++)
+			buffer[i - n] = buffer[i];
+
+		length -= n;
+		return length == 0;
+	}
+
+	size_t write(const uint8_t *src, size_t n)
+	{
+		/* Keep the byte order, never write past pending bytes: */
+		while (!flush() && n > N - length) {
+			if (!wait())
+				return 0;
+		}
+
+		size_t pos = (length == 0) ? send(src, n) : 0;
+
+		while (n - pos > N - length) {
+			if (!wait())
+				return pos;
+			if (flush())
+				pos += send(src + pos, n - pos);
+		}
+
+		for (size_t i = pos; i < n; i++)
+			buffer[length++] = src[i];
+
+		return n;
+	}
+
+private:
+	/* Writes as much as the descriptor takes without blocking */
+	size_t send(const uint8_t *src, size_t n)
+	{
+		size_t pos = 0;
+
+		while (pos < n) {
+			ssize_t ret = ::write(fd, src + pos, n - pos);
+			if (ret > 0)
+				pos += static_cast<size_t>(ret);
+			else if (ret < 0 && errno == EINTR)
+				continue;
+			else
+				break;
+		}
+
+		return pos;
+	}
+
+	/* Waits until the descriptor is writable */
+	bool wait()
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return false;
+
+		struct pollfd pfd = { fd, POLLOUT, 0 };
+		while (::poll(&pfd, 1, -1) < 0) {
+			if (errno != EINTR)
+				return false;
+		}
+
+		return true;
+	}
+};
+#endif /* NANOMIDI_HAVE_UNISTD */
+
+/** Source calling `bool f(uint8_t &c)` */
+template <typename F>
+struct lambda_source {
+	F f;
+
+	bool read(uint8_t &c)
+	{
+		return f(c);
+	}
+};
+
+/** Sink calling `size_t f(const uint8_t *data, size_t size)` */
+template <typename F>
+struct lambda_sink {
+	F f;
+
+	size_t write(const uint8_t *src, size_t n)
+	{
+		return f(src, n);
+	}
+};
+
+template <typename F>
+lambda_source<F> make_source(F f)
+{
+	return lambda_source<F>{std::move(f)};
+}
+
+template <typename F>
+lambda_sink<F> make_sink(F f)
+{
+	return lambda_sink<F>{std::move(f)};
+}
+
+/** MIDI decoder reading from a Source */
+template <typename Source>
+class decoder {
+public:
+	explicit decoder(Source source) : source_(std::move(source)), state_()
+	{
+		state_.capacity = MIDI_STREAM_CAPACITY_UNLIMITED;
+	}
+
+#if NANOMIDI_CONFIG_SYSEX
+	/** Provides a buffer for SysEx messages decoding */
+	void set_sysex_buffer(void *data, size_t size)
+	{
+		state_.sysex_buffer.data = data;
+		state_.sysex_buffer.size = size;
+	}
+#endif
+
+	/** Assigns an optional message filter (see midi_filter_compile()) */
+	void set_filter(const midi_filter *filter)
+	{
+		state_.filter = filter;
+	}
+
+	/** Decodes a single message, see midi_decode() */
+	const midi_message *decode()
+	{
+		uint8_t c;
+
+		while (source_.read(c)) {
+			/* Skip data of filtered messages without decoding: */
+			if (state_.skip && (c & 0x80) == 0)
+				continue;
+
+			midi_message *msg = midi_decode_byte(&state_, c);
+			if (msg != nullptr)
+				return msg;
+		}
+
+		return nullptr;
+	}
+
+	Source &source() { return source_; }
+	/** Decoder state compatible with the C API */
+	midi_istream &state() { return state_; }
+
+private:
+	Source source_;
+	midi_istream state_;
+};
+
+/** MIDI encoder writing to a Sink */
+template <typename Sink>
+class encoder {
+public:
+	explicit encoder(Sink sink) : sink_(std::move(sink)) {}
+
+	/** Encodes a single message, see midi_encode() */
+	size_t encode(const midi_message &msg)
+	{
+#if NANOMIDI_CONFIG_SYSEX
+		if (msg.type == MIDI_TYPE_SYSEX)
+			return encode_sysex(msg);
+#endif
+
+		uint8_t buffer[3];
+		size_t length = detail::encode_short(msg, buffer);
+
+		return (length > 0) ? sink_.write(buffer, length) : 0;
+	}
+
+	Sink &sink() { return sink_; }
+
+private:
+#if NANOMIDI_CONFIG_SYSEX
+	size_t encode_sysex(const midi_message &msg)
+	{
+		const uint8_t *sdata =
+			static_cast<const uint8_t *>(msg.data.sysex.data);
+		size_t slength = (sdata != nullptr) ? msg.data.sysex.length : 0;
+		uint8_t buffer[64];
+		size_t pos = 1;
+		size_t n = 0;
+
+		/* Written in chunks, so check the whole message fits first: */
+		if constexpr (detail::has_capacity<Sink>::value) {
+			if (slength + 2 > sink_.capacity())
+				return 0;
+		}
+
+		buffer[0] = 0xf0;
+
+		for (size_t i = 0; i < slength; i++) {
+			if (pos == sizeof(buffer)) {
+				n += sink_.write(buffer, pos);
+				pos = 0;
+			}
+
+			buffer[pos++] = detail::data_byte(sdata[i]);
+		}
+
+		if (pos == sizeof(buffer)) {
+			n += sink_.write(buffer, pos);
+			pos = 0;
+		}
+
+		buffer[pos++] = 0xf7;
+		return n + sink_.write(buffer, pos);
+	}
+#endif
+
+	Sink sink_;
+};
+
+} /* namespace nanomidi */
+
+#endif /* NANOMIDI_HPP */
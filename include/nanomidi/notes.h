@@ -0,0 +1,92 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_NOTES_H
+#define NANOMIDI_NOTES_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup notes
+ @{ */
+
+/**
+ * Active note tracker
+ *
+ * The structure should be initialized with midi_notes_init().
+ */
+struct midi_note_tracker {
+	/** Bit set of active notes, 128 bits per channel (handled
+	internally) */
+	uint32_t active[16][4];
+	/** Bit mask of channels with Sustain Pedal (controller 64) down */
+	uint16_t sustain;
+	/**
+	 * Pointer to an optional buffer of 16*128 bytes allocated by the
+	 * user, indexed by `(channel-1)*128 + note`. Velocity of each
+	 * Note On message is stored in the buffer.
+	 *
+	 * Can be set to `NULL` if velocity tracking is not needed.
+	 */
+	uint8_t *velocity;
+	/**
+	 * Pointer to an optional callback which is called when Note On is
+	 * received for a note which is already active. This usually means
+	 * that a Note Off message has been lost.
+	 *
+	 * @param tracker       Pointer to associated #midi_note_tracker
+	 * @param channel       Channel (1-16)
+	 * @param note          Note code (0-127)
+	 */
+	void (*stuck_cb)(struct midi_note_tracker *tracker, uint8_t channel,
+			 uint8_t note);
+	/** Optional parameter to be passed to stuck_cb() */
+	void *param;
+};
+
+void midi_notes_init(struct midi_note_tracker *tracker, uint8_t *velocity);
+void midi_notes_update(struct midi_note_tracker *tracker,
+		       const struct midi_message *msg);
+bool midi_notes_is_active(const struct midi_note_tracker *tracker,
+			  uint8_t channel, uint8_t note);
+int midi_notes_next(const struct midi_note_tracker *tracker, uint8_t channel,
+		    int note);
+size_t midi_notes_release(struct midi_note_tracker *tracker,
+			  struct midi_ostream *stream, uint8_t channel);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_NOTES_H */
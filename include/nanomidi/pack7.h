@@ -0,0 +1,93 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_PACK7_H
+#define NANOMIDI_PACK7_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup pack7
+ @{ */
+
+/** Packing scheme of 8-bit data in 7-bit SysEx bytes */
+enum midi_pack7_scheme {
+	/** Groups of seven bytes preceded by a byte with their MSBs, MSB of
+	the first byte in bit 0 */
+	MIDI_PACK7_MSB_GROUP,
+	/** Groups of seven bytes preceded by a byte with their MSBs, MSB of
+	the first byte in bit 6 */
+	MIDI_PACK7_MSB_GROUP_REVERSED,
+	/** Each byte split into two bytes, high nibble first */
+	MIDI_PACK7_NIBBLES,
+};
+
+/** Checksum of packed data */
+enum midi_checksum {
+	/** Roland checksum: sum of all bytes and the checksum is zero (mod
+	128) */
+	MIDI_CHECKSUM_ROLAND,
+	/** Sum of all bytes (mod 128) */
+	MIDI_CHECKSUM_SUM,
+	/** XOR of all bytes */
+	MIDI_CHECKSUM_XOR,
+};
+
+/**
+ * Packing state
+ *
+ * The structure should be initialized with midi_pack7_init().
+ */
+struct midi_pack7 {
+	/** Packing scheme */
+	enum midi_pack7_scheme scheme;
+	/** Sum of packed bytes (handled internally) */
+	uint8_t sum;
+	/** XOR of packed bytes (handled internally) */
+	uint8_t xor_sum;
+	/** Bytes of an incomplete group (handled internally) */
+	uint8_t pending[7];
+	/** Number of bytes in #pending (handled internally) */
+	uint8_t num_pending;
+};
+
+void midi_pack7_init(struct midi_pack7 *state, enum midi_pack7_scheme scheme);
+size_t midi_pack7_encoded_size(enum midi_pack7_scheme scheme, size_t length);
+size_t midi_pack7_decoded_size(enum midi_pack7_scheme scheme, size_t length);
+size_t midi_pack7_encode(struct midi_pack7 *state, uint8_t *out,
+			 const void *data, size_t length);
+size_t midi_pack7_encode_finish(struct midi_pack7 *state, uint8_t *out);
+size_t midi_pack7_decode(struct midi_pack7 *state, uint8_t *out,
+			 const void *data, size_t length);
+void midi_pack7_checksum_update(struct midi_pack7 *state, const void *data,
+				size_t length);
+uint8_t midi_pack7_checksum(const struct midi_pack7 *state,
+			    enum midi_checksum type);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_PACK7_H */
@@ -0,0 +1,112 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_PACKED_H
+#define NANOMIDI_PACKED_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup packed
+ @{ */
+
+/** Invalid SysEx handle */
+#define MIDI_PACKED_NO_HANDLE		0xffff
+
+/**
+ * Packed 4-byte MIDI message
+ *
+ * Channel Mode, System Common and System Real Time messages are stored as they
+ * appear in the stream: status byte (including channel) followed by up to two
+ * data bytes. SysEx messages are stored with #MIDI_TYPE_SYSEX status and
+ * a 16-bit handle to #midi_packed_pool in #data1 (LSB) and #data2 (MSB).
+ */
+struct midi_packed {
+	uint8_t status; /*!< Status byte */
+	uint8_t data1; /*!< First data byte (0-127) or SysEx handle LSB */
+	uint8_t data2; /*!< Second data byte (0-127) or SysEx handle MSB */
+	uint8_t flags; /*!< Not used by nanomidi, free for application use */
+};
+
+/** SysEx descriptor stored in #midi_packed_pool */
+struct midi_packed_sysex {
+	const void *data; /*!< Pointer to SysEx data */
+	size_t length; /*!< Length of data in bytes */
+};
+
+/**
+ * Side pool for SysEx data of packed messages
+ *
+ * The structure should be initialized with midi_packed_pool_init().
+ */
+struct midi_packed_pool {
+	/** SysEx descriptors allocated by the user, indexed by handle */
+	struct midi_packed_sysex *entries;
+	/** Number of elements in #entries */
+	size_t max_entries;
+	/** Number of descriptors used */
+	size_t num_entries;
+	/** Optional buffer allocated by the user for SysEx data. If set to
+	`NULL`, only pointers to the original data are stored. */
+	uint8_t *data;
+	/** Size of #data in bytes */
+	size_t size;
+	/** Number of bytes of #data used */
+	size_t used;
+	/** Number of SysEx messages which did not fit the pool */
+	size_t dropped;
+};
+
+void midi_packed_pool_init(struct midi_packed_pool *pool,
+			   struct midi_packed_sysex *entries,
+			   size_t max_entries, uint8_t *data, size_t size);
+void midi_packed_pool_reset(struct midi_packed_pool *pool);
+bool midi_pack(struct midi_packed *packed, const struct midi_message *msg,
+	       struct midi_packed_pool *pool);
+bool midi_unpack(struct midi_message *msg, const struct midi_packed *packed,
+		 const struct midi_packed_pool *pool);
+bool midi_decode_packed(struct midi_istream *stream,
+			struct midi_packed *packed,
+			struct midi_packed_pool *pool);
+size_t midi_encode_packed(struct midi_ostream *stream,
+			  const struct midi_packed *packed,
+			  const struct midi_packed_pool *pool);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_PACKED_H */
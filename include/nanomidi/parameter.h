@@ -0,0 +1,120 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_PARAMETER_H
+#define NANOMIDI_PARAMETER_H
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup parameter
+ @{ */
+
+/** High-resolution parameter types */
+enum midi_parameter_type {
+	/** Controller 0-31 with optional LSB in controller 32-63 */
+	MIDI_PARAMETER_CONTROLLER,
+	/** Registered Parameter Number (controllers 101 and 100) */
+	MIDI_PARAMETER_RPN,
+	/** Non-Registered Parameter Number (controllers 99 and 98) */
+	MIDI_PARAMETER_NRPN,
+};
+
+/** High-resolution parameter change */
+struct midi_parameter {
+	/** Parameter type */
+	enum midi_parameter_type type;
+	/** Channel (1-16) */
+	uint8_t channel;
+	/** Controller number (0-31) or parameter number (0-16383) */
+	uint16_t number;
+	/** Parameter value (0-16383), MSB in bits 7-13 and LSB in bits 0-6 */
+	uint16_t value;
+};
+
+/**
+ * State of the parameter decoder
+ *
+ * The structure should be initialized with midi_parameter_decoder_init().
+ */
+struct midi_parameter_decoder {
+	/** Per-channel state (handled internally) */
+	struct midi_parameter_decoder_channel {
+		/** Last MSB received for controllers 0-31 */
+		uint8_t msb[32];
+		/** Selected parameter number MSB and LSB */
+		uint8_t number[2];
+		/** Selected parameter type or #MIDI_PARAMETER_CONTROLLER
+		if none is selected */
+		uint8_t selected;
+	} channels[16];
+	/** Bit mask of controllers (0-31) which are always followed by LSB.
+	Changes of these controllers are reported once the LSB arrives. For
+	other controllers, both MSB and LSB are reported, so an MSB and LSB
+	pair (e.g. from midi_parameter_encode()) gives two changes. */
+	uint32_t lsb_controllers;
+	/** Last decoded parameter */
+	struct midi_parameter param;
+};
+
+/**
+ * State of the parameter encoder
+ *
+ * The structure should be initialized with midi_parameter_encoder_init().
+ */
+struct midi_parameter_encoder {
+	/** Per-channel state (handled internally) */
+	struct midi_parameter_encoder_channel {
+		/** Last MSB sent for controllers 0-31 (0xff if unknown) */
+		uint8_t msb[32];
+		/** Selected parameter number MSB and LSB (0xff if unknown) */
+		uint8_t number[2];
+		/** Selected parameter type */
+		uint8_t selected;
+	} channels[16];
+};
+
+void midi_parameter_decoder_init(struct midi_parameter_decoder *decoder,
+				 uint32_t lsb_controllers);
+struct midi_parameter *midi_parameter_decode(
+	struct midi_parameter_decoder *decoder, const struct midi_message *msg);
+
+void midi_parameter_encoder_init(struct midi_parameter_encoder *encoder);
+size_t midi_parameter_encode(struct midi_parameter_encoder *encoder,
+			     struct midi_ostream *stream,
+			     const struct midi_parameter *param);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_PARAMETER_H */
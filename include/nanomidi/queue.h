@@ -0,0 +1,91 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_QUEUE_H
+#define NANOMIDI_QUEUE_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup queue
+ @{ */
+
+/** Number of distinct coalescing keys (controllers, pressure, pitch bend) */
+#define MIDI_QUEUE_KEYS		(16*128 + 16*128 + 16 + 16)
+
+/**
+ * Output queue with latest-value coalescing
+ *
+ * The structure should be initialized with midi_queue_init().
+ */
+struct midi_queue {
+	/** Message storage allocated by the user */
+	struct midi_message *messages;
+	/** Number of messages in #messages */
+	size_t size;
+	/** Read position (handled internally) */
+	size_t head;
+	/** Write position (handled internally) */
+	size_t tail;
+	/** Write position following the last message which cannot be
+	reordered (handled internally) */
+	size_t barrier;
+	/** Bit mask of keys with a message in the queue (handled
+	internally) */
+	uint32_t pending[(MIDI_QUEUE_KEYS + 31) / 32];
+	/** Position of the newest pending message in #messages for each key
+	(handled internally) */
+	uint16_t slot[MIDI_QUEUE_KEYS];
+	/** Replace pending values with newer ones (`true` after
+	midi_queue_init(), may be changed while the queue is empty) */
+	bool coalescing;
+	/** Number of messages replaced by a newer value */
+	size_t coalesced;
+	/** Number of messages removed by midi_queue_encode() because they
+	cannot be encoded */
+	size_t dropped;
+};
+
+void midi_queue_init(struct midi_queue *queue, struct midi_message *messages,
+		     size_t size);
+bool midi_queue_push(struct midi_queue *queue, const struct midi_message *msg);
+struct midi_message *midi_queue_peek(struct midi_queue *queue);
+void midi_queue_pop(struct midi_queue *queue);
+size_t midi_queue_encode(struct midi_queue *queue, struct midi_ostream *stream);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_QUEUE_H */
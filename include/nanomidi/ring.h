@@ -0,0 +1,68 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_RING_H
+#define NANOMIDI_RING_H
+
+#ifdef ARDUINO
+#include <../include/nanomidi/decoder.h>
+#else
+#include <nanomidi/decoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup ring
+ @{ */
+
+/**
+ * Circular receive buffer shared by a producer (e.g. DMA in circular mode)
+ * and the decoder
+ *
+ * The structure should be initialized using midi_ring_init().
+ */
+struct midi_ring {
+	/** Pointer to the buffer allocated by the user */
+	const uint8_t *data;
+	/** Buffer size (in bytes) */
+	size_t size;
+	/** Index of the next byte to be decoded, advanced by the decoder */
+	volatile size_t read;
+	/** Index of the next byte to be written, advanced by the producer using
+	midi_ring_set_write() */
+	volatile size_t write;
+};
+
+void midi_ring_init(struct midi_ring *ring, const void *buffer, size_t size);
+void midi_ring_set_write(struct midi_ring *ring, size_t write);
+size_t midi_ring_available(const struct midi_ring *ring);
+void midi_istream_from_ring(struct midi_istream *stream,
+			    struct midi_ring *ring);
+size_t midi_decoder_feed_ring(struct midi_istream *stream,
+			      struct midi_ring *ring, struct midi_sink *sink);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_RING_H */
@@ -0,0 +1,198 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_RTP_H
+#define NANOMIDI_RTP_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup rtp
+ @{ */
+
+/** Size of the RTP header written by midi_rtp_flush() */
+#define MIDI_RTP_HEADER_SIZE		12
+/** Maximum length of the MIDI list in the command section */
+#define MIDI_RTP_MAX_LIST		4095
+/** Default dynamic payload type */
+#define MIDI_RTP_PAYLOAD_TYPE_DEFAULT	97
+
+/** Recovery journal chapter flags in a channel journal header */
+enum midi_rtp_chapter {
+	MIDI_RTP_CHAPTER_P = 0x80, /*!< Program Change */
+	MIDI_RTP_CHAPTER_C = 0x40, /*!< Control Change */
+	MIDI_RTP_CHAPTER_M = 0x20, /*!< Parameter System (not used) */
+	MIDI_RTP_CHAPTER_W = 0x10, /*!< Pitch Wheel */
+	MIDI_RTP_CHAPTER_N = 0x08, /*!< Note Off/On */
+	MIDI_RTP_CHAPTER_E = 0x04, /*!< Note Command Extras (not used) */
+	MIDI_RTP_CHAPTER_T = 0x02, /*!< Channel Aftertouch */
+	MIDI_RTP_CHAPTER_A = 0x01, /*!< Poly Aftertouch (not used) */
+};
+
+/**
+ * Recovery journal state of a single MIDI channel
+ *
+ * All fields are handled internally. Each value is stored together with
+ * the sequence number of the packet which carried it.
+ */
+struct midi_rtp_channel {
+	/** Chapters with a value since the checkpoint */
+	uint8_t chapters;
+	/** Last Program Change */
+	uint8_t program;
+	/** Sequence number of #program */
+	uint16_t program_seqnum;
+	/** Last Pitch Bend */
+	uint16_t pitch_bend;
+	/** Sequence number of #pitch_bend */
+	uint16_t pitch_bend_seqnum;
+	/** Last Channel Pressure */
+	uint8_t pressure;
+	/** Sequence number of #pressure */
+	uint16_t pressure_seqnum;
+	/** Sequence number of the last Control Change */
+	uint16_t controllers_seqnum;
+	/** Bit mask of controllers with a value since the checkpoint */
+	uint32_t controllers[4];
+	/** Last value of each controller */
+	uint8_t controller_values[128];
+	/** Sequence number of each controller value */
+	uint16_t controller_seqnums[128];
+	/** Sequence number of the last Note On or Note Off */
+	uint16_t notes_seqnum;
+	/** Bit mask of notes whose last command was Note On */
+	uint32_t notes_on[4];
+	/** Bit mask of notes whose last command was Note Off */
+	uint32_t notes_off[4];
+	/** Velocity of the last Note On of each note */
+	uint8_t velocities[128];
+	/** Sequence number of the last command of each note */
+	uint16_t note_seqnums[128];
+};
+
+/**
+ * Recovery journal builder
+ *
+ * The journal keeps the latest state of each channel since the checkpoint
+ * packet so it can be encoded without scanning the history. The structure
+ * should be initialized with midi_rtp_journal_init().
+ */
+struct midi_rtp_journal {
+	/** Per-channel state (handled internally) */
+	struct midi_rtp_channel channels[16];
+	/** Bit mask of channels with a chapter (handled internally) */
+	uint16_t active;
+	/** Oldest packet coded in the journal (handled internally) */
+	uint16_t checkpoint;
+};
+
+/**
+ * RTP MIDI packet encoder
+ *
+ * The structure should be initialized with midi_rtp_encoder_init().
+ */
+struct midi_rtp_encoder {
+	/** MIDI list buffer allocated by the user */
+	uint8_t *list;
+	/** Size of #list, at most #MIDI_RTP_MAX_LIST */
+	size_t size;
+	/** Number of bytes in #list (handled internally) */
+	size_t length;
+	/** Optional recovery journal, `NULL` if not used */
+	struct midi_rtp_journal *journal;
+	/** Synchronization source identifier */
+	uint32_t ssrc;
+	/** RTP payload type */
+	uint8_t payload_type;
+	/** Sequence number of the next packet */
+	uint16_t seqnum;
+	/** RTP timestamp of the current packet (handled internally) */
+	uint32_t timestamp;
+	/** Timestamp of the last command in #list (handled internally) */
+	uint32_t time;
+	/** Status byte which can be omitted, 0 if none (handled internally) */
+	uint8_t running_status;
+};
+
+/**
+ * RTP MIDI packet decoder
+ *
+ * The structure should be initialized with midi_rtp_decoder_init().
+ */
+struct midi_rtp_decoder {
+	/**
+	 * Byte stream decoder state. Fields midi_istream.sysex_buffer,
+	 * midi_istream.sysex_pool and midi_istream.filter can be set by the
+	 * user, other fields are handled internally.
+	 */
+	struct midi_istream stream;
+	/** Timestamp of the message passed to the sink */
+	uint32_t timestamp;
+	/** Sequence number of the last packet */
+	uint16_t seqnum;
+	/** Number of packets received */
+	uint32_t received;
+	/** Number of packets lost (according to sequence numbers) */
+	uint32_t lost;
+	/** Recovery journal of the last packet, `NULL` if none */
+	const uint8_t *journal;
+	/** Size of #journal (in bytes) */
+	size_t journal_size;
+};
+
+void midi_rtp_journal_init(struct midi_rtp_journal *journal);
+void midi_rtp_journal_update(struct midi_rtp_journal *journal,
+			     const struct midi_message *msg, uint16_t seqnum);
+void midi_rtp_journal_checkpoint(struct midi_rtp_journal *journal,
+				 uint16_t seqnum);
+size_t midi_rtp_journal_encode(struct midi_rtp_journal *journal,
+			       struct midi_ostream *stream, uint16_t seqnum);
+void midi_rtp_encoder_init(struct midi_rtp_encoder *encoder, void *list,
+			   size_t size, uint32_t ssrc,
+			   struct midi_rtp_journal *journal);
+size_t midi_rtp_encode(struct midi_rtp_encoder *encoder,
+		       const struct midi_message *msg, uint32_t timestamp);
+size_t midi_rtp_flush(struct midi_rtp_encoder *encoder,
+		      struct midi_ostream *stream);
+void midi_rtp_decoder_init(struct midi_rtp_decoder *decoder);
+size_t midi_rtp_decode(struct midi_rtp_decoder *decoder, const void *packet,
+		       size_t size, struct midi_sink *sink);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_RTP_H */
@@ -0,0 +1,162 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_SDS_H
+#define NANOMIDI_SDS_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/messages.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup sds
+ @{ */
+
+/** Number of sample data bytes in a Data Packet */
+#define MIDI_SDS_PACKET_SIZE		120
+/** Maximum number of Data Packets in flight */
+#define MIDI_SDS_MAX_WINDOW		64
+
+/** Sustain loop type */
+enum midi_sds_loop {
+	MIDI_SDS_LOOP_FORWARD = 0x00, /*!< Forward only */
+	MIDI_SDS_LOOP_ALTERNATING = 0x01, /*!< Backward/forward */
+	MIDI_SDS_LOOP_OFF = 0x7f, /*!< Loop off */
+};
+
+/** State of a sample dump transfer */
+enum midi_sds_state {
+	MIDI_SDS_IDLE, /*!< Dump Header not sent or received yet */
+	MIDI_SDS_HEADER, /*!< Dump Header sent, waiting for a response */
+	MIDI_SDS_DATA, /*!< Transferring Data Packets */
+	MIDI_SDS_DONE, /*!< All Data Packets transferred */
+	MIDI_SDS_CANCELLED, /*!< Transfer cancelled */
+};
+
+/** Content of Dump Header */
+struct midi_sds_header {
+	uint16_t sample_number; /*!< Sample number (0-16383) */
+	uint8_t bits; /*!< Sample format in bits per word (8-28) */
+	uint32_t period; /*!< Sample period in nanoseconds */
+	uint32_t length; /*!< Sample length in words */
+	uint32_t loop_start; /*!< Sustain loop start point (word number) */
+	uint32_t loop_end; /*!< Sustain loop end point (word number) */
+	uint8_t loop_type; /*!< Sustain loop type (#midi_sds_loop) */
+};
+
+/**
+ * Sample dump sender
+ *
+ * The structure should be initialized with midi_sds_sender_init().
+ */
+struct midi_sds_sender {
+	/** Device ID (channel) of the transfer */
+	uint8_t channel;
+	/** Maximum number of Data Packets sent before they are acknowledged
+	(1 is the stop-and-wait handshake, up to #MIDI_SDS_MAX_WINDOW) */
+	uint8_t window;
+	/** Open loop mode, send all Data Packets without waiting */
+	bool open_loop;
+	/** Time in ticks after which an unacknowledged Data Packet is assumed
+	to be received (20 ms by default) */
+	uint32_t timeout;
+	/** Time in ticks to wait for a response to Dump Header before
+	switching to open loop (2 s by default) */
+	uint32_t header_timeout;
+	/** Transfer state */
+	enum midi_sds_state state;
+	/** Dump Header */
+	struct midi_sds_header header;
+	/** Sample words (`int8_t`, `int16_t` or `int32_t` depending on
+	midi_sds_header.bits) */
+	const void *samples;
+	/** Number of Data Packets */
+	uint32_t num_packets;
+	/** Index of the next Data Packet to be sent (handled internally) */
+	uint32_t next;
+	/** Index of the first unacknowledged Data Packet (handled
+	internally) */
+	uint32_t acked;
+	/** Time of the last handshake or timeout (handled internally) */
+	uint32_t timestamp;
+	/** Receiver asked to wait (handled internally) */
+	bool wait;
+	/** Number of Data Packets sent again after NAK */
+	size_t resent;
+};
+
+/**
+ * Sample dump receiver
+ *
+ * The structure should be initialized with midi_sds_receiver_init().
+ */
+struct midi_sds_receiver {
+	/** Device ID (channel) of the receiver */
+	uint8_t channel;
+	/** Transfer state */
+	enum midi_sds_state state;
+	/** Received Dump Header */
+	struct midi_sds_header header;
+	/** Buffer for sample words allocated by the user (`int8_t`,
+	`int16_t` or `int32_t` depending on midi_sds_header.bits) */
+	void *samples;
+	/** Number of words which fit #samples */
+	size_t max_samples;
+	/** Number of Data Packets */
+	uint32_t num_packets;
+	/** Index of the next expected Data Packet (handled internally) */
+	uint32_t next;
+	/** NAK for the expected Data Packet was sent (handled internally) */
+	bool nak_sent;
+	/** Number of Data Packets with wrong checksum or length */
+	size_t errors;
+};
+
+size_t midi_sds_encode_request(struct midi_ostream *stream, uint8_t channel,
+			       uint16_t sample_number);
+void midi_sds_sender_init(struct midi_sds_sender *sender, uint8_t channel,
+			  const struct midi_sds_header *header,
+			  const void *samples, uint32_t ticks_per_second);
+size_t midi_sds_send(struct midi_sds_sender *sender,
+		     struct midi_ostream *stream, uint32_t now);
+bool midi_sds_sender_receive(struct midi_sds_sender *sender,
+			     const struct midi_message *msg, uint32_t now);
+void midi_sds_receiver_init(struct midi_sds_receiver *receiver,
+			    uint8_t channel, void *samples,
+			    size_t max_samples);
+size_t midi_sds_receive(struct midi_sds_receiver *receiver,
+			const struct midi_message *msg,
+			struct midi_ostream *stream);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_SDS_H */
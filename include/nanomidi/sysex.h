@@ -0,0 +1,138 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_SYSEX_H
+#define NANOMIDI_SYSEX_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/messages.h>
+#else
+#include <nanomidi/messages.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup sysex
+ @{ */
+
+/** Manufacturer ID from a 1-byte ID */
+#define MIDI_SYSEX_ID(b)		((uint32_t)(b) << 16)
+/** Manufacturer ID from a 3-byte ID (0x00 followed by two bytes) */
+#define MIDI_SYSEX_ID_EXTENDED(b1, b2)	(((uint32_t)(b1) << 8) | (b2))
+
+/** Non-commercial ID (for research and development) */
+#define MIDI_SYSEX_ID_NON_COMMERCIAL	MIDI_SYSEX_ID(0x7d)
+/** Universal Non-Real Time ID */
+#define MIDI_SYSEX_ID_NON_REALTIME	MIDI_SYSEX_ID(0x7e)
+/** Universal Real Time ID */
+#define MIDI_SYSEX_ID_REALTIME		MIDI_SYSEX_ID(0x7f)
+
+/** Device ID addressing all devices */
+#define MIDI_SYSEX_ALL_DEVICES		0x7f
+/** Wildcard matching any sub-ID in #midi_sysex_route */
+#define MIDI_SYSEX_ANY			0xff
+
+/** Universal Non-Real Time sub-ID #1 of General Information messages */
+#define MIDI_SYSEX_GENERAL_INFO		0x06
+/** Sub-ID #2 of Identity Request */
+#define MIDI_SYSEX_IDENTITY_REQUEST	0x01
+/** Sub-ID #2 of Identity Reply */
+#define MIDI_SYSEX_IDENTITY_REPLY	0x02
+
+/** Decoded SysEx header */
+struct midi_sysex_header {
+	/** Manufacturer ID (see #MIDI_SYSEX_ID and #MIDI_SYSEX_ID_EXTENDED) */
+	uint32_t id;
+	/** Device ID of universal messages (#MIDI_SYSEX_ALL_DEVICES for
+	manufacturer messages) */
+	uint8_t device;
+	/** Sub-ID #1 of universal messages (#MIDI_SYSEX_ANY for manufacturer
+	messages) */
+	uint8_t sub_id1;
+	/** Sub-ID #2 of universal messages (#MIDI_SYSEX_ANY if missing) */
+	uint8_t sub_id2;
+	/** Data following the manufacturer ID (manufacturer messages) or
+	sub-ID #1 (universal messages), points into the original message */
+	const uint8_t *payload;
+	/** Length of #payload in bytes */
+	size_t length;
+};
+
+/** Content of Identity Reply */
+struct midi_sysex_identity {
+	uint32_t manufacturer; /*!< Manufacturer ID */
+	uint16_t family; /*!< Device family code (14 bits) */
+	uint16_t model; /*!< Device family member code (14 bits) */
+	uint8_t version[4]; /*!< Software revision level */
+};
+
+/** Entry of the SysEx dispatch table */
+struct midi_sysex_route {
+	/** Manufacturer ID */
+	uint32_t id;
+	/** Sub-ID #1 of universal messages or #MIDI_SYSEX_ANY */
+	uint8_t sub_id1;
+	/** Sub-ID #2 of universal messages or #MIDI_SYSEX_ANY */
+	uint8_t sub_id2;
+	/** Handler called with the decoded header */
+	void (*handler)(const struct midi_sysex_header *header, void *param);
+	/** Parameter passed to #handler */
+	void *param;
+};
+
+/**
+ * SysEx dispatcher
+ *
+ * The structure should be initialized with midi_sysex_dispatcher_init().
+ */
+struct midi_sysex_dispatcher {
+	/** Dispatch table allocated by the user, sorted by
+	midi_sysex_route.id */
+	const struct midi_sysex_route *routes;
+	/** Number of elements in #routes */
+	size_t num_routes;
+	/** Own device ID, universal messages addressed to other devices are
+	ignored (#MIDI_SYSEX_ALL_DEVICES accepts all messages) */
+	uint8_t device;
+	/** Index of the first route for each first ID byte (handled
+	internally) */
+	uint16_t first[129];
+};
+
+bool midi_sysex_parse(struct midi_sysex_header *header, const void *data,
+		      size_t length);
+bool midi_sysex_decode_identity(struct midi_sysex_identity *identity,
+				const struct midi_sysex_header *header);
+void midi_sysex_dispatcher_init(struct midi_sysex_dispatcher *dispatcher,
+				const struct midi_sysex_route *routes,
+				size_t num_routes);
+bool midi_sysex_dispatch(const struct midi_sysex_dispatcher *dispatcher,
+			 const struct midi_message *msg);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_SYSEX_H */
@@ -0,0 +1,90 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_SYSEX_POOL_H
+#define NANOMIDI_SYSEX_POOL_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/decoder.h>
+#else
+#include <nanomidi/decoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup sysex_pool
+ @{ */
+
+/** Invalid block index */
+#define MIDI_SYSEX_POOL_NO_BLOCK	0xffff
+
+/** Number of `uint32_t` words of the free block map for `blocks` blocks */
+#define MIDI_SYSEX_POOL_MAP_SIZE(blocks)	(((blocks) + 31) / 32)
+
+/**
+ * Fixed-block pool for SysEx messages decoded by midi_decode()
+ *
+ * The structure should be initialized with midi_sysex_pool_init() and
+ * assigned to midi_istream.sysex_pool.
+ */
+struct midi_sysex_pool {
+	/** Block storage allocated by the user (`num_blocks * block_size`
+	bytes) */
+	uint8_t *data;
+	/** Size of a single block in bytes */
+	size_t block_size;
+	/** Next block of the message for each block, allocated by the user */
+	uint16_t *next;
+	/** Map of free blocks allocated by the user (bit `n % 32` in
+	`free_map[n / 32]` for block `n`) */
+	volatile uint32_t *free_map;
+	/** Number of blocks */
+	uint16_t num_blocks;
+	/** Number of free blocks */
+	volatile uint16_t num_free;
+	/** Lowest number of free blocks seen so far */
+	uint16_t min_free;
+	/** Number of SysEx messages dropped because the pool was exhausted */
+	volatile uint32_t exhausted;
+	/** First block of the message being decoded (handled internally) */
+	uint16_t first;
+	/** Last block of the message being decoded (handled internally) */
+	uint16_t last;
+};
+
+void midi_sysex_pool_init(struct midi_sysex_pool *pool, void *data,
+			  size_t block_size, uint16_t num_blocks,
+			  uint16_t *next, uint32_t *free_map);
+uint16_t midi_sysex_pool_acquire(struct midi_sysex_pool *pool);
+bool midi_sysex_pool_extend(struct midi_sysex_pool *pool);
+void midi_sysex_pool_release(struct midi_sysex_pool *pool, const void *data);
+const void *midi_sysex_pool_next(const struct midi_sysex_pool *pool,
+				 const void *data);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_SYSEX_POOL_H */
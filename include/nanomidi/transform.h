@@ -0,0 +1,106 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_TRANSFORM_H
+#define NANOMIDI_TRANSFORM_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup transform
+ @{ */
+
+/** Keyboard split (or transposition) rule */
+struct midi_transform_split {
+	uint8_t channel; /*!< Input channel (1-16) */
+	uint8_t low; /*!< Lowest note in the range (0-127) */
+	uint8_t high; /*!< Highest note in the range (0-127) */
+	uint8_t out_channel; /*!< Output channel (1-16), 0 to keep the channel
+			     given by midi_transform_rules.channels */
+	int8_t transpose; /*!< Transposition in semitones */
+};
+
+/** Rule set to be compiled by midi_transform_compile() */
+struct midi_transform_rules {
+	/** Output channel (1-16) for each input channel, 0 to keep the
+	channel unchanged */
+	uint8_t channels[16];
+	/** Bit mask of input channels to be dropped (bit 0 for channel 1) */
+	uint16_t mute;
+	/** Array of split rules, later rules take precedence */
+	const struct midi_transform_split *splits;
+	/** Number of elements in #splits */
+	size_t num_splits;
+	/** Optional 128-entry velocity curve for each input channel (`NULL`
+	for linear curve) */
+	const uint8_t *velocity[16];
+};
+
+/** Compiled lookup tables */
+struct midi_transform_table {
+	/** Output channel index (0-15) for each input channel, 0xff to drop */
+	uint8_t channel[16];
+	/** Output channel index and note for each input channel and note */
+	struct midi_transform_note {
+		uint8_t channel; /*!< Output channel index, 0xff to drop */
+		uint8_t note; /*!< Output note */
+	} note[16][128];
+	/** Note On velocity for each input channel and velocity */
+	uint8_t velocity[16][128];
+};
+
+/**
+ * Message transformation pipeline
+ *
+ * The structure should be initialized with midi_transform_init().
+ */
+struct midi_transform {
+	/** Active table (handled internally) */
+	const struct midi_transform_table *volatile table;
+};
+
+void midi_transform_compile(struct midi_transform_table *table,
+			    const struct midi_transform_rules *rules);
+void midi_transform_init(struct midi_transform *transform,
+			 const struct midi_transform_table *table);
+void midi_transform_set_table(struct midi_transform *transform,
+			      const struct midi_transform_table *table);
+bool midi_transform_apply(const struct midi_transform *transform,
+			  struct midi_message *msg);
+size_t midi_transform_apply_all(const struct midi_transform *transform,
+				struct midi_message *msgs, size_t count);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_TRANSFORM_H */
@@ -0,0 +1,84 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_UMP_H
+#define NANOMIDI_UMP_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/common.h>
+#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/common.h>
+#include <nanomidi/messages.h>
+#include <nanomidi/decoder.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup ump
+ @{ */
+
+/** Number of groups in Universal MIDI Packet stream */
+#define MIDI_UMP_GROUPS		16
+
+/**
+ * Translation state of a single MIDI 1.0 byte stream mapped to an UMP group
+ *
+ * The structure should be initialized with midi_ump_port_init() before it is
+ * passed to midi_bytes_to_ump().
+ */
+struct midi_ump_port {
+	/** Decoder state of the MIDI 1.0 byte stream (handled internally) */
+	struct midi_istream decoder;
+#if NANOMIDI_CONFIG_SYSEX
+	/** SysEx bytes not yet sent in a SysEx7 packet (handled internally) */
+	uint8_t sysex[6];
+	/** Number of bytes in #sysex (handled internally) */
+	uint8_t sysex_length;
+	/** SysEx message is being translated (handled internally) */
+	bool sysex_active;
+	/** SysEx Start packet has been sent (handled internally) */
+	bool sysex_started;
+#endif
+	/** UMP group (0-15) the byte stream is mapped to */
+	uint8_t group;
+};
+
+void midi_ump_port_init(struct midi_ump_port *port, uint8_t group);
+size_t midi_encode_ump(struct midi_ostream *stream,
+		       const struct midi_message *msg, uint8_t group);
+size_t midi_bytes_to_ump(struct midi_ump_port *port, struct midi_istream *bytes,
+			 struct midi_ostream *ump);
+size_t midi_ump_to_bytes(struct midi_istream *ump,
+			 struct midi_ostream *ports[MIDI_UMP_GROUPS]);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_UMP_H */
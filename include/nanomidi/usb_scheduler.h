@@ -0,0 +1,117 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NANOMIDI_USB_SCHEDULER_H
+#define NANOMIDI_USB_SCHEDULER_H
+
+#include <stdbool.h>
+
+#ifdef ARDUINO
+#include <../include/nanomidi/queue.h>
+#else
+#include <nanomidi/queue.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup usb_scheduler
+ @{ */
+
+/** Number of USB MIDI cables */
+#define MIDI_USB_CABLES			16
+/** Number of System Real Time messages waiting for transmission */
+#define MIDI_USB_REALTIME_SIZE		16
+
+/**
+ * Output port (cable) of #midi_usb_scheduler
+ *
+ * The structure should be initialized with midi_usb_port_init().
+ */
+struct midi_usb_port {
+	/** Message queue */
+	struct midi_queue queue;
+	/** Time of queueing for each element of midi_queue.messages,
+	allocated by the user (handled internally) */
+	uint32_t *times;
+	/** Number of packets sent in a row before the next cable is served */
+	uint8_t weight;
+	/** Number of bytes of the first SysEx message already sent (handled
+	internally) */
+	size_t offset;
+	/** Number of messages sent */
+	uint32_t messages;
+	/** Number of packets sent */
+	uint32_t packets;
+	/** Sum of latencies of sent messages in ticks */
+	uint64_t total_latency;
+	/** Maximum latency of a sent message in ticks */
+	uint32_t max_latency;
+	/** Number of messages which did not fit the queue */
+	uint32_t dropped;
+};
+
+/** System Real Time message waiting for transmission */
+struct midi_usb_realtime {
+	uint8_t cable; /*!< Cable number */
+	uint8_t type; /*!< Message type */
+	uint32_t time; /*!< Time of queueing */
+};
+
+/**
+ * Multi-cable USB MIDI output scheduler
+ *
+ * The structure should be initialized with midi_usb_scheduler_init().
+ */
+struct midi_usb_scheduler {
+	/** Ports assigned to cables, `NULL` if not used */
+	struct midi_usb_port *ports[MIDI_USB_CABLES];
+	/** Cable being served (handled internally) */
+	uint8_t current;
+	/** Packets left for the cable being served (handled internally) */
+	uint8_t credit;
+	/** Pending System Real Time messages (handled internally) */
+	struct midi_usb_realtime realtime[MIDI_USB_REALTIME_SIZE];
+	/** Read position in #realtime (handled internally) */
+	size_t head;
+	/** Write position in #realtime (handled internally) */
+	size_t tail;
+};
+
+void midi_usb_port_init(struct midi_usb_port *port,
+			struct midi_message *messages, uint32_t *times,
+			size_t size, uint8_t weight);
+void midi_usb_scheduler_init(struct midi_usb_scheduler *scheduler);
+void midi_usb_scheduler_add_port(struct midi_usb_scheduler *scheduler,
+				 uint8_t cable_number,
+				 struct midi_usb_port *port);
+bool midi_usb_scheduler_push(struct midi_usb_scheduler *scheduler,
+			     uint8_t cable_number,
+			     const struct midi_message *msg, uint32_t now);
+size_t midi_usb_scheduler_encode(struct midi_usb_scheduler *scheduler,
+				 struct midi_ostream *stream, uint32_t now);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NANOMIDI_USB_SCHEDULER_H */
@@ -26,6 +26,23 @@
 
 #include <../include/nanomidi/encoder.h>
 #include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/ump.h>
+#include <../include/nanomidi/parameter.h>
+#include <../include/nanomidi/queue.h>
+#include <../include/nanomidi/notes.h>
+#include <../include/nanomidi/transform.h>
+#include <../include/nanomidi/packed.h>
+#include <../include/nanomidi/ring.h>
+#include <../include/nanomidi/sysex_pool.h>
+#include <../include/nanomidi/mtc.h>
+#include <../include/nanomidi/clock.h>
+#include <../include/nanomidi/block.h>
+#include <../include/nanomidi/sysex.h>
+#include <../include/nanomidi/pack7.h>
+#include <../include/nanomidi/sds.h>
+#include <../include/nanomidi/usb_scheduler.h>
+#include <../include/nanomidi/ble.h>
+#include <../include/nanomidi/rtp.h>
 
 #endif /* ARDUINO */
 
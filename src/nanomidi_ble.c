@@ -0,0 +1,390 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * BLE MIDI packet encoder and decoder
+ * @defgroup ble BLE MIDI
+ *
+ * The packet format is described in the Specification for MIDI over Bluetooth
+ * Low Energy (BLE-MIDI). Each packet starts with a header byte holding the
+ * upper 6 bits of a 13-bit millisecond timestamp, each message is preceded by
+ * a timestamp byte holding the lower 7 bits.
+ *
+ * The encoder packs as many messages into a packet as possible. Status bytes
+ * of Channel Voice messages are omitted if the previous message in the packet
+ * has the same status (Running Status). Timestamp bytes of such messages are
+ * also omitted if the timestamp does not change. A new packet is started if
+ * the timestamp goes back or advances by 128 ms or more, as such a timestamp
+ * cannot be represented in the current packet. SysEx messages span as many
+ * packets as needed.
+ *
+ * The decoder restores the full 13-bit timestamp of each message, including
+ * the overflow of the lower 7 bits within a packet.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/ble.h>
+#else
+#include <nanomidi/ble.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define TIMESTAMP_MASK		(MIDI_BLE_TIMESTAMP_PERIOD - 1)
+#define TIMESTAMP_LOW_PERIOD	128
+
+static uint8_t header_byte(uint16_t timestamp)
+{
+	return (uint8_t)(0x80 | ((timestamp >> 7) & 0x3f));
+}
+
+static uint8_t timestamp_byte(uint16_t timestamp)
+{
+	return (uint8_t)(0x80 | (timestamp & 0x7f));
+}
+
+static void start_packet(struct midi_ble_encoder *encoder, uint16_t timestamp)
+{
+	encoder->packet[0] = header_byte(timestamp);
+	encoder->length = 1;
+	encoder->timestamp = timestamp;
+	encoder->running_status = 0;
+}
+
+/* Checks whether a message of given size fits the current packet */
+static bool fits(const struct midi_ble_encoder *encoder, uint16_t timestamp,
+		 size_t length)
+{
+	uint16_t delta = (timestamp - encoder->timestamp) & TIMESTAMP_MASK;
+
+	return (encoder->length > 0 && delta < TIMESTAMP_LOW_PERIOD &&
+		encoder->length + length <= encoder->size);
+}
+
+static void put(struct midi_ble_encoder *encoder, uint8_t c)
+{
+	encoder->packet[encoder->length++] = c;
+}
+
+#if NANOMIDI_CONFIG_SYSEX
+/* Returns the number of bytes written to the stream while encoding SysEx,
+ * i.e. the size of all packets completed by the message */
+static size_t sysex_flush_size(const struct midi_ble_encoder *encoder,
+			       uint16_t timestamp, size_t slength)
+{
+	size_t length = encoder->length;
+	size_t total = 0;
+
+	if (!fits(encoder, timestamp, 2)) {
+		total += length;
+		length = 1;
+	}
+
+	length += 2;
+	for (size_t i = 0; i <= slength; i++) {
+		size_t needed = (i < slength) ? 1 : 2;
+		if (length + needed > encoder->size) {
+			total += length;
+			length = 1;
+		}
+
+		if (i < slength)
+			length++;
+	}
+
+	return total;
+}
+
+static size_t encode_sysex(struct midi_ble_encoder *encoder,
+			   struct midi_ostream *stream,
+			   const struct midi_message *msg, uint16_t timestamp)
+{
+	const uint8_t *sdata = msg->data.sysex.data;
+	size_t slength = (sdata != NULL) ? msg->data.sysex.length : 0;
+
+	/* Do not start the message unless all its packets can be written: */
+	if (stream->capacity != MIDI_STREAM_CAPACITY_UNLIMITED &&
+	    stream->capacity < sysex_flush_size(encoder, timestamp, slength))
+		return 0;
+
+	/* Messages encoded before SysEx are kept if the first write fails: */
+	struct midi_ble_encoder saved = *encoder;
+	bool first = true;
+
+	if (!fits(encoder, timestamp, 2)) {
+		if (midi_ble_flush(encoder, stream) == 0 && encoder->length > 0)
+			return 0;
+		start_packet(encoder, timestamp);
+		first = false;
+	}
+
+	put(encoder, timestamp_byte(timestamp));
+	put(encoder, MIDI_TYPE_SOX);
+	encoder->running_status = 0;
+	encoder->timestamp = timestamp;
+
+	for (size_t i = 0; i <= slength; i++) {
+		/* SysEx continues in the next packet: */
+		size_t needed = (i < slength) ? 1 : 2;
+		if (encoder->length + needed > encoder->size) {
+			if (midi_ble_flush(encoder, stream) == 0) {
+				if (first) {
+					*encoder = saved;
+				} else {
+					/* Discard the truncated message: */
+					encoder->length = 0;
+				}
+				return 0;
+			}
+			start_packet(encoder, timestamp);
+			first = false;
+		}
+
+		if (i < slength)
+			put(encoder, DATA_BYTE(sdata[i]));
+	}
+
+	put(encoder, timestamp_byte(timestamp));
+	put(encoder, MIDI_TYPE_EOX);
+
+	return slength + 4;
+}
+#endif
+
+/**
+ * Initializes the BLE MIDI packet encoder.
+ *
+ * @param encoder       Pointer to the #midi_ble_encoder structure to be
+ *                      initialized
+ * @param packet        Packet buffer allocated by the user
+ * @param size          Size of the packet buffer, i.e. the maximum packet
+ *                      size (ATT MTU minus 3, at least 5 bytes)
+ */
+void midi_ble_encoder_init(struct midi_ble_encoder *encoder, void *packet,
+			   size_t size)
+{
+	assert(encoder != NULL);
+	assert(packet != NULL);
+	assert(size >= 5);
+
+	memset(encoder, 0, sizeof(struct midi_ble_encoder));
+	encoder->packet = packet;
+	encoder->size = size;
+}
+
+/**
+ * Adds a single MIDI message to the current packet.
+ *
+ * The current packet is written to `stream` once it is full or the message
+ * cannot be added to it. Each packet is passed to midi_ostream.write_cb() in
+ * a single call. Call midi_ble_flush() to write a partially filled packet,
+ * e.g. once per connection interval.
+ *
+ * If the stream does not accept the current packet, the message is not
+ * encoded and the packet is kept. SysEx is only encoded if the stream
+ * capacity suffices for all packets it completes. If the stream rejects a
+ * packet in the middle of SysEx anyway (i.e. write_cb() fails), the rest of
+ * the message is discarded.
+ *
+ * @param encoder       Pointer to the #midi_ble_encoder structure
+ * @param stream        Pointer to the #midi_ostream structure to write packets
+ *                      to
+ * @param[in] msg       Pointer to the #midi_message structure to be encoded
+ * @param timestamp     Timestamp in milliseconds (only lower 13 bits are used)
+ *
+ * @return The number of bytes the message occupies in packets (excluding
+ * packet headers) or zero if the message has not been encoded.
+ */
+size_t midi_ble_encode(struct midi_ble_encoder *encoder,
+		       struct midi_ostream *stream,
+		       const struct midi_message *msg, uint32_t timestamp)
+{
+	assert(encoder != NULL);
+	assert(stream != NULL);
+	assert(msg != NULL);
+	assert(stream->write_cb != NULL);
+
+	uint16_t ts = (uint16_t)(timestamp & TIMESTAMP_MASK);
+
+#if NANOMIDI_CONFIG_SYSEX
+	if (msg->type == MIDI_TYPE_SYSEX)
+		return encode_sysex(encoder, stream, msg, ts);
+#endif
+
+	uint8_t buffer[3];
+	struct midi_ostream bstream;
+	midi_ostream_from_buffer(&bstream, buffer, sizeof(buffer));
+
+	size_t length = midi_encode(&bstream, msg);
+	if (length == 0)
+		return 0;
+
+	uint8_t status = buffer[0];
+	bool omit_status = (status == encoder->running_status);
+	bool omit_timestamp = (omit_status && ts == encoder->timestamp);
+	size_t n = length + 1 - omit_status - omit_timestamp;
+
+	if (!fits(encoder, ts, n)) {
+		if (midi_ble_flush(encoder, stream) == 0 && encoder->length > 0)
+			return 0;
+
+		start_packet(encoder, ts);
+		omit_status = false;
+		omit_timestamp = false;
+		n = length + 1;
+	}
+
+	if (!omit_timestamp)
+		put(encoder, timestamp_byte(ts));
+	for (size_t i = omit_status ? 1 : 0; i < length; i++)
+		put(encoder, buffer[i]);
+
+	/* System Real Time messages do not cancel Running Status: */
+	if (status < MIDI_TYPE_SYSTEM_BASE)
+		encoder->running_status = status;
+	else if (status < MIDI_TYPE_TIMING_CLOCK)
+		encoder->running_status = 0;
+
+	encoder->timestamp = ts;
+
+	return n;
+}
+
+/**
+ * Writes the current packet to the stream.
+ *
+ * @param encoder       Pointer to the #midi_ble_encoder structure
+ * @param stream        Pointer to the #midi_ostream structure
+ *
+ * @return The packet size or zero if there is no packet to be written or the
+ * stream does not accept it.
+ */
+size_t midi_ble_flush(struct midi_ble_encoder *encoder,
+		      struct midi_ostream *stream)
+{
+	assert(encoder != NULL);
+	assert(stream != NULL);
+	assert(stream->write_cb != NULL);
+
+	size_t length = encoder->length;
+	if (length == 0)
+		return 0;
+
+	if (stream->capacity != MIDI_STREAM_CAPACITY_UNLIMITED) {
+		if (stream->capacity < length)
+			return 0;
+		stream->capacity -= length;
+	}
+
+	if (stream->write_cb(stream, encoder->packet, length) != length)
+		return 0;
+
+	encoder->length = 0;
+	encoder->running_status = 0;
+
+	return length;
+}
+
+/**
+ * Initializes the BLE MIDI packet decoder.
+ *
+ * Fields of midi_ble_decoder.stream (e.g. midi_istream.sysex_buffer) can be
+ * set after the initialization.
+ *
+ * @param decoder       Pointer to the #midi_ble_decoder structure to be
+ *                      initialized
+ */
+void midi_ble_decoder_init(struct midi_ble_decoder *decoder)
+{
+	assert(decoder != NULL);
+
+	memset(decoder, 0, sizeof(struct midi_ble_decoder));
+}
+
+/**
+ * Decodes all messages from a BLE MIDI packet.
+ *
+ * Each decoded message is passed to `sink` with its timestamp stored in
+ * midi_ble_decoder.timestamp. A SysEx message spanning multiple packets is
+ * passed to `sink` with the timestamp of its last packet. Packets with an
+ * invalid header are ignored.
+ *
+ * @param decoder       Pointer to the #midi_ble_decoder structure
+ * @param[in] packet    Packet to be decoded
+ * @param size          Packet size (in bytes)
+ * @param sink          Pointer to the #midi_sink structure to pass decoded
+ *                      messages to
+ *
+ * @return The number of messages passed to `sink`.
+ */
+size_t midi_ble_decode(struct midi_ble_decoder *decoder, const void *packet,
+		       size_t size, struct midi_sink *sink)
+{
+	assert(decoder != NULL);
+	assert(packet != NULL || size == 0);
+	assert(sink != NULL);
+	assert(sink->message_cb != NULL);
+
+	const uint8_t *bytes = packet;
+	size_t num_messages = 0;
+
+	if (size < 2 || (bytes[0] & 0xc0) != 0x80)
+		return 0;
+
+	uint16_t high = (bytes[0] & 0x3f);
+	int last_low = -1;
+	bool after_timestamp = false;
+
+	for (size_t i = 1; i < size; i++) {
+		uint8_t c = bytes[i];
+
+		if (!after_timestamp && (c & 0x80) != 0) {
+			/* Timestamp byte, lower 7 bits may overflow: */
+			int low = (c & 0x7f);
+			if (low < last_low)
+				high = (high + 1) & 0x3f;
+
+			last_low = low;
+			decoder->timestamp = (uint16_t)((high << 7) | low);
+			after_timestamp = true;
+			continue;
+		}
+
+		/* Status byte or data byte (SysEx or Running Status): */
+		after_timestamp = false;
+
+		if (decoder->stream.skip && (c & 0x80) == 0)
+			continue;
+
+		struct midi_message *msg = midi_decode_byte(&decoder->stream,
+							    c);
+		if (msg != NULL) {
+			sink->message_cb(sink, msg);
+			num_messages++;
+		}
+	}
+
+	return num_messages;
+}
+
+/**@}*/
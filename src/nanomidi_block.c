@@ -0,0 +1,211 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Sample-accurate scheduling of messages in audio blocks
+ * @defgroup block Audio Block Scheduler
+ *
+ * Audio block scheduler assigns timestamped messages to the audio blocks
+ * they belong to. At the start of each audio callback, midi_block_begin()
+ * sets the block start time and length. Messages pushed by midi_block_push()
+ * then land in midi_block.events with their frame offset within the block,
+ * sorted by the offset. Messages with the same offset keep the order in which
+ * they were pushed. Messages which belong to later blocks wait in
+ * a carry-over queue and are moved to the events of the right block by
+ * midi_block_begin(). Late messages get offset zero.
+ *
+ * Messages are stored as #midi_packed so the arrays stay small. Both arrays
+ * are allocated by the user and no function allocates memory, so it is safe
+ * to call them from the audio thread. Insertion takes constant time if
+ * messages are pushed in timestamp order.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/block.h>
+#else
+#include <nanomidi/block.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+/**@{*/
+
+/* Returns the frame offset of a timestamp, zero for late timestamps: */
+static uint32_t frame_offset(const struct midi_block *block, uint32_t time)
+{
+	int32_t ticks = (int32_t)(time - block->start);
+	if (ticks <= 0)
+		return 0;
+
+	if (block->ticks_per_second == block->sample_rate)
+		return (uint32_t)ticks;
+
+	uint64_t frames = (uint64_t)ticks * block->sample_rate /
+			  block->ticks_per_second;
+	return (frames > UINT32_MAX) ? UINT32_MAX : (uint32_t)frames;
+}
+
+static void insert_event(struct midi_block *block,
+			 const struct midi_block_event *event)
+{
+	size_t i = block->num_events;
+	while (i > 0 && block->events[i-1].time > event->time) {
+		block->events[i] = block->events[i-1];
+		i--;
+	}
+
+	block->events[i] = *event;
+	block->num_events++;
+}
+
+static void insert_carry(struct midi_block *block,
+			 const struct midi_block_event *event)
+{
+	size_t i = block->num_carry;
+	while (i > 0 && (int32_t)(block->carry[i-1].time - event->time) > 0) {
+		block->carry[i] = block->carry[i-1];
+		i--;
+	}
+
+	block->carry[i] = *event;
+	block->num_carry++;
+}
+
+/**
+ * Initializes the #midi_block structure.
+ *
+ * Messages pushed before the first call to midi_block_begin() wait in
+ * the carry-over queue. Member midi_block.pool is set to `NULL`.
+ *
+ * @param block             Pointer to the #midi_block structure
+ * @param ticks_per_second  Resolution of timestamps passed to other functions
+ * @param sample_rate       Audio sample rate in frames per second
+ * @param events            Array for events of the current block
+ * @param max_events        Number of elements in `events`
+ * @param carry             Array for the carry-over queue
+ * @param max_carry         Number of elements in `carry`
+ */
+void midi_block_init(struct midi_block *block, uint32_t ticks_per_second,
+		     uint32_t sample_rate, struct midi_block_event *events,
+		     size_t max_events, struct midi_block_event *carry,
+		     size_t max_carry)
+{
+	assert(block != NULL);
+	assert(ticks_per_second > 0);
+	assert(sample_rate > 0);
+	assert(events != NULL && max_events > 0);
+	assert(carry != NULL || max_carry == 0);
+
+	memset(block, 0, sizeof(struct midi_block));
+	block->ticks_per_second = ticks_per_second;
+	block->sample_rate = sample_rate;
+	block->events = events;
+	block->max_events = max_events;
+	block->carry = carry;
+	block->max_carry = max_carry;
+}
+
+/**
+ * Starts a new audio block.
+ *
+ * Events of the previous block are discarded and events from the carry-over
+ * queue which belong to the new block (or are late) are moved to
+ * midi_block.events. If midi_block.events is full, the remaining events stay
+ * in the carry-over queue and are delivered late in the next block.
+ *
+ * @param block         Pointer to the #midi_block structure
+ * @param start         Time of the first frame of the block in ticks
+ * @param frames        Number of frames in the block
+ *
+ * @return Number of events moved from the carry-over queue
+ */
+size_t midi_block_begin(struct midi_block *block, uint32_t start,
+			uint32_t frames)
+{
+	assert(block != NULL);
+
+	block->start = start;
+	block->frames = frames;
+	block->num_events = 0;
+
+	size_t n = 0;
+	while (n < block->num_carry && n < block->max_events) {
+		uint32_t offset = frame_offset(block, block->carry[n].time);
+		if (offset >= frames)
+			break;
+
+		block->events[n].time = offset;
+		block->events[n].msg = block->carry[n].msg;
+		n++;
+	}
+
+	block->num_events = n;
+	block->num_carry -= n;
+	if (n > 0 && block->num_carry > 0) {
+		memmove(&block->carry[0], &block->carry[n],
+			block->num_carry * sizeof(struct midi_block_event));
+	}
+
+	return n;
+}
+
+/**
+ * Schedules a message.
+ *
+ * The message is added to midi_block.events if it belongs to the current
+ * block (or is late), otherwise it is added to the carry-over queue.
+ *
+ * @param block         Pointer to the #midi_block structure
+ * @param msg           Pointer to the message
+ * @param time          Timestamp of the message in ticks
+ *
+ * @return `true` on success, `false` if the message cannot be packed or
+ * the carry-over queue is full (midi_block.dropped is incremented)
+ */
+bool midi_block_push(struct midi_block *block, const struct midi_message *msg,
+		     uint32_t time)
+{
+	assert(block != NULL);
+	assert(msg != NULL);
+
+	struct midi_block_event event;
+	if (!midi_pack(&event.msg, msg, block->pool)) {
+		block->dropped++;
+		return false;
+	}
+
+	uint32_t offset = frame_offset(block, time);
+	if (offset < block->frames && block->num_events < block->max_events) {
+		event.time = offset;
+		insert_event(block, &event);
+		return true;
+	}
+
+	if (block->num_carry < block->max_carry) {
+		event.time = time;
+		insert_carry(block, &event);
+		return true;
+	}
+
+	block->dropped++;
+	return false;
+}
+
+/**@}*/
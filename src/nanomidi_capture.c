@@ -0,0 +1,761 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Binary capture log
+ * @defgroup capture Capture log
+ *
+ * Compact binary log of timestamped messages for recording all traffic of
+ * a system, e.g. for debugging.
+ *
+ * Each message is stored as a fixed 8-byte #midi_capture_record holding
+ * the time and a #midi_packed message. SysEx data follows its record
+ * header. Records are appended to fixed-size segments which are
+ * preallocated in batches and written through a memory mapping. A record
+ * is committed by updating the segment length after it has been written,
+ * so a crash of the writing process loses no complete records.
+ *
+ * Each segment starts with a sparse time index with one entry per
+ * midi_capture_header.index_interval records. The reader maps the whole
+ * file and seeks to any time using binary search over segments and their
+ * index, followed by a scan of at most one index interval. Messages are
+ * replayed with midi_capture_read(), which returns SysEx data pointing
+ * directly into the mapped file, or through an input stream created by
+ * midi_capture_istream().
+ *
+ * Times are 64-bit values in units chosen by the user (e.g. microseconds).
+ * The module is only compiled on Unix-like systems.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+/* F_PREALLOCATE is hidden by _POSIX_C_SOURCE: */
+#define _DARWIN_C_SOURCE
+#endif
+
+#ifdef ARDUINO
+#include <../include/nanomidi/capture.h>
+#include <../include/nanomidi/encoder.h>
+#else
+#include <nanomidi/capture.h>
+#include <nanomidi/encoder.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+static size_t index_entries(size_t segment_size, uint32_t index_interval)
+{
+	size_t max_records = (segment_size -
+			      sizeof(struct midi_capture_segment)) /
+			     sizeof(struct midi_capture_record);
+
+	return (max_records + index_interval - 1) / index_interval;
+}
+
+static struct midi_capture_index *segment_index(
+	const struct midi_capture_segment *segment)
+{
+	return (struct midi_capture_index *)(segment + 1);
+}
+
+static uint8_t *segment_records(const struct midi_capture_header *header,
+				const struct midi_capture_segment *segment)
+{
+	return (uint8_t *)(segment_index(segment) + header->index_entries);
+}
+
+/* Number of bytes available for records in each segment */
+static size_t segment_capacity(const struct midi_capture_header *header)
+{
+	return header->segment_size - sizeof(struct midi_capture_segment) -
+	       header->index_entries * sizeof(struct midi_capture_index);
+}
+
+static size_t record_size(const struct midi_capture_record *record)
+{
+	if (record->msg.status != MIDI_TYPE_SYSEX)
+		return sizeof(struct midi_capture_record);
+
+	size_t length = (size_t)((record->msg.data2 << 8) |
+				 record->msg.data1);
+	return sizeof(struct midi_capture_record) + ((length + 3) & ~(size_t)3);
+}
+
+static bool pack_record(struct midi_capture_record *record,
+			const struct midi_message *msg, size_t *length)
+{
+	*length = 0;
+
+#if NANOMIDI_CONFIG_SYSEX
+	if (msg->type == MIDI_TYPE_SYSEX) {
+		*length = msg->data.sysex.length;
+		if (*length > MIDI_CAPTURE_MAX_SYSEX)
+			return false;
+
+		record->msg.status = MIDI_TYPE_SYSEX;
+		record->msg.data1 = (uint8_t)(*length & 0xff);
+		record->msg.data2 = (uint8_t)(*length >> 8);
+		return true;
+	}
+#endif
+
+	return midi_pack(&record->msg, msg, NULL);
+}
+
+/*
+ * Allocates length bytes at offset (the end of the file) filled with zeros.
+ * Returns zero on success or an error number.
+ */
+static int preallocate(int fd, off_t offset, off_t length)
+{
+#ifdef __APPLE__
+	/* There is no posix_fallocate(). Reserve the space if the file system
+	 * supports it, then extend the file: */
+	fstore_t store = {
+		.fst_flags = F_ALLOCATEALL,
+		.fst_posmode = F_PEOFPOSMODE,
+		.fst_offset = 0,
+		.fst_length = length,
+	};
+	(void)fcntl(fd, F_PREALLOCATE, &store);
+
+	return (ftruncate(fd, offset + length) == 0) ? 0 : errno;
+#else
+	return posix_fallocate(fd, offset, length);
+#endif
+}
+
+static bool next_segment(struct midi_capture_writer *writer, uint64_t time)
+{
+	struct midi_capture_header *header = writer->header;
+	uint32_t n = header->num_segments;
+	off_t offset = (off_t)(header->data_offset +
+			       (uint64_t)n * header->segment_size);
+
+	if (writer->segment != NULL) {
+		munmap(writer->segment, header->segment_size);
+		writer->segment = NULL;
+	}
+
+	/* Allocate segments in batches instead of growing the file for each
+	 * one: */
+	if (n >= writer->allocated) {
+		off_t length = (off_t)MIDI_CAPTURE_PREALLOCATE *
+			       header->segment_size;
+		int err = preallocate(writer->fd, offset, length);
+		if (err != 0) {
+			errno = err;
+			return false;
+		}
+		writer->allocated = n + MIDI_CAPTURE_PREALLOCATE;
+	}
+
+	void *map = mmap(NULL, header->segment_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, writer->fd, offset);
+	if (map == MAP_FAILED)
+		return false;
+
+	/* Allocated space is zeroed, only base time and magic are set: */
+	struct midi_capture_segment *segment = map;
+	segment->base_time = time;
+	segment->magic = MIDI_CAPTURE_SEGMENT_MAGIC;
+
+	writer->segment = segment;
+	header->num_segments = n + 1;
+	return true;
+}
+
+static const struct midi_capture_segment *segment_at(
+	const struct midi_capture_reader *reader, uint32_t n)
+{
+	const struct midi_capture_header *header =
+		(const struct midi_capture_header *)reader->data;
+
+	return (const struct midi_capture_segment *)(reader->data +
+		header->data_offset + (uint64_t)n * header->segment_size);
+}
+
+/* Returns the next record without consuming it or NULL at the end */
+static const struct midi_capture_record *current(
+	struct midi_capture_reader *reader)
+{
+	const struct midi_capture_header *header =
+		(const struct midi_capture_header *)reader->data;
+	size_t capacity = segment_capacity(header);
+
+	while (reader->segment < reader->num_segments) {
+		const struct midi_capture_segment *segment =
+			segment_at(reader, reader->segment);
+
+		if (segment->magic == MIDI_CAPTURE_SEGMENT_MAGIC &&
+		    segment->length <= capacity &&
+		    reader->offset + sizeof(struct midi_capture_record) <=
+		    segment->length) {
+			const struct midi_capture_record *record =
+				(const struct midi_capture_record *)
+				(segment_records(header, segment) +
+				 reader->offset);
+
+			/* Truncated SysEx ends the segment: */
+			if (reader->offset + record_size(record) <=
+			    segment->length)
+				return record;
+		}
+
+		reader->segment++;
+		reader->offset = 0;
+	}
+
+	return NULL;
+}
+
+static uint64_t record_time(const struct midi_capture_reader *reader,
+			    const struct midi_capture_record *record)
+{
+	return segment_at(reader, reader->segment)->base_time + record->time;
+}
+
+static void consume(struct midi_capture_reader *reader,
+		    const struct midi_capture_record *record)
+{
+	reader->time = record_time(reader, record);
+	reader->port = record->msg.flags;
+	reader->offset += (uint32_t)record_size(record);
+}
+
+/* Prepares the next chunk of bytes for the input stream */
+static bool load(struct midi_capture_reader *reader)
+{
+	if (reader->sysex_length > 0) {
+		reader->pending = reader->sysex;
+		reader->pending_length = reader->sysex_length;
+		reader->sysex_length = 0;
+		return true;
+	} else if (reader->eox) {
+		reader->bytes[0] = MIDI_TYPE_EOX;
+		reader->pending = reader->bytes;
+		reader->pending_length = 1;
+		reader->eox = false;
+		return true;
+	}
+
+	const struct midi_capture_record *record;
+	while ((record = current(reader)) != NULL) {
+		consume(reader, record);
+		reader->pending = reader->bytes;
+
+		if (record->msg.status == MIDI_TYPE_SYSEX) {
+			reader->bytes[0] = MIDI_TYPE_SOX;
+			reader->pending_length = 1;
+			reader->sysex = (const uint8_t *)(record + 1);
+			reader->sysex_length = (size_t)((record->msg.data2 << 8)
+							| record->msg.data1);
+			reader->eox = true;
+			return true;
+		}
+
+		struct midi_ostream stream;
+		midi_ostream_from_buffer(&stream, reader->bytes,
+					 sizeof(reader->bytes));
+		reader->pending_length = midi_encode_packed(&stream,
+							    &record->msg, NULL);
+		if (reader->pending_length > 0)
+			return true;
+	}
+
+	return false;
+}
+
+static size_t capture_read(struct midi_istream *stream, void *data,
+			   size_t size)
+{
+	struct midi_capture_reader *reader = stream->param;
+	uint8_t *dst = data;
+	size_t num_read = 0;
+
+	while (num_read < size) {
+		if (reader->pending_length == 0 && !load(reader))
+			break;
+
+		size_t n = reader->pending_length;
+		if (n > size - num_read)
+			n = size - num_read;
+
+		memcpy(&dst[num_read], reader->pending, n);
+		reader->pending += n;
+		reader->pending_length -= n;
+		num_read += n;
+	}
+
+	return num_read;
+}
+
+/**
+ * Creates a new capture file.
+ *
+ * An existing file is truncated. Segment size is rounded up to a multiple of
+ * the page size.
+ *
+ * @param writer        Pointer to the #midi_capture_writer structure to be
+ *                      initialized
+ * @param path          Path to the file
+ * @param segment_size  Segment size in bytes (e.g.
+ *                      #MIDI_CAPTURE_SEGMENT_SIZE_DEFAULT)
+ * @param index_interval Number of records per index entry (e.g.
+ *                      #MIDI_CAPTURE_INDEX_INTERVAL_DEFAULT)
+ *
+ * @return `true` on success or `false` on error (with errno set).
+ */
+bool midi_capture_writer_open(struct midi_capture_writer *writer,
+			      const char *path, size_t segment_size,
+			      uint32_t index_interval)
+{
+	assert(writer != NULL);
+	assert(path != NULL);
+	assert(index_interval > 0);
+
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	if (segment_size < page_size)
+		segment_size = page_size;
+	segment_size = (segment_size + page_size - 1) / page_size * page_size;
+	if (segment_size > UINT32_MAX) {
+		errno = EINVAL;
+		return false;
+	}
+
+	memset(writer, 0, sizeof(struct midi_capture_writer));
+	writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (writer->fd < 0)
+		return false;
+
+	void *map = MAP_FAILED;
+	if (ftruncate(writer->fd, (off_t)page_size) == 0) {
+		map = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, writer->fd, 0);
+	}
+
+	if (map == MAP_FAILED) {
+		int err = errno;
+		close(writer->fd);
+		errno = err;
+		return false;
+	}
+
+	struct midi_capture_header *header = map;
+	header->version = MIDI_CAPTURE_VERSION;
+	header->header_size = sizeof(struct midi_capture_header);
+	header->segment_size = (uint32_t)segment_size;
+	header->index_interval = index_interval;
+	header->index_entries = (uint32_t)index_entries(segment_size,
+							index_interval);
+	header->num_segments = 0;
+	header->data_offset = page_size;
+	header->magic = MIDI_CAPTURE_MAGIC;
+
+	writer->header = header;
+	return true;
+}
+
+/**
+ * Appends a message to the capture file.
+ *
+ * Times have to be non-decreasing, a time older than the previous one is
+ * replaced by the previous time. A new segment is started when the current
+ * one is full or when the time does not fit into its 32-bit relative range.
+ *
+ * @param writer        Pointer to the #midi_capture_writer structure
+ * @param[in] msg       Pointer to the #midi_message structure to be written
+ * @param port          Port number (e.g. USB cable number) stored with the
+ *                      message
+ * @param time          Time of the message
+ *
+ * @return `true` on success or `false` if the message could not be written
+ * (midi_capture_writer.dropped is incremented in that case).
+ */
+bool midi_capture_write(struct midi_capture_writer *writer,
+			const struct midi_message *msg, uint8_t port,
+			uint64_t time)
+{
+	assert(writer != NULL);
+	assert(writer->header != NULL);
+	assert(msg != NULL);
+
+	struct midi_capture_header *header = writer->header;
+	struct midi_capture_segment *segment = writer->segment;
+	struct midi_capture_record record;
+	size_t length;
+
+	if (!pack_record(&record, msg, &length)) {
+		writer->dropped++;
+		return false;
+	}
+	record.msg.flags = port;
+
+	size_t size = sizeof(record) + ((length + 3) & ~(size_t)3);
+	size_t capacity = segment_capacity(header);
+	if (size > capacity) {
+		writer->dropped++;
+		return false;
+	}
+
+	if (time < writer->time)
+		time = writer->time;
+
+	if (segment == NULL || time - segment->base_time > UINT32_MAX ||
+	    segment->length + size > capacity) {
+		if (!next_segment(writer, time)) {
+			writer->dropped++;
+			return false;
+		}
+		segment = writer->segment;
+	}
+
+	uint8_t *dst = segment_records(header, segment) + segment->length;
+	record.time = (uint32_t)(time - segment->base_time);
+	memcpy(dst, &record, sizeof(record));
+#if NANOMIDI_CONFIG_SYSEX
+	if (length > 0)
+		memcpy(&dst[sizeof(record)], msg->data.sysex.data, length);
+#endif
+
+	if (segment->num_records % header->index_interval == 0) {
+		struct midi_capture_index *index = segment_index(segment);
+		index[segment->num_index].time = record.time;
+		index[segment->num_index].offset = segment->length;
+		segment->num_index++;
+	}
+
+	/* Commit the record: */
+	segment->num_records++;
+	segment->length += (uint32_t)size;
+	writer->time = time;
+	return true;
+}
+
+/**
+ * Writes all records to the storage and waits for completion.
+ *
+ * Records are visible to readers of the file right after
+ * midi_capture_write(), synchronization only makes them survive a system
+ * crash.
+ *
+ * @param writer        Pointer to the #midi_capture_writer structure
+ *
+ * @return `true` on success or `false` on error (with errno set).
+ */
+bool midi_capture_writer_sync(struct midi_capture_writer *writer)
+{
+	assert(writer != NULL);
+	assert(writer->header != NULL);
+
+	struct midi_capture_header *header = writer->header;
+
+	if (writer->segment != NULL &&
+	    msync(writer->segment, header->segment_size, MS_SYNC) != 0)
+		return false;
+
+	return (msync(header, header->data_offset, MS_SYNC) == 0);
+}
+
+/**
+ * Closes the capture file.
+ *
+ * Segments preallocated but not used are removed from the file.
+ *
+ * @param writer        Pointer to the #midi_capture_writer structure
+ *
+ * @return `true` on success or `false` on error (with errno set).
+ */
+bool midi_capture_writer_close(struct midi_capture_writer *writer)
+{
+	assert(writer != NULL);
+	assert(writer->header != NULL);
+
+	struct midi_capture_header *header = writer->header;
+	off_t length = (off_t)(header->data_offset +
+			       (uint64_t)header->num_segments *
+			       header->segment_size);
+	size_t header_size = header->data_offset;
+
+	if (writer->segment != NULL)
+		munmap(writer->segment, header->segment_size);
+	munmap(header, header_size);
+
+	bool ok = (ftruncate(writer->fd, length) == 0);
+	int err = errno;
+	close(writer->fd);
+	errno = err;
+
+	writer->fd = -1;
+	writer->header = NULL;
+	writer->segment = NULL;
+	return ok;
+}
+
+/**
+ * Opens a capture file for reading.
+ *
+ * The whole file is mapped into memory. The file may be still open by
+ * a writer, records written after opening are not visible to the reader.
+ *
+ * @param reader        Pointer to the #midi_capture_reader structure to be
+ *                      initialized
+ * @param path          Path to the file
+ *
+ * @return `true` on success or `false` on error (with errno set, EINVAL if
+ * the file is not a valid capture file).
+ */
+bool midi_capture_reader_open(struct midi_capture_reader *reader,
+			      const char *path)
+{
+	assert(reader != NULL);
+	assert(path != NULL);
+
+	memset(reader, 0, sizeof(struct midi_capture_reader));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0) {
+		if (st.st_size < (off_t)sizeof(struct midi_capture_header))
+			errno = EINVAL;
+		else
+			map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+				   MAP_SHARED, fd, 0);
+	}
+
+	int err = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		errno = err;
+		return false;
+	}
+
+	const struct midi_capture_header *header = map;
+	size_t size = (size_t)st.st_size;
+
+	if (header->magic != MIDI_CAPTURE_MAGIC ||
+	    header->version != MIDI_CAPTURE_VERSION ||
+	    header->header_size != sizeof(struct midi_capture_header) ||
+	    header->data_offset < sizeof(struct midi_capture_header) ||
+	    header->data_offset > size || header->index_interval == 0 ||
+	    header->segment_size <= sizeof(struct midi_capture_segment) ||
+	    header->index_entries != index_entries(header->segment_size,
+						   header->index_interval)) {
+		munmap(map, size);
+		errno = EINVAL;
+		return false;
+	}
+
+	/* Segments not fully present (e.g. still being allocated) are
+	 * ignored: */
+	uint64_t num_segments = (size - header->data_offset) /
+				header->segment_size;
+	if (num_segments > header->num_segments)
+		num_segments = header->num_segments;
+
+	posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+	reader->data = map;
+	reader->size = size;
+	reader->num_segments = (uint32_t)num_segments;
+	return true;
+}
+
+/**
+ * Moves the read position to the first message with time equal to or
+ * greater than the given time.
+ *
+ * The segment is found using binary search over segment base times, the
+ * position in the segment using binary search over its index. At most
+ * midi_capture_header.index_interval records are scanned afterwards.
+ *
+ * @param reader        Pointer to the #midi_capture_reader structure
+ * @param time          Time to seek to
+ *
+ * @return `true` on success or `false` if there is no message at or after
+ * the given time (the read position is at the end of the file).
+ */
+bool midi_capture_seek(struct midi_capture_reader *reader, uint64_t time)
+{
+	assert(reader != NULL);
+	assert(reader->data != NULL);
+
+	const struct midi_capture_header *header =
+		(const struct midi_capture_header *)reader->data;
+
+	/* Last segment starting before the time: */
+	uint32_t lo = 0;
+	uint32_t hi = reader->num_segments;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (segment_at(reader, mid)->base_time < time)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	reader->segment = lo;
+	reader->offset = 0;
+	reader->pending_length = 0;
+	reader->sysex_length = 0;
+	reader->eox = false;
+
+	/* Last index entry before the time: */
+	const struct midi_capture_segment *segment = segment_at(reader, lo);
+	if (reader->num_segments > 0 &&
+	    segment->magic == MIDI_CAPTURE_SEGMENT_MAGIC &&
+	    segment->num_index <= header->index_entries &&
+	    time > segment->base_time) {
+		const struct midi_capture_index *index = segment_index(segment);
+		uint64_t relative = time - segment->base_time;
+		uint32_t first = 0;
+		uint32_t last = segment->num_index;
+
+		while (last - first > 1) {
+			uint32_t mid = first + (last - first) / 2;
+			if (index[mid].time < relative)
+				first = mid;
+			else
+				last = mid;
+		}
+
+		if (segment->num_index > 0 && index[first].time < relative)
+			reader->offset = index[first].offset;
+	}
+
+	const struct midi_capture_record *record;
+	while ((record = current(reader)) != NULL) {
+		if (record_time(reader, record) >= time)
+			return true;
+		reader->offset += (uint32_t)record_size(record);
+	}
+
+	return false;
+}
+
+/**
+ * Reads the next message.
+ *
+ * SysEx data points directly into the mapped file and stays valid until
+ * midi_capture_reader_close() is called. Time and port number of the message
+ * are stored in midi_capture_reader.time and midi_capture_reader.port.
+ *
+ * @param reader        Pointer to the #midi_capture_reader structure
+ * @param[out] msg      Pointer to the #midi_message structure to be filled
+ *
+ * @return `true` if a message has been read, `false` at the end of the file.
+ */
+bool midi_capture_read(struct midi_capture_reader *reader,
+		       struct midi_message *msg)
+{
+	assert(reader != NULL);
+	assert(reader->data != NULL);
+	assert(msg != NULL);
+
+	const struct midi_capture_record *record;
+	while ((record = current(reader)) != NULL) {
+		consume(reader, record);
+
+#if NANOMIDI_CONFIG_SYSEX
+		if (record->msg.status == MIDI_TYPE_SYSEX) {
+			msg->type = MIDI_TYPE_SYSEX;
+			msg->channel = 0;
+			msg->data.sysex.data = record + 1;
+			msg->data.sysex.length =
+				(size_t)((record->msg.data2 << 8) |
+					 record->msg.data1);
+			return true;
+		}
+#endif
+
+		if (midi_unpack(msg, &record->msg, NULL))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Creates an input stream which reads messages from the read position.
+ *
+ * The stream produces the MIDI byte stream of the captured messages for
+ * midi_decode(). Time and port number of the last decoded message are stored
+ * in midi_capture_reader.time and midi_capture_reader.port. Fields
+ * midi_istream.sysex_buffer, midi_istream.sysex_pool and midi_istream.filter
+ * can be set by the user.
+ *
+ * @param reader        Pointer to the #midi_capture_reader structure
+ * @param stream        Pointer to the #midi_istream structure to be
+ *                      initialized
+ */
+void midi_capture_istream(struct midi_capture_reader *reader,
+			  struct midi_istream *stream)
+{
+	assert(reader != NULL);
+	assert(reader->data != NULL);
+	assert(stream != NULL);
+
+	memset(stream, 0, sizeof(struct midi_istream));
+	stream->read_cb = &capture_read;
+	stream->capacity = MIDI_STREAM_CAPACITY_UNLIMITED;
+	stream->param = reader;
+
+	reader->pending_length = 0;
+	reader->sysex_length = 0;
+	reader->eox = false;
+}
+
+/**
+ * Closes the capture file.
+ *
+ * @param reader        Pointer to the #midi_capture_reader structure
+ */
+void midi_capture_reader_close(struct midi_capture_reader *reader)
+{
+	assert(reader != NULL);
+
+	if (reader->data != NULL)
+		munmap((void *)reader->data, reader->size);
+
+	reader->data = NULL;
+	reader->size = 0;
+	reader->num_segments = 0;
+}
+
+/**@}*/
+
+#endif /* defined(__unix__) || defined(__APPLE__) */
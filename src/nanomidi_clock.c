@@ -0,0 +1,288 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * MIDI Timing Clock follower
+ * @defgroup clock Clock Follower
+ *
+ * Clock follower estimates the tempo and the song position from timestamped
+ * Timing Clock (#MIDI_TYPE_TIMING_CLOCK) messages. The arrival times are
+ * filtered by a second-order delay-locked loop (DLL) which tracks both the
+ * phase and the period of the clock while suppressing the transport jitter.
+ * All computations use fixed-point arithmetic and take constant time and
+ * memory per message.
+ *
+ * The loop bandwidth is set by the coefficients midi_clock.coef_b and
+ * midi_clock.coef_c. For a critically damped loop with a normalized
+ * bandwidth w (relative to the clock rate), coef_b = sqrt(2) * w and
+ * coef_c = w * w. The default is w = 0.05, i.e. the loop settles within
+ * about one beat. If a Timing Clock arrives more than half a period off
+ * the prediction, the loop is reset and the period is measured again from
+ * the following interval.
+ *
+ * Start, Stop, Continue and Song Position Pointer messages control the song
+ * position. The first Timing Clock after Start or Continue marks the current
+ * song position.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/clock.h>
+#else
+#include <nanomidi/clock.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+/**@{*/
+
+#define Q16_ONE		((int64_t)1 << 16)
+
+/* Default clock period (120 BPM) in Q16 ticks: */
+static uint64_t default_period(uint32_t ticks_per_second)
+{
+	return ((uint64_t)ticks_per_second << 16) / (2u * MIDI_CLOCK_PPQN);
+}
+
+/* Returns (a - b) in Q16 ticks: */
+static int64_t time_diff(uint32_t a, uint16_t a_frac, uint32_t b,
+			 uint16_t b_frac)
+{
+	return (int64_t)(int32_t)(a - b) * Q16_ONE + a_frac - b_frac;
+}
+
+static void time_add(uint32_t *time, uint16_t *frac, uint64_t delta)
+{
+	uint64_t sum = *frac + delta;
+	*time += (uint32_t)(sum >> 16);
+	*frac = (uint16_t)(sum & 0xffff);
+}
+
+/* Multiplies a signed Q16 value by a Q16 coefficient: */
+static int64_t q16_mul(int64_t value, uint32_t coef)
+{
+	int64_t product = value * (int64_t)coef;
+	return (product >= 0) ? (product >> 16) : -((-product) >> 16);
+}
+
+static void reset_loop(struct midi_clock *clock, uint32_t now)
+{
+	clock->time = now;
+	clock->time_frac = 0;
+	clock->next = now;
+	clock->next_frac = 0;
+	time_add(&clock->next, &clock->next_frac, clock->period);
+	clock->error = 0;
+}
+
+static void update_loop(struct midi_clock *clock, uint32_t now)
+{
+	if (clock->count == 0) {
+		reset_loop(clock, now);
+		return;
+	}
+
+	if (clock->count == 1) {
+		/* Use the first interval as the initial period estimate: */
+		uint32_t interval = now - clock->raw;
+		if (interval > 0)
+			clock->period = (uint64_t)interval << 16;
+		reset_loop(clock, now);
+		return;
+	}
+
+	int64_t period = (int64_t)clock->period;
+	int64_t error = time_diff(now, 0, clock->next, clock->next_frac);
+
+	if (error > period / 2 || error < -period / 2) {
+		/* Tempo change or lost clocks, measure the period again: */
+		clock->count = 0;
+		reset_loop(clock, now);
+		return;
+	}
+
+	/* The filtered time is the previous prediction: */
+	clock->time = clock->next;
+	clock->time_frac = clock->next_frac;
+
+	int64_t delta = period + q16_mul(error, clock->coef_b);
+	period += q16_mul(error, clock->coef_c);
+	if (delta < 1)
+		delta = 1;
+	if (period < 1)
+		period = 1;
+
+	time_add(&clock->next, &clock->next_frac, (uint64_t)delta);
+	clock->period = (uint64_t)period;
+
+	if (error > INT32_MAX)
+		error = INT32_MAX;
+	else if (error < INT32_MIN)
+		error = INT32_MIN;
+	clock->error = (int32_t)error;
+}
+
+/**
+ * Initializes the #midi_clock structure.
+ *
+ * The tempo is initialized to 120 BPM, the song position to zero and
+ * the transport is stopped.
+ *
+ * @param clock             Pointer to the #midi_clock structure
+ * @param ticks_per_second  Resolution of timestamps passed to other functions
+ */
+void midi_clock_init(struct midi_clock *clock, uint32_t ticks_per_second)
+{
+	assert(clock != NULL);
+	assert(ticks_per_second > 0);
+
+	memset(clock, 0, sizeof(struct midi_clock));
+	clock->ticks_per_second = ticks_per_second;
+	clock->coef_b = MIDI_CLOCK_COEF_B_DEFAULT;
+	clock->coef_c = MIDI_CLOCK_COEF_C_DEFAULT;
+	clock->period = default_period(ticks_per_second);
+	clock->pending = true;
+}
+
+/**
+ * Updates the clock follower with a received message.
+ *
+ * Timing Clock messages update the tempo estimate even if the transport is
+ * stopped. The song position only advances while the transport is running.
+ * Song Position Pointer is ignored while the transport is running.
+ *
+ * @param clock         Pointer to the #midi_clock structure
+ * @param msg           Pointer to the received message
+ * @param now           Time of reception in ticks
+ *
+ * @return `true` if the message was processed, `false` otherwise
+ */
+bool midi_clock_update(struct midi_clock *clock,
+		       const struct midi_message *msg, uint32_t now)
+{
+	assert(clock != NULL);
+	assert(msg != NULL);
+
+	switch (msg->type) {
+	case MIDI_TYPE_TIMING_CLOCK:
+		update_loop(clock, now);
+		clock->raw = now;
+		if (clock->count < UINT32_MAX)
+			clock->count++;
+		if (clock->running) {
+			clock->position++;
+			clock->pending = false;
+		}
+		return true;
+	case MIDI_TYPE_START:
+		clock->position = 0;
+		clock->running = true;
+		clock->pending = true;
+		return true;
+	case MIDI_TYPE_CONTINUE:
+		clock->running = true;
+		clock->pending = true;
+		return true;
+	case MIDI_TYPE_STOP:
+		clock->running = false;
+		clock->pending = true;
+		return true;
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
+	case MIDI_TYPE_SONG_POSITION:
+		if (clock->running)
+			return false;
+		clock->position = 6u * msg->data.song_position.position;
+		clock->pending = true;
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/**
+ * Returns the estimated tempo.
+ *
+ * @param clock         Pointer to the #midi_clock structure
+ *
+ * @return Tempo in thousandths of BPM (e.g. 120000 for 120 BPM)
+ */
+uint32_t midi_clock_bpm(const struct midi_clock *clock)
+{
+	assert(clock != NULL);
+
+	/* 60 * 1000 / MIDI_CLOCK_PPQN = 2500 */
+	uint64_t num = ((uint64_t)clock->ticks_per_second * 2500u) << 16;
+	uint64_t bpm = (num + clock->period / 2) / clock->period;
+	return (bpm > UINT32_MAX) ? UINT32_MAX : (uint32_t)bpm;
+}
+
+/**
+ * Returns the predicted time of a future Timing Clock message.
+ *
+ * @param clock         Pointer to the #midi_clock structure
+ * @param n             Number of Timing Clock messages to skip (zero returns
+ *                      the time of the next Timing Clock)
+ *
+ * @return Predicted time in ticks (rounded)
+ */
+uint32_t midi_clock_next(const struct midi_clock *clock, uint32_t n)
+{
+	assert(clock != NULL);
+
+	uint32_t time = clock->next;
+	uint16_t frac = clock->next_frac;
+	time_add(&time, &frac, clock->period * n + Q16_ONE / 2);
+	return time;
+}
+
+/**
+ * Returns the current song position.
+ *
+ * The position is interpolated between Timing Clock messages using
+ * the filtered clock period. It never exceeds the position of the next
+ * Timing Clock so it does not run away if the clock stops. If the transport
+ * is stopped, the position where the playback will continue is returned.
+ *
+ * @param clock         Pointer to the #midi_clock structure
+ * @param now           Current time in ticks
+ *
+ * @return Song position in Q16 clocks (#MIDI_CLOCK_PPQN clocks per quarter
+ * note)
+ */
+uint64_t midi_clock_position(const struct midi_clock *clock, uint32_t now)
+{
+	assert(clock != NULL);
+
+	uint64_t position = (uint64_t)clock->position << 16;
+	if (clock->pending || !clock->running)
+		return position;
+
+	int64_t elapsed = time_diff(now, 0, clock->time, clock->time_frac);
+	int64_t phase = 0;
+	if (elapsed > 0) {
+		phase = (int64_t)(((uint64_t)elapsed << 16) / clock->period);
+		if (phase > Q16_ONE - 1)
+			phase = Q16_ONE - 1;
+	}
+
+	return position - (uint64_t)Q16_ONE + (uint64_t)phase;
+}
+
+/**@}*/
@@ -24,8 +24,10 @@
 
 #ifdef ARDUINO
 #include <../include/nanomidi/decoder.h>
+#include <../include/nanomidi/sysex_pool.h>
 #else
 #include <nanomidi/decoder.h>
+#include <nanomidi/sysex_pool.h>
 #endif
 
 #include <assert.h>
@@ -44,18 +46,24 @@ static int data_size(struct midi_message *msg)
 	case MIDI_TYPE_POLYPHONIC_PRESSURE:
 	case MIDI_TYPE_CONTROL_CHANGE:
 	case MIDI_TYPE_PITCH_BEND:
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
 	case MIDI_TYPE_SONG_POSITION:
+#endif
 		length = 2;
 		break;
 	case MIDI_TYPE_PROGRAM_CHANGE:
 	case MIDI_TYPE_CHANNEL_PRESSURE:
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
 	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
 	case MIDI_TYPE_SONG_SELECT:
+#endif
 		length = 1;
 		break;
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
 	case MIDI_TYPE_TUNE_REQUEST:
 		length = 0;
 		break;
+#endif
 	default:
 		length = -1;
 		break;
@@ -105,6 +113,7 @@ static bool decode_data(struct midi_message *msg, uint8_t c, int bytes_left)
 			msg->data.pitch_bend.value |= msb;
 		}
 		break;
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
 	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
 		msg->data.time_code_quarter_frame.value = DATA_BYTE(c);
 		break;
@@ -119,6 +128,7 @@ static bool decode_data(struct midi_message *msg, uint8_t c, int bytes_left)
 	case MIDI_TYPE_SONG_SELECT:
 		msg->data.song_select.song = DATA_BYTE(c);
 		break;
+#endif
 	default:
 		return false;
 	}
@@ -147,6 +157,49 @@ static bool is_realtime_message(int type)
 	return is_rt;
 }
 
+#if NANOMIDI_CONFIG_SYSEX
+static void sysex_pool_abort(struct midi_sysex_pool *pool)
+{
+	if (pool == NULL || pool->first == MIDI_SYSEX_POOL_NO_BLOCK)
+		return;
+
+	midi_sysex_pool_release(pool,
+				&pool->data[pool->first * pool->block_size]);
+	pool->first = MIDI_SYSEX_POOL_NO_BLOCK;
+	pool->last = MIDI_SYSEX_POOL_NO_BLOCK;
+}
+
+static bool sysex_pool_store(struct midi_sysex_pool *pool, size_t pos,
+			     uint8_t c)
+{
+	size_t offset = pos % pool->block_size;
+
+	if (offset == 0) {
+		/* Current block is full (or there is none yet): */
+		if (!midi_sysex_pool_extend(pool)) {
+			pool->exhausted++;
+			sysex_pool_abort(pool);
+			return false;
+		}
+	}
+
+	pool->data[pool->last * pool->block_size + offset] = c;
+	return true;
+}
+
+static void *sysex_pool_finish(struct midi_sysex_pool *pool)
+{
+	if (pool->first == MIDI_SYSEX_POOL_NO_BLOCK)
+		return NULL;
+
+	/* The message is owned by the user from now on: */
+	void *data = &pool->data[pool->first * pool->block_size];
+	pool->first = MIDI_SYSEX_POOL_NO_BLOCK;
+	pool->last = MIDI_SYSEX_POOL_NO_BLOCK;
+	return data;
+}
+#endif
+
 static bool read_byte(struct midi_istream *stream, uint8_t *c)
 {
 	if (stream->capacity == 0)
@@ -159,6 +212,139 @@ static bool read_byte(struct midi_istream *stream, uint8_t *c)
 	return (stream->read_cb(stream, c, 1) == 1);
 }
 
+/**
+ * Feeds a single byte to the decoder.
+ *
+ * The function does not use midi_istream.read_cb() and midi_istream.capacity,
+ * it can be used to decode data which are already in memory. Function
+ * midi_decode() is built on top of it.
+ *
+ * If a message is decoded, it has to be processed (e.g. copied) immediately
+ * as it will become invalid with the next call to midi_decode_byte().
+ *
+ * @param stream        Pointer to the #midi_istream structure holding
+ *                      the decoder state
+ * @param c             Byte to be decoded
+ *
+ * @return Pointer to a decoded message (allocated in #midi_istream) or `NULL`
+ * if the message has not been decoded yet.
+ */
+struct midi_message *midi_decode_byte(struct midi_istream *stream, uint8_t c)
+{
+	assert(stream != NULL);
+
+	bool is_type_byte = ((c & 0x80) != 0);
+	if (is_type_byte) {
+		if (is_realtime_message(c)) {
+			/* System Real Time Message: */
+			if (!filter_accepts(stream->filter, c))
+				return NULL;
+
+			stream->rtmsg.type = c;
+			return &stream->rtmsg;
+		}
+
+#if NANOMIDI_CONFIG_SYSEX
+		/* Any status byte but EOX discards unfinished SysEx: */
+		if (c != MIDI_TYPE_EOX)
+			sysex_pool_abort(stream->sysex_pool);
+#endif
+
+		if (c == MIDI_TYPE_SOX) {
+#if NANOMIDI_CONFIG_SYSEX
+			/* SysEx Message start: */
+			stream->msg.type = MIDI_TYPE_SYSEX;
+			stream->msg.channel = 0;
+			stream->skip = !filter_accepts(stream->filter, c);
+#else
+			/* SysEx Message start (disabled), skip its data: */
+			stream->skip = true;
+#endif
+			stream->bytes_left = 0;
+			return NULL;
+		} else if (c == MIDI_TYPE_EOX) {
+			/* SysEx Message end: */
+#if NANOMIDI_CONFIG_SYSEX
+			if (stream->skip)
+				return NULL;
+
+			void *data = stream->sysex_buffer.data;
+			if (stream->sysex_pool != NULL)
+				data = sysex_pool_finish(stream->sysex_pool);
+
+			int len = stream->bytes_left;
+			if (len < 0)
+				len = 0;
+			stream->msg.data.sysex.data = data;
+			stream->msg.data.sysex.length = (size_t)len;
+
+			/* Ignore data bytes until the next status byte: */
+			stream->skip = true;
+			return &stream->msg;
+#else
+			return NULL;
+#endif
+		} else if (c >= MIDI_TYPE_SYSTEM_BASE) {
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
+			/* System Common Message: */
+			stream->msg.type = c;
+			stream->msg.channel = 0;
+#else
+			/* System Common Message (disabled), skip its data: */
+			stream->skip = true;
+			stream->bytes_left = 0;
+			return NULL;
+#endif
+		} else {
+			/* Channel Mode Message: */
+			stream->msg.type = (c & 0xf0);
+			stream->msg.channel = (uint8_t)((c & 0x0f) + 1);
+		}
+
+		stream->skip = !filter_accepts(stream->filter, c);
+		stream->bytes_left = data_size(&stream->msg);
+		if (stream->bytes_left == 0 && !stream->skip) {
+			/* Message with no data */
+			return &stream->msg;
+		}
+	} else if (stream->skip) {
+		/* Data of a filtered message (including Running Status): */
+		return NULL;
+#if NANOMIDI_CONFIG_SYSEX
+	} else if (stream->msg.type == MIDI_TYPE_SYSEX) {
+		/* SysEx Message data: */
+		int pos = stream->bytes_left;
+		if (stream->sysex_pool != NULL) {
+			if (sysex_pool_store(stream->sysex_pool, (size_t)pos, c))
+				stream->bytes_left++;
+			else
+				stream->skip = true;
+		} else if (stream->sysex_buffer.data != NULL &&
+			   pos < (int)stream->sysex_buffer.size) {
+			((uint8_t *)stream->sysex_buffer.data)[pos] = c;
+			stream->bytes_left++;
+		}
+#endif
+	} else {
+		/* Channel Mode or System Common Message data: */
+		if (stream->bytes_left == 0) {
+			/* Running Status: */
+			stream->bytes_left = data_size(&stream->msg);
+		}
+
+		if (stream->bytes_left > 0) {
+			if (decode_data(&stream->msg, c, stream->bytes_left)) {
+				stream->bytes_left = 0;
+				return &stream->msg;
+			} else {
+				stream->bytes_left--;
+			}
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * Decodes a single MIDI message.
  *
@@ -177,70 +363,65 @@ struct midi_message *midi_decode(struct midi_istream *stream)
 
 	uint8_t c;
 	while (read_byte(stream, &c)) {
-		bool is_type_byte = ((c & 0x80) != 0);
-		if (is_type_byte) {
-			if (is_realtime_message(c)) {
-				/* System Real Time Message: */
-				stream->rtmsg.type = c;
-				return &stream->rtmsg;
-			} else if (c == MIDI_TYPE_SOX) {
-				/* SysEx Message start: */
-				stream->msg.type = MIDI_TYPE_SYSEX;
-				stream->msg.channel = 0;
-				stream->bytes_left = 0;
-				continue;
-			} else if (c == MIDI_TYPE_EOX) {
-				/* SysEx Message end: */
-				void *data = stream->sysex_buffer.data;
-				int len = stream->bytes_left;
-				if (len < 0)
-					len = 0;
-				stream->msg.data.sysex.data = data;
-				stream->msg.data.sysex.length = (size_t)len;
-				return &stream->msg;
-			} else if (c >= MIDI_TYPE_SYSTEM_BASE) {
-				/* System Common Message: */
-				stream->msg.type = c;
-				stream->msg.channel = 0;
-			} else {
-				/* Channel Mode Message: */
-				stream->msg.type = (c & 0xf0);
-				stream->msg.channel = (uint8_t)((c & 0x0f) + 1);
-			}
+		/* Skip data of filtered messages without decoding: */
+		if (stream->skip && (c & 0x80) == 0)
+			continue;
 
-			stream->bytes_left = data_size(&stream->msg);
-			if (stream->bytes_left == 0) {
-				/* Message with no data */
-				return &stream->msg;
-			}
-		} else if (stream->msg.type == MIDI_TYPE_SYSEX) {
-			/* SysEx Message data: */
-			int pos = stream->bytes_left;
-			if (stream->sysex_buffer.data != NULL &&
-			    pos < (int)stream->sysex_buffer.size) {
-				((uint8_t *)stream->sysex_buffer.data)[pos] = c;
-				stream->bytes_left++;
-			}
-		} else {
-			/* Channel Mode or System Common Message data: */
-			if (stream->bytes_left == 0) {
-				/* Running Status: */
-				stream->bytes_left = data_size(&stream->msg);
-			}
+		struct midi_message *msg = midi_decode_byte(stream, c);
+		if (msg != NULL)
+			return msg;
+	}
 
-			if (stream->bytes_left > 0) {
-				if (decode_data(&stream->msg, c,
-						stream->bytes_left)) {
-					stream->bytes_left = 0;
-					return &stream->msg;
-				} else {
-					stream->bytes_left--;
-				}
-			}
+	return NULL;
+}
+
+/**
+ * Decodes all messages from a chunk of data.
+ *
+ * The function is intended for push-style input, e.g. from DMA transfer
+ * complete interrupts. Whole chunk is processed and each decoded message is
+ * passed to `sink`. Partially decoded message is kept in `stream` so it can
+ * be completed by the next chunk.
+ *
+ * The function does not use midi_istream.read_cb() and midi_istream.capacity
+ * so the #midi_istream structure can be just zero-initialized (optionally
+ * with midi_istream.sysex_buffer and midi_istream.filter set).
+ *
+ * @param stream        Pointer to the #midi_istream structure holding
+ *                      the decoder state
+ * @param[in] data      Data to be decoded
+ * @param size          Data size (in bytes)
+ * @param sink          Pointer to the #midi_sink structure to pass decoded
+ *                      messages to
+ *
+ * @return The number of messages passed to `sink`.
+ */
+size_t midi_decoder_feed(struct midi_istream *stream, const void *data,
+			 size_t size, struct midi_sink *sink)
+{
+	assert(stream != NULL);
+	assert(data != NULL || size == 0);
+	assert(sink != NULL);
+	assert(sink->message_cb != NULL);
+
+	const uint8_t *bytes = data;
+	size_t num_messages = 0;
+
+	for (size_t i = 0; i < size; i++) {
+		uint8_t c = bytes[i];
+
+		/* Skip data of filtered messages without decoding: */
+		if (stream->skip && (c & 0x80) == 0)
+			continue;
+
+		struct midi_message *msg = midi_decode_byte(stream, c);
+		if (msg != NULL) {
+			sink->message_cb(sink, msg);
+			num_messages++;
 		}
 	}
 
-	return NULL;
+	return num_messages;
 }
 
 /**@}*/
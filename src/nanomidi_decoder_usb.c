@@ -28,6 +28,8 @@
 #include <stdbool.h>
 #include "nanomidi_internal.h"
 
+#if NANOMIDI_CONFIG_USB
+
 static bool read_buffer(struct midi_istream *stream, uint8_t *buffer)
 {
 	if (stream->capacity < 4)
@@ -40,41 +42,20 @@ static bool read_buffer(struct midi_istream *stream, uint8_t *buffer)
 	return (stream->read_cb(stream, buffer, 4) == 4);
 }
 
+#if NANOMIDI_CONFIG_SYSEX
 static bool decode_sysex(struct midi_istream *stream, const uint8_t *buffer,
 			 size_t length)
 {
-	if (stream->sysex_buffer.data == NULL || stream->bytes_left < 0)
-		return false;
-
-	int len;
-	uint8_t *sysex_buffer = stream->sysex_buffer.data;
-
+	/* Decode SysEx bytes as in a byte stream: */
 	for (size_t i = 0; i < length; i++) {
-		switch (buffer[i]) {
-		case MIDI_TYPE_SOX:
-			stream->msg.type = MIDI_TYPE_SYSEX;
-			stream->msg.channel = 0;
-			stream->bytes_left = 0;
-			break;
-		case MIDI_TYPE_EOX:
-			len = stream->bytes_left;
-			if (len < 0)
-				len = 0;
-			stream->msg.data.sysex.data = stream->sysex_buffer.data;
-			stream->msg.data.sysex.length = (size_t)len;
+		struct midi_message *msg = midi_decode_byte(stream, buffer[i]);
+		if (msg != NULL && msg->type == MIDI_TYPE_SYSEX)
 			return true;
-		default:
-			len = stream->bytes_left;
-			if ((size_t)len < stream->sysex_buffer.size) {
-				sysex_buffer[stream->bytes_left] = buffer[i];
-				stream->bytes_left++;
-			}
-			break;
-		}
 	}
 
 	return false;
 }
+#endif
 
 /**
  * Decodes a single MIDI message from USB packet.
@@ -108,8 +89,13 @@ struct midi_message *midi_decode_usb(struct midi_istream *stream,
 	/* Stream might already contain partially decoded message, copy it: */
 	istream.msg = stream->msg;
 	istream.rtmsg = stream->rtmsg;
+#if NANOMIDI_CONFIG_SYSEX
 	istream.sysex_buffer = stream->sysex_buffer;
+	istream.sysex_pool = stream->sysex_pool;
+#endif
 	istream.bytes_left = stream->bytes_left;
+	istream.filter = stream->filter;
+	istream.skip = stream->skip;
 
 	while (read_buffer(stream, buffer)) {
 		*cable_number = (buffer[0] >> 4);
@@ -132,6 +118,7 @@ struct midi_message *midi_decode_usb(struct midi_istream *stream,
 		case 0x0e:
 			midi_length = 3;
 			break;
+#if NANOMIDI_CONFIG_SYSEX
 		case 0x04:
 			sysex = decode_sysex(&istream, &buffer[1], 3);
 			break;
@@ -148,6 +135,11 @@ struct midi_message *midi_decode_usb(struct midi_istream *stream,
 		case 0x07:
 			sysex = decode_sysex(&istream, &buffer[1], 3);
 			break;
+#else
+		case 0x05:
+			midi_length = 1;
+			break;
+#endif
 		case 0x0f:
 			midi_length = 1;
 			break;
@@ -177,6 +169,9 @@ struct midi_message *midi_decode_usb(struct midi_istream *stream,
 	/* Message can be unfinished, copy it: */
 	stream->msg = istream.msg;
 	stream->bytes_left = istream.bytes_left;
+	stream->skip = istream.skip;
 
 	return NULL;
 }
+
+#endif /* NANOMIDI_CONFIG_USB */
@@ -110,6 +110,7 @@ size_t midi_encode(struct midi_ostream *stream, const struct midi_message *msg)
 		buffer[1] = DATA_BYTE(msg->data.pitch_bend.value);
 		buffer[2] = DATA_BYTE(msg->data.pitch_bend.value >> 7);
 		break;
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
 	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
 		length = 2;
 		buffer[1] = DATA_BYTE(msg->data.time_code_quarter_frame.value);
@@ -124,6 +125,7 @@ size_t midi_encode(struct midi_ostream *stream, const struct midi_message *msg)
 		buffer[1] = DATA_BYTE(msg->data.song_select.song);
 		break;
 	case MIDI_TYPE_TUNE_REQUEST:
+#endif
 	case MIDI_TYPE_TIMING_CLOCK:
 	case MIDI_TYPE_START:
 	case MIDI_TYPE_CONTINUE:
@@ -132,6 +134,7 @@ size_t midi_encode(struct midi_ostream *stream, const struct midi_message *msg)
 	case MIDI_TYPE_SYSTEM_RESET:
 		length = 1;
 		break;
+#if NANOMIDI_CONFIG_SYSEX
 	case MIDI_TYPE_SYSEX:
 		if (msg->data.sysex.data == NULL)
 			length = 2;
@@ -139,6 +142,7 @@ size_t midi_encode(struct midi_ostream *stream, const struct midi_message *msg)
 			length = msg->data.sysex.length + 2;
 		buffer[1] = MIDI_TYPE_EOX;
 		break;
+#endif
 	default:
 		length = 0;
 		break;
@@ -148,6 +152,7 @@ size_t midi_encode(struct midi_ostream *stream, const struct midi_message *msg)
 		if (!prepare_write(stream, length))
 			return false;
 
+#if NANOMIDI_CONFIG_SYSEX
 		if (msg->type == MIDI_TYPE_SYSEX) {
 			size_t n = stream->write_cb(stream, buffer, 1);
 
@@ -162,9 +167,10 @@ size_t midi_encode(struct midi_ostream *stream, const struct midi_message *msg)
 
 			n += stream->write_cb(stream, &buffer[1], 1);
 			return n;
-		} else {
-			return stream->write_cb(stream, buffer, length);
 		}
+#endif
+
+		return stream->write_cb(stream, buffer, length);
 	}
 
 	return false;
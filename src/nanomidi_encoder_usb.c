@@ -28,6 +28,8 @@
 #include <stdbool.h>
 #include "nanomidi_internal.h"
 
+#if NANOMIDI_CONFIG_USB
+
 static size_t write_buffer(struct midi_ostream *stream, uint8_t *buffer)
 {
 	if (stream->capacity < 4)
@@ -38,37 +40,45 @@ static size_t write_buffer(struct midi_ostream *stream, uint8_t *buffer)
 	return stream->write_cb(stream, buffer, 4);
 }
 
+#if NANOMIDI_CONFIG_SYSEX
 static size_t encode_sysex(struct midi_ostream *stream,
 			   const struct midi_message *msg, uint8_t cable_number)
 {
 	int remaining;
 	const uint8_t *sdata = msg->data.sysex.data;
+	size_t slength = (sdata != NULL) ? msg->data.sysex.length : 0;
 	size_t num_written = 0;
 	uint8_t buffer[4] = { 0 };
 
-	switch (msg->data.sysex.length) {
+	switch (slength) {
 	case 0:
-		break;
+		/* Empty SysEx, "SOX" and "EOX" only as from midi_encode(): */
+		buffer[0] = USB_BYTE0(cable_number, 0x06);
+		buffer[1] = MIDI_TYPE_SOX;
+		buffer[2] = MIDI_TYPE_EOX;
+		return write_buffer(stream, buffer);
 	case 1:
 		/* Single-byte SysEx: */
+		buffer[0] = USB_BYTE0(cable_number, 0x07);
 		buffer[1] = MIDI_TYPE_SOX;
 		buffer[2] = *sdata;
 		buffer[3] = MIDI_TYPE_EOX;
 		return write_buffer(stream, buffer);
 	default:
 		/* SysEx starts: */
-		remaining  = (int)msg->data.sysex.length + 1;
+		remaining  = (int)slength + 1;
 		buffer[0] = USB_BYTE0(cable_number, 0x04);
 		buffer[1] = MIDI_TYPE_SOX;
 		buffer[2] = *sdata++;
 		buffer[3] = *sdata++;
 
-		while (remaining >= 0) {
+		for (;;) {
 			remaining -= 3;
 
 			size_t n = write_buffer(stream, buffer);
 			num_written += n;
-			if (n < 4)
+			/* Stop after the last packet: */
+			if (n < 4 || remaining < 0)
 				return num_written;
 
 			switch (remaining) {
@@ -96,16 +106,15 @@ static size_t encode_sysex(struct midi_ostream *stream,
 			default:
 				/* SysEx continues: */
 				for (int i = 0; i < 3; i++)
-					buffer[i] = *sdata++;
+					buffer[i+1] = *sdata++;
 				break;
 			}
 		}
-
-		return num_written;
 	}
 
 	return 0;
 }
+#endif
 
 /**
  * Encodes a single MIDI message into USB packet.
@@ -132,6 +141,7 @@ size_t midi_encode_usb(struct midi_ostream *stream,
 	uint8_t cin = 0;
 
 	switch (msg->type) {
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
 	/* Single-byte System Common messages: */
 	case MIDI_TYPE_TUNE_REQUEST:
 		cin = 0x05;
@@ -145,6 +155,7 @@ size_t midi_encode_usb(struct midi_ostream *stream,
 	case MIDI_TYPE_SONG_POSITION:
 		cin = 0x03;
 		break;
+#endif
 	/* Channel Mode messages: */
 	case MIDI_TYPE_NOTE_OFF:
 	case MIDI_TYPE_NOTE_ON:
@@ -155,9 +166,11 @@ size_t midi_encode_usb(struct midi_ostream *stream,
 	case MIDI_TYPE_PITCH_BEND:
 		cin = (uint8_t)(msg->type >> 4);
 		break;
+#if NANOMIDI_CONFIG_SYSEX
 	/* System exclusive message: */
 	case MIDI_TYPE_SYSEX:
 		return encode_sysex(stream, msg, cable_number);
+#endif
 	/* Single byte: */
 	default:
 		cin = 0x0f;
@@ -175,3 +188,5 @@ size_t midi_encode_usb(struct midi_ostream *stream,
 
 	return 0;
 }
+
+#endif /* NANOMIDI_CONFIG_USB */
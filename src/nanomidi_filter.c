@@ -0,0 +1,74 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/decoder.h>
+#else
+#include <nanomidi/decoder.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+static void accept_status(struct midi_filter *filter, uint8_t c)
+{
+	filter->status[c / 32] |= ((uint32_t)1 << (c % 32));
+}
+
+/**
+ * Compiles a message filter for midi_decode().
+ *
+ * @ingroup decoder
+ *
+ * Messages of types which are not listed (or channel messages such as Note
+ * On or Control Change on channels which are not listed) are skipped by midi_decode() and
+ * midi_decode_usb() once the filter is assigned to midi_istream.filter.
+ * Their data bytes (including Running Status data and SysEx data) are
+ * neither decoded nor stored into the SysEx buffer.
+ *
+ * @param[out] filter   Pointer to the #midi_filter structure to be compiled
+ * @param[in] types     Array of accepted message types
+ * @param count         Number of elements in `types`
+ * @param channels      Bit mask of accepted channels for all channel messages
+ *                      (bit 0 for channel 1, 0xffff for all channels)
+ */
+void midi_filter_compile(struct midi_filter *filter,
+			 const enum midi_type *types, size_t count,
+			 uint16_t channels)
+{
+	assert(filter != NULL);
+	assert(types != NULL || count == 0);
+
+	memset(filter, 0, sizeof(struct midi_filter));
+
+	for (size_t i = 0; i < count; i++) {
+		uint8_t type = (uint8_t)types[i];
+
+		if (type >= MIDI_TYPE_SYSTEM_BASE) {
+			accept_status(filter, type);
+			continue;
+		}
+
+		for (uint8_t ch = 0; ch < 16; ch++) {
+			if (channels & (1U << ch))
+				accept_status(filter, (uint8_t)(type | ch));
+		}
+	}
+}
@@ -21,9 +21,9 @@
 #define NANOMIDI_INTERNAL_H
 
 #ifdef ARDUINO
-#include <../include/nanomidi/messages.h>
+#include <../include/nanomidi/decoder.h>
 #else
-#include <nanomidi/messages.h>
+#include <nanomidi/decoder.h>
 #endif
 
 #define DATA_BYTE(data)		((data) & 0x7f)
@@ -35,4 +35,43 @@ enum midi_type_sysex {
 	MIDI_TYPE_EOX = 0xf7,
 };
 
+/* Checks whether a status byte passes an optional filter */
+static inline bool filter_accepts(const struct midi_filter *filter, uint8_t c)
+{
+	if (filter == NULL)
+		return true;
+
+	return (filter->status[c / 32] & ((uint32_t)1 << (c % 32))) != 0;
+}
+
+/* Index of the least significant bit set in non-zero x */
+static inline int ctz32(uint32_t x)
+{
+#ifdef __GNUC__
+	return __builtin_ctzl((unsigned long)x);
+#else
+	int n = 0;
+	while ((x & 1) == 0) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/* Number of bits set in x */
+static inline int popcount32(uint32_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcountl((unsigned long)x);
+#else
+	int n = 0;
+	while (x != 0) {
+		x &= x - 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
 #endif /* NANOMIDI_INTERNAL_H */
@@ -0,0 +1,512 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Buffered non-blocking I/O for Linux
+ * @defgroup linux_io Linux I/O
+ *
+ * Ready-made #midi_istream and #midi_ostream streams for ALSA raw MIDI
+ * devices (`/dev/snd/midiC*D*`), serial ports, pipes and FIFOs.
+ *
+ * Instead of one read() per byte requested by midi_decode(), input is read
+ * in large non-blocking chunks into a buffer. Output is collected in a ring
+ * buffer by midi_encode() and written by midi_linux_flush() using a single
+ * writev() call. If the ports are registered with a #midi_linux_poller,
+ * input is read only after epoll reported it, so reading a burst of messages
+ * costs a single system call.
+ *
+ * The module is only compiled on Linux.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifdef ARDUINO
+#include <../include/nanomidi/linux_io.h>
+#else
+#include <nanomidi/linux_io.h>
+#endif
+
+#if defined(__linux__)
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+/**@{*/
+
+static speed_t baud_rate(int baud)
+{
+	switch (baud) {
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	default:
+		return B0;
+	}
+}
+
+static bool configure_tty(int fd, int baud)
+{
+	struct termios tio;
+	if (tcgetattr(fd, &tio) < 0)
+		return false;
+
+	/* Raw 8N1 without flow control: */
+	tio.c_iflag &= ~(tcflag_t)(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR |
+				   IGNCR | ICRNL | IXON | IXOFF);
+	tio.c_oflag &= ~(tcflag_t)OPOST;
+	tio.c_lflag &= ~(tcflag_t)(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	tio.c_cflag &= ~(tcflag_t)(CSIZE | PARENB | CSTOPB);
+	tio.c_cflag |= CS8 | CREAD | CLOCAL;
+	/* Non-blocking read() fails with EAGAIN instead of returning 0: */
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+
+	if (baud != 0) {
+		speed_t speed = baud_rate(baud);
+		if (speed == B0) {
+			errno = EINVAL;
+			return false;
+		}
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+	}
+
+	return (tcsetattr(fd, TCSANOW, &tio) == 0);
+}
+
+static bool update_events(struct midi_linux_port *port, int op)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN | (port->waiting ? EPOLLOUT : 0),
+		.data.ptr = port,
+	};
+
+	return (epoll_ctl(port->poll_fd, op, port->fd, &event) == 0);
+}
+
+static void hang_up(struct midi_linux_port *port)
+{
+	port->hangup = true;
+	port->readable = false;
+
+	if (port->poll_fd >= 0) {
+		epoll_ctl(port->poll_fd, EPOLL_CTL_DEL, port->fd, NULL);
+		port->poll_fd = -1;
+	}
+}
+
+/* Reads as much data as possible into the empty input buffer */
+static size_t fill(struct midi_linux_port *port)
+{
+	if (port->hangup || (port->poll_fd >= 0 && !port->readable))
+		return 0;
+
+	ssize_t n = read(port->fd, port->rx_buffer, port->rx_size);
+	port->num_reads++;
+
+	if (n > 0) {
+		port->rx_pos = 0;
+		port->rx_length = (size_t)n;
+		/* Short read means the kernel buffer has been drained: */
+		if ((size_t)n < port->rx_size)
+			port->readable = false;
+		return (size_t)n;
+	}
+
+	port->readable = false;
+	if (n == 0 || errno == EIO) {
+		/* End of file or closed pseudoterminal: */
+		hang_up(port);
+	}
+
+	return 0;
+}
+
+static size_t port_read(struct midi_istream *stream, void *data, size_t size)
+{
+	struct midi_linux_port *port = stream->param;
+	uint8_t *dst = data;
+	size_t num_read = 0;
+
+	while (num_read < size) {
+		if (port->rx_pos >= port->rx_length && fill(port) == 0)
+			break;
+
+		size_t n = port->rx_length - port->rx_pos;
+		if (n > size - num_read)
+			n = size - num_read;
+
+		memcpy(&dst[num_read], &port->rx_buffer[port->rx_pos], n);
+		port->rx_pos += n;
+		num_read += n;
+	}
+
+	return num_read;
+}
+
+static size_t port_write(struct midi_ostream *stream, const void *data,
+			 size_t size)
+{
+	struct midi_linux_port *port = stream->param;
+	const uint8_t *src = data;
+
+	/* Stream capacity guarantees there is enough free space: */
+	size_t space = port->tx_size - (port->tx_tail - port->tx_head);
+	if (size > space)
+		size = space;
+
+	for (size_t i = 0; i < size; ) {
+		size_t pos = port->tx_tail % port->tx_size;
+		size_t n = port->tx_size - pos;
+		if (n > size - i)
+			n = size - i;
+
+		memcpy(&port->tx_buffer[pos], &src[i], n);
+		port->tx_tail += n;
+		i += n;
+	}
+
+	return size;
+}
+
+/**
+ * Opens a raw MIDI device, serial port or FIFO in non-blocking mode.
+ *
+ * Terminal devices are switched to raw 8N1 mode without flow control. The
+ * MIDI baud rate of 31250 is not a standard termios rate, serial adapters
+ * usually map a standard rate (e.g. 38400) to it.
+ *
+ * @param path          Path to the device node or FIFO
+ * @param baud          Baud rate of a serial port or 0 to keep the current
+ *                      setting (ignored for other devices)
+ *
+ * @return File descriptor to be passed to midi_linux_port_init() or -1 on
+ * error (with errno set).
+ */
+int midi_linux_open(const char *path, int baud)
+{
+	assert(path != NULL);
+
+	int fd = open(path, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (isatty(fd) && !configure_tty(fd, baud)) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Initializes the port.
+ *
+ * The file descriptor (e.g. an end of a pipe) is switched to non-blocking
+ * mode. Members midi_linux_port.input and midi_linux_port.output are set up
+ * to read from and write to the port.
+ *
+ * @param port          Pointer to the #midi_linux_port structure to be
+ *                      initialized
+ * @param fd            Open file descriptor
+ * @param rx_buffer     Input buffer allocated by the user
+ * @param rx_size       Size of the input buffer
+ * @param tx_buffer     Output buffer allocated by the user
+ * @param tx_size       Size of the output buffer
+ *
+ * @return `true` on success or `false` on error (with errno set).
+ */
+bool midi_linux_port_init(struct midi_linux_port *port, int fd,
+			  void *rx_buffer, size_t rx_size,
+			  void *tx_buffer, size_t tx_size)
+{
+	assert(port != NULL);
+	assert(fd >= 0);
+	assert(rx_buffer != NULL && rx_size > 0);
+	assert(tx_buffer != NULL && tx_size > 0);
+
+	memset(port, 0, sizeof(struct midi_linux_port));
+	port->fd = fd;
+	port->poll_fd = -1;
+	port->readable = true;
+	port->rx_buffer = rx_buffer;
+	port->rx_size = rx_size;
+	port->tx_buffer = tx_buffer;
+	port->tx_size = tx_size;
+
+	port->input.read_cb = &port_read;
+	port->input.capacity = MIDI_STREAM_CAPACITY_UNLIMITED;
+	port->input.param = port;
+
+	port->output.write_cb = &port_write;
+	port->output.capacity = tx_size;
+	port->output.param = port;
+
+	int flags = fcntl(fd, F_GETFL);
+	return (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+/**
+ * Removes the port from its poller and closes the file descriptor.
+ *
+ * Pending output which has not been flushed is discarded.
+ *
+ * @param port          Pointer to the #midi_linux_port structure
+ */
+void midi_linux_port_close(struct midi_linux_port *port)
+{
+	assert(port != NULL);
+
+	if (port->poll_fd >= 0)
+		epoll_ctl(port->poll_fd, EPOLL_CTL_DEL, port->fd, NULL);
+
+	close(port->fd);
+	port->fd = -1;
+	port->poll_fd = -1;
+}
+
+/**
+ * Reads available input and passes all decoded messages to the sink.
+ *
+ * Input is decoded directly from midi_linux_port.rx_buffer using
+ * midi_decoder_feed(). The function performs a single read() call (none if
+ * the port is registered with a poller which has not reported it readable).
+ *
+ * @param port          Pointer to the #midi_linux_port structure
+ * @param sink          Pointer to the #midi_sink structure to pass decoded
+ *                      messages to
+ *
+ * @return The number of messages passed to `sink`.
+ */
+size_t midi_linux_receive(struct midi_linux_port *port,
+			  struct midi_sink *sink)
+{
+	assert(port != NULL);
+	assert(sink != NULL);
+
+	size_t num_messages = 0;
+
+	/* Data left in the buffer by midi_decode(): */
+	if (port->rx_pos < port->rx_length) {
+		num_messages += midi_decoder_feed(&port->input,
+					&port->rx_buffer[port->rx_pos],
+					port->rx_length - port->rx_pos, sink);
+		port->rx_pos = port->rx_length;
+	}
+
+	size_t n = fill(port);
+	if (n > 0) {
+		num_messages += midi_decoder_feed(&port->input,
+						  port->rx_buffer, n, sink);
+		port->rx_pos = n;
+	}
+
+	return num_messages;
+}
+
+/**
+ * Writes buffered output using writev().
+ *
+ * Data which cannot be written without blocking are kept in the buffer. If
+ * the port is registered with a poller, the rest is written by
+ * midi_linux_poll() once the port becomes writable.
+ *
+ * @param port          Pointer to the #midi_linux_port structure
+ *
+ * @return `true` on success (including partial writes) or `false` on error
+ * (with errno set).
+ */
+bool midi_linux_flush(struct midi_linux_port *port)
+{
+	assert(port != NULL);
+
+	bool ok = true;
+
+	while (port->tx_tail != port->tx_head) {
+		size_t pending = port->tx_tail - port->tx_head;
+		size_t pos = port->tx_head % port->tx_size;
+		size_t first = port->tx_size - pos;
+		if (first > pending)
+			first = pending;
+
+		/* Ring buffer may wrap around: */
+		struct iovec iov[2] = {
+			{ .iov_base = &port->tx_buffer[pos], .iov_len = first },
+			{ .iov_base = port->tx_buffer,
+			  .iov_len = pending - first },
+		};
+
+		ssize_t n = writev(port->fd, iov, (pending > first) ? 2 : 1);
+		port->num_writes++;
+
+		if (n < 0) {
+			ok = (errno == EAGAIN || errno == EWOULDBLOCK ||
+			      errno == EINTR);
+			break;
+		}
+
+		port->tx_head += (size_t)n;
+		port->output.capacity += (size_t)n;
+
+		if ((size_t)n < pending)
+			break;
+	}
+
+	bool waiting = (port->tx_tail != port->tx_head);
+	if (port->poll_fd >= 0 && waiting != port->waiting) {
+		port->waiting = waiting;
+		update_events(port, EPOLL_CTL_MOD);
+	}
+
+	return ok;
+}
+
+/**
+ * Initializes the poller.
+ *
+ * @param poller        Pointer to the #midi_linux_poller structure to be
+ *                      initialized
+ *
+ * @return `true` on success or `false` on error (with errno set).
+ */
+bool midi_linux_poller_init(struct midi_linux_poller *poller)
+{
+	assert(poller != NULL);
+
+	poller->fd = epoll_create1(EPOLL_CLOEXEC);
+	return (poller->fd >= 0);
+}
+
+/**
+ * Registers the port with the poller.
+ *
+ * @param poller        Pointer to the #midi_linux_poller structure
+ * @param port          Pointer to an initialized #midi_linux_port structure
+ *
+ * @return `true` on success or `false` on error (with errno set).
+ */
+bool midi_linux_poller_add(struct midi_linux_poller *poller,
+			   struct midi_linux_port *port)
+{
+	assert(poller != NULL);
+	assert(port != NULL);
+	assert(port->poll_fd < 0);
+
+	port->poll_fd = poller->fd;
+	port->waiting = (port->tx_tail != port->tx_head);
+	/* Data received before registration are reported by epoll: */
+	port->readable = false;
+
+	if (!update_events(port, EPOLL_CTL_ADD)) {
+		port->poll_fd = -1;
+		port->readable = true;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Waits until input is available on any of the registered ports.
+ *
+ * Pending output of ports which became writable is flushed internally.
+ * Ports whose other end has been closed are reported with
+ * midi_linux_port.hangup set and removed from the poller.
+ *
+ * @param poller        Pointer to the #midi_linux_poller structure
+ * @param[out] ports    Array to be filled with pointers to readable ports
+ * @param max_ports     Size of the array (at most #MIDI_LINUX_MAX_EVENTS
+ *                      ports are returned)
+ * @param timeout_ms    Timeout in milliseconds, -1 to wait indefinitely or 0
+ *                      to return immediately
+ *
+ * @return The number of ports stored in `ports` or -1 on error (with errno
+ * set).
+ */
+int midi_linux_poll(struct midi_linux_poller *poller,
+		    struct midi_linux_port **ports, int max_ports,
+		    int timeout_ms)
+{
+	assert(poller != NULL);
+	assert(ports != NULL);
+	assert(max_ports > 0);
+
+	struct epoll_event events[MIDI_LINUX_MAX_EVENTS];
+	if (max_ports > MIDI_LINUX_MAX_EVENTS)
+		max_ports = MIDI_LINUX_MAX_EVENTS;
+
+	int n = epoll_wait(poller->fd, events, max_ports, timeout_ms);
+	if (n < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	int num_ports = 0;
+	for (int i = 0; i < n; i++) {
+		struct midi_linux_port *port = events[i].data.ptr;
+		uint32_t flags = events[i].events;
+
+		if (flags & EPOLLOUT)
+			midi_linux_flush(port);
+
+		if (flags & EPOLLIN) {
+			port->readable = true;
+			ports[num_ports++] = port;
+		} else if (flags & (EPOLLHUP | EPOLLERR)) {
+			hang_up(port);
+			ports[num_ports++] = port;
+		}
+	}
+
+	return num_ports;
+}
+
+/**
+ * Closes the poller.
+ *
+ * @param poller        Pointer to the #midi_linux_poller structure
+ */
+void midi_linux_poller_close(struct midi_linux_poller *poller)
+{
+	assert(poller != NULL);
+
+	close(poller->fd);
+	poller->fd = -1;
+}
+
+/**@}*/
+
+#endif /* __linux__ */
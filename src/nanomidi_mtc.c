@@ -0,0 +1,543 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * MIDI Time Code
+ * @defgroup mtc MIDI Time Code
+ *
+ * MIDI Time Code (MTC) assembler collects quarter frame messages
+ * (#MIDI_TYPE_TIME_CODE_QUARTER_FRAME) and full-frame SysEx messages and
+ * provides the current position, interpolated between quarter frames using
+ * the measured quarter frame period. The position is returned in subframes
+ * (hundredths of a frame) counted from 00:00:00:00.
+ *
+ * Each quarter frame advances the position by a quarter of a frame. The time
+ * carried by eight quarter frames refers to the first quarter frame of the
+ * sequence so the position is already 1.75 frames ahead once the sequence is
+ * complete (the two-frame offset).
+ *
+ * MTC generator produces quarter frames from a free-running clock.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/mtc.h>
+#else
+#include <nanomidi/mtc.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define QUARTER_SUBFRAMES	(MIDI_MTC_SUBFRAMES / 4)
+#define DROP_FRAMES_10MIN	17982
+#define DROP_FRAMES_MIN		1798
+
+/* Number of frames per second (nominal): */
+static const uint8_t frame_count[4] = { 24, 25, 30, 30 };
+
+/* Exact frame rate as a fraction (rate_num / rate_den frames per second): */
+static const uint16_t rate_num[4] = { 24, 25, 30000, 30 };
+static const uint16_t rate_den[4] = { 1, 1, 1001, 1 };
+
+static uint32_t quarter_frame_period(uint32_t ticks_per_second,
+				     enum midi_mtc_rate rate)
+{
+	uint64_t ticks = (uint64_t)ticks_per_second * rate_den[rate];
+	return (uint32_t)(ticks / (4u * rate_num[rate]));
+}
+
+static uint32_t frames_per_day(enum midi_mtc_rate rate)
+{
+	uint32_t frames = 24u * 3600u * frame_count[rate];
+
+	if (rate == MIDI_MTC_RATE_30_DROP)
+		frames -= 2u * (24u * 60u - 24u * 6u);
+
+	return frames;
+}
+
+static enum midi_mtc_rate decode_hours(uint8_t c, uint8_t *hours)
+{
+	*hours = (c & 0x1f);
+	return (enum midi_mtc_rate)((c >> 5) & 0x03);
+}
+
+/**
+ * Converts a time code into the number of frames since 00:00:00:00.
+ *
+ * Frames skipped in drop-frame time code are not counted.
+ *
+ * @param[in] time      Pointer to the #midi_mtc_time structure
+ *
+ * @return The number of frames.
+ */
+uint32_t midi_mtc_time_to_frames(const struct midi_mtc_time *time)
+{
+	assert(time != NULL);
+
+	uint32_t minutes = 60u * time->hours + time->minutes;
+	uint32_t frames = (60u * minutes + time->seconds) *
+			  frame_count[time->rate & 0x03] + time->frames;
+
+	if (time->rate == MIDI_MTC_RATE_30_DROP)
+		frames -= 2u * (minutes - minutes / 10);
+
+	return frames;
+}
+
+/**
+ * Converts the number of frames since 00:00:00:00 into a time code.
+ *
+ * @param[out] time     Pointer to the #midi_mtc_time structure to be filled
+ * @param frames        Number of frames (wraps around after 24 hours)
+ * @param rate          Frame rate
+ */
+void midi_mtc_frames_to_time(struct midi_mtc_time *time, uint32_t frames,
+			     enum midi_mtc_rate rate)
+{
+	assert(time != NULL);
+
+	rate &= 0x03;
+	frames %= frames_per_day(rate);
+
+	if (rate == MIDI_MTC_RATE_30_DROP) {
+		/* Add dropped frames 0 and 1 of each minute but every tenth: */
+		uint32_t d = frames / DROP_FRAMES_10MIN;
+		uint32_t m = frames % DROP_FRAMES_10MIN;
+		frames += 18u * d;
+		if (m > 1)
+			frames += 2u * ((m - 2) / DROP_FRAMES_MIN);
+	}
+
+	uint32_t fps = frame_count[rate];
+	time->frames = (uint8_t)(frames % fps);
+	frames /= fps;
+	time->seconds = (uint8_t)(frames % 60);
+	frames /= 60;
+	time->minutes = (uint8_t)(frames % 60);
+	time->hours = (uint8_t)(frames / 60);
+	time->subframes = 0;
+	time->rate = rate;
+}
+
+/**
+ * Decodes a full-frame MTC SysEx message.
+ *
+ * @param[out] time     Pointer to the #midi_mtc_time structure to be filled
+ * @param[in] data      SysEx data without "SOX" and "EOX" bytes
+ *                      (midi_message.data.sysex.data)
+ * @param length        SysEx data length
+ *
+ * @return `true` if the message is a full-frame MTC message, `false`
+ * otherwise.
+ */
+bool midi_mtc_decode_full_frame(struct midi_mtc_time *time, const void *data,
+				size_t length)
+{
+	assert(time != NULL);
+
+	const uint8_t *d = data;
+
+	/* F0 7F <device> 01 01 hr mn sc fr F7 */
+	if (d == NULL || length != 8 || d[0] != 0x7f || d[2] != 0x01 ||
+	    d[3] != 0x01)
+		return false;
+
+	time->rate = decode_hours(d[4], &time->hours);
+	time->minutes = DATA_BYTE(d[5]);
+	time->seconds = DATA_BYTE(d[6]);
+	time->frames = (d[7] & 0x1f);
+	time->subframes = 0;
+	return true;
+}
+
+/**
+ * Encodes a full-frame MTC SysEx message.
+ *
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param[in] time      Pointer to the #midi_mtc_time structure
+ * @param device_id     Device ID (0x7f to address all devices)
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_encode_mtc_full_frame(struct midi_ostream *stream,
+				  const struct midi_mtc_time *time,
+				  uint8_t device_id)
+{
+	assert(stream != NULL);
+	assert(time != NULL);
+	assert(stream->write_cb != NULL);
+
+	uint8_t data[8] = {
+		0x7f, DATA_BYTE(device_id), 0x01, 0x01,
+		(uint8_t)(((time->rate & 0x03) << 5) | (time->hours & 0x1f)),
+		DATA_BYTE(time->minutes),
+		DATA_BYTE(time->seconds),
+		(uint8_t)(time->frames & 0x1f),
+	};
+
+#if NANOMIDI_CONFIG_SYSEX
+	struct midi_message msg;
+	msg.type = MIDI_TYPE_SYSEX;
+	msg.channel = 0;
+	msg.data.sysex.data = data;
+	msg.data.sysex.length = sizeof(data);
+
+	return midi_encode(stream, &msg);
+#else
+	(void)data;
+	return 0;
+#endif
+}
+
+/**
+ * Initializes the MIDI Time Code assembler.
+ *
+ * @param mtc                   Pointer to the #midi_mtc structure to be
+ *                              initialized
+ * @param ticks_per_second      Number of ticks per second (resolution of time
+ *                              passed to other functions)
+ * @param timeout               Number of ticks without a quarter frame after
+ *                              which the time code is considered stopped
+ */
+void midi_mtc_init(struct midi_mtc *mtc, uint32_t ticks_per_second,
+		   uint32_t timeout)
+{
+	assert(mtc != NULL);
+	assert(ticks_per_second > 0);
+
+	memset(mtc, 0, sizeof(struct midi_mtc));
+	mtc->ticks_per_second = ticks_per_second;
+	mtc->timeout = timeout;
+	mtc->state = MIDI_MTC_STOPPED;
+	mtc->rate = MIDI_MTC_RATE_30;
+	mtc->direction = 1;
+	mtc->piece = 7;
+	mtc->period = quarter_frame_period(ticks_per_second, mtc->rate);
+}
+
+static uint32_t interpolate(struct midi_mtc *mtc, uint32_t elapsed)
+{
+	uint32_t position = QUARTER_SUBFRAMES * mtc->position;
+	uint32_t delta = (uint32_t)((uint64_t)elapsed * QUARTER_SUBFRAMES /
+				    mtc->period);
+
+	/* Never go back unless the time code jumps: */
+	if (mtc->direction > 0) {
+		position += delta;
+		if (position < mtc->last)
+			position = mtc->last;
+	} else {
+		position = (position > delta) ? position - delta : 0;
+		if (position > mtc->last)
+			position = mtc->last;
+	}
+
+	mtc->last = position;
+	return position;
+}
+
+static uint32_t check_timeout(struct midi_mtc *mtc, uint32_t now)
+{
+	uint32_t elapsed = now - mtc->timestamp;
+
+	if (mtc->state == MIDI_MTC_STOPPED)
+		return elapsed;
+
+	if (elapsed > mtc->timeout) {
+		/* Stop at the position reached when the timeout expired: */
+		interpolate(mtc, mtc->timeout);
+		mtc->state = MIDI_MTC_STOPPED;
+		mtc->tracking = false;
+	} else if (elapsed > 2 * mtc->period) {
+		mtc->state = MIDI_MTC_FREEWHEEL;
+	}
+
+	return elapsed;
+}
+
+static bool update_quarter_frame(struct midi_mtc *mtc, uint8_t value,
+				 uint32_t now)
+{
+	uint8_t piece = (value >> 4) & 0x07;
+	int8_t direction = 0;
+
+	if (piece == ((mtc->piece + 1) & 0x07))
+		direction = 1;
+	else if (piece == ((mtc->piece - 1) & 0x07))
+		direction = -1;
+
+	uint32_t elapsed = check_timeout(mtc, now);
+
+	if (direction == 0 || direction != mtc->direction) {
+		/* Lost quarter frame or change of direction, keep running
+		   from the last known position until the next sequence: */
+		mtc->received = 0;
+		mtc->tracking = false;
+		if (direction != 0)
+			mtc->direction = direction;
+		if (mtc->state == MIDI_MTC_LOCKED)
+			mtc->state = MIDI_MTC_FREEWHEEL;
+	} else if (mtc->tracking) {
+		if (direction > 0 || mtc->position > 0)
+			mtc->position = (uint32_t)((int32_t)mtc->position +
+						   direction);
+
+		/* Measure quarter frame period: */
+		if (elapsed < 2 * mtc->period) {
+			int32_t error = (int32_t)(elapsed - mtc->period);
+			mtc->period = (uint32_t)((int32_t)mtc->period +
+						 error / 8);
+		}
+
+		mtc->timestamp = now;
+		mtc->state = MIDI_MTC_LOCKED;
+	}
+
+	mtc->piece = piece;
+
+	uint8_t first = (mtc->direction > 0) ? 0 : 7;
+	if (piece == first)
+		mtc->received = 0;
+
+	mtc->nibbles[piece] = (value & 0x0f);
+	mtc->received |= (uint8_t)(1 << piece);
+
+	if (mtc->received != 0xff || piece != 7 - first)
+		return false;
+
+	/* Whole sequence received: */
+	const uint8_t *n = mtc->nibbles;
+	struct midi_mtc_time time;
+	time.frames = (uint8_t)(n[0] | (n[1] << 4));
+	time.seconds = (uint8_t)(n[2] | (n[3] << 4));
+	time.minutes = (uint8_t)(n[4] | (n[5] << 4));
+	time.rate = decode_hours((uint8_t)(n[6] | (n[7] << 4)), &time.hours);
+
+	uint32_t position = 4 * midi_mtc_time_to_frames(&time);
+	if (mtc->direction > 0)
+		position += 7;
+	else
+		position = (position >= 7) ? position - 7 : 0;
+
+	if (!mtc->tracking || position != mtc->position) {
+		/* Jump (or first lock), do not keep the position monotonic: */
+		mtc->last = QUARTER_SUBFRAMES * position;
+	}
+
+	if (time.rate != mtc->rate) {
+		mtc->rate = time.rate;
+		mtc->period = quarter_frame_period(mtc->ticks_per_second,
+						   time.rate);
+	}
+
+	mtc->position = position;
+	mtc->timestamp = now;
+	mtc->tracking = true;
+	mtc->state = MIDI_MTC_LOCKED;
+	return true;
+}
+
+/**
+ * Updates the MIDI Time Code assembler with a decoded message.
+ *
+ * Quarter frames are processed in constant time. Full-frame SysEx messages
+ * set the position directly and stop the time code until quarter frames
+ * arrive. Other messages are ignored.
+ *
+ * @param mtc           Pointer to the #midi_mtc structure
+ * @param[in] msg       Pointer to the decoded message
+ * @param now           Current time in ticks
+ *
+ * @return `true` if a complete time code has been received, `false`
+ * otherwise.
+ */
+bool midi_mtc_update(struct midi_mtc *mtc, const struct midi_message *msg,
+		     uint32_t now)
+{
+	assert(mtc != NULL);
+	assert(msg != NULL);
+
+	if (msg->type == MIDI_TYPE_TIME_CODE_QUARTER_FRAME) {
+		uint8_t value = msg->data.time_code_quarter_frame.value;
+		return update_quarter_frame(mtc, value, now);
+	}
+
+#if NANOMIDI_CONFIG_SYSEX
+	struct midi_mtc_time time;
+	if (msg->type == MIDI_TYPE_SYSEX &&
+	    midi_mtc_decode_full_frame(&time, msg->data.sysex.data,
+				       msg->data.sysex.length)) {
+		mtc->rate = time.rate;
+		mtc->period = quarter_frame_period(mtc->ticks_per_second,
+						   time.rate);
+		mtc->position = 4 * midi_mtc_time_to_frames(&time);
+		mtc->last = QUARTER_SUBFRAMES * mtc->position;
+		mtc->tracking = false;
+		mtc->state = MIDI_MTC_STOPPED;
+		mtc->received = 0;
+		mtc->timestamp = now;
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+/**
+ * Returns the current position.
+ *
+ * The position is interpolated from the last quarter frame using
+ * the measured quarter frame period. It never goes back (or forth for
+ * reverse direction) unless the time code jumps. If quarter frames are late,
+ * the state changes to #MIDI_MTC_FREEWHEEL and the position keeps running.
+ * Once midi_mtc.timeout expires, the state changes to #MIDI_MTC_STOPPED and
+ * the position stops.
+ *
+ * @param mtc           Pointer to the #midi_mtc structure
+ * @param now           Current time in ticks
+ *
+ * @return The position in subframes (#MIDI_MTC_SUBFRAMES per frame) since
+ * 00:00:00:00.
+ */
+uint32_t midi_mtc_position(struct midi_mtc *mtc, uint32_t now)
+{
+	assert(mtc != NULL);
+
+	uint32_t elapsed = check_timeout(mtc, now);
+	if (mtc->state == MIDI_MTC_STOPPED)
+		return mtc->last;
+
+	return interpolate(mtc, elapsed);
+}
+
+/**
+ * Returns the current position as a time code.
+ *
+ * @param mtc           Pointer to the #midi_mtc structure
+ * @param now           Current time in ticks
+ * @param[out] time     Pointer to the #midi_mtc_time structure to be filled
+ */
+void midi_mtc_get_time(struct midi_mtc *mtc, uint32_t now,
+		       struct midi_mtc_time *time)
+{
+	assert(mtc != NULL);
+	assert(time != NULL);
+
+	uint32_t position = midi_mtc_position(mtc, now);
+	midi_mtc_frames_to_time(time, position / MIDI_MTC_SUBFRAMES,
+				mtc->rate);
+	time->subframes = (uint8_t)(position % MIDI_MTC_SUBFRAMES);
+}
+
+/**
+ * Initializes the MIDI Time Code generator.
+ *
+ * @param gen                   Pointer to the #midi_mtc_generator structure
+ *                              to be initialized
+ * @param[in] start             Pointer to the #midi_mtc_time structure with
+ *                              starting position and frame rate
+ * @param ticks_per_second      Number of ticks per second (resolution of time
+ *                              passed to midi_mtc_generate())
+ * @param now                   Current time in ticks, the first quarter frame
+ *                              is generated at this time
+ */
+void midi_mtc_generator_init(struct midi_mtc_generator *gen,
+			     const struct midi_mtc_time *start,
+			     uint32_t ticks_per_second, uint32_t now)
+{
+	assert(gen != NULL);
+	assert(start != NULL);
+	assert(ticks_per_second > 0);
+
+	gen->ticks_per_second = ticks_per_second;
+	gen->rate = start->rate & 0x03;
+	gen->frame = midi_mtc_time_to_frames(start);
+	gen->position = 4 * gen->frame;
+	gen->piece = 0;
+	gen->next = now;
+	gen->remainder = 0;
+}
+
+/**
+ * Generates quarter frames which are due.
+ *
+ * The function should be called periodically, at least once per quarter
+ * frame period. Quarter frames are timed exactly (without accumulating
+ * rounding errors) in respect to the clock providing `now`.
+ *
+ * @param gen           Pointer to the #midi_mtc_generator structure
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param now           Current time in ticks
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_mtc_generate(struct midi_mtc_generator *gen,
+			 struct midi_ostream *stream, uint32_t now)
+{
+	assert(gen != NULL);
+	assert(stream != NULL);
+	assert(stream->write_cb != NULL);
+
+	size_t num_written = 0;
+	uint32_t divisor = 4u * rate_num[gen->rate];
+
+	while ((int32_t)(now - gen->next) >= 0) {
+		if (gen->piece == 0)
+			gen->frame = gen->position / 4;
+
+		struct midi_mtc_time time;
+		midi_mtc_frames_to_time(&time, gen->frame, gen->rate);
+
+		/* Pieces carry low and high nibbles of frames, seconds,
+		   minutes and hours (including rate): */
+		uint8_t values[4] = {
+			time.frames, time.seconds, time.minutes,
+			(uint8_t)((gen->rate << 5) | time.hours),
+		};
+		uint8_t value = values[gen->piece / 2];
+		uint8_t nibble = (gen->piece & 1) ? (value >> 4) : value;
+
+		struct midi_message msg;
+		msg.type = MIDI_TYPE_TIME_CODE_QUARTER_FRAME;
+		msg.channel = 0;
+		msg.data.time_code_quarter_frame.value =
+			(uint8_t)((gen->piece << 4) | (nibble & 0x0f));
+
+		size_t n = midi_encode(stream, &msg);
+		if (n == 0)
+			break; /* Try again next time */
+		num_written += n;
+
+		gen->piece = (gen->piece + 1) & 0x07;
+		gen->position++;
+
+		uint64_t ticks = (uint64_t)gen->ticks_per_second *
+				 rate_den[gen->rate] + gen->remainder;
+		gen->next += (uint32_t)(ticks / divisor);
+		gen->remainder = (uint32_t)(ticks % divisor);
+	}
+
+	return num_written;
+}
+
+/**@}*/
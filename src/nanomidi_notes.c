@@ -0,0 +1,308 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Active note tracker
+ * @defgroup notes Note Tracker
+ *
+ * The tracker keeps a bit set of active notes (128 bits per channel, 256 bytes
+ * in total) updated from decoded or encoded messages. It can generate
+ * the minimal set of Note Off messages needed to silence a channel or all
+ * channels, e.g. when the playback stops or the output is disconnected.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/notes.h>
+#else
+#include <nanomidi/notes.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define CC_SUSTAIN		64
+#define CC_ALL_SOUND_OFF	120
+#define CC_RESET_CONTROLLERS	121
+#define CC_ALL_NOTES_OFF	123
+
+static bool prepare_write(struct midi_ostream *stream, size_t length)
+{
+	if (stream->capacity == MIDI_STREAM_CAPACITY_UNLIMITED) {
+		return true;
+	} else if (stream->capacity >= length) {
+		stream->capacity -= length;
+		return true;
+	}
+
+	return false;
+}
+
+static uint8_t channel_index(uint8_t channel)
+{
+	/* Channel goes from 1 to 16 but accept zero too: */
+	return (channel > 0) ? (uint8_t)((channel-1) & 0x0f) : 0;
+}
+
+static void set_note(struct midi_note_tracker *tracker, uint8_t ch,
+		     uint8_t note, bool active)
+{
+	uint32_t bit = ((uint32_t)1 << (note % 32));
+
+	if (active)
+		tracker->active[ch][note / 32] |= bit;
+	else
+		tracker->active[ch][note / 32] &= ~bit;
+}
+
+static void clear_channel(struct midi_note_tracker *tracker, uint8_t ch)
+{
+	memset(tracker->active[ch], 0, sizeof(tracker->active[ch]));
+	tracker->sustain &= (uint16_t)~(1U << ch);
+}
+
+static size_t release_channel(struct midi_note_tracker *tracker,
+			      struct midi_ostream *stream, uint8_t ch)
+{
+	bool sustain = ((tracker->sustain & (1U << ch)) != 0);
+	size_t count = 0;
+
+	for (size_t i = 0; i < 4; i++) {
+		for (uint32_t w = tracker->active[ch][i]; w != 0; w &= w-1)
+			count++;
+	}
+
+	if (count == 0 && !sustain)
+		return 0;
+
+	size_t length = (count > 0) ? 1 + 2*count : 0;
+	if (sustain)
+		length += 3;
+
+	if (!prepare_write(stream, length))
+		return 0;
+
+	size_t num_written = 0;
+
+	if (count > 0) {
+		/* Note Off status byte followed by Running Status data: */
+		uint8_t status = (uint8_t)(MIDI_TYPE_NOTE_OFF | ch);
+		num_written += stream->write_cb(stream, &status, 1);
+
+		for (size_t i = 0; i < 4; i++) {
+			uint32_t w = tracker->active[ch][i];
+			while (w != 0) {
+				uint8_t data[2] = {
+					(uint8_t)(32*i + (size_t)ctz32(w)), 0
+				};
+				num_written += stream->write_cb(stream, data,
+								2);
+				w &= w-1;
+			}
+		}
+	}
+
+	if (sustain) {
+		uint8_t data[3] = {
+			(uint8_t)(MIDI_TYPE_CONTROL_CHANGE | ch), CC_SUSTAIN, 0
+		};
+		num_written += stream->write_cb(stream, data, 3);
+	}
+
+	clear_channel(tracker, ch);
+	return num_written;
+}
+
+/**
+ * Initializes the active note tracker.
+ *
+ * @param tracker       Pointer to the #midi_note_tracker structure to be
+ *                      initialized
+ * @param velocity      Pointer to an optional buffer of 16*128 bytes for note
+ *                      velocities or `NULL`
+ */
+void midi_notes_init(struct midi_note_tracker *tracker, uint8_t *velocity)
+{
+	assert(tracker != NULL);
+
+	memset(tracker, 0, sizeof(struct midi_note_tracker));
+	tracker->velocity = velocity;
+}
+
+/**
+ * Updates the tracker with a decoded or encoded message.
+ *
+ * Note On and Note Off messages update the active notes, Sustain Pedal
+ * (controller 64) updates midi_note_tracker.sustain and Reset All Controllers
+ * (controller 121) releases it. All Sound Off, All Notes Off and mode
+ * messages (controllers 120 and 123-127) release all notes on the channel and
+ * System Reset releases all notes on all channels. Other messages are
+ * ignored.
+ *
+ * @param tracker       Pointer to the #midi_note_tracker structure
+ * @param[in] msg       Pointer to the #midi_message structure
+ */
+void midi_notes_update(struct midi_note_tracker *tracker,
+		       const struct midi_message *msg)
+{
+	assert(tracker != NULL);
+	assert(msg != NULL);
+
+	uint8_t ch = channel_index(msg->channel);
+	uint8_t note;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		note = DATA_BYTE(msg->data.note_on.note);
+		if (msg->data.note_on.velocity == 0) {
+			set_note(tracker, ch, note, false);
+			break;
+		}
+
+		if (tracker->stuck_cb != NULL &&
+		    midi_notes_is_active(tracker, (uint8_t)(ch+1), note))
+			tracker->stuck_cb(tracker, (uint8_t)(ch+1), note);
+
+		set_note(tracker, ch, note, true);
+		if (tracker->velocity != NULL)
+			tracker->velocity[128*ch + note] =
+				DATA_BYTE(msg->data.note_on.velocity);
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		note = DATA_BYTE(msg->data.note_off.note);
+		set_note(tracker, ch, note, false);
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		if (msg->data.control_change.controller == CC_SUSTAIN) {
+			if (msg->data.control_change.value >= 64)
+				tracker->sustain |= (uint16_t)(1U << ch);
+			else
+				tracker->sustain &= (uint16_t)~(1U << ch);
+		} else if (msg->data.control_change.controller ==
+			   CC_RESET_CONTROLLERS) {
+			tracker->sustain &= (uint16_t)~(1U << ch);
+		} else if (msg->data.control_change.controller ==
+			   CC_ALL_SOUND_OFF ||
+			   msg->data.control_change.controller >=
+			   CC_ALL_NOTES_OFF) {
+			memset(tracker->active[ch], 0,
+			       sizeof(tracker->active[ch]));
+		}
+		break;
+	case MIDI_TYPE_SYSTEM_RESET:
+		memset(tracker->active, 0, sizeof(tracker->active));
+		tracker->sustain = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Checks whether a note is active.
+ *
+ * @param tracker       Pointer to the #midi_note_tracker structure
+ * @param channel       Channel (1-16)
+ * @param note          Note code (0-127)
+ *
+ * @return `true` if Note On has been received without matching Note Off.
+ */
+bool midi_notes_is_active(const struct midi_note_tracker *tracker,
+			  uint8_t channel, uint8_t note)
+{
+	assert(tracker != NULL);
+
+	uint8_t ch = channel_index(channel);
+	note = DATA_BYTE(note);
+
+	return (tracker->active[ch][note / 32] & ((uint32_t)1 << (note % 32)))
+	       != 0;
+}
+
+/**
+ * Finds the next active note on a channel.
+ *
+ * The function can be used to iterate over active notes, e.g. to look for
+ * notes which have been active for too long:
+ *
+ *     for (int n = midi_notes_next(t, ch, 0); n >= 0;
+ *          n = midi_notes_next(t, ch, n+1)) { ... }
+ *
+ * @param tracker       Pointer to the #midi_note_tracker structure
+ * @param channel       Channel (1-16)
+ * @param note          Note code (0-127) to start searching from
+ *
+ * @return The lowest active note code greater than or equal to `note` or -1
+ * if there is no such note.
+ */
+int midi_notes_next(const struct midi_note_tracker *tracker, uint8_t channel,
+		    int note)
+{
+	assert(tracker != NULL);
+
+	uint8_t ch = channel_index(channel);
+
+	if (note < 0)
+		note = 0;
+
+	for (int i = note / 32; i < 4; i++) {
+		uint32_t w = tracker->active[ch][i];
+		if (i == note / 32)
+			w &= ~(uint32_t)0 << (note % 32);
+
+		if (w != 0)
+			return 32*i + ctz32(w);
+	}
+
+	return -1;
+}
+
+/**
+ * Releases all active notes on a channel or on all channels.
+ *
+ * A single Note Off status byte is written for each channel followed by
+ * Running Status data for each active note. Sustain Pedal is released too if
+ * it is down. Channels which do not fit the output stream are left untouched.
+ *
+ * @param tracker       Pointer to the #midi_note_tracker structure
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param channel       Channel (1-16) or 0 for all channels
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_notes_release(struct midi_note_tracker *tracker,
+			  struct midi_ostream *stream, uint8_t channel)
+{
+	assert(tracker != NULL);
+	assert(stream != NULL);
+	assert(stream->write_cb != NULL);
+
+	if (channel > 0)
+		return release_channel(tracker, stream, channel_index(channel));
+
+	size_t num_written = 0;
+	for (uint8_t ch = 0; ch < 16; ch++)
+		num_written += release_channel(tracker, stream, ch);
+
+	return num_written;
+}
+
+/**@}*/
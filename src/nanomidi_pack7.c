@@ -0,0 +1,632 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Packing of 8-bit data into 7-bit SysEx bytes
+ * @defgroup pack7 7-bit Packing
+ *
+ * SysEx data bytes can only carry seven bits so binary data (firmware
+ * images, sample dumps, patches) has to be packed. Two common schemes are
+ * supported: groups of seven bytes preceded by a byte gathering their most
+ * significant bits (#MIDI_PACK7_MSB_GROUP and #MIDI_PACK7_MSB_GROUP_REVERSED)
+ * and splitting each byte into two nibbles (#MIDI_PACK7_NIBBLES).
+ *
+ * Both midi_pack7_encode() and midi_pack7_decode() can be called repeatedly
+ * on consecutive chunks of data (e.g. blocks returned by
+ * midi_sysex_pool_next()), an incomplete group is kept in #midi_pack7.
+ * The sum and XOR of all packed bytes are computed in the same pass and
+ * returned by midi_pack7_checksum().
+ *
+ * On 64-bit little-endian targets, complete MSB groups are processed eight
+ * bytes at a time using 64-bit arithmetic. Nibbles are processed by SSE2 or
+ * NEON instructions if the compiler targets them.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/pack7.h>
+#else
+#include <nanomidi/pack7.h>
+#endif
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PACK7_SSE2	1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PACK7_NEON	1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+    defined(__SIZEOF_POINTER__) && __SIZEOF_POINTER__ >= 8
+#define PACK7_SWAR	1
+#endif
+
+/**@{*/
+
+#ifdef PACK7_SWAR
+
+/* Multiplier moving bit 8*i+7 to 56+i and bit i to 8*i+7 (and vice versa
+ * for the reversed order: 8*i+7 to 62-i and 6-i to 8*i+7): */
+#define MAGIC			0x0002040810204080ull
+#define MAGIC_REVERSED		0x0080402010080402ull
+
+#define LOW_BITS		0x007f7f7f7f7f7f7full
+#define HIGH_BITS		0x0080808080808080ull
+
+static uint64_t load64(const uint8_t *p)
+{
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static void store64(uint8_t *p, uint64_t w)
+{
+	memcpy(p, &w, sizeof(w));
+}
+
+static void checksum64(struct midi_pack7 *state, uint64_t w)
+{
+	const uint64_t lanes = 0x00ff00ff00ff00ffull;
+	uint64_t pairs = (w & lanes) + ((w >> 8) & lanes);
+	uint64_t sum = (pairs * 0x0001000100010001ull) >> 48;
+	state->sum = (uint8_t)(state->sum + sum);
+
+	w ^= (w >> 32);
+	w ^= (w >> 16);
+	w ^= (w >> 8);
+	state->xor_sum = (uint8_t)(state->xor_sum ^ w);
+}
+
+#endif /* PACK7_SWAR */
+
+static void checksum_bytes(struct midi_pack7 *state, const uint8_t *data,
+			   size_t length)
+{
+	uint8_t sum = state->sum;
+	uint8_t parity = state->xor_sum;
+
+	for (size_t i = 0; i < length; i++) {
+		uint8_t c = (data[i] & 0x7f);
+		sum = (uint8_t)(sum + c);
+		parity ^= c;
+	}
+
+	state->sum = sum;
+	state->xor_sum = parity;
+}
+
+static unsigned int msb_position(const struct midi_pack7 *state, size_t i)
+{
+	if (state->scheme == MIDI_PACK7_MSB_GROUP_REVERSED)
+		return (unsigned int)(6 - i);
+	else
+		return (unsigned int)i;
+}
+
+static size_t encode_group(struct midi_pack7 *state, uint8_t *out,
+			   const uint8_t *in, size_t length)
+{
+	uint8_t msbs = 0;
+	for (size_t i = 0; i < length; i++) {
+		msbs |= (uint8_t)((in[i] >> 7) << msb_position(state, i));
+		out[1+i] = (in[i] & 0x7f);
+	}
+
+	out[0] = msbs;
+	checksum_bytes(state, out, length + 1);
+	return length + 1;
+}
+
+static size_t encode_groups(struct midi_pack7 *state, uint8_t *out,
+			    const uint8_t *in, size_t groups)
+{
+	size_t n = 0;
+
+#ifdef PACK7_SWAR
+	uint64_t magic = (state->scheme == MIDI_PACK7_MSB_GROUP_REVERSED) ?
+			 MAGIC_REVERSED : MAGIC;
+
+	/* Reads one byte past the group so the last group is done below: */
+	for (; groups > 1; groups--) {
+		uint64_t w = load64(in);
+		uint64_t msbs = (((w & HIGH_BITS) * magic) >> 56) & 0x7f;
+		uint64_t packed = ((w & LOW_BITS) << 8) | msbs;
+
+		store64(&out[n], packed);
+		checksum64(state, packed);
+		in += 7;
+		n += 8;
+	}
+#endif
+
+	for (; groups > 0; groups--) {
+		n += encode_group(state, &out[n], in, 7);
+		in += 7;
+	}
+
+	return n;
+}
+
+#if defined(PACK7_SSE2)
+
+static void fold_checksum(struct midi_pack7 *state, __m128i sum,
+			  __m128i parity)
+{
+	uint32_t s = (uint32_t)_mm_cvtsi128_si32(sum) +
+		     (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	state->sum = (uint8_t)(state->sum + s);
+
+	parity = _mm_xor_si128(parity, _mm_srli_si128(parity, 8));
+	parity = _mm_xor_si128(parity, _mm_srli_si128(parity, 4));
+	parity = _mm_xor_si128(parity, _mm_srli_si128(parity, 2));
+	parity = _mm_xor_si128(parity, _mm_srli_si128(parity, 1));
+	state->xor_sum ^= (uint8_t)_mm_cvtsi128_si32(parity);
+}
+
+/* Encodes blocks of 16 bytes, returns the number of bytes consumed: */
+static size_t encode_nibbles_simd(struct midi_pack7 *state, uint8_t *out,
+				  const uint8_t *in, size_t length)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	__m128i parity = zero;
+
+	size_t i;
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&in[i]);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		__m128i lo = _mm_and_si128(v, mask);
+		__m128i a = _mm_unpacklo_epi8(hi, lo);
+		__m128i b = _mm_unpackhi_epi8(hi, lo);
+
+		_mm_storeu_si128((__m128i *)&out[2*i], a);
+		_mm_storeu_si128((__m128i *)&out[2*i+16], b);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_add_epi8(hi, lo),
+						      zero));
+		parity = _mm_xor_si128(parity, _mm_xor_si128(hi, lo));
+	}
+
+	fold_checksum(state, sum, parity);
+	return i;
+}
+
+/* Decodes blocks of 32 bytes, returns the number of bytes consumed: */
+static size_t decode_nibbles_simd(struct midi_pack7 *state, uint8_t *out,
+				  const uint8_t *in, size_t length)
+{
+	const __m128i mask7 = _mm_set1_epi8(0x7f);
+	const __m128i mask4 = _mm_set1_epi16(0x000f);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	__m128i parity = zero;
+
+	size_t i;
+	for (i = 0; i + 32 <= length; i += 32) {
+		__m128i a = _mm_loadu_si128((const __m128i *)&in[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&in[i+16]);
+		a = _mm_and_si128(a, mask7);
+		b = _mm_and_si128(b, mask7);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_add_epi8(a, b),
+						      zero));
+		parity = _mm_xor_si128(parity, _mm_xor_si128(a, b));
+
+		/* High nibble in the low byte of each 16-bit lane: */
+		a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, mask4), 4),
+				 _mm_and_si128(_mm_srli_epi16(a, 8), mask4));
+		b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, mask4), 4),
+				 _mm_and_si128(_mm_srli_epi16(b, 8), mask4));
+		_mm_storeu_si128((__m128i *)&out[i/2], _mm_packus_epi16(a, b));
+	}
+
+	fold_checksum(state, sum, parity);
+	return i;
+}
+
+#elif defined(PACK7_NEON)
+
+static void fold_checksum(struct midi_pack7 *state, uint16x8_t sum,
+			  uint8x16_t parity)
+{
+	uint16_t sums[8];
+	uint8_t xors[16];
+	vst1q_u16(sums, sum);
+	vst1q_u8(xors, parity);
+
+	uint8_t s = state->sum;
+	uint8_t x = state->xor_sum;
+	for (size_t i = 0; i < 8; i++)
+		s = (uint8_t)(s + sums[i]);
+	for (size_t i = 0; i < 16; i++)
+		x ^= xors[i];
+
+	state->sum = s;
+	state->xor_sum = x;
+}
+
+/* Encodes blocks of 16 bytes, returns the number of bytes consumed: */
+static size_t encode_nibbles_simd(struct midi_pack7 *state, uint8_t *out,
+				  const uint8_t *in, size_t length)
+{
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+	uint16x8_t sum = vdupq_n_u16(0);
+	uint8x16_t parity = vdupq_n_u8(0);
+
+	size_t i;
+	for (i = 0; i + 16 <= length; i += 16) {
+		uint8x16_t v = vld1q_u8(&in[i]);
+		uint8x16x2_t nibbles;
+		nibbles.val[0] = vshrq_n_u8(v, 4);
+		nibbles.val[1] = vandq_u8(v, mask);
+
+		vst2q_u8(&out[2*i], nibbles);
+		sum = vpadalq_u8(sum, vaddq_u8(nibbles.val[0],
+					       nibbles.val[1]));
+		parity = veorq_u8(parity, veorq_u8(nibbles.val[0],
+						   nibbles.val[1]));
+	}
+
+	fold_checksum(state, sum, parity);
+	return i;
+}
+
+/* Decodes blocks of 32 bytes, returns the number of bytes consumed: */
+static size_t decode_nibbles_simd(struct midi_pack7 *state, uint8_t *out,
+				  const uint8_t *in, size_t length)
+{
+	const uint8x16_t mask7 = vdupq_n_u8(0x7f);
+	const uint8x16_t mask4 = vdupq_n_u8(0x0f);
+	uint16x8_t sum = vdupq_n_u16(0);
+	uint8x16_t parity = vdupq_n_u8(0);
+
+	size_t i;
+	for (i = 0; i + 32 <= length; i += 32) {
+		uint8x16x2_t nibbles = vld2q_u8(&in[i]);
+		uint8x16_t hi = vandq_u8(nibbles.val[0], mask7);
+		uint8x16_t lo = vandq_u8(nibbles.val[1], mask7);
+		sum = vpadalq_u8(sum, vaddq_u8(hi, lo));
+		parity = veorq_u8(parity, veorq_u8(hi, lo));
+
+		vst1q_u8(&out[i/2], vorrq_u8(vshlq_n_u8(vandq_u8(hi, mask4), 4),
+					     vandq_u8(lo, mask4)));
+	}
+
+	fold_checksum(state, sum, parity);
+	return i;
+}
+
+#else
+
+static size_t encode_nibbles_simd(struct midi_pack7 *state, uint8_t *out,
+				  const uint8_t *in, size_t length)
+{
+	(void)state;
+	(void)out;
+	(void)in;
+	(void)length;
+	return 0;
+}
+
+static size_t decode_nibbles_simd(struct midi_pack7 *state, uint8_t *out,
+				  const uint8_t *in, size_t length)
+{
+	(void)state;
+	(void)out;
+	(void)in;
+	(void)length;
+	return 0;
+}
+
+#endif
+
+static size_t encode_nibbles(struct midi_pack7 *state, uint8_t *out,
+			     const uint8_t *in, size_t length)
+{
+	size_t i = encode_nibbles_simd(state, out, in, length);
+
+	for (; i < length; i++) {
+		out[2*i] = (uint8_t)(in[i] >> 4);
+		out[2*i+1] = (in[i] & 0x0f);
+		checksum_bytes(state, &out[2*i], 2);
+	}
+
+	return 2 * length;
+}
+
+static size_t decode_nibbles(struct midi_pack7 *state, uint8_t *out,
+			     const uint8_t *in, size_t length)
+{
+	size_t n = 0;
+	size_t i = 0;
+
+	if (state->num_pending > 0 && length > 0) {
+		checksum_bytes(state, &in[0], 1);
+		out[n++] = (uint8_t)((state->pending[0] << 4) | (in[0] & 0x0f));
+		state->num_pending = 0;
+		i++;
+	}
+
+	size_t done = decode_nibbles_simd(state, &out[n], &in[i], length - i);
+	n += done / 2;
+	i += done;
+
+	for (; i + 1 < length; i += 2) {
+		checksum_bytes(state, &in[i], 2);
+		out[n++] = (uint8_t)(((in[i] & 0x0f) << 4) | (in[i+1] & 0x0f));
+	}
+
+	if (i < length) {
+		checksum_bytes(state, &in[i], 1);
+		state->pending[0] = (in[i] & 0x0f);
+		state->num_pending = 1;
+	}
+
+	return n;
+}
+
+/**
+ * Initializes the #midi_pack7 structure.
+ *
+ * Separate structures should be used for encoding and decoding.
+ *
+ * @param state         Pointer to the #midi_pack7 structure
+ * @param scheme        Packing scheme
+ */
+void midi_pack7_init(struct midi_pack7 *state, enum midi_pack7_scheme scheme)
+{
+	assert(state != NULL);
+
+	memset(state, 0, sizeof(struct midi_pack7));
+	state->scheme = scheme;
+}
+
+/**
+ * Returns the length of packed data.
+ *
+ * @param scheme        Packing scheme
+ * @param length        Length of data before packing in bytes
+ *
+ * @return Length of packed data in bytes
+ */
+size_t midi_pack7_encoded_size(enum midi_pack7_scheme scheme, size_t length)
+{
+	if (scheme == MIDI_PACK7_NIBBLES)
+		return 2 * length;
+	else
+		return length + (length + 6) / 7;
+}
+
+/**
+ * Returns the length of unpacked data.
+ *
+ * @param scheme        Packing scheme
+ * @param length        Length of packed data in bytes
+ *
+ * @return Length of data after unpacking in bytes
+ */
+size_t midi_pack7_decoded_size(enum midi_pack7_scheme scheme, size_t length)
+{
+	if (scheme == MIDI_PACK7_NIBBLES)
+		return length / 2;
+	else
+		return length - (length + 7) / 8;
+}
+
+/**
+ * Packs 8-bit data into 7-bit bytes.
+ *
+ * Incomplete group of bytes at the end is kept until the next call or until
+ * midi_pack7_encode_finish() is called.
+ *
+ * Each group of seven bytes completed by the call (including up to six bytes
+ * kept from the previous call) is written as eight bytes, so
+ * `midi_pack7_encoded_size(scheme, length + 6)` bytes of output are always
+ * enough. The 64-bit path reads one byte past each group except the last one
+ * but never past `data`, and it writes whole groups only, so no extra room
+ * is needed.
+ *
+ * @param state         Pointer to the #midi_pack7 structure
+ * @param[out] out      Output buffer with room for at least
+ *                      `midi_pack7_encoded_size(scheme, length + 6)` bytes
+ * @param[in] data      Data to be packed
+ * @param length        Length of `data` in bytes
+ *
+ * @return The number of bytes written to `out`.
+ */
+size_t midi_pack7_encode(struct midi_pack7 *state, uint8_t *out,
+			 const void *data, size_t length)
+{
+	assert(state != NULL);
+	assert(out != NULL || length == 0);
+	assert(data != NULL || length == 0);
+
+	const uint8_t *in = data;
+
+	if (state->scheme == MIDI_PACK7_NIBBLES)
+		return encode_nibbles(state, out, in, length);
+
+	size_t n = 0;
+	size_t i = 0;
+
+	/* Complete the pending group first: */
+	if (state->num_pending > 0) {
+		while (state->num_pending < 7 && i < length)
+			state->pending[state->num_pending++] = in[i++];
+
+		if (state->num_pending < 7)
+			return 0;
+
+		n += encode_group(state, out, state->pending, 7);
+		state->num_pending = 0;
+	}
+
+	size_t groups = (length - i) / 7;
+	n += encode_groups(state, &out[n], &in[i], groups);
+	i += 7 * groups;
+
+	while (i < length)
+		state->pending[state->num_pending++] = in[i++];
+
+	return n;
+}
+
+/**
+ * Packs the remaining incomplete group.
+ *
+ * @param state         Pointer to the #midi_pack7 structure
+ * @param[out] out      Output buffer with room for at least 7 bytes
+ *
+ * @return The number of bytes written to `out`.
+ */
+size_t midi_pack7_encode_finish(struct midi_pack7 *state, uint8_t *out)
+{
+	assert(state != NULL);
+	assert(out != NULL);
+
+	if (state->scheme == MIDI_PACK7_NIBBLES || state->num_pending == 0)
+		return 0;
+
+	size_t n = encode_group(state, out, state->pending,
+				state->num_pending);
+	state->num_pending = 0;
+	return n;
+}
+
+/**
+ * Unpacks 7-bit bytes into 8-bit data.
+ *
+ * Bytes are unpacked as soon as possible, only the state of an incomplete
+ * group is kept until the next call. The most significant bit of input bytes
+ * is ignored.
+ *
+ * The 64-bit path writes eight bytes for each group of seven, i.e. one byte
+ * past the group, and only runs while at least one more input byte follows
+ * the group. The extra byte therefore always stays within the first `length`
+ * bytes of `out`, which is the room required anyway.
+ *
+ * @param state         Pointer to the #midi_pack7 structure
+ * @param[out] out      Output buffer with room for at least `length` bytes
+ * @param[in] data      Packed data
+ * @param length        Length of `data` in bytes
+ *
+ * @return The number of bytes written to `out`.
+ */
+size_t midi_pack7_decode(struct midi_pack7 *state, uint8_t *out,
+			 const void *data, size_t length)
+{
+	assert(state != NULL);
+	assert(out != NULL || length == 0);
+	assert(data != NULL || length == 0);
+
+	const uint8_t *in = data;
+
+	if (state->scheme == MIDI_PACK7_NIBBLES)
+		return decode_nibbles(state, out, in, length);
+
+	size_t n = 0;
+	size_t i = 0;
+
+#ifdef PACK7_SWAR
+	uint64_t magic = (state->scheme == MIDI_PACK7_MSB_GROUP_REVERSED) ?
+			 MAGIC_REVERSED : MAGIC;
+#endif
+
+	while (i < length) {
+#ifdef PACK7_SWAR
+		/* Reads and writes one byte past the group: */
+		while (state->num_pending == 0 && i + 9 <= length) {
+			uint64_t msbs = (in[i] & 0x7f);
+			uint64_t w = load64(&in[i+1]) & LOW_BITS;
+
+			store64(&out[n], w | ((msbs * magic) & HIGH_BITS));
+			checksum64(state, (w << 8) | msbs);
+			i += 8;
+			n += 7;
+		}
+
+		if (i >= length)
+			break;
+#endif
+
+		uint8_t c = (in[i++] & 0x7f);
+		checksum_bytes(state, &c, 1);
+
+		if (state->num_pending == 0) {
+			state->pending[0] = c;
+			state->num_pending = 1;
+			continue;
+		}
+
+		unsigned int bit = msb_position(state, state->num_pending - 1u);
+		uint8_t msb = ((state->pending[0] >> bit) & 1);
+		out[n++] = (uint8_t)(c | (msb << 7));
+		if (++state->num_pending == 8)
+			state->num_pending = 0;
+	}
+
+	return n;
+}
+
+/**
+ * Adds bytes which are not packed (e.g. an address) to the checksum.
+ *
+ * @param state         Pointer to the #midi_pack7 structure
+ * @param[in] data      Data bytes
+ * @param length        Length of `data` in bytes
+ */
+void midi_pack7_checksum_update(struct midi_pack7 *state, const void *data,
+				size_t length)
+{
+	assert(state != NULL);
+	assert(data != NULL || length == 0);
+
+	checksum_bytes(state, data, length);
+}
+
+/**
+ * Returns the checksum of all packed bytes.
+ *
+ * @param state         Pointer to the #midi_pack7 structure
+ * @param type          Checksum type
+ *
+ * @return Checksum (0-127)
+ */
+uint8_t midi_pack7_checksum(const struct midi_pack7 *state,
+			    enum midi_checksum type)
+{
+	assert(state != NULL);
+
+	switch (type) {
+	case MIDI_CHECKSUM_ROLAND:
+		return (uint8_t)((128 - (state->sum & 0x7f)) & 0x7f);
+	case MIDI_CHECKSUM_SUM:
+		return (state->sum & 0x7f);
+	case MIDI_CHECKSUM_XOR:
+		return (state->xor_sum & 0x7f);
+	default:
+		return 0;
+	}
+}
+
+/**@}*/
@@ -0,0 +1,430 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Compact 4-byte message representation
+ * @defgroup packed Packed Messages
+ *
+ * Structure #midi_message takes 12 to 24 bytes depending on the platform
+ * because of its SysEx member. Structure #midi_packed stores the same
+ * information in four bytes, with SysEx data kept aside in #midi_packed_pool.
+ * It is intended for queues and capture buffers.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/packed.h>
+#else
+#include <nanomidi/packed.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+static uint8_t status_byte(const struct midi_message *msg)
+{
+	if (msg->type >= MIDI_TYPE_SYSTEM_BASE) {
+		return msg->type;
+	} else {
+		/* Channel goes from 1 to 16 but accept zero too: */
+		uint8_t c = (msg->channel > 0) ? (uint8_t)(msg->channel-1) : 0;
+		return (uint8_t)((msg->type & 0xf0) | (c & 0x0f));
+	}
+}
+
+static size_t message_length(uint8_t status)
+{
+	switch (status & 0xf0) {
+	case MIDI_TYPE_PROGRAM_CHANGE:
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		return 2;
+	case MIDI_TYPE_SYSTEM_BASE:
+		break;
+	default:
+		return 3;
+	}
+
+	switch (status) {
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+	case MIDI_TYPE_SONG_SELECT:
+		return 2;
+	case MIDI_TYPE_SONG_POSITION:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+static bool prepare_write(struct midi_ostream *stream, size_t length)
+{
+	if (stream->capacity == MIDI_STREAM_CAPACITY_UNLIMITED) {
+		return true;
+	} else if (stream->capacity >= length) {
+		stream->capacity -= length;
+		return true;
+	}
+
+	return false;
+}
+
+#if NANOMIDI_CONFIG_SYSEX
+static bool pack_sysex(struct midi_packed *packed,
+		       const struct midi_message *msg,
+		       struct midi_packed_pool *pool)
+{
+	packed->data1 = (uint8_t)(MIDI_PACKED_NO_HANDLE & 0xff);
+	packed->data2 = (uint8_t)(MIDI_PACKED_NO_HANDLE >> 8);
+
+	if (pool == NULL)
+		return false;
+
+	size_t length = msg->data.sysex.length;
+	const void *data = msg->data.sysex.data;
+
+	if (pool->num_entries >= pool->max_entries ||
+	    pool->num_entries >= MIDI_PACKED_NO_HANDLE) {
+		pool->dropped++;
+		return false;
+	}
+
+	if (pool->data != NULL && data != NULL) {
+		if (length > pool->size - pool->used) {
+			pool->dropped++;
+			return false;
+		}
+
+		/* Copy SysEx data as the source becomes invalid soon: */
+		memcpy(&pool->data[pool->used], data, length);
+		data = &pool->data[pool->used];
+		pool->used += length;
+	}
+
+	size_t handle = pool->num_entries++;
+	pool->entries[handle].data = data;
+	pool->entries[handle].length = length;
+
+	packed->data1 = (uint8_t)(handle & 0xff);
+	packed->data2 = (uint8_t)(handle >> 8);
+	return true;
+}
+#endif
+
+/**
+ * Initializes the SysEx side pool.
+ *
+ * @param pool          Pointer to the #midi_packed_pool structure to be
+ *                      initialized
+ * @param entries       Pointer to an array of SysEx descriptors allocated by
+ *                      the user
+ * @param max_entries   Number of elements in `entries`
+ * @param data          Pointer to an optional buffer for SysEx data or `NULL`
+ * @param size          Size of `data` in bytes
+ */
+void midi_packed_pool_init(struct midi_packed_pool *pool,
+			   struct midi_packed_sysex *entries,
+			   size_t max_entries, uint8_t *data, size_t size)
+{
+	assert(pool != NULL);
+	assert(entries != NULL || max_entries == 0);
+
+	memset(pool, 0, sizeof(struct midi_packed_pool));
+	pool->entries = entries;
+	pool->max_entries = max_entries;
+	pool->data = data;
+	pool->size = (data != NULL) ? size : 0;
+}
+
+/**
+ * Releases all SysEx data stored in the pool.
+ *
+ * All handles become invalid. The counter midi_packed_pool.dropped is kept.
+ *
+ * @param pool          Pointer to the #midi_packed_pool structure
+ */
+void midi_packed_pool_reset(struct midi_packed_pool *pool)
+{
+	assert(pool != NULL);
+
+	pool->num_entries = 0;
+	pool->used = 0;
+}
+
+/**
+ * Converts a message into the packed representation.
+ *
+ * @param[out] packed   Pointer to the #midi_packed structure to be filled
+ * @param[in] msg       Pointer to the #midi_message structure to be converted
+ * @param pool          Pointer to the #midi_packed_pool structure to store
+ *                      SysEx data to, can be `NULL` if no SysEx is expected
+ *
+ * @return `true` on success, `false` if the message type is unknown or SysEx
+ * does not fit the pool (#MIDI_PACKED_NO_HANDLE is stored in that case).
+ */
+bool midi_pack(struct midi_packed *packed, const struct midi_message *msg,
+	       struct midi_packed_pool *pool)
+{
+	assert(packed != NULL);
+	assert(msg != NULL);
+#if !NANOMIDI_CONFIG_SYSEX
+	(void)pool;
+#endif
+
+	uint8_t d1 = 0;
+	uint8_t d2 = 0;
+
+	packed->status = status_byte(msg);
+	packed->flags = 0;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		d1 = DATA_BYTE(msg->data.note_on.note);
+		d2 = DATA_BYTE(msg->data.note_on.velocity);
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		d1 = DATA_BYTE(msg->data.note_off.note);
+		d2 = DATA_BYTE(msg->data.note_off.velocity);
+		break;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		d1 = DATA_BYTE(msg->data.polyphonic_pressure.note);
+		d2 = DATA_BYTE(msg->data.polyphonic_pressure.pressure);
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		d1 = DATA_BYTE(msg->data.control_change.controller);
+		d2 = DATA_BYTE(msg->data.control_change.value);
+		break;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		d1 = DATA_BYTE(msg->data.program_change.program);
+		break;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		d1 = DATA_BYTE(msg->data.channel_pressure.pressure);
+		break;
+	case MIDI_TYPE_PITCH_BEND:
+		d1 = DATA_BYTE(msg->data.pitch_bend.value);
+		d2 = DATA_BYTE(msg->data.pitch_bend.value >> 7);
+		break;
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+		d1 = DATA_BYTE(msg->data.time_code_quarter_frame.value);
+		break;
+	case MIDI_TYPE_SONG_POSITION:
+		d1 = DATA_BYTE(msg->data.song_position.position);
+		d2 = DATA_BYTE(msg->data.song_position.position >> 7);
+		break;
+	case MIDI_TYPE_SONG_SELECT:
+		d1 = DATA_BYTE(msg->data.song_select.song);
+		break;
+	case MIDI_TYPE_TUNE_REQUEST:
+	case MIDI_TYPE_TIMING_CLOCK:
+	case MIDI_TYPE_START:
+	case MIDI_TYPE_CONTINUE:
+	case MIDI_TYPE_STOP:
+	case MIDI_TYPE_ACTIVE_SENSE:
+	case MIDI_TYPE_SYSTEM_RESET:
+		break;
+#if NANOMIDI_CONFIG_SYSEX
+	case MIDI_TYPE_SYSEX:
+		return pack_sysex(packed, msg, pool);
+#endif
+	default:
+		return false;
+	}
+
+	packed->data1 = d1;
+	packed->data2 = d2;
+	return true;
+}
+
+/**
+ * Converts a packed message back into #midi_message.
+ *
+ * @param[out] msg      Pointer to the #midi_message structure to be filled
+ * @param[in] packed    Pointer to the #midi_packed structure to be converted
+ * @param[in] pool      Pointer to the #midi_packed_pool structure holding
+ *                      SysEx data, can be `NULL` if no SysEx is expected
+ *
+ * @return `true` on success, `false` if the status byte is invalid or SysEx
+ * handle is not valid (SysEx without data is returned in that case).
+ */
+bool midi_unpack(struct midi_message *msg, const struct midi_packed *packed,
+		 const struct midi_packed_pool *pool)
+{
+	assert(msg != NULL);
+	assert(packed != NULL);
+#if !NANOMIDI_CONFIG_SYSEX
+	(void)pool;
+#endif
+
+	uint8_t status = packed->status;
+	uint8_t d1 = DATA_BYTE(packed->data1);
+	uint8_t d2 = DATA_BYTE(packed->data2);
+
+	if (status >= MIDI_TYPE_SYSTEM_BASE) {
+		msg->type = status;
+		msg->channel = 0;
+	} else {
+		msg->type = (status & 0xf0);
+		msg->channel = (uint8_t)((status & 0x0f) + 1);
+	}
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		msg->data.note_on.note = d1;
+		msg->data.note_on.velocity = d2;
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		msg->data.note_off.note = d1;
+		msg->data.note_off.velocity = d2;
+		break;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		msg->data.polyphonic_pressure.note = d1;
+		msg->data.polyphonic_pressure.pressure = d2;
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		msg->data.control_change.controller = d1;
+		msg->data.control_change.value = d2;
+		break;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		msg->data.program_change.program = d1;
+		break;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		msg->data.channel_pressure.pressure = d1;
+		break;
+	case MIDI_TYPE_PITCH_BEND:
+		msg->data.pitch_bend.value = (uint16_t)((d2 << 7) | d1);
+		break;
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+		msg->data.time_code_quarter_frame.value = d1;
+		break;
+	case MIDI_TYPE_SONG_POSITION:
+		msg->data.song_position.position = (uint16_t)((d2 << 7) | d1);
+		break;
+	case MIDI_TYPE_SONG_SELECT:
+		msg->data.song_select.song = d1;
+		break;
+#if NANOMIDI_CONFIG_SYSEX
+	case MIDI_TYPE_SYSEX:
+		msg->data.sysex.data = NULL;
+		msg->data.sysex.length = 0;
+		{
+			size_t handle = (size_t)((packed->data2 << 8) |
+						 packed->data1);
+			if (pool == NULL || handle >= pool->num_entries)
+				return false;
+
+			msg->data.sysex.data = pool->entries[handle].data;
+			msg->data.sysex.length = pool->entries[handle].length;
+		}
+		break;
+#endif
+	case MIDI_TYPE_TUNE_REQUEST:
+	case MIDI_TYPE_TIMING_CLOCK:
+	case MIDI_TYPE_START:
+	case MIDI_TYPE_CONTINUE:
+	case MIDI_TYPE_STOP:
+	case MIDI_TYPE_ACTIVE_SENSE:
+	case MIDI_TYPE_SYSTEM_RESET:
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Decodes a single MIDI message into the packed representation.
+ *
+ * @param stream        Pointer to the #midi_istream structure
+ * @param[out] packed   Pointer to the #midi_packed structure to be filled
+ * @param pool          Pointer to the #midi_packed_pool structure to store
+ *                      SysEx data to, can be `NULL` if no SysEx is expected
+ *
+ * A SysEx message which does not fit the pool is still reported, with
+ * #MIDI_PACKED_NO_HANDLE stored as its handle and counted in
+ * midi_packed_pool.dropped (see midi_pack()). The function can therefore be
+ * called in a loop until it returns `false`:
+ *
+ *     while (midi_decode_packed(stream, &packed, pool)) { ... }
+ *
+ * @return `true` if a message has been decoded, `false` if no message is
+ * left in the stream.
+ */
+bool midi_decode_packed(struct midi_istream *stream,
+			struct midi_packed *packed,
+			struct midi_packed_pool *pool)
+{
+	assert(stream != NULL);
+	assert(packed != NULL);
+
+	struct midi_message *msg = midi_decode(stream);
+	if (msg == NULL)
+		return false;
+
+	/* Dropped SysEx keeps MIDI_PACKED_NO_HANDLE for the caller: */
+	midi_pack(packed, msg, pool);
+	return true;
+}
+
+/**
+ * Encodes a single packed message.
+ *
+ * Messages other than SysEx are written directly from the packed
+ * representation.
+ *
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param[in] packed    Pointer to the #midi_packed structure to be encoded
+ * @param[in] pool      Pointer to the #midi_packed_pool structure holding
+ *                      SysEx data, can be `NULL` if no SysEx is expected
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_encode_packed(struct midi_ostream *stream,
+			  const struct midi_packed *packed,
+			  const struct midi_packed_pool *pool)
+{
+	assert(stream != NULL);
+	assert(packed != NULL);
+	assert(stream->write_cb != NULL);
+
+	if (packed->status == MIDI_TYPE_SYSEX) {
+		struct midi_message msg;
+		if (!midi_unpack(&msg, packed, pool))
+			return 0;
+
+		return midi_encode(stream, &msg);
+	} else if ((packed->status & 0x80) == 0 ||
+		   packed->status == MIDI_TYPE_EOX) {
+		return 0;
+	}
+
+	uint8_t buffer[3] = {
+		packed->status,
+		DATA_BYTE(packed->data1),
+		DATA_BYTE(packed->data2),
+	};
+	size_t length = message_length(packed->status);
+
+	if (!prepare_write(stream, length))
+		return 0;
+
+	return stream->write_cb(stream, buffer, length);
+}
+
+/**@}*/
@@ -0,0 +1,297 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * High-resolution controller and RPN/NRPN parameter assembler
+ * @defgroup parameter Parameter Assembler
+ *
+ * The decoder combines Control Change messages carrying 14-bit controller
+ * values (MSB in controllers 0-31 and LSB in controllers 32-63), Registered
+ * Parameter Number (RPN) and Non-Registered Parameter Number (NRPN) changes
+ * into a single #midi_parameter. The encoder expands #midi_parameter back into
+ * the shortest sequence of Control Change messages.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/parameter.h>
+#else
+#include <nanomidi/parameter.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define CC_DATA_ENTRY		6
+#define CC_LSB_OFFSET		32
+#define CC_NRPN_LSB		98
+#define CC_NRPN_MSB		99
+#define CC_RPN_LSB		100
+#define CC_RPN_MSB		101
+
+#define NUMBER_NULL		0x7f
+#define UNKNOWN			0xff
+
+static uint8_t channel_index(uint8_t channel)
+{
+	/* Channel goes from 1 to 16 but accept zero too: */
+	return (channel > 0) ? (uint8_t)((channel-1) & 0x0f) : 0;
+}
+
+static void select_parameter(struct midi_parameter_decoder_channel *state,
+			     enum midi_parameter_type type)
+{
+	if (state->number[0] == NUMBER_NULL && state->number[1] == NUMBER_NULL)
+		state->selected = MIDI_PARAMETER_CONTROLLER;
+	else
+		state->selected = (uint8_t)type;
+}
+
+static size_t encode_cc(struct midi_ostream *stream, uint8_t channel,
+			uint8_t controller, uint8_t value)
+{
+	struct midi_message msg = {
+		.type = MIDI_TYPE_CONTROL_CHANGE,
+		.channel = channel,
+		.data.control_change.controller = controller,
+		.data.control_change.value = value,
+	};
+
+	return midi_encode(stream, &msg);
+}
+
+/**
+ * Initializes the parameter decoder.
+ *
+ * @param decoder               Pointer to the #midi_parameter_decoder
+ *                              structure to be initialized
+ * @param lsb_controllers       Bit mask of controllers (0-31) whose MSB is
+ *                              always followed by LSB. Set bit 6 (Data Entry)
+ *                              to wait for Data Entry LSB in RPN and NRPN
+ *                              changes. Use 0xffffffff to decode the output
+ *                              of midi_parameter_encode(), which always sends
+ *                              LSB; with bits cleared, each MSB and LSB pair
+ *                              is reported as two changes.
+ */
+void midi_parameter_decoder_init(struct midi_parameter_decoder *decoder,
+				 uint32_t lsb_controllers)
+{
+	assert(decoder != NULL);
+
+	memset(decoder, 0, sizeof(struct midi_parameter_decoder));
+	decoder->lsb_controllers = lsb_controllers;
+
+	for (size_t i = 0; i < 16; i++) {
+		decoder->channels[i].number[0] = NUMBER_NULL;
+		decoder->channels[i].number[1] = NUMBER_NULL;
+	}
+}
+
+/**
+ * Feeds a decoded message to the parameter decoder.
+ *
+ * The decoder consumes Control Change messages for controllers 0-63 and
+ * 98-101. A single #midi_parameter is reported for each MSB (unless the
+ * controller is listed in midi_parameter_decoder.lsb_controllers) and LSB.
+ * Data Entry (controllers 6 and 38) is reported as #MIDI_PARAMETER_RPN or
+ * #MIDI_PARAMETER_NRPN when a parameter is selected.
+ *
+ * All other messages are ignored and should be processed as usual.
+ *
+ * @param decoder       Pointer to the #midi_parameter_decoder structure
+ * @param[in] msg       Pointer to a decoded message
+ *
+ * @return Pointer to a parameter change (allocated in #midi_parameter_decoder)
+ * or `NULL` if the message does not complete any change.
+ */
+struct midi_parameter *midi_parameter_decode(
+	struct midi_parameter_decoder *decoder, const struct midi_message *msg)
+{
+	assert(decoder != NULL);
+	assert(msg != NULL);
+
+	if (msg->type != MIDI_TYPE_CONTROL_CHANGE)
+		return NULL;
+
+	uint8_t ch = channel_index(msg->channel);
+	struct midi_parameter_decoder_channel *state = &decoder->channels[ch];
+	uint8_t controller = DATA_BYTE(msg->data.control_change.controller);
+	uint8_t value = DATA_BYTE(msg->data.control_change.value);
+	uint8_t lsb = 0;
+
+	switch (controller) {
+	case CC_NRPN_MSB:
+	case CC_RPN_MSB:
+		state->number[0] = value;
+		break;
+	case CC_NRPN_LSB:
+	case CC_RPN_LSB:
+		state->number[1] = value;
+		break;
+	default:
+		if (controller >= 2*CC_LSB_OFFSET)
+			return NULL;
+
+		if (controller >= CC_LSB_OFFSET) {
+			/* LSB completes the change: */
+			controller -= CC_LSB_OFFSET;
+			lsb = value;
+		} else {
+			/* MSB resets LSB: */
+			state->msb[controller] = value;
+			if (decoder->lsb_controllers &
+			    ((uint32_t)1 << controller))
+				return NULL;
+		}
+
+		struct midi_parameter *param = &decoder->param;
+		param->channel = (uint8_t)(ch+1);
+		param->value = (uint16_t)((state->msb[controller] << 7) | lsb);
+
+		if (controller == CC_DATA_ENTRY &&
+		    state->selected != MIDI_PARAMETER_CONTROLLER) {
+			param->type = state->selected;
+			param->number = (uint16_t)((state->number[0] << 7) |
+						   state->number[1]);
+		} else {
+			param->type = MIDI_PARAMETER_CONTROLLER;
+			param->number = controller;
+		}
+
+		return param;
+	}
+
+	/* Parameter selection has changed: */
+	if (controller == CC_RPN_MSB || controller == CC_RPN_LSB)
+		select_parameter(state, MIDI_PARAMETER_RPN);
+	else
+		select_parameter(state, MIDI_PARAMETER_NRPN);
+
+	return NULL;
+}
+
+/**
+ * Initializes the parameter encoder.
+ *
+ * @param encoder       Pointer to the #midi_parameter_encoder structure to be
+ *                      initialized
+ */
+void midi_parameter_encoder_init(struct midi_parameter_encoder *encoder)
+{
+	assert(encoder != NULL);
+
+	memset(encoder, UNKNOWN, sizeof(struct midi_parameter_encoder));
+}
+
+/**
+ * Encodes a parameter change as a sequence of Control Change messages.
+ *
+ * Parameter selection (controllers 101 and 100 or 99 and 98) and MSB are
+ * only sent if they differ from the previous call for the same channel. LSB
+ * is always sent.
+ *
+ * Nothing is encoded for #MIDI_PARAMETER_CONTROLLER with a controller number
+ * outside 0-31 as only these controllers have an LSB controller.
+ *
+ * @param encoder       Pointer to the #midi_parameter_encoder structure
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param[in] param     Pointer to the #midi_parameter structure to be encoded
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_parameter_encode(struct midi_parameter_encoder *encoder,
+			     struct midi_ostream *stream,
+			     const struct midi_parameter *param)
+{
+	assert(encoder != NULL);
+	assert(stream != NULL);
+	assert(param != NULL);
+
+	uint8_t ch = channel_index(param->channel);
+	struct midi_parameter_encoder_channel *state = &encoder->channels[ch];
+	uint8_t channel = (uint8_t)(ch+1);
+	uint8_t msb = DATA_BYTE(param->value >> 7);
+	uint8_t lsb = DATA_BYTE(param->value);
+	uint8_t number[2];
+	uint8_t cc[2];
+	uint8_t controller;
+	size_t num_written = 0;
+
+	if (param->type == MIDI_PARAMETER_CONTROLLER) {
+		if (param->number >= CC_LSB_OFFSET)
+			return 0;
+
+		controller = (uint8_t)param->number;
+		number[0] = NUMBER_NULL;
+		number[1] = NUMBER_NULL;
+		cc[0] = CC_RPN_MSB;
+		cc[1] = CC_RPN_LSB;
+	} else {
+		controller = CC_DATA_ENTRY;
+		number[0] = DATA_BYTE(param->number >> 7);
+		number[1] = DATA_BYTE(param->number);
+		if (param->type == MIDI_PARAMETER_RPN) {
+			cc[0] = CC_RPN_MSB;
+			cc[1] = CC_RPN_LSB;
+		} else {
+			cc[0] = CC_NRPN_MSB;
+			cc[1] = CC_NRPN_LSB;
+		}
+	}
+
+	/* Data Entry needs the right parameter (or none) to be selected: */
+	if (controller == CC_DATA_ENTRY &&
+	    state->selected != (uint8_t)param->type) {
+		state->number[0] = UNKNOWN;
+		state->number[1] = UNKNOWN;
+	}
+
+	if (controller == CC_DATA_ENTRY) {
+		for (size_t i = 0; i < 2; i++) {
+			if (state->number[i] == number[i])
+				continue;
+
+			size_t n = encode_cc(stream, channel, cc[i], number[i]);
+			if (n == 0)
+				return num_written;
+
+			num_written += n;
+			state->number[i] = number[i];
+			state->msb[CC_DATA_ENTRY] = UNKNOWN;
+		}
+		state->selected = (uint8_t)param->type;
+	}
+
+	if (state->msb[controller] != msb) {
+		size_t n = encode_cc(stream, channel, controller, msb);
+		if (n == 0)
+			return num_written;
+
+		num_written += n;
+		state->msb[controller] = msb;
+	}
+
+	return num_written + encode_cc(stream, channel,
+				       (uint8_t)(controller + CC_LSB_OFFSET),
+				       lsb);
+}
+
+/**@}*/
@@ -0,0 +1,294 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Output queue with latest-value coalescing
+ * @defgroup queue Output Queue
+ *
+ * The queue is intended to be placed in front of midi_encode() when
+ * the output stream is slower than the input. Only the newest pending value is
+ * kept for each Control Change controller, Polyphonic Pressure note, Pitch
+ * Bend and Channel Pressure (per channel). All other messages keep their
+ * order.
+ *
+ * A newer value replaces the pending one in place unless a message which
+ * cannot be reordered (e.g. Note On or SysEx) has been queued since. In that
+ * case, the newer value is appended to the end of the queue and both values
+ * are sent. System Real Time messages never block coalescing.
+ *
+ * Controllers whose meaning depends on the order of messages (Bank Select,
+ * Data Entry, Registered and Non-Registered Parameter Number and Channel Mode
+ * messages) are never coalesced and cannot be reordered.
+ *
+ * Coalescing can be turned off with midi_queue.coalescing, the queue then
+ * keeps all messages in order.
+ *
+ * The queue does not allocate any memory. SysEx data are not copied and must
+ * remain valid until the message leaves the queue.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/queue.h>
+#else
+#include <nanomidi/queue.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define KEY_CONTROL_CHANGE		0
+#define KEY_POLYPHONIC_PRESSURE		(16*128)
+#define KEY_PITCH_BEND			(16*128 + 16*128)
+#define KEY_CHANNEL_PRESSURE		(16*128 + 16*128 + 16)
+
+static bool is_ordered_controller(uint8_t controller)
+{
+	switch (controller) {
+	case 0:		/* Bank Select MSB */
+	case 6:		/* Data Entry MSB */
+	case 32:	/* Bank Select LSB */
+	case 38:	/* Data Entry LSB */
+	case 96:	/* Data Increment */
+	case 97:	/* Data Decrement */
+	case 98:	/* NRPN LSB */
+	case 99:	/* NRPN MSB */
+	case 100:	/* RPN LSB */
+	case 101:	/* RPN MSB */
+		return true;
+	default:
+		/* Channel Mode messages: */
+		return (controller >= 120);
+	}
+}
+
+static int coalescing_key(const struct midi_message *msg)
+{
+	/* Channel goes from 1 to 16 but accept zero too: */
+	int ch = (msg->channel > 0) ? ((msg->channel-1) & 0x0f) : 0;
+	uint8_t controller;
+
+	switch (msg->type) {
+	case MIDI_TYPE_CONTROL_CHANGE:
+		controller = DATA_BYTE(msg->data.control_change.controller);
+		if (is_ordered_controller(controller))
+			return -1;
+		return KEY_CONTROL_CHANGE + (ch << 7) + controller;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		return KEY_POLYPHONIC_PRESSURE + (ch << 7) +
+		       DATA_BYTE(msg->data.polyphonic_pressure.note);
+	case MIDI_TYPE_PITCH_BEND:
+		return KEY_PITCH_BEND + ch;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		return KEY_CHANNEL_PRESSURE + ch;
+	default:
+		return -1;
+	}
+}
+
+static bool is_pending(const struct midi_queue *queue, int key)
+{
+	return (queue->pending[key / 32] & ((uint32_t)1 << (key % 32))) != 0;
+}
+
+static void set_pending(struct midi_queue *queue, int key, bool pending)
+{
+	uint32_t bit = ((uint32_t)1 << (key % 32));
+
+	if (pending)
+		queue->pending[key / 32] |= bit;
+	else
+		queue->pending[key / 32] &= ~bit;
+}
+
+/* Returns the write position of the newest pending message with the key */
+static size_t pending_pos(const struct midi_queue *queue, int key)
+{
+	size_t offset = (queue->slot[key] + queue->size -
+			 queue->head % queue->size) % queue->size;
+
+	return queue->head + offset;
+}
+
+/**
+ * Initializes the output queue.
+ *
+ * @param queue         Pointer to the #midi_queue structure to be initialized
+ * @param messages      Pointer to an array of #midi_message structures
+ *                      allocated by the user
+ * @param size          Number of elements in the array (at most 65536)
+ */
+void midi_queue_init(struct midi_queue *queue, struct midi_message *messages,
+		     size_t size)
+{
+	assert(queue != NULL);
+	assert(messages != NULL);
+	assert(size > 0);
+	assert(size <= (size_t)UINT16_MAX + 1);
+
+	memset(queue, 0, sizeof(struct midi_queue));
+	queue->messages = messages;
+	queue->size = size;
+	queue->coalescing = true;
+}
+
+/**
+ * Adds a message to the end of the queue or replaces a pending value.
+ *
+ * Number of replaced values is counted in midi_queue.coalesced.
+ *
+ * @param queue         Pointer to the #midi_queue structure
+ * @param[in] msg       Pointer to the #midi_message structure to be queued
+ *
+ * @return `true` if the message has been queued, `false` if the queue is full.
+ */
+bool midi_queue_push(struct midi_queue *queue, const struct midi_message *msg)
+{
+	assert(queue != NULL);
+	assert(msg != NULL);
+
+	int key = queue->coalescing ? coalescing_key(msg) : -1;
+
+	if (key >= 0 && is_pending(queue, key)) {
+		size_t pos = pending_pos(queue, key);
+		if (pos >= queue->barrier) {
+			queue->messages[pos % queue->size] = *msg;
+			queue->coalesced++;
+			return true;
+		}
+
+		/* Cannot be moved before the barrier, keep both values. */
+	}
+
+	if (queue->tail - queue->head >= queue->size)
+		return false;
+
+	queue->messages[queue->tail % queue->size] = *msg;
+
+	if (key >= 0) {
+		queue->slot[key] = (uint16_t)(queue->tail % queue->size);
+		set_pending(queue, key, true);
+	} else if (msg->type < MIDI_TYPE_TIMING_CLOCK) {
+		queue->barrier = queue->tail + 1;
+	}
+
+	queue->tail++;
+	return true;
+}
+
+/**
+ * Returns the oldest message in the queue without removing it.
+ *
+ * @param queue         Pointer to the #midi_queue structure
+ *
+ * @return Pointer to the message (allocated in midi_queue.messages) or `NULL`
+ * if the queue is empty.
+ */
+struct midi_message *midi_queue_peek(struct midi_queue *queue)
+{
+	assert(queue != NULL);
+
+	if (queue->head == queue->tail)
+		return NULL;
+
+	return &queue->messages[queue->head % queue->size];
+}
+
+/**
+ * Removes the oldest message from the queue.
+ *
+ * @param queue         Pointer to the #midi_queue structure
+ */
+void midi_queue_pop(struct midi_queue *queue)
+{
+	assert(queue != NULL);
+
+	struct midi_message *m = midi_queue_peek(queue);
+	if (m == NULL)
+		return;
+
+	/* The key stays pending if a newer value follows the barrier: */
+	int key = queue->coalescing ? coalescing_key(m) : -1;
+	if (key >= 0 && queue->slot[key] == queue->head % queue->size)
+		set_pending(queue, key, false);
+
+	queue->head++;
+}
+
+static size_t discard(struct midi_ostream *stream, const void *data,
+		      size_t size)
+{
+	(void)stream;
+	(void)data;
+
+	return size;
+}
+
+/* Checks whether midi_encode() can encode the message at all */
+static bool is_encodable(const struct midi_message *msg)
+{
+	struct midi_ostream stream;
+
+	stream.write_cb = &discard;
+	stream.capacity = MIDI_STREAM_CAPACITY_UNLIMITED;
+	stream.param = NULL;
+
+	return (midi_encode(&stream, msg) > 0);
+}
+
+/**
+ * Encodes queued messages until the queue is empty or the output stream is
+ * full.
+ *
+ * Messages which do not fit the stream are kept in the queue. Messages which
+ * cannot be encoded at all (e.g. of an unknown type) are removed and counted
+ * in midi_queue.dropped so they do not block the queue.
+ *
+ * @param queue         Pointer to the #midi_queue structure
+ * @param stream        Pointer to the #midi_ostream structure
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_queue_encode(struct midi_queue *queue, struct midi_ostream *stream)
+{
+	assert(queue != NULL);
+	assert(stream != NULL);
+
+	size_t num_written = 0;
+	struct midi_message *m;
+
+	while ((m = midi_queue_peek(queue)) != NULL) {
+		size_t n = midi_encode(stream, m);
+		if (n == 0) {
+			if (is_encodable(m))
+				break;
+
+			queue->dropped++;
+		}
+
+		num_written += n;
+		midi_queue_pop(queue);
+	}
+
+	return num_written;
+}
+
+/**@}*/
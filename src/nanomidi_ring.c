@@ -0,0 +1,211 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Circular buffer input
+ * @defgroup ring Circular Buffer Input
+ *
+ * Data received into a circular buffer (typically by DMA running in circular
+ * mode) can be decoded in place, including messages which wrap around the end
+ * of the buffer. The producer only advances the write index, the decoder only
+ * advances the read index so no locking is needed.
+ *
+ * The buffer is empty when both indices are equal. The producer must not
+ * write more than `size - 1` bytes ahead of the read index, otherwise the data
+ * are lost (overrun).
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/ring.h>
+#else
+#include <nanomidi/ring.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+static size_t load_index(const volatile size_t *index)
+{
+#ifdef __GNUC__
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+#else
+	return *index;
+#endif
+}
+
+static void store_index(volatile size_t *index, size_t value)
+{
+#ifdef __GNUC__
+	__atomic_store_n(index, value, __ATOMIC_RELEASE);
+#else
+	*index = value;
+#endif
+}
+
+static size_t read_ring(struct midi_istream *stream, void *data, size_t size)
+{
+	struct midi_ring *ring = stream->param;
+	size_t read = ring->read;
+	size_t write = load_index(&ring->write);
+	size_t n = 0;
+
+	while (n < size && read != write) {
+		((uint8_t *)data)[n++] = ring->data[read];
+		if (++read == ring->size)
+			read = 0;
+	}
+
+	store_index(&ring->read, read);
+	return n;
+}
+
+/**
+ * Initializes an empty circular buffer.
+ *
+ * @param ring          Pointer to the #midi_ring structure to be initialized
+ * @param[in] buffer    Pointer to the buffer the producer writes to
+ * @param size          Buffer size (in bytes)
+ */
+void midi_ring_init(struct midi_ring *ring, const void *buffer, size_t size)
+{
+	assert(ring != NULL);
+	assert(buffer != NULL);
+	assert(size > 0);
+
+	ring->data = buffer;
+	ring->size = size;
+	ring->read = 0;
+	ring->write = 0;
+}
+
+/**
+ * Advances the write index once new data are written to the buffer.
+ *
+ * The function is intended to be called by the producer, e.g. from DMA
+ * half/full transfer or UART idle line interrupt. For a DMA in circular mode,
+ * the write index is usually `size` minus the DMA transfer counter.
+ *
+ * @param ring          Pointer to the #midi_ring structure
+ * @param write         Index of the next byte to be written (0 to `size - 1`)
+ */
+void midi_ring_set_write(struct midi_ring *ring, size_t write)
+{
+	assert(ring != NULL);
+	assert(write < ring->size);
+
+	store_index(&ring->write, write);
+}
+
+/**
+ * Returns the number of bytes waiting to be decoded.
+ *
+ * @param[in] ring      Pointer to the #midi_ring structure
+ *
+ * @return The number of bytes between the read and the write index.
+ */
+size_t midi_ring_available(const struct midi_ring *ring)
+{
+	assert(ring != NULL);
+
+	size_t read = load_index(&ring->read);
+	size_t write = load_index(&ring->write);
+
+	return (write >= read) ? write - read : ring->size - read + write;
+}
+
+/**
+ * Creates an input stream which reads from a circular buffer.
+ *
+ * Function midi_decode() then returns `NULL` once all bytes written to the
+ * buffer are read. The read index is advanced with each byte read.
+ *
+ * @param stream        Pointer to the #midi_istream structure to be initialized
+ * @param ring          Pointer to the #midi_ring structure to be read from
+ */
+void midi_istream_from_ring(struct midi_istream *stream,
+			    struct midi_ring *ring)
+{
+	assert(stream != NULL);
+	assert(ring != NULL);
+
+	memset(stream, 0, sizeof(struct midi_istream));
+	stream->read_cb = &read_ring;
+	stream->capacity = MIDI_STREAM_CAPACITY_UNLIMITED;
+	stream->param = ring;
+}
+
+/**
+ * Decodes all messages waiting in a circular buffer.
+ *
+ * Works as midi_decoder_feed() but reads the data directly from the circular
+ * buffer without copying. The read index is advanced right before each
+ * decoded message is passed to `sink` and once all data are processed.
+ *
+ * @param stream        Pointer to the #midi_istream structure holding
+ *                      the decoder state
+ * @param ring          Pointer to the #midi_ring structure to be read from
+ * @param sink          Pointer to the #midi_sink structure to pass decoded
+ *                      messages to
+ *
+ * @return The number of messages passed to `sink`.
+ */
+size_t midi_decoder_feed_ring(struct midi_istream *stream,
+			      struct midi_ring *ring, struct midi_sink *sink)
+{
+	assert(stream != NULL);
+	assert(ring != NULL);
+	assert(sink != NULL);
+	assert(sink->message_cb != NULL);
+
+	size_t read = ring->read;
+	size_t write = load_index(&ring->write);
+	size_t num_messages = 0;
+
+	while (read != write) {
+		/* Contiguous part up to the write index or end of buffer: */
+		size_t end = (write > read) ? write : ring->size;
+
+		while (read < end) {
+			uint8_t c = ring->data[read++];
+
+			/* Skip data of filtered messages without decoding: */
+			if (stream->skip && (c & 0x80) == 0)
+				continue;
+
+			struct midi_message *msg = midi_decode_byte(stream, c);
+			if (msg != NULL) {
+				store_index(&ring->read,
+					    (read == ring->size) ? 0 : read);
+				sink->message_cb(sink, msg);
+				num_messages++;
+			}
+		}
+
+		if (read == ring->size)
+			read = 0;
+	}
+
+	store_index(&ring->read, read);
+	return num_messages;
+}
+
+/**@}*/
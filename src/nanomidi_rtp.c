@@ -0,0 +1,907 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * RTP MIDI packet encoder and decoder with recovery journal
+ * @defgroup rtp RTP MIDI
+ *
+ * The payload format is described in
+ * <a href="https://tools.ietf.org/html/rfc6295">RFC 6295</a>. The MIDI
+ * command section carries a list of MIDI commands, each preceded by a delta
+ * time in RTP timestamp units (except for the first one). Running Status is
+ * used for Channel Voice messages within a packet.
+ *
+ * The recovery journal appended to each packet codes the channel state
+ * changed since the checkpoint packet so that a receiver can recover from
+ * packet loss. The journal builder keeps the latest value of each chapter
+ * element together with the sequence number of the packet which carried it,
+ * so the journal is encoded directly from the state rather than from the
+ * packet history. Chapters P (Program Change), C (Control Change, value
+ * tool), W (Pitch Wheel), N (Note Off/On) and T (Channel Aftertouch) are
+ * supported. The system journal is not used.
+ *
+ * Session management (e.g. the AppleMIDI invitation protocol) and socket
+ * handling are left to the user.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/rtp.h>
+#else
+#include <nanomidi/rtp.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define SEQNUM_BEFORE(a, b)	((int16_t)(uint16_t)((a) - (b)) < 0)
+
+#define FLAG_B			0x80
+#define FLAG_J			0x40
+#define FLAG_Z			0x20
+#define FLAG_S			0x80
+#define FLAG_A			0x20
+#define FLAG_Y			0x80
+
+struct writer {
+	struct midi_ostream *stream;
+	uint8_t buffer[32];
+	size_t pending;
+	size_t length;
+};
+
+/* Number of Note Off/On logs and range of OFFBITS octets in chapter N */
+struct chapter_n {
+	int count;
+	int low;
+	int high;
+};
+
+static void flush_writer(struct writer *w)
+{
+	if (w->pending > 0)
+		w->stream->write_cb(w->stream, w->buffer, w->pending);
+	w->pending = 0;
+}
+
+static void emit(struct writer *w, uint8_t c)
+{
+	w->buffer[w->pending++] = c;
+	w->length++;
+
+	if (w->pending == sizeof(w->buffer))
+		flush_writer(w);
+}
+
+static void set_bit(uint32_t *mask, int n, bool value)
+{
+	uint32_t bit = ((uint32_t)1 << (n % 32));
+
+	if (value)
+		mask[n / 32] |= bit;
+	else
+		mask[n / 32] &= ~bit;
+}
+
+static bool any_bit(const uint32_t *mask)
+{
+	return (mask[0] | mask[1] | mask[2] | mask[3]) != 0;
+}
+
+static int count_bits(const uint32_t *mask)
+{
+	return popcount32(mask[0]) + popcount32(mask[1]) +
+	       popcount32(mask[2]) + popcount32(mask[3]);
+}
+
+/* S bit is cleared if the value comes from the previous packet: */
+static uint8_t s_bit(uint16_t seqnum, uint16_t packet_seqnum)
+{
+	return (seqnum == (uint16_t)(packet_seqnum - 1)) ? 0 : FLAG_S;
+}
+
+/* Removes mask bits of elements older than the checkpoint */
+static void expire_mask(uint32_t *mask, const uint16_t *seqnums,
+			uint16_t checkpoint)
+{
+	for (int i = 0; i < 4; i++) {
+		uint32_t bits = mask[i];
+		while (bits != 0) {
+			int n = ctz32(bits);
+			bits &= bits - 1;
+			if (SEQNUM_BEFORE(seqnums[32*i + n], checkpoint))
+				mask[i] &= ~((uint32_t)1 << n);
+		}
+	}
+}
+
+static void layout_chapter_n(const struct midi_rtp_channel *c,
+			     struct chapter_n *n)
+{
+	n->count = count_bits(c->notes_on);
+	if (n->count > 127)
+		n->count = 127;
+
+	/* OFFBITS octet k codes notes 8*k to 8*k + 7: */
+	n->low = 15;
+	n->high = 0;
+	for (int i = 0; i < 4; i++) {
+		uint32_t bits = c->notes_off[i];
+		if (bits == 0)
+			continue;
+
+		int first = 4*i + ctz32(bits) / 8;
+		int last = 4*i + 3;
+		while ((bits >> (8 * (last - 4*i))) == 0)
+			last--;
+
+		if (first < n->low)
+			n->low = first;
+		n->high = last;
+	}
+
+	/* LEN = 127 with LOW = 15 and HIGH = 0 would code 128 logs: */
+	if (n->count == 127 && n->low > n->high) {
+		n->low = 0;
+		n->high = 0;
+	}
+}
+
+static size_t channel_length(const struct midi_rtp_channel *c,
+			     const struct chapter_n *n)
+{
+	size_t length = 3;
+
+	if (c->chapters & MIDI_RTP_CHAPTER_P)
+		length += 3;
+	if (c->chapters & MIDI_RTP_CHAPTER_C)
+		length += 1 + 2 * (size_t)count_bits(c->controllers);
+	if (c->chapters & MIDI_RTP_CHAPTER_W)
+		length += 2;
+	if (c->chapters & MIDI_RTP_CHAPTER_N) {
+		length += 2 + 2 * (size_t)n->count;
+		if (n->low <= n->high)
+			length += (size_t)(n->high - n->low + 1);
+	}
+	if (c->chapters & MIDI_RTP_CHAPTER_T)
+		length += 1;
+
+	return length;
+}
+
+/* S bit of a channel journal is cleared if any of its chapters has it
+cleared. Chapter seqnums hold the last update of any element: */
+static uint8_t channel_s_bit(const struct midi_rtp_channel *c,
+			     uint16_t seqnum)
+{
+	uint8_t s = FLAG_S;
+
+	if (c->chapters & MIDI_RTP_CHAPTER_P)
+		s &= s_bit(c->program_seqnum, seqnum);
+	if (c->chapters & MIDI_RTP_CHAPTER_C)
+		s &= s_bit(c->controllers_seqnum, seqnum);
+	if (c->chapters & MIDI_RTP_CHAPTER_W)
+		s &= s_bit(c->pitch_bend_seqnum, seqnum);
+	if (c->chapters & MIDI_RTP_CHAPTER_N)
+		s &= s_bit(c->notes_seqnum, seqnum);
+	if (c->chapters & MIDI_RTP_CHAPTER_T)
+		s &= s_bit(c->pressure_seqnum, seqnum);
+
+	return s;
+}
+
+static void encode_chapter_c(struct writer *w, const struct midi_rtp_channel *c,
+			     uint16_t seqnum)
+{
+	int count = count_bits(c->controllers);
+
+	emit(w, (uint8_t)(s_bit(c->controllers_seqnum, seqnum) | (count - 1)));
+
+	for (int i = 0; i < 4; i++) {
+		uint32_t bits = c->controllers[i];
+		while (bits != 0) {
+			int n = 32*i + ctz32(bits);
+			bits &= bits - 1;
+			emit(w, (uint8_t)(s_bit(c->controller_seqnums[n],
+						seqnum) | n));
+			/* Value tool (A = 0): */
+			emit(w, DATA_BYTE(c->controller_values[n]));
+		}
+	}
+}
+
+static void encode_chapter_n(struct writer *w, const struct midi_rtp_channel *c,
+			     const struct chapter_n *n, uint16_t seqnum)
+{
+	emit(w, (uint8_t)(s_bit(c->notes_seqnum, seqnum) | n->count));
+	emit(w, (uint8_t)((n->low << 4) | n->high));
+
+	int logged = 0;
+	for (int i = 0; i < 4 && logged < n->count; i++) {
+		uint32_t bits = c->notes_on[i];
+		while (bits != 0 && logged < n->count) {
+			int note = 32*i + ctz32(bits);
+			bits &= bits - 1;
+			emit(w, (uint8_t)(s_bit(c->note_seqnums[note],
+						seqnum) | note));
+			emit(w, (uint8_t)(FLAG_Y |
+					  DATA_BYTE(c->velocities[note])));
+			logged++;
+		}
+	}
+
+	for (int k = n->low; k <= n->high; k++) {
+		/* Bit 7 codes the lowest note of the octet: */
+		uint8_t bits = (uint8_t)(c->notes_off[k / 4] >> (8 * (k % 4)));
+		uint8_t offbits = 0;
+		for (int i = 0; i < 8; i++) {
+			if (bits & (1 << i))
+				offbits |= (uint8_t)(0x80 >> i);
+		}
+		emit(w, offbits);
+	}
+}
+
+static void encode_channel(struct writer *w, const struct midi_rtp_channel *c,
+			   int ch, uint16_t seqnum)
+{
+	struct chapter_n n;
+	layout_chapter_n(c, &n);
+	size_t length = channel_length(c, &n);
+
+	emit(w, (uint8_t)(channel_s_bit(c, seqnum) | (uint8_t)(ch << 3) |
+			  ((length >> 8) & 0x03)));
+	emit(w, (uint8_t)length);
+	emit(w, c->chapters);
+
+	if (c->chapters & MIDI_RTP_CHAPTER_P) {
+		emit(w, (uint8_t)(s_bit(c->program_seqnum, seqnum) |
+				  DATA_BYTE(c->program)));
+		/* Bank is coded in chapter C (B = 0): */
+		emit(w, 0);
+		emit(w, 0);
+	}
+
+	if (c->chapters & MIDI_RTP_CHAPTER_C)
+		encode_chapter_c(w, c, seqnum);
+
+	if (c->chapters & MIDI_RTP_CHAPTER_W) {
+		emit(w, (uint8_t)(s_bit(c->pitch_bend_seqnum, seqnum) |
+				  DATA_BYTE(c->pitch_bend)));
+		emit(w, DATA_BYTE(c->pitch_bend >> 7));
+	}
+
+	if (c->chapters & MIDI_RTP_CHAPTER_N)
+		encode_chapter_n(w, c, &n, seqnum);
+
+	if (c->chapters & MIDI_RTP_CHAPTER_T) {
+		emit(w, (uint8_t)(s_bit(c->pressure_seqnum, seqnum) |
+				  DATA_BYTE(c->pressure)));
+	}
+}
+
+static size_t journal_length(const struct midi_rtp_journal *journal)
+{
+	size_t length = 3;
+
+	for (int ch = 0; ch < 16; ch++) {
+		if (journal->active & (1u << ch)) {
+			const struct midi_rtp_channel *c;
+			struct chapter_n n;
+
+			c = &journal->channels[ch];
+			layout_chapter_n(c, &n);
+			length += channel_length(c, &n);
+		}
+	}
+
+	return length;
+}
+
+static void encode_journal(struct writer *w,
+			   const struct midi_rtp_journal *journal,
+			   uint16_t seqnum)
+{
+	uint8_t s = FLAG_S;
+	int num_channels = 0;
+
+	for (int ch = 0; ch < 16; ch++) {
+		if (journal->active & (1u << ch)) {
+			s &= channel_s_bit(&journal->channels[ch], seqnum);
+			num_channels++;
+		}
+	}
+
+	uint8_t header = s;
+	if (num_channels > 0)
+		header |= (uint8_t)(FLAG_A | (num_channels - 1));
+
+	emit(w, header);
+	emit(w, (uint8_t)(journal->checkpoint >> 8));
+	emit(w, (uint8_t)journal->checkpoint);
+
+	for (int ch = 0; ch < 16; ch++) {
+		if (journal->active & (1u << ch))
+			encode_channel(w, &journal->channels[ch], ch, seqnum);
+	}
+}
+
+/* Returns the length of the command starting at cmd including data bytes */
+static size_t command_length(const uint8_t *cmd, size_t size,
+			     uint8_t *running_status)
+{
+	uint8_t status = cmd[0];
+	size_t length;
+
+	if ((status & 0x80) == 0) {
+		/* Running Status: */
+		status = *running_status;
+		if (status == 0)
+			return 0;
+		length = 0;
+	} else if (status == MIDI_TYPE_SOX) {
+		length = 1;
+		while (length < size && cmd[length-1] != MIDI_TYPE_EOX)
+			length++;
+		*running_status = 0;
+		return length;
+	} else if (status >= MIDI_TYPE_TIMING_CLOCK) {
+		return 1;
+	} else {
+		length = 1;
+		*running_status = (status < MIDI_TYPE_SYSTEM_BASE) ? status : 0;
+	}
+
+	switch (status & 0xf0) {
+	case MIDI_TYPE_PROGRAM_CHANGE:
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		length += 1;
+		break;
+	case MIDI_TYPE_SYSTEM_BASE:
+		if (status == MIDI_TYPE_TIME_CODE_QUARTER_FRAME ||
+		    status == MIDI_TYPE_SONG_SELECT)
+			length += 1;
+		else if (status == MIDI_TYPE_SONG_POSITION)
+			length += 2;
+		break;
+	default:
+		length += 2;
+		break;
+	}
+
+	return (length <= size) ? length : size;
+}
+
+/* Decodes the MIDI list, timestamp is advanced by delta times */
+static size_t decode_list(struct midi_istream *stream, const uint8_t *list,
+			  size_t size, bool z, uint32_t *timestamp,
+			  struct midi_sink *sink)
+{
+	uint8_t running_status = 0;
+	size_t num_messages = 0;
+	size_t i = 0;
+	bool first = true;
+
+	while (i < size) {
+		if (!first || z) {
+			/* Delta time (1 to 4 bytes): */
+			uint32_t delta = 0;
+			for (int n = 0; n < 4 && i < size; n++) {
+				uint8_t c = list[i++];
+				delta = (delta << 7) | DATA_BYTE(c);
+				if ((c & 0x80) == 0)
+					break;
+			}
+			*timestamp += delta;
+		}
+		first = false;
+
+		if (i >= size)
+			break;
+
+		size_t length = command_length(&list[i], size - i,
+					       &running_status);
+		if (length == 0)
+			break;
+
+		for (size_t end = i + length; i < end; i++) {
+			if (stream->skip && (list[i] & 0x80) == 0)
+				continue;
+
+			struct midi_message *msg;
+			msg = midi_decode_byte(stream, list[i]);
+			if (msg != NULL) {
+				sink->message_cb(sink, msg);
+				num_messages++;
+			}
+		}
+	}
+
+	return num_messages;
+}
+
+static void journal_sink(struct midi_sink *sink, struct midi_message *msg)
+{
+	struct midi_rtp_encoder *encoder = sink->param;
+	midi_rtp_journal_update(encoder->journal, msg, encoder->seqnum);
+}
+
+static void put_be(struct writer *w, uint32_t value, int num_bytes)
+{
+	while (num_bytes-- > 0)
+		emit(w, (uint8_t)(value >> (8 * num_bytes)));
+}
+
+/**
+ * Initializes the recovery journal.
+ *
+ * @param journal       Pointer to the #midi_rtp_journal structure to be
+ *                      initialized
+ */
+void midi_rtp_journal_init(struct midi_rtp_journal *journal)
+{
+	assert(journal != NULL);
+
+	memset(journal, 0, sizeof(struct midi_rtp_journal));
+}
+
+/**
+ * Records a message sent in a packet.
+ *
+ * The function is called by midi_rtp_flush() for each message of a packet.
+ * System messages are ignored.
+ *
+ * @param journal       Pointer to the #midi_rtp_journal structure
+ * @param[in] msg       Pointer to the #midi_message structure
+ * @param seqnum        Sequence number of the packet carrying the message
+ */
+void midi_rtp_journal_update(struct midi_rtp_journal *journal,
+			     const struct midi_message *msg, uint16_t seqnum)
+{
+	assert(journal != NULL);
+	assert(msg != NULL);
+
+	/* Channel goes from 1 to 16 but accept zero too: */
+	int ch = (msg->channel > 0) ? ((msg->channel-1) & 0x0f) : 0;
+	struct midi_rtp_channel *c = &journal->channels[ch];
+	int n;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		n = DATA_BYTE(msg->data.note_on.note);
+		if (msg->data.note_on.velocity > 0) {
+			c->velocities[n] = msg->data.note_on.velocity;
+			set_bit(c->notes_on, n, true);
+			set_bit(c->notes_off, n, false);
+			c->note_seqnums[n] = seqnum;
+			c->notes_seqnum = seqnum;
+			c->chapters |= MIDI_RTP_CHAPTER_N;
+			break;
+		}
+		/* Note On with zero velocity: */
+		/* fall through */
+	case MIDI_TYPE_NOTE_OFF:
+		n = DATA_BYTE(msg->data.note_off.note);
+		set_bit(c->notes_on, n, false);
+		set_bit(c->notes_off, n, true);
+		c->note_seqnums[n] = seqnum;
+		c->notes_seqnum = seqnum;
+		c->chapters |= MIDI_RTP_CHAPTER_N;
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		n = DATA_BYTE(msg->data.control_change.controller);
+		c->controller_values[n] = msg->data.control_change.value;
+		c->controller_seqnums[n] = seqnum;
+		set_bit(c->controllers, n, true);
+		c->controllers_seqnum = seqnum;
+		c->chapters |= MIDI_RTP_CHAPTER_C;
+		break;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		c->program = msg->data.program_change.program;
+		c->program_seqnum = seqnum;
+		c->chapters |= MIDI_RTP_CHAPTER_P;
+		break;
+	case MIDI_TYPE_PITCH_BEND:
+		c->pitch_bend = msg->data.pitch_bend.value;
+		c->pitch_bend_seqnum = seqnum;
+		c->chapters |= MIDI_RTP_CHAPTER_W;
+		break;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		c->pressure = msg->data.channel_pressure.pressure;
+		c->pressure_seqnum = seqnum;
+		c->chapters |= MIDI_RTP_CHAPTER_T;
+		break;
+	default:
+		return;
+	}
+
+	journal->active |= (uint16_t)(1u << ch);
+}
+
+/**
+ * Moves the checkpoint, i.e. the oldest packet coded in the journal.
+ *
+ * Should be called once the receiver confirms reception of a packet (e.g.
+ * via RTCP feedback). Elements of packets older than `seqnum` are removed
+ * from the journal.
+ *
+ * @param journal       Pointer to the #midi_rtp_journal structure
+ * @param seqnum        Sequence number of the new checkpoint packet
+ */
+void midi_rtp_journal_checkpoint(struct midi_rtp_journal *journal,
+				 uint16_t seqnum)
+{
+	assert(journal != NULL);
+
+	journal->checkpoint = seqnum;
+
+	for (int ch = 0; ch < 16; ch++) {
+		struct midi_rtp_channel *c = &journal->channels[ch];
+
+		if (!(journal->active & (1u << ch)))
+			continue;
+
+		if (SEQNUM_BEFORE(c->program_seqnum, seqnum))
+			c->chapters &= (uint8_t)~MIDI_RTP_CHAPTER_P;
+		if (SEQNUM_BEFORE(c->pitch_bend_seqnum, seqnum))
+			c->chapters &= (uint8_t)~MIDI_RTP_CHAPTER_W;
+		if (SEQNUM_BEFORE(c->pressure_seqnum, seqnum))
+			c->chapters &= (uint8_t)~MIDI_RTP_CHAPTER_T;
+
+		expire_mask(c->controllers, c->controller_seqnums, seqnum);
+		if (!any_bit(c->controllers))
+			c->chapters &= (uint8_t)~MIDI_RTP_CHAPTER_C;
+
+		expire_mask(c->notes_on, c->note_seqnums, seqnum);
+		expire_mask(c->notes_off, c->note_seqnums, seqnum);
+		if (!any_bit(c->notes_on) && !any_bit(c->notes_off))
+			c->chapters &= (uint8_t)~MIDI_RTP_CHAPTER_N;
+
+		if (c->chapters == 0)
+			journal->active &= (uint16_t)~(1u << ch);
+	}
+}
+
+/**
+ * Encodes the recovery journal.
+ *
+ * @param journal       Pointer to the #midi_rtp_journal structure
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param seqnum        Sequence number of the packet carrying the journal
+ *
+ * @return The number of bytes encoded or zero if the journal does not fit
+ * the stream.
+ */
+size_t midi_rtp_journal_encode(struct midi_rtp_journal *journal,
+			       struct midi_ostream *stream, uint16_t seqnum)
+{
+	assert(journal != NULL);
+	assert(stream != NULL);
+	assert(stream->write_cb != NULL);
+
+	size_t length = journal_length(journal);
+
+	if (stream->capacity != MIDI_STREAM_CAPACITY_UNLIMITED) {
+		if (stream->capacity < length)
+			return 0;
+		stream->capacity -= length;
+	}
+
+	struct writer w = { .stream = stream };
+	encode_journal(&w, journal, seqnum);
+	flush_writer(&w);
+
+	return w.length;
+}
+
+/**
+ * Initializes the RTP MIDI packet encoder.
+ *
+ * Fields midi_rtp_encoder.payload_type and midi_rtp_encoder.seqnum can be
+ * changed after the initialization.
+ *
+ * @param encoder       Pointer to the #midi_rtp_encoder structure to be
+ *                      initialized
+ * @param list          MIDI list buffer allocated by the user
+ * @param size          Size of the MIDI list buffer (at most
+ *                      #MIDI_RTP_MAX_LIST)
+ * @param ssrc          Synchronization source identifier
+ * @param journal       Pointer to an initialized #midi_rtp_journal structure
+ *                      or `NULL` if the recovery journal is not used
+ */
+void midi_rtp_encoder_init(struct midi_rtp_encoder *encoder, void *list,
+			   size_t size, uint32_t ssrc,
+			   struct midi_rtp_journal *journal)
+{
+	assert(encoder != NULL);
+	assert(list != NULL);
+	assert(size > 0 && size <= MIDI_RTP_MAX_LIST);
+
+	memset(encoder, 0, sizeof(struct midi_rtp_encoder));
+	encoder->list = list;
+	encoder->size = size;
+	encoder->journal = journal;
+	encoder->ssrc = ssrc;
+	encoder->payload_type = MIDI_RTP_PAYLOAD_TYPE_DEFAULT;
+}
+
+/**
+ * Adds a single MIDI message to the current packet.
+ *
+ * The first message sets the RTP timestamp of the packet, the following
+ * messages are coded with delta times. Timestamps should not decrease.
+ *
+ * @param encoder       Pointer to the #midi_rtp_encoder structure
+ * @param[in] msg       Pointer to the #midi_message structure to be encoded
+ * @param timestamp     Timestamp in RTP timestamp units
+ *
+ * @return The number of bytes added to the MIDI list or zero if the message
+ * does not fit (midi_rtp_flush() should be called first).
+ */
+size_t midi_rtp_encode(struct midi_rtp_encoder *encoder,
+		       const struct midi_message *msg, uint32_t timestamp)
+{
+	assert(encoder != NULL);
+	assert(msg != NULL);
+
+	size_t pos = encoder->length;
+	uint8_t delta[4];
+	size_t delta_length = 0;
+
+	if (pos == 0) {
+		encoder->timestamp = timestamp;
+		encoder->time = timestamp;
+	} else {
+		uint32_t d = timestamp - encoder->time;
+		if ((int32_t)d < 0)
+			d = 0;
+		else
+			encoder->time = timestamp;
+
+		/* Variable-length quantity, up to 28 bits: */
+		if (d > 0x0fffffff)
+			d = 0x0fffffff;
+		for (int shift = 21; shift > 0; shift -= 7) {
+			if (d >> shift || delta_length > 0) {
+				delta[delta_length++] =
+					(uint8_t)(0x80 | DATA_BYTE(d >> shift));
+			}
+		}
+		delta[delta_length++] = DATA_BYTE(d);
+	}
+
+	if (pos + delta_length >= encoder->size)
+		return 0;
+
+	uint8_t *cmd = &encoder->list[pos + delta_length];
+	struct midi_ostream stream;
+	midi_ostream_from_buffer(&stream, cmd,
+				 encoder->size - pos - delta_length);
+
+	size_t length = midi_encode(&stream, msg);
+	if (length == 0)
+		return 0;
+
+	uint8_t status = cmd[0];
+	if (status == encoder->running_status) {
+		memmove(cmd, cmd + 1, length - 1);
+		length--;
+	}
+
+	/* System Real Time messages do not cancel Running Status: */
+	if (status < MIDI_TYPE_SYSTEM_BASE)
+		encoder->running_status = status;
+	else if (status < MIDI_TYPE_TIMING_CLOCK)
+		encoder->running_status = 0;
+
+	memcpy(&encoder->list[pos], delta, delta_length);
+	encoder->length = pos + delta_length + length;
+
+	return delta_length + length;
+}
+
+/**
+ * Writes the current packet to the stream.
+ *
+ * The packet consists of the RTP header, MIDI command section and, if
+ * midi_rtp_encoder.journal is set, the recovery journal. It is passed to
+ * the stream as a whole, so the stream capacity should be set to the maximum
+ * datagram size. Messages of the packet are then recorded in the journal.
+ *
+ * A packet with an empty command section is written if the journal is not
+ * empty, so the function can be called periodically to let the receiver
+ * recover from loss of the last packet.
+ *
+ * @param encoder       Pointer to the #midi_rtp_encoder structure
+ * @param stream        Pointer to the #midi_ostream structure
+ *
+ * @return The packet size or zero if there is nothing to be written or the
+ * packet does not fit the stream.
+ */
+size_t midi_rtp_flush(struct midi_rtp_encoder *encoder,
+		      struct midi_ostream *stream)
+{
+	assert(encoder != NULL);
+	assert(stream != NULL);
+	assert(stream->write_cb != NULL);
+
+	struct midi_rtp_journal *journal = encoder->journal;
+	size_t length = encoder->length;
+
+	if (length == 0 && (journal == NULL || journal->active == 0))
+		return 0;
+
+	size_t header_length = (length > 15) ? 2 : 1;
+	size_t total = MIDI_RTP_HEADER_SIZE + header_length + length;
+
+	if (journal != NULL) {
+		/* Nothing to recover, the journal can start here: */
+		if (journal->active == 0)
+			journal->checkpoint = encoder->seqnum;
+
+		total += journal_length(journal);
+	}
+
+	if (stream->capacity != MIDI_STREAM_CAPACITY_UNLIMITED) {
+		if (stream->capacity < total)
+			return 0;
+		stream->capacity -= total;
+	}
+
+	struct writer w = { .stream = stream };
+
+	/* RTP header (version 2): */
+	emit(&w, 0x80);
+	emit(&w, (uint8_t)(((length > 0) ? 0x80 : 0) |
+			   DATA_BYTE(encoder->payload_type)));
+	put_be(&w, encoder->seqnum, 2);
+	put_be(&w, (length > 0) ? encoder->timestamp : encoder->time, 4);
+	put_be(&w, encoder->ssrc, 4);
+
+	/* MIDI command section header (first command without delta time): */
+	uint8_t flags = (journal != NULL) ? FLAG_J : 0;
+	if (header_length == 2) {
+		emit(&w, (uint8_t)(FLAG_B | flags | (length >> 8)));
+		emit(&w, (uint8_t)length);
+	} else {
+		emit(&w, (uint8_t)(flags | length));
+	}
+
+	flush_writer(&w);
+	if (length > 0)
+		w.length += stream->write_cb(stream, encoder->list, length);
+
+	if (journal != NULL) {
+		encode_journal(&w, journal, encoder->seqnum);
+		flush_writer(&w);
+
+		struct midi_istream istream;
+		memset(&istream, 0, sizeof(istream));
+		struct midi_sink sink = {
+			.message_cb = &journal_sink,
+			.param = encoder,
+		};
+		uint32_t timestamp = encoder->timestamp;
+		decode_list(&istream, encoder->list, length, false, &timestamp,
+			    &sink);
+	}
+
+	encoder->seqnum++;
+	encoder->length = 0;
+	encoder->running_status = 0;
+
+	return w.length;
+}
+
+/**
+ * Initializes the RTP MIDI packet decoder.
+ *
+ * Fields of midi_rtp_decoder.stream (e.g. midi_istream.sysex_buffer) can be
+ * set after the initialization.
+ *
+ * @param decoder       Pointer to the #midi_rtp_decoder structure to be
+ *                      initialized
+ */
+void midi_rtp_decoder_init(struct midi_rtp_decoder *decoder)
+{
+	assert(decoder != NULL);
+
+	memset(decoder, 0, sizeof(struct midi_rtp_decoder));
+}
+
+/**
+ * Decodes all messages from the MIDI command section of an RTP MIDI packet.
+ *
+ * Each decoded message is passed to `sink` with its timestamp (RTP timestamp
+ * of the packet plus delta times) stored in midi_rtp_decoder.timestamp.
+ * Lost packets are counted in midi_rtp_decoder.lost, the recovery journal of
+ * the packet is made available in midi_rtp_decoder.journal. Invalid,
+ * duplicate and reordered packets are ignored.
+ *
+ * @param decoder       Pointer to the #midi_rtp_decoder structure
+ * @param[in] packet    Packet to be decoded (starting with the RTP header)
+ * @param size          Packet size (in bytes)
+ * @param sink          Pointer to the #midi_sink structure to pass decoded
+ *                      messages to
+ *
+ * @return The number of messages passed to `sink`.
+ */
+size_t midi_rtp_decode(struct midi_rtp_decoder *decoder, const void *packet,
+		       size_t size, struct midi_sink *sink)
+{
+	assert(decoder != NULL);
+	assert(packet != NULL || size == 0);
+	assert(sink != NULL);
+	assert(sink->message_cb != NULL);
+
+	const uint8_t *p = packet;
+
+	if (size < MIDI_RTP_HEADER_SIZE + 1 || (p[0] >> 6) != 2)
+		return 0;
+
+	size_t offset = MIDI_RTP_HEADER_SIZE + 4 * (size_t)(p[0] & 0x0f);
+	if ((p[0] & 0x10) && offset + 4 <= size) {
+		/* Header extension: */
+		offset += 4 + 4 * (size_t)((p[offset+2] << 8) | p[offset+3]);
+	}
+	if (p[0] & 0x20) {
+		/* Padding: */
+		size = (p[size-1] < size) ? size - p[size-1] : 0;
+	}
+	if (offset >= size)
+		return 0;
+
+	uint16_t seqnum = (uint16_t)((p[2] << 8) | p[3]);
+	if (decoder->received > 0) {
+		uint16_t gap = (uint16_t)(seqnum - decoder->seqnum - 1);
+		if (gap >= 0x8000)
+			return 0;
+		decoder->lost += gap;
+	}
+	decoder->seqnum = seqnum;
+	decoder->received++;
+
+	uint8_t header = p[offset++];
+	size_t length = (header & 0x0f);
+	if (header & FLAG_B) {
+		if (offset >= size)
+			return 0;
+		length = (length << 8) | p[offset++];
+	}
+	if (offset + length > size)
+		return 0;
+
+	if (header & FLAG_J) {
+		decoder->journal = &p[offset + length];
+		decoder->journal_size = size - offset - length;
+	} else {
+		decoder->journal = NULL;
+		decoder->journal_size = 0;
+	}
+
+	decoder->timestamp = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) |
+			     ((uint32_t)p[6] << 8) | p[7];
+
+	return decode_list(&decoder->stream, &p[offset], length,
+			   (header & FLAG_Z) != 0, &decoder->timestamp, sink);
+}
+
+/**@}*/
@@ -0,0 +1,599 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * MIDI Sample Dump Standard
+ * @defgroup sds Sample Dump
+ *
+ * Sample Dump Standard (SDS) transfers sample data in Data Packets of 120
+ * bytes preceded by a Dump Header. Messages are encoded by midi_encode() and
+ * received messages decoded by midi_decode() (or midi_decoder_feed()) are
+ * passed to midi_sds_sender_receive() or midi_sds_receive().
+ *
+ * The receiver acknowledges each Data Packet. With the default window of one
+ * packet, the sender waits for the acknowledgement (ACK) before sending the
+ * next packet. A larger window lets the sender send more packets ahead so
+ * the link does not stay idle while the handshake travels back. If a packet
+ * is rejected (NAK) or lost, the sender continues from that packet. Packets
+ * which are not acknowledged within midi_sds_sender.timeout are assumed to
+ * be received as the standard defines for receivers without handshaking.
+ * The timeout runs from the moment the packet is encoded so it should be
+ * extended by the transmission time on links with buffered output.
+ * In open loop mode, no handshake is expected at all.
+ *
+ * Sample words are stored as signed integers (`int8_t` for up to 8 bits,
+ * `int16_t` for up to 16 bits and `int32_t` otherwise) and transferred
+ * left-justified in groups of 7 bits, most significant bits first, as
+ * unsigned numbers.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/sds.h>
+#include <../include/nanomidi/sysex.h>
+#else
+#include <nanomidi/sds.h>
+#include <nanomidi/sysex.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+#if NANOMIDI_CONFIG_SYSEX
+
+/**@{*/
+
+#define SDS_HEADER		0x01
+#define SDS_DATA		0x02
+#define SDS_REQUEST		0x03
+#define SDS_WAIT		0x7c
+#define SDS_CANCEL		0x7d
+#define SDS_NAK			0x7e
+#define SDS_ACK			0x7f
+
+#define HEADER_SIZE		16
+#define PACKET_SIZE		(MIDI_SDS_PACKET_SIZE + 2)
+
+static unsigned int word_size(uint8_t bits)
+{
+	return (bits + 6u) / 7u;
+}
+
+static uint32_t words_per_packet(uint8_t bits)
+{
+	return MIDI_SDS_PACKET_SIZE / word_size(bits);
+}
+
+static uint32_t packet_count(const struct midi_sds_header *header)
+{
+	uint32_t words = words_per_packet(header->bits);
+	return (header->length + words - 1) / words;
+}
+
+static bool valid_bits(uint8_t bits)
+{
+	return (bits >= 8 && bits <= 28);
+}
+
+static void put_21bit(uint8_t *buffer, uint32_t value)
+{
+	buffer[0] = DATA_BYTE(value);
+	buffer[1] = DATA_BYTE(value >> 7);
+	buffer[2] = DATA_BYTE(value >> 14);
+}
+
+static uint32_t get_21bit(const uint8_t *buffer)
+{
+	return (uint32_t)(DATA_BYTE(buffer[0]) | (DATA_BYTE(buffer[1]) << 7) |
+			  ((uint32_t)DATA_BYTE(buffer[2]) << 14));
+}
+
+static size_t encode_sysex(struct midi_ostream *stream, const uint8_t *data,
+			   size_t length)
+{
+	struct midi_message msg;
+	msg.type = MIDI_TYPE_SYSEX;
+	msg.data.sysex.data = data;
+	msg.data.sysex.length = length;
+	return midi_encode(stream, &msg);
+}
+
+static size_t encode_handshake(struct midi_ostream *stream, uint8_t channel,
+			       uint8_t sub_id, uint32_t packet)
+{
+	uint8_t buffer[4] = { 0x7e, channel, sub_id, DATA_BYTE(packet) };
+	return encode_sysex(stream, buffer, sizeof(buffer));
+}
+
+static void put_word(uint8_t *out, uint32_t value, unsigned int size)
+{
+	for (unsigned int j = size; j > 0; j--) {
+		out[j-1] = DATA_BYTE(value);
+		value >>= 7;
+	}
+}
+
+static uint32_t get_word(const uint8_t *in, unsigned int size)
+{
+	uint32_t value = 0;
+	for (unsigned int j = 0; j < size; j++)
+		value = (value << 7) | DATA_BYTE(in[j]);
+	return value;
+}
+
+/* Converts signed words to left-justified unsigned 7-bit groups: */
+static void pack_words(uint8_t *out, const void *samples, uint8_t bits,
+		       uint32_t first, uint32_t count)
+{
+	unsigned int size = word_size(bits);
+	unsigned int shift = 7 * size - bits;
+	uint32_t offset = (1u << (bits - 1));
+	uint32_t mask = (1u << bits) - 1;
+
+	if (bits <= 8) {
+		const int8_t *s = (const int8_t *)samples + first;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t u = ((uint32_t)s[i] + offset) & mask;
+			put_word(&out[i * size], u << shift, size);
+		}
+	} else if (bits <= 16) {
+		const int16_t *s = (const int16_t *)samples + first;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t u = ((uint32_t)s[i] + offset) & mask;
+			put_word(&out[i * size], u << shift, size);
+		}
+	} else {
+		const int32_t *s = (const int32_t *)samples + first;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t u = ((uint32_t)s[i] + offset) & mask;
+			put_word(&out[i * size], u << shift, size);
+		}
+	}
+}
+
+/* Converts left-justified unsigned 7-bit groups to signed words: */
+static void unpack_words(void *samples, const uint8_t *in, uint8_t bits,
+			 uint32_t first, uint32_t count)
+{
+	unsigned int size = word_size(bits);
+	unsigned int shift = 7 * size - bits;
+	uint32_t offset = (1u << (bits - 1));
+
+	if (bits <= 8) {
+		int8_t *s = (int8_t *)samples + first;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t u = get_word(&in[i * size], size) >> shift;
+			s[i] = (int8_t)(u - offset);
+		}
+	} else if (bits <= 16) {
+		int16_t *s = (int16_t *)samples + first;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t u = get_word(&in[i * size], size) >> shift;
+			s[i] = (int16_t)(u - offset);
+		}
+	} else {
+		int32_t *s = (int32_t *)samples + first;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t u = get_word(&in[i * size], size) >> shift;
+			s[i] = (int32_t)(u - offset);
+		}
+	}
+}
+
+static uint8_t packet_checksum(const uint8_t *packet, size_t length)
+{
+	uint8_t sum = 0;
+	for (size_t i = 0; i < length; i++)
+		sum ^= packet[i];
+	return DATA_BYTE(sum);
+}
+
+static size_t encode_header(struct midi_sds_sender *sender,
+			    struct midi_ostream *stream)
+{
+	const struct midi_sds_header *header = &sender->header;
+	uint8_t buffer[3 + HEADER_SIZE];
+
+	buffer[0] = 0x7e;
+	buffer[1] = sender->channel;
+	buffer[2] = SDS_HEADER;
+	buffer[3] = DATA_BYTE(header->sample_number);
+	buffer[4] = DATA_BYTE(header->sample_number >> 7);
+	buffer[5] = header->bits;
+	put_21bit(&buffer[6], header->period);
+	put_21bit(&buffer[9], header->length);
+	put_21bit(&buffer[12], header->loop_start);
+	put_21bit(&buffer[15], header->loop_end);
+	buffer[18] = DATA_BYTE(header->loop_type);
+
+	return encode_sysex(stream, buffer, sizeof(buffer));
+}
+
+static bool decode_header(struct midi_sds_header *header, const uint8_t *data,
+			  size_t length)
+{
+	if (length < HEADER_SIZE)
+		return false;
+
+	header->sample_number = (uint16_t)(DATA_BYTE(data[0]) |
+					   (DATA_BYTE(data[1]) << 7));
+	header->bits = DATA_BYTE(data[2]);
+	header->period = get_21bit(&data[3]);
+	header->length = get_21bit(&data[6]);
+	header->loop_start = get_21bit(&data[9]);
+	header->loop_end = get_21bit(&data[12]);
+	header->loop_type = DATA_BYTE(data[15]);
+	return true;
+}
+
+static size_t encode_packet(struct midi_sds_sender *sender,
+			    struct midi_ostream *stream, uint32_t packet)
+{
+	const struct midi_sds_header *header = &sender->header;
+	uint8_t buffer[4 + PACKET_SIZE - 1];
+
+	uint32_t words = words_per_packet(header->bits);
+	uint32_t first = packet * words;
+	uint32_t count = header->length - first;
+	if (count > words)
+		count = words;
+
+	buffer[0] = 0x7e;
+	buffer[1] = sender->channel;
+	buffer[2] = SDS_DATA;
+	buffer[3] = DATA_BYTE(packet);
+	memset(&buffer[4], 0, MIDI_SDS_PACKET_SIZE);
+	pack_words(&buffer[4], sender->samples, header->bits, first, count);
+	buffer[sizeof(buffer)-1] = packet_checksum(buffer, sizeof(buffer) - 1);
+
+	return encode_sysex(stream, buffer, sizeof(buffer));
+}
+
+/* Decodes a SDS message addressed to the channel: */
+static bool parse_message(struct midi_sysex_header *header,
+			  const struct midi_message *msg, uint8_t channel)
+{
+	return (msg->type == MIDI_TYPE_SYSEX &&
+		midi_sysex_parse(header, msg->data.sysex.data,
+				 msg->data.sysex.length) &&
+		header->id == MIDI_SYSEX_ID_NON_REALTIME &&
+		header->device == channel);
+}
+
+/* Finds one of the last sent packets by its 7-bit number: */
+static bool find_packet(const struct midi_sds_sender *sender, uint8_t number,
+			uint32_t *packet)
+{
+	uint32_t first = 0;
+	if (sender->next > MIDI_SDS_MAX_WINDOW)
+		first = sender->next - MIDI_SDS_MAX_WINDOW;
+
+	for (uint32_t i = sender->next; i > first; i--) {
+		if (DATA_BYTE(i - 1) == number) {
+			*packet = i - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Encodes Dump Request.
+ *
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param channel       Device ID (channel) of the sender
+ * @param sample_number Requested sample number (0-16383)
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_sds_encode_request(struct midi_ostream *stream, uint8_t channel,
+			       uint16_t sample_number)
+{
+	assert(stream != NULL);
+
+	uint8_t buffer[5] = { 0x7e, DATA_BYTE(channel), SDS_REQUEST,
+			      DATA_BYTE(sample_number),
+			      DATA_BYTE(sample_number >> 7) };
+	return encode_sysex(stream, buffer, sizeof(buffer));
+}
+
+/**
+ * Initializes the #midi_sds_sender structure.
+ *
+ * The window is set to one packet (stop-and-wait handshake) and timeouts to
+ * the values defined by the standard.
+ *
+ * @param sender            Pointer to the #midi_sds_sender structure
+ * @param channel           Device ID (channel) of the transfer
+ * @param[in] header        Pointer to the Dump Header to be sent
+ * @param[in] samples       Sample words, midi_sds_header.length words
+ * @param ticks_per_second  Resolution of timestamps passed to other functions
+ */
+void midi_sds_sender_init(struct midi_sds_sender *sender, uint8_t channel,
+			  const struct midi_sds_header *header,
+			  const void *samples, uint32_t ticks_per_second)
+{
+	assert(sender != NULL);
+	assert(header != NULL);
+	assert(valid_bits(header->bits));
+	assert(samples != NULL || header->length == 0);
+
+	memset(sender, 0, sizeof(struct midi_sds_sender));
+	sender->channel = DATA_BYTE(channel);
+	sender->window = 1;
+	sender->timeout = ticks_per_second / 50;
+	sender->header_timeout = 2 * ticks_per_second;
+	sender->header = *header;
+	sender->samples = samples;
+	sender->num_packets = packet_count(header);
+}
+
+/**
+ * Sends Dump Header and Data Packets.
+ *
+ * The function should be called periodically. It sends as many messages as
+ * the window and the stream capacity allow and handles timeouts.
+ *
+ * @param sender        Pointer to the #midi_sds_sender structure
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param now           Current time in ticks
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_sds_send(struct midi_sds_sender *sender,
+		     struct midi_ostream *stream, uint32_t now)
+{
+	assert(sender != NULL);
+	assert(stream != NULL);
+	assert(sender->window > 0 && sender->window <= MIDI_SDS_MAX_WINDOW);
+
+	size_t n = 0;
+
+	if (sender->state == MIDI_SDS_IDLE) {
+		n = encode_header(sender, stream);
+		if (n == 0)
+			return 0;
+
+		sender->state = (sender->open_loop) ? MIDI_SDS_DATA :
+						      MIDI_SDS_HEADER;
+		sender->timestamp = now;
+	}
+
+	if (sender->state == MIDI_SDS_HEADER &&
+	    now - sender->timestamp >= sender->header_timeout) {
+		/* No response, the receiver has no handshake: */
+		sender->state = MIDI_SDS_DATA;
+		sender->timestamp = now;
+	}
+
+	if (sender->state != MIDI_SDS_DATA || sender->wait)
+		return n;
+
+	if (!sender->open_loop && sender->acked < sender->next &&
+	    now - sender->timestamp >= sender->timeout) {
+		/* Assume the oldest packet was received: */
+		sender->acked++;
+		sender->timestamp = now;
+	}
+
+	while (sender->next < sender->num_packets &&
+	       (sender->open_loop ||
+		sender->next - sender->acked < sender->window)) {
+		size_t m = encode_packet(sender, stream, sender->next);
+		if (m == 0)
+			break;
+
+		if (sender->next == sender->acked)
+			sender->timestamp = now;
+
+		sender->next++;
+		n += m;
+	}
+
+	if (sender->open_loop)
+		sender->acked = sender->next;
+
+	if (sender->acked >= sender->num_packets)
+		sender->state = MIDI_SDS_DONE;
+
+	return n;
+}
+
+/**
+ * Processes a handshake message received by the sender.
+ *
+ * @param sender        Pointer to the #midi_sds_sender structure
+ * @param msg           Pointer to the received message
+ * @param now           Time of reception in ticks
+ *
+ * @return `true` if the message was a handshake message for the sender,
+ * `false` otherwise
+ */
+bool midi_sds_sender_receive(struct midi_sds_sender *sender,
+			     const struct midi_message *msg, uint32_t now)
+{
+	assert(sender != NULL);
+	assert(msg != NULL);
+
+	struct midi_sysex_header header;
+	if (!parse_message(&header, msg, sender->channel))
+		return false;
+
+	uint8_t number = (header.length > 0) ? DATA_BYTE(header.payload[0]) :
+					       0;
+	uint32_t packet;
+
+	switch (header.sub_id1) {
+	case SDS_ACK:
+		if (sender->state == MIDI_SDS_HEADER)
+			sender->state = MIDI_SDS_DATA;
+		else if (find_packet(sender, number, &packet) &&
+			 packet >= sender->acked)
+			sender->acked = packet + 1;
+		break;
+	case SDS_NAK:
+		if ((sender->state == MIDI_SDS_DATA ||
+		     sender->state == MIDI_SDS_DONE) &&
+		    find_packet(sender, number, &packet)) {
+			/* Continue from the rejected packet: */
+			sender->resent += sender->next - packet;
+			sender->next = packet;
+			sender->acked = packet;
+			sender->state = MIDI_SDS_DATA;
+		}
+		break;
+	case SDS_WAIT:
+		sender->wait = true;
+		return true;
+	case SDS_CANCEL:
+		sender->state = MIDI_SDS_CANCELLED;
+		return true;
+	default:
+		return false;
+	}
+
+	sender->wait = false;
+	sender->timestamp = now;
+	if (sender->state == MIDI_SDS_DATA &&
+	    sender->acked >= sender->num_packets)
+		sender->state = MIDI_SDS_DONE;
+
+	return true;
+}
+
+/**
+ * Initializes the #midi_sds_receiver structure.
+ *
+ * @param receiver      Pointer to the #midi_sds_receiver structure
+ * @param channel       Device ID (channel) of the receiver
+ * @param samples       Buffer for sample words
+ * @param max_samples   Number of words which fit `samples`
+ */
+void midi_sds_receiver_init(struct midi_sds_receiver *receiver,
+			    uint8_t channel, void *samples,
+			    size_t max_samples)
+{
+	assert(receiver != NULL);
+	assert(samples != NULL || max_samples == 0);
+
+	memset(receiver, 0, sizeof(struct midi_sds_receiver));
+	receiver->channel = DATA_BYTE(channel);
+	receiver->samples = samples;
+	receiver->max_samples = max_samples;
+}
+
+/**
+ * Processes a message received by the receiver.
+ *
+ * Dump Header and Data Packets are answered by a handshake message encoded
+ * to the stream. If the dump does not fit the sample buffer, the transfer is
+ * cancelled.
+ *
+ * @param receiver      Pointer to the #midi_sds_receiver structure
+ * @param msg           Pointer to the received message
+ * @param stream        Pointer to the #midi_ostream structure for handshake
+ *
+ * @return The number of bytes encoded.
+ */
+size_t midi_sds_receive(struct midi_sds_receiver *receiver,
+			const struct midi_message *msg,
+			struct midi_ostream *stream)
+{
+	assert(receiver != NULL);
+	assert(msg != NULL);
+	assert(stream != NULL);
+
+	struct midi_sysex_header header;
+	if (!parse_message(&header, msg, receiver->channel))
+		return 0;
+
+	uint8_t channel = receiver->channel;
+
+	if (header.sub_id1 == SDS_HEADER) {
+		struct midi_sds_header *h = &receiver->header;
+		if (!decode_header(h, header.payload, header.length))
+			return 0;
+
+		if (!valid_bits(h->bits) || h->length > receiver->max_samples) {
+			receiver->state = MIDI_SDS_CANCELLED;
+			return encode_handshake(stream, channel, SDS_CANCEL, 0);
+		}
+
+		receiver->num_packets = packet_count(h);
+		receiver->next = 0;
+		receiver->nak_sent = false;
+		receiver->state = (receiver->num_packets > 0) ? MIDI_SDS_DATA :
+								MIDI_SDS_DONE;
+		return encode_handshake(stream, channel, SDS_ACK, 0);
+	} else if (header.sub_id1 == SDS_CANCEL) {
+		receiver->state = MIDI_SDS_CANCELLED;
+		return 0;
+	} else if (header.sub_id1 != SDS_DATA || header.length == 0 ||
+		   (receiver->state != MIDI_SDS_DATA &&
+		    receiver->state != MIDI_SDS_DONE)) {
+		return 0;
+	}
+
+	uint32_t expected = receiver->next;
+	const uint8_t *data = msg->data.sysex.data;
+	bool valid = (msg->data.sysex.length == 4 + PACKET_SIZE - 1 &&
+		      packet_checksum(data, 3 + PACKET_SIZE - 1) ==
+		      data[3 + PACKET_SIZE - 1]);
+	uint8_t number = DATA_BYTE(header.payload[0]);
+
+	if (valid && receiver->state == MIDI_SDS_DATA &&
+	    number == DATA_BYTE(expected)) {
+		const struct midi_sds_header *h = &receiver->header;
+		uint32_t words = words_per_packet(h->bits);
+		uint32_t first = expected * words;
+		uint32_t count = h->length - first;
+		if (count > words)
+			count = words;
+
+		unpack_words(receiver->samples, &header.payload[1], h->bits,
+			     first, count);
+		receiver->next++;
+		receiver->nak_sent = false;
+		if (receiver->next == receiver->num_packets)
+			receiver->state = MIDI_SDS_DONE;
+
+		return encode_handshake(stream, channel, SDS_ACK, number);
+	}
+
+	if (valid && DATA_BYTE(expected - 1u - number) < MIDI_SDS_MAX_WINDOW) {
+		/* Repeated packet, acknowledge it again: */
+		return encode_handshake(stream, channel, SDS_ACK, number);
+	}
+
+	if (!valid)
+		receiver->errors++;
+
+	/* Ask for the expected packet (once if later packets follow): */
+	if (receiver->state != MIDI_SDS_DATA ||
+	    (receiver->nak_sent && number != DATA_BYTE(expected)))
+		return 0;
+
+	receiver->nak_sent = true;
+	return encode_handshake(stream, channel, SDS_NAK, expected);
+}
+
+/**@}*/
+
+#endif /* NANOMIDI_CONFIG_SYSEX */
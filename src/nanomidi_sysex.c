@@ -0,0 +1,246 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * System Exclusive header parser and dispatcher
+ * @defgroup sysex SysEx Dispatch
+ *
+ * SysEx parser decodes the header of a SysEx message: 1-byte or 3-byte
+ * manufacturer ID and, for Universal Real Time and Non-Real Time messages,
+ * device ID and sub-IDs. The payload is not copied, the header points into
+ * the original message.
+ *
+ * Manufacturer IDs are stored as 24-bit numbers with the ID bytes in
+ * big-endian order. 1-byte IDs are padded with zeros (#MIDI_SYSEX_ID) and
+ * 3-byte IDs start with a zero byte (#MIDI_SYSEX_ID_EXTENDED), so each ID
+ * has a unique value and the value order matches the first ID byte.
+ *
+ * SysEx dispatcher routes messages to handlers registered in a dispatch table
+ * sorted by the manufacturer ID. Routes are indexed by the first ID byte so
+ * the lookup only scans routes sharing that byte. For universal messages,
+ * the first route with matching sub-IDs is used.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/sysex.h>
+#else
+#include <nanomidi/sysex.h>
+#endif
+
+#include <assert.h>
+#include "nanomidi_internal.h"
+
+#if NANOMIDI_CONFIG_SYSEX
+
+/**@{*/
+
+#define ID_SLOT(id)	(((id) >> 16) & 0x7f)
+
+static bool is_universal(uint32_t id)
+{
+	return (id == MIDI_SYSEX_ID_NON_REALTIME ||
+		id == MIDI_SYSEX_ID_REALTIME);
+}
+
+/* Decodes manufacturer ID, returns its length in bytes (zero on error): */
+static size_t decode_id(uint32_t *id, const uint8_t *d, size_t length)
+{
+	if (length < 1) {
+		return 0;
+	} else if (d[0] != 0x00) {
+		*id = MIDI_SYSEX_ID(DATA_BYTE(d[0]));
+		return 1;
+	} else if (length >= 3) {
+		*id = MIDI_SYSEX_ID_EXTENDED(DATA_BYTE(d[1]), DATA_BYTE(d[2]));
+		return 3;
+	} else {
+		return 0;
+	}
+}
+
+static bool route_matches(const struct midi_sysex_route *route,
+			  const struct midi_sysex_header *header)
+{
+	if (route->id != header->id)
+		return false;
+
+	return ((route->sub_id1 == MIDI_SYSEX_ANY ||
+		 route->sub_id1 == header->sub_id1) &&
+		(route->sub_id2 == MIDI_SYSEX_ANY ||
+		 route->sub_id2 == header->sub_id2));
+}
+
+/**
+ * Decodes the SysEx header.
+ *
+ * @param[out] header   Pointer to the #midi_sysex_header structure to be
+ *                      filled
+ * @param[in] data      SysEx data without "SOX" and "EOX" bytes (e.g.
+ *                      midi_message.data.sysex.data)
+ * @param length        Length of `data` in bytes
+ *
+ * @return `true` on success, `false` if the message is too short
+ */
+bool midi_sysex_parse(struct midi_sysex_header *header, const void *data,
+		      size_t length)
+{
+	assert(header != NULL);
+
+	const uint8_t *d = data;
+	if (d == NULL)
+		return false;
+
+	size_t n = decode_id(&header->id, d, length);
+	if (n == 0)
+		return false;
+
+	header->device = MIDI_SYSEX_ALL_DEVICES;
+	header->sub_id1 = MIDI_SYSEX_ANY;
+	header->sub_id2 = MIDI_SYSEX_ANY;
+
+	if (is_universal(header->id)) {
+		/* <id> <device> <sub-ID #1> [<sub-ID #2>] ... */
+		if (length < 3)
+			return false;
+
+		header->device = DATA_BYTE(d[1]);
+		header->sub_id1 = DATA_BYTE(d[2]);
+		if (length > 3)
+			header->sub_id2 = DATA_BYTE(d[3]);
+		n = 3;
+	}
+
+	header->payload = &d[n];
+	header->length = length - n;
+	return true;
+}
+
+/**
+ * Decodes Identity Reply.
+ *
+ * @param[out] identity Pointer to the #midi_sysex_identity structure to be
+ *                      filled
+ * @param[in] header    Pointer to the header decoded by midi_sysex_parse()
+ *
+ * @return `true` on success, `false` if the message is not an Identity Reply
+ */
+bool midi_sysex_decode_identity(struct midi_sysex_identity *identity,
+				const struct midi_sysex_header *header)
+{
+	assert(identity != NULL);
+	assert(header != NULL);
+
+	if (header->id != MIDI_SYSEX_ID_NON_REALTIME ||
+	    header->sub_id1 != MIDI_SYSEX_GENERAL_INFO ||
+	    header->sub_id2 != MIDI_SYSEX_IDENTITY_REPLY)
+		return false;
+
+	/* 02 <manufacturer> <family> <model> <version> */
+	const uint8_t *d = &header->payload[1];
+	size_t length = header->length - 1;
+
+	size_t n = decode_id(&identity->manufacturer, d, length);
+	if (n == 0 || length < n + 8)
+		return false;
+
+	d += n;
+	identity->family = (uint16_t)(DATA_BYTE(d[0]) |
+				      (DATA_BYTE(d[1]) << 7));
+	identity->model = (uint16_t)(DATA_BYTE(d[2]) |
+				     (DATA_BYTE(d[3]) << 7));
+	for (size_t i = 0; i < 4; i++)
+		identity->version[i] = DATA_BYTE(d[4+i]);
+
+	return true;
+}
+
+/**
+ * Initializes the #midi_sysex_dispatcher structure.
+ *
+ * The own device ID is set to #MIDI_SYSEX_ALL_DEVICES.
+ *
+ * @param dispatcher    Pointer to the #midi_sysex_dispatcher structure
+ * @param routes        Dispatch table sorted by midi_sysex_route.id
+ * @param num_routes    Number of elements in `routes`
+ */
+void midi_sysex_dispatcher_init(struct midi_sysex_dispatcher *dispatcher,
+				const struct midi_sysex_route *routes,
+				size_t num_routes)
+{
+	assert(dispatcher != NULL);
+	assert(routes != NULL || num_routes == 0);
+	assert(num_routes <= UINT16_MAX);
+
+	dispatcher->routes = routes;
+	dispatcher->num_routes = num_routes;
+	dispatcher->device = MIDI_SYSEX_ALL_DEVICES;
+
+	size_t i = 0;
+	for (uint32_t slot = 0; slot <= 128; slot++) {
+		while (i < num_routes && ID_SLOT(routes[i].id) < slot)
+			i++;
+		dispatcher->first[slot] = (uint16_t)i;
+	}
+
+	for (i = 1; i < num_routes; i++)
+		assert(routes[i-1].id <= routes[i].id);
+}
+
+/**
+ * Routes a SysEx message to its handler.
+ *
+ * @param dispatcher    Pointer to the #midi_sysex_dispatcher structure
+ * @param msg           Pointer to the message
+ *
+ * @return `true` if a handler was called, `false` if the message is not
+ * a SysEx message, it is addressed to another device or no route matches
+ */
+bool midi_sysex_dispatch(const struct midi_sysex_dispatcher *dispatcher,
+			 const struct midi_message *msg)
+{
+	assert(dispatcher != NULL);
+	assert(msg != NULL);
+
+	struct midi_sysex_header header;
+	if (msg->type != MIDI_TYPE_SYSEX ||
+	    !midi_sysex_parse(&header, msg->data.sysex.data,
+			      msg->data.sysex.length))
+		return false;
+
+	if (dispatcher->device != MIDI_SYSEX_ALL_DEVICES &&
+	    header.device != MIDI_SYSEX_ALL_DEVICES &&
+	    header.device != dispatcher->device)
+		return false;
+
+	uint32_t slot = ID_SLOT(header.id);
+	for (size_t i = dispatcher->first[slot];
+	     i < dispatcher->first[slot+1]; i++) {
+		const struct midi_sysex_route *route = &dispatcher->routes[i];
+		if (route_matches(route, &header)) {
+			route->handler(&header, route->param);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**@}*/
+
+#endif /* NANOMIDI_CONFIG_SYSEX */
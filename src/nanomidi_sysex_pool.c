@@ -0,0 +1,335 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Fixed-block SysEx pool
+ * @defgroup sysex_pool SysEx Pool
+ *
+ * By default, all SysEx messages are decoded into midi_istream.sysex_buffer
+ * so each message overwrites the previous one. If a #midi_sysex_pool is
+ * assigned to midi_istream.sysex_pool, each SysEx message is decoded into
+ * a freshly acquired block instead and stays valid until it is released by
+ * midi_sysex_pool_release(). The message can be passed to another thread
+ * without copying.
+ *
+ * Messages longer than the block size are stored in a run of contiguous
+ * blocks, so midi_message.data.sysex.data and midi_message.data.sysex.length
+ * describe the whole message as for any other SysEx. The decoder grows the
+ * run into the adjacent block if it is free, otherwise the message is moved
+ * to a free run one block longer. Blocks of a message are also linked so
+ * midi_sysex_pool_next() returns them one by one.
+ *
+ * Blocks are acquired by the decoder and can be released from any other
+ * thread or interrupt without locking (using atomic operations on
+ * GCC-compatible compilers). If no block (or no long enough run of free
+ * blocks) is available, the message is dropped and counted in
+ * midi_sysex_pool.exhausted.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/sysex_pool.h>
+#else
+#include <nanomidi/sysex_pool.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+#if NANOMIDI_CONFIG_SYSEX
+
+/**@{*/
+
+static uint32_t fetch_and(volatile uint32_t *word, uint32_t mask)
+{
+#ifdef __GNUC__
+	return __atomic_fetch_and(word, mask, __ATOMIC_ACQ_REL);
+#else
+	uint32_t value = *word;
+	*word = value & mask;
+	return value;
+#endif
+}
+
+static void fetch_or(volatile uint32_t *word, uint32_t mask)
+{
+#ifdef __GNUC__
+	__atomic_fetch_or(word, mask, __ATOMIC_ACQ_REL);
+#else
+	*word |= mask;
+#endif
+}
+
+static uint16_t add_free(volatile uint16_t *num_free, int n)
+{
+#ifdef __GNUC__
+	if (n > 0)
+		return __atomic_add_fetch(num_free, (uint16_t)n,
+					  __ATOMIC_RELAXED);
+	else
+		return __atomic_sub_fetch(num_free, (uint16_t)-n,
+					  __ATOMIC_RELAXED);
+#else
+	*num_free = (uint16_t)(*num_free + n);
+	return *num_free;
+#endif
+}
+
+static bool is_free(const struct midi_sysex_pool *pool, uint16_t index)
+{
+	return (pool->free_map[index / 32] & ((uint32_t)1 << (index % 32))) != 0;
+}
+
+/* Takes a block known to be free, other threads can only free blocks */
+static void take(struct midi_sysex_pool *pool, uint16_t index)
+{
+	fetch_and(&pool->free_map[index / 32], ~((uint32_t)1 << (index % 32)));
+
+	uint16_t num_free = add_free(&pool->num_free, -1);
+	if (num_free < pool->min_free)
+		pool->min_free = num_free;
+
+	pool->next[index] = MIDI_SYSEX_POOL_NO_BLOCK;
+}
+
+/* Finds the first run of count free blocks */
+static uint16_t find_run(const struct midi_sysex_pool *pool, uint16_t count)
+{
+	uint16_t length = 0;
+
+	for (uint16_t i = 0; i < pool->num_blocks; i++) {
+		if (!is_free(pool, i)) {
+			length = 0;
+		} else if (++length == count) {
+			return (uint16_t)(i + 1 - count);
+		}
+	}
+
+	return MIDI_SYSEX_POOL_NO_BLOCK;
+}
+
+static uint16_t block_index(const struct midi_sysex_pool *pool,
+			    const void *data)
+{
+	const uint8_t *p = data;
+
+	if (p < pool->data)
+		return MIDI_SYSEX_POOL_NO_BLOCK;
+
+	size_t index = (size_t)(p - pool->data) / pool->block_size;
+	if (index >= pool->num_blocks)
+		return MIDI_SYSEX_POOL_NO_BLOCK;
+
+	return (uint16_t)index;
+}
+
+/**
+ * Initializes the pool with all blocks free.
+ *
+ * @param pool          Pointer to the #midi_sysex_pool structure to be
+ *                      initialized
+ * @param data          Pointer to block storage allocated by the user
+ *                      (`num_blocks * block_size` bytes)
+ * @param block_size    Size of a single block in bytes
+ * @param num_blocks    Number of blocks (less than #MIDI_SYSEX_POOL_NO_BLOCK)
+ * @param next          Pointer to an array of `num_blocks` elements allocated
+ *                      by the user
+ * @param free_map      Pointer to an array of
+ *                      #MIDI_SYSEX_POOL_MAP_SIZE(num_blocks) elements
+ *                      allocated by the user
+ */
+void midi_sysex_pool_init(struct midi_sysex_pool *pool, void *data,
+			  size_t block_size, uint16_t num_blocks,
+			  uint16_t *next, uint32_t *free_map)
+{
+	assert(pool != NULL);
+	assert(data != NULL);
+	assert(block_size > 0);
+	assert(num_blocks < MIDI_SYSEX_POOL_NO_BLOCK);
+	assert(next != NULL);
+	assert(free_map != NULL);
+
+	pool->data = data;
+	pool->block_size = block_size;
+	pool->next = next;
+	pool->free_map = free_map;
+	pool->num_blocks = num_blocks;
+	pool->num_free = num_blocks;
+	pool->min_free = num_blocks;
+	pool->exhausted = 0;
+	pool->first = MIDI_SYSEX_POOL_NO_BLOCK;
+	pool->last = MIDI_SYSEX_POOL_NO_BLOCK;
+
+	for (uint16_t i = 0; i < MIDI_SYSEX_POOL_MAP_SIZE(num_blocks); i++) {
+		uint16_t n = (uint16_t)(num_blocks - 32*i);
+		free_map[i] = (n >= 32) ? 0xffffffff :
+					  (((uint32_t)1 << n) - 1);
+	}
+
+	for (uint16_t i = 0; i < num_blocks; i++)
+		next[i] = MIDI_SYSEX_POOL_NO_BLOCK;
+}
+
+/**
+ * Acquires a single free block.
+ *
+ * The function is used by the decoder. It must not be called from more than
+ * one thread at once.
+ *
+ * @param pool          Pointer to the #midi_sysex_pool structure
+ *
+ * @return Index of the acquired block or #MIDI_SYSEX_POOL_NO_BLOCK if the pool
+ * is exhausted.
+ */
+uint16_t midi_sysex_pool_acquire(struct midi_sysex_pool *pool)
+{
+	assert(pool != NULL);
+
+	for (uint16_t i = 0; i < MIDI_SYSEX_POOL_MAP_SIZE(pool->num_blocks);
+	     i++) {
+		uint32_t word = pool->free_map[i];
+		if (word == 0)
+			continue;
+
+		uint16_t index = (uint16_t)(32*i + ctz32(word));
+		take(pool, index);
+		return index;
+	}
+
+	return MIDI_SYSEX_POOL_NO_BLOCK;
+}
+
+/**
+ * Extends the message being decoded by one block.
+ *
+ * The function is used by the decoder. It must not be called from more than
+ * one thread at once. The blocks of the message (midi_sysex_pool.first to
+ * midi_sysex_pool.last) stay contiguous: the block following the message is
+ * acquired if it is free, otherwise the message is moved to the first free
+ * run of blocks long enough.
+ *
+ * @param pool          Pointer to the #midi_sysex_pool structure
+ *
+ * @return `true` on success, `false` if there is no free run long enough (the
+ * message is left untouched in that case).
+ */
+bool midi_sysex_pool_extend(struct midi_sysex_pool *pool)
+{
+	assert(pool != NULL);
+
+	if (pool->first == MIDI_SYSEX_POOL_NO_BLOCK) {
+		uint16_t block = midi_sysex_pool_acquire(pool);
+		if (block == MIDI_SYSEX_POOL_NO_BLOCK)
+			return false;
+
+		pool->first = block;
+		pool->last = block;
+		return true;
+	}
+
+	uint16_t next = (uint16_t)(pool->last + 1);
+	if (next < pool->num_blocks && is_free(pool, next)) {
+		take(pool, next);
+		pool->next[pool->last] = next;
+		pool->last = next;
+		return true;
+	}
+
+	/* Move the message to a longer run (which cannot overlap it): */
+	uint16_t count = (uint16_t)(pool->last - pool->first + 2);
+	uint16_t first = find_run(pool, count);
+	if (first == MIDI_SYSEX_POOL_NO_BLOCK)
+		return false;
+
+	for (uint16_t i = 0; i < count; i++) {
+		take(pool, (uint16_t)(first + i));
+		if (i > 0)
+			pool->next[first + i - 1] = (uint16_t)(first + i);
+	}
+
+	memcpy(&pool->data[first * pool->block_size],
+	       &pool->data[pool->first * pool->block_size],
+	       (size_t)(count - 1) * pool->block_size);
+	midi_sysex_pool_release(pool,
+				&pool->data[pool->first * pool->block_size]);
+
+	pool->first = first;
+	pool->last = (uint16_t)(first + count - 1);
+	return true;
+}
+
+/**
+ * Releases a SysEx message (the whole chain of blocks) back to the pool.
+ *
+ * Can be called from any thread or interrupt.
+ *
+ * @param pool          Pointer to the #midi_sysex_pool structure
+ * @param[in] data      Pointer to SysEx data (midi_message.data.sysex.data)
+ *                      decoded into the pool
+ */
+void midi_sysex_pool_release(struct midi_sysex_pool *pool, const void *data)
+{
+	assert(pool != NULL);
+
+	uint16_t index = (data != NULL) ? block_index(pool, data) :
+					  MIDI_SYSEX_POOL_NO_BLOCK;
+
+	while (index != MIDI_SYSEX_POOL_NO_BLOCK) {
+		/* Read the link before the block can be acquired again: */
+		uint16_t next = pool->next[index];
+
+		fetch_or(&pool->free_map[index / 32],
+			 (uint32_t)1 << (index % 32));
+		add_free(&pool->num_free, 1);
+
+		index = next;
+	}
+}
+
+/**
+ * Returns the next block of a SysEx message longer than the block size.
+ *
+ * Blocks of a message are contiguous, the function is useful for processing
+ * long messages block by block.
+ *
+ * @param[in] pool      Pointer to the #midi_sysex_pool structure
+ * @param[in] data      Pointer to the current block (the first block is
+ *                      midi_message.data.sysex.data)
+ *
+ * @return Pointer to the next block or `NULL` if there is none.
+ */
+const void *midi_sysex_pool_next(const struct midi_sysex_pool *pool,
+				 const void *data)
+{
+	assert(pool != NULL);
+
+	uint16_t index = block_index(pool, data);
+	if (index == MIDI_SYSEX_POOL_NO_BLOCK)
+		return NULL;
+
+	index = pool->next[index];
+	if (index == MIDI_SYSEX_POOL_NO_BLOCK)
+		return NULL;
+
+	return &pool->data[index * pool->block_size];
+}
+
+/**@}*/
+
+#endif /* NANOMIDI_CONFIG_SYSEX */
@@ -0,0 +1,251 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Message transformation pipeline
+ * @defgroup transform Transform Pipeline
+ *
+ * Channel remapping, keyboard splits, transposition and velocity curves are
+ * compiled into dense lookup tables by midi_transform_compile(). Applying
+ * the tables to a message takes a few table loads.
+ *
+ * The tables can be replaced with midi_transform_set_table() while another
+ * thread keeps calling midi_transform_apply(), without any locking. The
+ * previous table must not be modified until the other thread has finished
+ * the calls which were running during the swap.
+ *
+ * Note Off messages are transformed by the same table as Note On so
+ * the table should not be replaced while notes are held, otherwise Note Off
+ * may be sent to a different channel or note.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/transform.h>
+#else
+#include <nanomidi/transform.h>
+#endif
+
+#include <assert.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define DROP		0xff
+
+static uint8_t channel_index(uint8_t channel)
+{
+	/* Channel goes from 1 to 16 but accept zero too: */
+	return (channel > 0) ? (uint8_t)((channel-1) & 0x0f) : 0;
+}
+
+static const struct midi_transform_table *load_table(
+	const struct midi_transform *transform)
+{
+#ifdef __GNUC__
+	return __atomic_load_n(&transform->table, __ATOMIC_ACQUIRE);
+#else
+	return transform->table;
+#endif
+}
+
+/**
+ * Compiles a rule set into lookup tables.
+ *
+ * @param[out] table    Pointer to the #midi_transform_table structure to be
+ *                      compiled
+ * @param[in] rules     Pointer to the #midi_transform_rules structure
+ */
+void midi_transform_compile(struct midi_transform_table *table,
+			    const struct midi_transform_rules *rules)
+{
+	assert(table != NULL);
+	assert(rules != NULL);
+	assert(rules->splits != NULL || rules->num_splits == 0);
+
+	for (uint8_t ch = 0; ch < 16; ch++) {
+		uint8_t out = ch;
+		if (rules->mute & (1U << ch))
+			out = DROP;
+		else if (rules->channels[ch] > 0)
+			out = channel_index(rules->channels[ch]);
+
+		table->channel[ch] = out;
+
+		const uint8_t *curve = rules->velocity[ch];
+		for (uint8_t i = 0; i < 128; i++) {
+			table->note[ch][i].channel = out;
+			table->note[ch][i].note = i;
+
+			/* Note On never turns into Note Off (velocity 0): */
+			uint8_t v = (curve != NULL) ? DATA_BYTE(curve[i]) : i;
+			table->velocity[ch][i] = (v > 0) ? v : 1;
+		}
+
+		/* Note Off (velocity 0) never turns into Note On: */
+		table->velocity[ch][0] = 0;
+	}
+
+	for (size_t i = 0; i < rules->num_splits; i++) {
+		const struct midi_transform_split *split = &rules->splits[i];
+		uint8_t ch = channel_index(split->channel);
+
+		if (rules->mute & (1U << ch))
+			continue;
+
+		for (int note = split->low; note <= split->high && note < 128;
+		     note++) {
+			struct midi_transform_note *n = &table->note[ch][note];
+			int out = note + split->transpose;
+
+			if (out < 0 || out > 127) {
+				n->channel = DROP;
+			} else {
+				if (split->out_channel > 0)
+					n->channel = channel_index(
+						split->out_channel);
+				else
+					n->channel = table->channel[ch];
+				n->note = (uint8_t)out;
+			}
+		}
+	}
+}
+
+/**
+ * Initializes the transformation pipeline.
+ *
+ * @param transform     Pointer to the #midi_transform structure to be
+ *                      initialized
+ * @param[in] table     Pointer to compiled tables
+ */
+void midi_transform_init(struct midi_transform *transform,
+			 const struct midi_transform_table *table)
+{
+	assert(transform != NULL);
+	assert(table != NULL);
+
+	transform->table = table;
+}
+
+/**
+ * Replaces the lookup tables atomically.
+ *
+ * @param transform     Pointer to the #midi_transform structure
+ * @param[in] table     Pointer to new compiled tables
+ */
+void midi_transform_set_table(struct midi_transform *transform,
+			      const struct midi_transform_table *table)
+{
+	assert(transform != NULL);
+	assert(table != NULL);
+
+#ifdef __GNUC__
+	__atomic_store_n(&transform->table, table, __ATOMIC_RELEASE);
+#else
+	transform->table = table;
+#endif
+}
+
+/**
+ * Transforms a single message in place.
+ *
+ * Only Channel Mode messages are transformed, other messages are left
+ * untouched.
+ *
+ * @param transform     Pointer to the #midi_transform structure
+ * @param msg           Pointer to the #midi_message structure to be
+ *                      transformed
+ *
+ * @return `true` if the message should be kept, `false` if it should be
+ * dropped.
+ */
+bool midi_transform_apply(const struct midi_transform *transform,
+			  struct midi_message *msg)
+{
+	assert(transform != NULL);
+	assert(msg != NULL);
+
+	if (msg->type >= MIDI_TYPE_SYSTEM_BASE)
+		return true;
+
+	const struct midi_transform_table *table = load_table(transform);
+	const struct midi_transform_note *n;
+	uint8_t ch = channel_index(msg->channel);
+	uint8_t out, note, velocity;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		note = DATA_BYTE(msg->data.note_on.note);
+		velocity = DATA_BYTE(msg->data.note_on.velocity);
+		n = &table->note[ch][note];
+		msg->data.note_on.note = n->note;
+		msg->data.note_on.velocity = table->velocity[ch][velocity];
+		out = n->channel;
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		note = DATA_BYTE(msg->data.note_off.note);
+		n = &table->note[ch][note];
+		msg->data.note_off.note = n->note;
+		out = n->channel;
+		break;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		note = DATA_BYTE(msg->data.polyphonic_pressure.note);
+		n = &table->note[ch][note];
+		msg->data.polyphonic_pressure.note = n->note;
+		out = n->channel;
+		break;
+	default:
+		out = table->channel[ch];
+		break;
+	}
+
+	msg->channel = (uint8_t)(out + 1);
+	return (out != DROP);
+}
+
+/**
+ * Transforms an array of messages in place.
+ *
+ * Dropped messages are removed from the array, order of the remaining
+ * messages is preserved.
+ *
+ * @param transform     Pointer to the #midi_transform structure
+ * @param msgs          Pointer to an array of #midi_message structures
+ * @param count         Number of elements in the array
+ *
+ * @return The number of messages kept in the array.
+ */
+size_t midi_transform_apply_all(const struct midi_transform *transform,
+				struct midi_message *msgs, size_t count)
+{
+	assert(transform != NULL);
+	assert(msgs != NULL || count == 0);
+
+	size_t kept = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		struct midi_message msg = msgs[i];
+		if (midi_transform_apply(transform, &msg))
+			msgs[kept++] = msg;
+	}
+
+	return kept;
+}
+
+/**@}*/
@@ -0,0 +1,555 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Translation between MIDI 1.0 byte stream and Universal MIDI Packets (UMP)
+ * @defgroup ump UMP Translator
+ *
+ * Messages are translated to MIDI 1.0 Channel Voice messages (message type
+ * 0x2), System messages (message type 0x1) and SysEx7 data messages (message
+ * type 0x3) as described in
+ * <a href="https://www.midi.org/specifications/universal-midi-packet-ump-and-midi-2-0-protocol-specification">
+ * Universal MIDI Packet (UMP) Format and MIDI 2.0 Protocol</a>.
+ *
+ * UMP streams consist of 32-bit words in host byte order, stream capacity is
+ * still counted in bytes.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/ump.h>
+#else
+#include <nanomidi/ump.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+/**@{*/
+
+#define UMP_MT_SYSTEM		0x1
+#define UMP_MT_CHANNEL_VOICE	0x2
+#define UMP_MT_SYSEX7		0x3
+
+#define UMP_SYSEX7_COMPLETE	0x0
+#define UMP_SYSEX7_START	0x1
+#define UMP_SYSEX7_CONTINUE	0x2
+#define UMP_SYSEX7_END		0x3
+
+#define UMP_WORD0(mt, group)	((uint32_t)(((mt) << 28) | \
+					    (((group) & 0x0f) << 24)))
+
+/* Number of 32-bit words in a packet for each message type */
+static const uint8_t packet_words[16] = {
+	1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
+static bool prepare_write(struct midi_ostream *stream, size_t length)
+{
+	if (stream->capacity == MIDI_STREAM_CAPACITY_UNLIMITED) {
+		return true;
+	} else if (stream->capacity >= length) {
+		stream->capacity -= length;
+		return true;
+	}
+
+	return false;
+}
+
+/* Most UMP words a single input byte can produce: SysEx7 packet ended by
+ * a Tune Request */
+#define UMP_WORDS_PER_BYTE	3
+
+/* Number of bytes or words read from the input stream at once */
+#define UMP_BATCH_SIZE		16
+
+/* Limits a batch to what the stream can still provide */
+static size_t read_batch(struct midi_istream *stream, void *data,
+			 size_t size, size_t max)
+{
+	size_t n = max;
+
+	if (stream->capacity != MIDI_STREAM_CAPACITY_UNLIMITED) {
+		if (n > stream->capacity / size)
+			n = stream->capacity / size;
+		stream->capacity -= n * size;
+	}
+
+	if (n == 0)
+		return 0;
+
+	return stream->read_cb(stream, data, n * size) / size;
+}
+
+static size_t write_words(struct midi_ostream *stream, const uint32_t *words,
+			  size_t count)
+{
+	if (!prepare_write(stream, 4*count))
+		return 0;
+
+	return stream->write_cb(stream, words, 4*count);
+}
+
+#if NANOMIDI_CONFIG_SYSEX
+static void sysex7_words(uint32_t *words, uint8_t group, uint8_t status,
+			 const uint8_t *data, size_t length)
+{
+	uint8_t b[6] = { 0 };
+
+	assert(length <= sizeof(b));
+	for (size_t i = 0; i < length; i++)
+		b[i] = DATA_BYTE(data[i]);
+
+	words[0] = UMP_WORD0(UMP_MT_SYSEX7, group) | ((uint32_t)status << 20) |
+		   ((uint32_t)length << 16) | ((uint32_t)b[0] << 8) | b[1];
+	words[1] = ((uint32_t)b[2] << 24) | ((uint32_t)b[3] << 16) |
+		   ((uint32_t)b[4] << 8) | b[5];
+}
+
+static size_t write_sysex7(struct midi_ostream *stream, uint8_t group,
+			   uint8_t status, const uint8_t *data, size_t length)
+{
+	uint32_t words[2];
+
+	sysex7_words(words, group, status, data, length);
+	return write_words(stream, words, 2);
+}
+
+static size_t encode_sysex(struct midi_ostream *stream,
+			   const struct midi_message *msg, uint8_t group)
+{
+	const uint8_t *sdata = msg->data.sysex.data;
+	size_t remaining = (sdata != NULL) ? msg->data.sysex.length : 0;
+	size_t num_written = 0;
+	uint8_t status = UMP_SYSEX7_START;
+
+	if (remaining <= 6)
+		return write_sysex7(stream, group, UMP_SYSEX7_COMPLETE, sdata,
+				    remaining);
+
+	while (remaining > 0) {
+		size_t length = (remaining > 6) ? 6 : remaining;
+		remaining -= length;
+		if (remaining == 0)
+			status = UMP_SYSEX7_END;
+
+		size_t n = write_sysex7(stream, group, status, sdata, length);
+		num_written += n;
+		if (n < 8)
+			return num_written;
+
+		sdata += length;
+		status = UMP_SYSEX7_CONTINUE;
+	}
+
+	return num_written;
+}
+
+/* Packs bytes held in the port into a SysEx7 packet, returns its words */
+static size_t sysex_words(struct midi_ump_port *port, uint32_t *words,
+			  bool last)
+{
+	uint8_t status;
+
+	if (last)
+		status = port->sysex_started ? UMP_SYSEX7_END :
+					       UMP_SYSEX7_COMPLETE;
+	else
+		status = port->sysex_started ? UMP_SYSEX7_CONTINUE :
+					       UMP_SYSEX7_START;
+
+	sysex7_words(words, port->group, status, port->sysex,
+		     port->sysex_length);
+	port->sysex_length = 0;
+	port->sysex_started = true;
+	port->sysex_active = !last;
+
+	return 2;
+}
+#endif
+
+/* Builds a MIDI 1.0 Channel Voice or System packet, returns 0 if unknown */
+static uint32_t message_word(const struct midi_message *msg, uint8_t group)
+{
+	uint32_t b1 = 0;
+	uint32_t b2 = 0;
+
+	switch (msg->type) {
+	case MIDI_TYPE_NOTE_ON:
+		b1 = DATA_BYTE(msg->data.note_on.note);
+		b2 = DATA_BYTE(msg->data.note_on.velocity);
+		break;
+	case MIDI_TYPE_NOTE_OFF:
+		b1 = DATA_BYTE(msg->data.note_off.note);
+		b2 = DATA_BYTE(msg->data.note_off.velocity);
+		break;
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+		b1 = DATA_BYTE(msg->data.polyphonic_pressure.note);
+		b2 = DATA_BYTE(msg->data.polyphonic_pressure.pressure);
+		break;
+	case MIDI_TYPE_CONTROL_CHANGE:
+		b1 = DATA_BYTE(msg->data.control_change.controller);
+		b2 = DATA_BYTE(msg->data.control_change.value);
+		break;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+		b1 = DATA_BYTE(msg->data.program_change.program);
+		break;
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		b1 = DATA_BYTE(msg->data.channel_pressure.pressure);
+		break;
+	case MIDI_TYPE_PITCH_BEND:
+		b1 = DATA_BYTE(msg->data.pitch_bend.value);
+		b2 = DATA_BYTE(msg->data.pitch_bend.value >> 7);
+		break;
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+		b1 = DATA_BYTE(msg->data.time_code_quarter_frame.value);
+		break;
+	case MIDI_TYPE_SONG_POSITION:
+		b1 = DATA_BYTE(msg->data.song_position.position);
+		b2 = DATA_BYTE(msg->data.song_position.position >> 7);
+		break;
+	case MIDI_TYPE_SONG_SELECT:
+		b1 = DATA_BYTE(msg->data.song_select.song);
+		break;
+	case MIDI_TYPE_TUNE_REQUEST:
+#endif
+	case MIDI_TYPE_TIMING_CLOCK:
+	case MIDI_TYPE_START:
+	case MIDI_TYPE_CONTINUE:
+	case MIDI_TYPE_STOP:
+	case MIDI_TYPE_ACTIVE_SENSE:
+	case MIDI_TYPE_SYSTEM_RESET:
+		break;
+	default:
+		return 0;
+	}
+
+	if (msg->type >= MIDI_TYPE_SYSTEM_BASE)
+		return UMP_WORD0(UMP_MT_SYSTEM, group) |
+		       ((uint32_t)msg->type << 16) | (b1 << 8) | b2;
+
+	/* Channel goes from 1 to 16 but accept zero too: */
+	uint32_t c = (msg->channel > 0) ? msg->channel - 1u : 0u;
+	uint32_t status = (uint32_t)(msg->type & 0xf0) | (c & 0x0f);
+
+	return UMP_WORD0(UMP_MT_CHANNEL_VOICE, group) | (status << 16) |
+	       (b1 << 8) | b2;
+}
+
+/* Translates a single input byte, returns the number of words produced */
+static size_t translate_byte(struct midi_ump_port *port, uint8_t c,
+			     uint32_t *words)
+{
+	size_t count = 0;
+
+#if NANOMIDI_CONFIG_SYSEX
+	bool is_type_byte = ((c & 0x80) != 0);
+
+	if (port->sysex_active) {
+		if (!is_type_byte) {
+			/* SysEx data, send six bytes per packet: */
+			if (port->sysex_length == sizeof(port->sysex))
+				count = sysex_words(port, words, false);
+			port->sysex[port->sysex_length++] = c;
+			return count;
+		} else if (c < MIDI_TYPE_TIMING_CLOCK) {
+			/* EOX or any other status byte ends SysEx: */
+			count = sysex_words(port, words, true);
+		}
+	}
+
+	if (c == MIDI_TYPE_SOX) {
+		port->sysex_active = true;
+		port->sysex_started = false;
+		port->sysex_length = 0;
+	}
+#endif
+
+	struct midi_message *msg = midi_decode_byte(&port->decoder, c);
+	if (msg != NULL && msg->type != MIDI_TYPE_SYSEX) {
+		uint32_t word = message_word(msg, port->group);
+		if (word != 0)
+			words[count++] = word;
+	}
+
+	return count;
+}
+
+/**
+ * Initializes MIDI 1.0 byte stream to UMP translation state.
+ *
+ * @param port          Pointer to the #midi_ump_port structure to be
+ *                      initialized
+ * @param group         UMP group (0-15) the byte stream is mapped to (e.g.
+ *                      USB MIDI cable number)
+ */
+void midi_ump_port_init(struct midi_ump_port *port, uint8_t group)
+{
+	assert(port != NULL);
+
+	memset(port, 0, sizeof(struct midi_ump_port));
+	port->group = (group & 0x0f);
+}
+
+/**
+ * Encodes a single MIDI message into Universal MIDI Packets.
+ *
+ * Channel Mode messages are encoded as MIDI 1.0 Channel Voice messages,
+ * System Common and System Real Time messages as System messages and SysEx
+ * messages as a sequence of 64-bit SysEx7 packets.
+ *
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param[in] msg       Pointer to the #midi_message structure to be encoded
+ * @param group         UMP group (0-15)
+ *
+ * @return The number of bytes encoded (multiples of four).
+ */
+size_t midi_encode_ump(struct midi_ostream *stream,
+		       const struct midi_message *msg, uint8_t group)
+{
+	assert(stream != NULL);
+	assert(msg != NULL);
+	assert(stream->write_cb != NULL);
+
+#if NANOMIDI_CONFIG_SYSEX
+	if (msg->type == MIDI_TYPE_SYSEX)
+		return encode_sysex(stream, msg, group);
+#endif
+
+	uint32_t word = message_word(msg, group);
+	if (word == 0)
+		return 0;
+
+	return write_words(stream, &word, 1);
+}
+
+/**
+ * Translates MIDI 1.0 byte stream into Universal MIDI Packets.
+ *
+ * Reads all bytes available in the input stream and writes translated
+ * packets into the output stream. SysEx messages are split into SysEx7
+ * packets as the data arrive so at most six bytes are held in the
+ * #midi_ump_port structure between calls. Messages split between two calls
+ * are completed during the next call.
+ *
+ * Input bytes are only read while the output stream has room for twelve
+ * bytes (the most a single input byte can produce). When the output stream
+ * fills up, the translation stops and the remaining input is left unread for
+ * the next call, so no message is lost.
+ *
+ * @param port          Pointer to the #midi_ump_port structure
+ * @param bytes         Pointer to the #midi_istream structure to read MIDI 1.0
+ *                      byte stream from
+ * @param ump           Pointer to the #midi_ostream structure to write UMP
+ *                      words to
+ *
+ * @return The number of bytes written into the UMP stream.
+ */
+size_t midi_bytes_to_ump(struct midi_ump_port *port, struct midi_istream *bytes,
+			 struct midi_ostream *ump)
+{
+	assert(port != NULL);
+	assert(bytes != NULL);
+	assert(ump != NULL);
+	assert(bytes->read_cb != NULL);
+	assert(ump->write_cb != NULL);
+
+	size_t num_written = 0;
+	uint8_t batch[UMP_BATCH_SIZE];
+	uint32_t words[UMP_WORDS_PER_BYTE * UMP_BATCH_SIZE];
+
+	for (;;) {
+		/* Read only as many bytes as there is room for their words: */
+		size_t max = sizeof(batch);
+		if (ump->capacity != MIDI_STREAM_CAPACITY_UNLIMITED &&
+		    max > ump->capacity / (4 * UMP_WORDS_PER_BYTE))
+			max = ump->capacity / (4 * UMP_WORDS_PER_BYTE);
+
+		size_t length = read_batch(bytes, batch, 1, max);
+		if (length == 0)
+			break;
+
+		size_t count = 0;
+		for (size_t i = 0; i < length; i++)
+			count += translate_byte(port, batch[i], &words[count]);
+
+		if (count > 0)
+			num_written += write_words(ump, words, count);
+	}
+
+	return num_written;
+}
+
+/* Length of a MIDI 1.0 message including the status byte, 0 if invalid */
+static size_t message_length(uint8_t status)
+{
+	switch (status & 0xf0) {
+	case MIDI_TYPE_NOTE_OFF:
+	case MIDI_TYPE_NOTE_ON:
+	case MIDI_TYPE_POLYPHONIC_PRESSURE:
+	case MIDI_TYPE_CONTROL_CHANGE:
+	case MIDI_TYPE_PITCH_BEND:
+		return 3;
+	case MIDI_TYPE_PROGRAM_CHANGE:
+	case MIDI_TYPE_CHANNEL_PRESSURE:
+		return 2;
+	default:
+		break;
+	}
+
+	switch (status) {
+#if NANOMIDI_CONFIG_SYSTEM_COMMON
+	case MIDI_TYPE_TIME_CODE_QUARTER_FRAME:
+	case MIDI_TYPE_SONG_SELECT:
+		return 2;
+	case MIDI_TYPE_SONG_POSITION:
+		return 3;
+	case MIDI_TYPE_TUNE_REQUEST:
+#endif
+	case MIDI_TYPE_TIMING_CLOCK:
+	case MIDI_TYPE_START:
+	case MIDI_TYPE_CONTINUE:
+	case MIDI_TYPE_STOP:
+	case MIDI_TYPE_ACTIVE_SENSE:
+	case MIDI_TYPE_SYSTEM_RESET:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Writes a single packet into the stream of its group */
+static size_t translate_packet(const uint32_t *words,
+			       struct midi_ostream *ports[MIDI_UMP_GROUPS])
+{
+	uint8_t mt = (uint8_t)(words[0] >> 28);
+	uint8_t group = (uint8_t)((words[0] >> 24) & 0x0f);
+	struct midi_ostream *stream = ports[group];
+	uint8_t buffer[8];
+	uint8_t *start = buffer;
+	size_t n = 0;
+
+	if (stream == NULL)
+		return 0;
+
+	assert(stream->write_cb != NULL);
+
+	if (mt == UMP_MT_SYSTEM || mt == UMP_MT_CHANNEL_VOICE) {
+		buffer[0] = (uint8_t)(words[0] >> 16);
+		buffer[1] = DATA_BYTE((uint8_t)(words[0] >> 8));
+		buffer[2] = DATA_BYTE((uint8_t)words[0]);
+
+		/* Only Channel Voice messages belong to message type 0x2: */
+		if ((mt == UMP_MT_CHANNEL_VOICE) !=
+		    (buffer[0] < MIDI_TYPE_SYSTEM_BASE))
+			return 0;
+
+		n = message_length(buffer[0]);
+#if NANOMIDI_CONFIG_SYSEX
+	} else if (mt == UMP_MT_SYSEX7) {
+		uint8_t status = (uint8_t)((words[0] >> 20) & 0x0f);
+		uint8_t length = (uint8_t)((words[0] >> 16) & 0x0f);
+
+		buffer[0] = MIDI_TYPE_SOX;
+		buffer[1] = DATA_BYTE((uint8_t)(words[0] >> 8));
+		buffer[2] = DATA_BYTE((uint8_t)words[0]);
+		buffer[3] = DATA_BYTE((uint8_t)(words[1] >> 24));
+		buffer[4] = DATA_BYTE((uint8_t)(words[1] >> 16));
+		buffer[5] = DATA_BYTE((uint8_t)(words[1] >> 8));
+		buffer[6] = DATA_BYTE((uint8_t)words[1]);
+
+		if (length > 6)
+			length = 6;
+
+		n = length;
+		if (status == UMP_SYSEX7_COMPLETE ||
+		    status == UMP_SYSEX7_START) {
+			n++;
+		} else {
+			start = &buffer[1];
+		}
+		if (status == UMP_SYSEX7_COMPLETE ||
+		    status == UMP_SYSEX7_END) {
+			buffer[length+1] = MIDI_TYPE_EOX;
+			n++;
+		}
+#endif
+	}
+
+	if (n == 0 || !prepare_write(stream, n))
+		return 0;
+
+	return stream->write_cb(stream, start, n);
+}
+
+/**
+ * Translates Universal MIDI Packets into MIDI 1.0 byte streams.
+ *
+ * Reads all packets available in the input stream. MIDI 1.0 Channel Voice and
+ * System messages are written as MIDI 1.0 messages, SysEx7 packets are
+ * written directly as they arrive without joining the whole message. Packets
+ * of other message types and packets for groups without an output stream are
+ * skipped. A packet which does not fit into its output stream is skipped as
+ * well, the output streams are expected to be large enough for all packets
+ * available in the input stream.
+ *
+ * The input stream should contain whole packets.
+ *
+ * @param ump           Pointer to the #midi_istream structure to read UMP
+ *                      words from
+ * @param ports         Array of #MIDI_UMP_GROUPS pointers to #midi_ostream
+ *                      structures, one for each group. Pointers can be set to
+ *                      `NULL` to ignore the group.
+ *
+ * @return The number of bytes written into all output streams.
+ */
+size_t midi_ump_to_bytes(struct midi_istream *ump,
+			 struct midi_ostream *ports[MIDI_UMP_GROUPS])
+{
+	assert(ump != NULL);
+	assert(ports != NULL);
+	assert(ump->read_cb != NULL);
+
+	size_t num_written = 0;
+	/* Room for the rest of a packet started at the end of a batch: */
+	uint32_t batch[UMP_BATCH_SIZE + 3];
+	size_t length;
+
+	while ((length = read_batch(ump, batch, 4, UMP_BATCH_SIZE)) > 0) {
+		size_t i = 0;
+
+		while (i < length) {
+			size_t size = packet_words[batch[i] >> 28];
+
+			if (i + size > length)
+				length += read_batch(ump, &batch[length], 4,
+						     i + size - length);
+			if (i + size > length)
+				break;
+
+			num_written += translate_packet(&batch[i], ports);
+			i += size;
+		}
+	}
+
+	return num_written;
+}
+
+/**@}*/
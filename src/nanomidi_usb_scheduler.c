@@ -0,0 +1,381 @@
+/*
+ * This file is part of nanomidi.
+ *
+ * Copyright (C) 2018 Adam Heinrich <adam@adamh.cz>
+ *
+ * Nanomidi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Nanomidi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nanomidi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Fair multi-cable USB MIDI output scheduler
+ * @defgroup usb_scheduler USB Scheduler
+ *
+ * The scheduler keeps one #midi_queue per cable and interleaves the queued
+ * messages at USB packet granularity, so a long SysEx dump sent over one
+ * cable does not delay Note On messages sent over the other cables. Cables
+ * are served using deficit round robin: each cable may send up to
+ * midi_usb_port.weight packets in a row before the next cable with pending
+ * data is served.
+ *
+ * Values of controllers, pressure and pitch bend are coalesced in the
+ * queues (see #midi_queue). Coalescing can be turned off per cable with
+ * midi_usb_port.queue.coalescing.
+ *
+ * System Real Time messages bypass the per-cable queues and are sent before
+ * any other packet. The encoded packets are meant to be aggregated into a
+ * single bulk transfer, i.e. midi_usb_scheduler_encode() should be called
+ * with an output stream whose capacity equals the size of the bulk frame.
+ *
+ * Latency of each message is measured between midi_usb_scheduler_push() and
+ * the transmission of its last packet. Statistics are collected per cable in
+ * #midi_usb_port. Time is measured in arbitrary ticks provided by the user.
+ */
+
+#ifdef ARDUINO
+#include <../include/nanomidi/usb_scheduler.h>
+#else
+#include <nanomidi/usb_scheduler.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include "nanomidi_internal.h"
+
+#if NANOMIDI_CONFIG_USB
+
+/**@{*/
+
+static size_t buffer_write(struct midi_ostream *stream, const void *data,
+			   size_t size)
+{
+	memcpy(stream->param, data, size);
+	return size;
+}
+
+static size_t write_packet(struct midi_ostream *stream, const uint8_t *packet)
+{
+	if (stream->capacity < 4)
+		return 0;
+	else if (stream->capacity < MIDI_STREAM_CAPACITY_UNLIMITED)
+		stream->capacity -= 4;
+
+	return stream->write_cb(stream, packet, 4);
+}
+
+static void record_latency(struct midi_usb_port *port, uint32_t latency)
+{
+	port->messages++;
+	port->total_latency += latency;
+	if (latency > port->max_latency)
+		port->max_latency = latency;
+}
+
+static bool has_data(struct midi_usb_port *port)
+{
+	return (port != NULL && midi_queue_peek(&port->queue) != NULL);
+}
+
+#if NANOMIDI_CONFIG_SYSEX
+static bool sysex_packet(struct midi_usb_port *port,
+			 const struct midi_message *msg, uint8_t cable_number,
+			 uint8_t *packet)
+{
+	const uint8_t *sdata = msg->data.sysex.data;
+	size_t total = msg->data.sysex.length + 2;
+	size_t n = total - port->offset;
+	uint8_t cin = 0x04;
+
+	if (n > 3)
+		n = 3;
+	else
+		cin = 0x04 + (uint8_t)n;
+
+	packet[0] = USB_BYTE0(cable_number, cin);
+	for (size_t i = 0; i < 3; i++) {
+		size_t pos = port->offset + i;
+
+		if (i >= n)
+			packet[i+1] = 0;
+		else if (pos == 0)
+			packet[i+1] = MIDI_TYPE_SOX;
+		else if (pos == total - 1)
+			packet[i+1] = MIDI_TYPE_EOX;
+		else
+			packet[i+1] = sdata[pos-1];
+	}
+
+	port->offset += n;
+	return (port->offset >= total);
+}
+#endif
+
+/*
+ * Fills the packet with the next part of the message. Returns false if there
+ * are more packets to be sent. The packet is left empty if the message cannot
+ * be encoded.
+ */
+static bool message_packet(struct midi_usb_port *port,
+			   const struct midi_message *msg, uint8_t cable_number,
+			   uint8_t *packet)
+{
+	memset(packet, 0, 4);
+
+#if NANOMIDI_CONFIG_SYSEX
+	if (msg->type == MIDI_TYPE_SYSEX) {
+		if (msg->data.sysex.length == 0)
+			return true;
+
+		return sysex_packet(port, msg, cable_number, packet);
+	}
+#else
+	(void)port;
+#endif
+
+	struct midi_ostream buffer = {
+		.write_cb = &buffer_write,
+		.capacity = 4,
+		.param = packet,
+	};
+	midi_encode_usb(&buffer, msg, cable_number);
+	return true;
+}
+
+static bool next_port(struct midi_usb_scheduler *scheduler)
+{
+	for (int i = 1; i <= MIDI_USB_CABLES; i++) {
+		uint8_t cable = (uint8_t)((scheduler->current + i) %
+					  MIDI_USB_CABLES);
+		struct midi_usb_port *port = scheduler->ports[cable];
+
+		if (has_data(port)) {
+			scheduler->current = cable;
+			scheduler->credit = port->weight;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Initializes the output port.
+ *
+ * @param port          Pointer to the #midi_usb_port structure to be
+ *                      initialized
+ * @param messages      Pointer to an array of #midi_message structures
+ *                      allocated by the user
+ * @param times         Pointer to an array of timestamps allocated by the user
+ * @param size          Number of elements in both arrays
+ * @param weight        Number of packets sent in a row before the next cable
+ *                      is served (at least 1)
+ */
+void midi_usb_port_init(struct midi_usb_port *port,
+			struct midi_message *messages, uint32_t *times,
+			size_t size, uint8_t weight)
+{
+	assert(port != NULL);
+	assert(times != NULL);
+	assert(weight > 0);
+
+	memset(port, 0, sizeof(struct midi_usb_port));
+	midi_queue_init(&port->queue, messages, size);
+	port->times = times;
+	port->weight = weight;
+}
+
+/**
+ * Initializes the scheduler with no ports assigned.
+ *
+ * @param scheduler     Pointer to the #midi_usb_scheduler structure to be
+ *                      initialized
+ */
+void midi_usb_scheduler_init(struct midi_usb_scheduler *scheduler)
+{
+	assert(scheduler != NULL);
+
+	memset(scheduler, 0, sizeof(struct midi_usb_scheduler));
+	scheduler->current = MIDI_USB_CABLES - 1;
+}
+
+/**
+ * Assigns a port to a cable.
+ *
+ * @param scheduler     Pointer to the #midi_usb_scheduler structure
+ * @param cable_number  Cable number (0-15)
+ * @param port          Pointer to an initialized #midi_usb_port structure or
+ *                      `NULL` to remove the port
+ */
+void midi_usb_scheduler_add_port(struct midi_usb_scheduler *scheduler,
+				 uint8_t cable_number,
+				 struct midi_usb_port *port)
+{
+	assert(scheduler != NULL);
+	assert(cable_number < MIDI_USB_CABLES);
+
+	scheduler->ports[cable_number] = port;
+	if (scheduler->current == cable_number)
+		scheduler->credit = 0;
+}
+
+/**
+ * Queues a message for transmission over the given cable.
+ *
+ * System Real Time messages are queued separately and sent before all other
+ * messages. Other messages are coalesced as described in midi_queue_push().
+ * Messages which do not fit are counted in midi_usb_port.dropped.
+ *
+ * @param scheduler     Pointer to the #midi_usb_scheduler structure
+ * @param cable_number  Cable number (0-15) with a port assigned
+ * @param[in] msg       Pointer to the #midi_message structure to be queued
+ * @param now           Current time in ticks
+ *
+ * @return `true` if the message has been queued, `false` if it was dropped.
+ */
+bool midi_usb_scheduler_push(struct midi_usb_scheduler *scheduler,
+			     uint8_t cable_number,
+			     const struct midi_message *msg, uint32_t now)
+{
+	assert(scheduler != NULL);
+	assert(msg != NULL);
+	assert(cable_number < MIDI_USB_CABLES);
+
+	struct midi_usb_port *port = scheduler->ports[cable_number];
+	assert(port != NULL);
+
+	if (msg->type >= MIDI_TYPE_TIMING_CLOCK) {
+		struct midi_usb_realtime *rt;
+		size_t num_pending = scheduler->tail - scheduler->head;
+
+		if (num_pending >= MIDI_USB_REALTIME_SIZE) {
+			port->dropped++;
+			return false;
+		}
+
+		rt = &scheduler->realtime[scheduler->tail %
+					  MIDI_USB_REALTIME_SIZE];
+		rt->cable = cable_number;
+		rt->type = (uint8_t)msg->type;
+		rt->time = now;
+		scheduler->tail++;
+		return true;
+	}
+
+	struct midi_queue *queue = &port->queue;
+	size_t tail = queue->tail;
+
+	if (!midi_queue_push(queue, msg)) {
+		port->dropped++;
+		return false;
+	}
+
+	/* Coalesced values keep the time of the replaced message: */
+	if (queue->tail != tail)
+		port->times[tail % queue->size] = now;
+
+	return true;
+}
+
+/**
+ * Encodes queued messages into USB packets until all queues are empty or the
+ * output stream is full.
+ *
+ * System Real Time messages are encoded first, followed by the other
+ * messages interleaved across cables. SysEx messages may be split across
+ * multiple calls.
+ *
+ * @param scheduler     Pointer to the #midi_usb_scheduler structure
+ * @param stream        Pointer to the #midi_ostream structure
+ * @param now           Current time in ticks
+ *
+ * @return The number of bytes encoded (multiples of four).
+ */
+size_t midi_usb_scheduler_encode(struct midi_usb_scheduler *scheduler,
+				 struct midi_ostream *stream, uint32_t now)
+{
+	assert(scheduler != NULL);
+	assert(stream != NULL);
+	assert(stream->write_cb != NULL);
+
+	size_t num_written = 0;
+	uint8_t packet[4];
+
+	while (scheduler->head != scheduler->tail) {
+		struct midi_usb_realtime *rt;
+		rt = &scheduler->realtime[scheduler->head %
+					  MIDI_USB_REALTIME_SIZE];
+
+		packet[0] = USB_BYTE0(rt->cable, 0x0f);
+		packet[1] = rt->type;
+		packet[2] = 0;
+		packet[3] = 0;
+		if (write_packet(stream, packet) < 4)
+			return num_written;
+
+		num_written += 4;
+		scheduler->head++;
+
+		struct midi_usb_port *port = scheduler->ports[rt->cable];
+		if (port != NULL) {
+			record_latency(port, now - rt->time);
+			port->packets++;
+		}
+	}
+
+	while (stream->capacity >= 4) {
+		uint8_t cable = scheduler->current;
+		struct midi_usb_port *port = scheduler->ports[cable];
+
+		if ((scheduler->credit == 0 || !has_data(port)) &&
+		    !next_port(scheduler))
+			break;
+
+		cable = scheduler->current;
+		port = scheduler->ports[cable];
+
+		struct midi_queue *queue = &port->queue;
+		struct midi_message *m = midi_queue_peek(queue);
+		size_t offset = port->offset;
+		bool last = message_packet(port, m, cable, packet);
+		bool valid = (packet[0] & 0x0f) != 0;
+
+		if (valid) {
+			if (write_packet(stream, packet) < 4) {
+				port->offset = offset;
+				break;
+			}
+
+			num_written += 4;
+			port->packets++;
+			scheduler->credit--;
+		} else {
+			/* Cannot be encoded: */
+			port->dropped++;
+		}
+
+		if (last) {
+			size_t index = (size_t)(m - queue->messages);
+
+			if (valid)
+				record_latency(port, now - port->times[index]);
+			port->offset = 0;
+			midi_queue_pop(queue);
+		}
+	}
+
+	return num_written;
+}
+
+/**@}*/
+
+#endif /* NANOMIDI_CONFIG_USB */